@@ -1,4 +1,4 @@
-#ifdef DESKTOP
+#if defined(DESKTOP) && defined(_MSC_VER)
 #define _CRTDBG_MAP_ALLOC
 #include <stdlib.h>
 #include <crtdbg.h>
@@ -11,17 +11,100 @@
 #include "basicproc.h"
 #include "basicexpr.h"
 #include "basicstr.h"
+#include "basicimg.h"
+#include "basicmem.h"
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+
+#ifndef _MSC_VER
+#define _strdup strdup
+#endif
 
 extern basic_line_t *program ;
 
 extern uint32_t lineToString(basic_line_t *line) ;
+extern void basic_clear_int() ;
 bool basic_line_proc(const char *line, basic_out_fn_t outfn) ;
 
 static char filename[64] ;
-static char buffer[512] ;
+
+//
+// The desktop has no user button to break into a running program, so the break
+// is never pending.  These stand in for the ones basictask.c provides on the
+// target.
+//
+volatile bool basic_break_pending = false ;
+
+void basic_clear_break()
+{
+    basic_break_pending = false ;
+}
+
+bool basic_is_break()
+{
+    return basic_break_pending ;
+}
+
+static int read_file(void *ctx, char *buf, uint32_t size)
+{
+    size_t got = fread(buf, 1, size, (FILE *)ctx) ;
+
+    if (got == 0 && ferror((FILE *)ctx))
+        return -1 ;
+
+    return (int)got ;
+}
+
+#ifdef BASIC_PROGRAM_IMAGES
+//
+// Load the image saved with a program if there is one and it is for the text
+// in fp.  Otherwise fp is left for the text to be read from the start.
+//
+static bool load_image(const char *fname, FILE *fp)
+{
+    char imgname[256] ;
+
+    if (!basic_img_name(fname, imgname, sizeof(imgname)))
+        return false ;
+
+    FILE *imgfp = fopen(imgname, "rb") ;
+    if (imgfp == NULL)
+        return false ;
+
+    bool ret = basic_img_load_file(read_file, imgfp, fp) ;
+    fclose(imgfp) ;
+
+    if (!ret)
+        rewind(fp) ;
+
+    return ret ;
+}
+
+//
+// Write the image of the program in memory next to its text.  An image that
+// cannot be written is left out, since LOAD ignores one that does not match.
+//
+static bool save_image(const char *fname, uint32_t srchash, uint32_t srclen)
+{
+    char imgname[256] ;
+    basic_err_t err ;
+    uint8_t *image ;
+    uint32_t size ;
+
+    if (!basic_img_name(fname, imgname, sizeof(imgname)) || !basic_img_build(srchash, srclen, &image, &size, &err))
+        return false ;
+
+    FILE *fp = fopen(imgname, "wb") ;
+    bool ret = (fp != NULL && fwrite(image, 1, size, fp) == size) ;
+    if (fp != NULL)
+        fclose(fp) ;
+
+    basic_free(image) ;
+    return ret ;
+}
+#endif
 
 bool basic_proc_load(const char *fname, basic_err_t *err, basic_out_fn_t outfn)
 {
@@ -32,15 +115,18 @@ bool basic_proc_load(const char *fname, basic_err_t *err, basic_out_fn_t outfn)
         return false ;
     }
 
-    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-        if (!basic_line_proc(buffer, outfn)) {
-            basic_clear(NULL, err, outfn) ;
-            return false ;
-        }
+#ifdef BASIC_PROGRAM_IMAGES
+    if (load_image(fname, fp)) {
+        fclose(fp) ;
+        *err = BASIC_ERR_NONE ;
+        return true ;
     }
+#endif
 
+    bool ret = basic_proc_load_stream(read_file, fp, err, outfn) ;
     fclose(fp) ;
-    return true;
+
+    return ret ;
 }
 
 void basic_del(basic_line_t* line, basic_err_t* err, basic_out_fn_t outfn)
@@ -53,6 +139,8 @@ void basic_rename(basic_line_t* line, basic_err_t* err, basic_out_fn_t outfn)
 
 void basic_save(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 {
+    uint32_t srchash = BASIC_IMG_HASH_INIT ;
+    uint32_t srclen = 0 ;
     FILE *fp ;
 
     *err = BASIC_ERR_NONE ;
@@ -71,7 +159,7 @@ void basic_save(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
         return ;
     }
 
-    strcat(filename, value->value.svalue_);
+    strcat(filename, basic_value_chars(value));
 
     fp = fopen(filename, "w");
     if (fp == NULL) {
@@ -99,10 +187,18 @@ void basic_save(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
         }        
 
         const char *strval = basic_str_value(str) ;
+        uint32_t len = (uint32_t)strlen(strval) ;
+        srchash = basic_img_hash(srchash, strval, len) ;
+        srclen += len ;
+
         fputs(strval, fp) ;
         basic_str_destroy(str) ;
     }
     fclose(fp) ;
+
+#ifdef BASIC_PROGRAM_IMAGES
+    save_image(filename, srchash, srclen) ;
+#endif
 }
 
 void basic_load(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
@@ -125,7 +221,7 @@ void basic_load(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
         return ;
     }
 
-    strcat(filename, value->value.svalue_);
+    strcat(filename, basic_value_chars(value));
     basic_proc_load(filename, err, outfn) ;
     basic_value_destroy(value);
 }
@@ -154,12 +250,298 @@ void basic_task_store_input(bool b)
 {
 }
 
+//
+// basic -bench program.bas loads a program, runs it, and reports how many
+// statements it executed per second.  Build with DISPATCH=switch or
+// DISPATCH=call to compare the statement dispatch methods.
+//
+static int bench(const char *fname)
+{
+    basic_err_t err = BASIC_ERR_NONE ;
+
+    if (!basic_proc_load(fname, &err, outfn)) {
+        printf("Could not load '%s': %s\n", fname, basic_err_to_string(err)) ;
+        return 1 ;
+    }
+
+    uint64_t count = basic_stmt_count ;
+    clock_t start = clock() ;
+
+    basic_line_proc("RUN\n", outfn) ;
+
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC ;
+    count = basic_stmt_count - count ;
+
+    printf("%llu statements in %.3f seconds", (unsigned long long)count, secs) ;
+    if (secs > 0.0)
+        printf(", %.0f statements/sec", count / secs) ;
+    printf("\n") ;
+
+    return 0 ;
+}
+
+//
+// basic -loadbench a.bas b.bas ... loads each program a number of times and
+// reports the time taken to parse a line.  This is how the cost of LOAD is
+// measured over the programs in test/games.
+//
+#define LOADBENCH_PASSES    (20)
+
+static int loadbench(int count, char **files)
+{
+    unsigned long total_lines = 0 ;
+    double total_secs = 0.0 ;
+
+    for(int i = 0 ; i < count ; i++) {
+        FILE *fp = fopen(files[i], "r") ;
+        if (fp == NULL) {
+            printf("%s: not found\n", files[i]) ;
+            continue ;
+        }
+
+        unsigned long lines = 0 ;
+        while (fgets(inbuf, sizeof(inbuf), fp) != NULL)
+            lines++ ;
+        fclose(fp) ;
+
+        double secs = 0.0 ;
+        bool ok = true ;
+        for(int pass = 0 ; pass < LOADBENCH_PASSES && ok ; pass++) {
+            basic_err_t err = BASIC_ERR_NONE ;
+
+            basic_clear_int() ;
+            clock_t start = clock() ;
+            ok = basic_proc_load(files[i], &err, outfn) ;
+            secs += (double)(clock() - start) / CLOCKS_PER_SEC ;
+        }
+        basic_clear_int() ;
+
+        if (!ok) {
+            printf("%s: load failed\n", files[i]) ;
+            continue ;
+        }
+
+        secs /= LOADBENCH_PASSES ;
+        printf("%s: %lu lines, %.3f ms, %.2f us/line\n", files[i], lines, secs * 1000.0, lines ? secs * 1e6 / lines : 0.0) ;
+
+        total_lines += lines ;
+        total_secs += secs ;
+    }
+
+    printf("total: %lu lines, %.3f ms, %.2f us/line\n", total_lines, total_secs * 1000.0, total_lines ? total_secs * 1e6 / total_lines : 0.0) ;
+    return 0 ;
+}
+
+//
+// basic -mkimage a.bas b.bas ... loads each program from its text and writes
+// its image next to it, as SAVE does.  basic -checkimage a.bas ... loads each
+// program from its text and from its image, checks that the two list the same,
+// and reports how long each takes to load.
+//
+static bool hash_text(FILE *fp, uint32_t *srchash, uint32_t *srclen)
+{
+    int got ;
+
+    *srchash = BASIC_IMG_HASH_INIT ;
+    *srclen = 0 ;
+    while ((got = read_file(fp, inbuf, sizeof(inbuf))) > 0) {
+        *srchash = basic_img_hash(*srchash, inbuf, (uint32_t)got) ;
+        *srclen += (uint32_t)got ;
+    }
+
+    rewind(fp) ;
+    return got == 0 ;
+}
+
+static bool load_text(const char *fname, uint32_t *srchash, uint32_t *srclen)
+{
+    basic_err_t err ;
+
+    FILE *fp = fopen(fname, "r") ;
+    if (fp == NULL)
+        return false ;
+
+    basic_clear_int() ;
+    bool ret = hash_text(fp, srchash, srclen) && basic_proc_load_stream(read_file, fp, &err, outfn) ;
+    fclose(fp) ;
+
+    return ret ;
+}
+
+//
+// The listing of the program in memory, allocated with malloc()
+//
+static char *list_program()
+{
+    size_t count = 0 ;
+    char *ret = NULL ;
+
+    for(basic_line_t *line = program ; line != NULL ; line = line->next_) {
+        uint32_t str = lineToString(line) ;
+        if (str == BASIC_STR_INVALID) {
+            free(ret) ;
+            return NULL ;
+        }
+
+        const char *strval = basic_str_value(str) ;
+        size_t len = strlen(strval) ;
+        char *grown = (char *)realloc(ret, count + len + 2) ;
+        if (grown == NULL) {
+            basic_str_destroy(str) ;
+            free(ret) ;
+            return NULL ;
+        }
+
+        ret = grown ;
+        memcpy(ret + count, strval, len) ;
+        count += len ;
+        ret[count++] = '\n' ;
+        ret[count] = '\0' ;
+        basic_str_destroy(str) ;
+    }
+
+    return (ret != NULL) ? ret : strdup("") ;
+}
+
+static int mkimage(int count, char **files)
+{
+    int ret = 0 ;
+
+    for(int i = 0 ; i < count ; i++) {
+        char imgname[256] ;
+        uint32_t srchash, srclen ;
+        basic_err_t err ;
+        uint8_t *image ;
+        uint32_t size ;
+
+        if (!load_text(files[i], &srchash, &srclen)) {
+            printf("%s: load failed\n", files[i]) ;
+            ret = 1 ;
+            continue ;
+        }
+
+        if (!basic_img_name(files[i], imgname, sizeof(imgname)) || !basic_img_build(srchash, srclen, &image, &size, &err)) {
+            printf("%s: no image, %s\n", files[i], basic_err_to_string(err)) ;
+            ret = 1 ;
+            continue ;
+        }
+
+        FILE *fp = fopen(imgname, "wb") ;
+        if (fp == NULL || fwrite(image, 1, size, fp) != size) {
+            printf("%s: could not write\n", imgname) ;
+            ret = 1 ;
+        }
+        else {
+            printf("%s: %lu bytes of text, %lu byte image\n", imgname, (unsigned long)srclen, (unsigned long)size) ;
+        }
+
+        if (fp != NULL)
+            fclose(fp) ;
+        basic_free(image) ;
+    }
+
+    basic_clear_int() ;
+    return ret ;
+}
+
+static int checkimage(int count, char **files)
+{
+    int ret = 0 ;
+
+    for(int i = 0 ; i < count ; i++) {
+        char imgname[256] ;
+        uint32_t srchash, srclen ;
+        basic_err_t err = BASIC_ERR_NONE ;
+
+        if (!basic_img_name(files[i], imgname, sizeof(imgname))) {
+            printf("%s: name too long\n", files[i]) ;
+            ret = 1 ;
+            continue ;
+        }
+
+        FILE *fp = fopen(imgname, "rb") ;
+        if (fp == NULL) {
+            printf("%s: not found\n", imgname) ;
+            ret = 1 ;
+            continue ;
+        }
+
+        fseek(fp, 0, SEEK_END) ;
+        uint32_t size = (uint32_t)ftell(fp) ;
+        rewind(fp) ;
+
+        uint8_t *image = (uint8_t *)malloc(size) ;
+        bool ok = (image != NULL && fread(image, 1, size, fp) == size) ;
+        fclose(fp) ;
+
+        double textsecs = 0.0, imgsecs = 0.0 ;
+        for(int pass = 0 ; pass < LOADBENCH_PASSES && ok ; pass++) {
+            clock_t start = clock() ;
+            ok = load_text(files[i], &srchash, &srclen) ;
+            textsecs += (double)(clock() - start) / CLOCKS_PER_SEC ;
+        }
+
+        char *text = ok ? list_program() : NULL ;
+        if (text == NULL) {
+            printf("%s: load failed\n", files[i]) ;
+            basic_clear_int() ;
+            free(image) ;
+            ret = 1 ;
+            continue ;
+        }
+
+        if (!basic_img_matches(image, size, srchash, srclen)) {
+            printf("%s: out of date\n", imgname) ;
+            ok = false ;
+        }
+
+        for(int pass = 0 ; pass < LOADBENCH_PASSES && ok ; pass++) {
+            basic_clear_int() ;
+            clock_t start = clock() ;
+            ok = basic_img_load(image, size, &err) ;
+            imgsecs += (double)(clock() - start) / CLOCKS_PER_SEC ;
+        }
+
+        char *loaded = ok ? list_program() : NULL ;
+        if (loaded == NULL) {
+            if (err != BASIC_ERR_NONE)
+                printf("%s: %s\n", imgname, basic_err_to_string(err)) ;
+            ret = 1 ;
+        }
+        else if (strcmp(text, loaded) != 0) {
+            printf("%s: lists differently from %s\n", imgname, files[i]) ;
+            ret = 1 ;
+        }
+        else {
+            printf("%s: ok, text %.3f ms, image %.3f ms\n", imgname, textsecs * 1000.0 / LOADBENCH_PASSES, imgsecs * 1000.0 / LOADBENCH_PASSES) ;
+        }
+
+        basic_clear_int() ;
+        free(loaded) ;
+        free(text) ;
+        free(image) ;
+    }
+
+    return ret ;
+}
 
 int main(int ac, char **av)
 {
     ac-- ;
     av++ ;
 
+    if (ac == 2 && strcmp(av[0], "-bench") == 0)
+        return bench(av[1]) ;
+
+    if (ac >= 2 && strcmp(av[0], "-loadbench") == 0)
+        return loadbench(ac - 1, av + 1) ;
+
+    if (ac >= 2 && strcmp(av[0], "-mkimage") == 0)
+        return mkimage(ac - 1, av + 1) ;
+
+    if (ac >= 2 && strcmp(av[0], "-checkimage") == 0)
+        return checkimage(ac - 1, av + 1) ;
+
     // _crtBreakAlloc = 19850;
 
     FILE *f = fopen(*av, "r") ;
@@ -179,7 +561,9 @@ int main(int ac, char **av)
 
     fclose(f) ;
 
+#ifdef _MSC_VER
     _CrtDumpMemoryLeaks();
+#endif
 
     return 0 ;
 }
@@ -1,5 +1,17 @@
 #pragma once
 
+// The representation of numbers.  BASIC_NUM_DOUBLE is a double, as the
+// interpreter has always used.  BASIC_NUM_FLOAT is a float, which the single
+// precision FPU of the PSoC 6 CM4 core does in hardware.  BASIC_NUM_FIXED is
+// Q16.16 fixed point in an int32_t, see basicnum.h.
+#define BASIC_NUM_DOUBLE						(1)
+#define BASIC_NUM_FLOAT							(2)
+#define BASIC_NUM_FIXED							(3)
+
+#ifndef BASIC_NUM_TYPE
+#define BASIC_NUM_TYPE							BASIC_NUM_DOUBLE
+#endif
+
 // The maximum number of dimensions for an array
 #define BASIC_MAX_DIMS							(3)
 
@@ -20,9 +32,66 @@
 // of a string constant.
 #define BASIC_PARSE_BUFFER_LENGTH				(256)
 
+// LOAD reads a file in chunks of this many bytes, which should be a multiple
+// of the sector size so that FatFs reads straight into the load buffer
+#define BASIC_LOAD_CHUNK						(512)
+
+// The size of the load buffer, which is also the longest line LOAD accepts
+#define BASIC_LOAD_BUFFER_LENGTH				(4 * BASIC_LOAD_CHUNK)
+
+// SAVE writes an image of the program next to its text, X.BBC for X.BAS, and
+// LOAD reads the image instead of parsing the text when the text has not
+// changed since, see basicimg.h.  Comment this out to save only the text.
+#define BASIC_PROGRAM_IMAGES
+
+// The size of the space for a string held inside a value, including the
+// terminator.  Shorter strings than this are stored in the value itself and
+// need no allocation.
+#define BASIC_STR_INLINE_SIZE					(12)
+
 // The stack depth of the expression parser 
 #define BASIC_MAX_EXPR_DEPTH					(48)
 
 // The maximum number of arguments to a def fnX(a,b,c,d) function
 #define BASIC_MAX_DEFFN_ARGS					(4)
 
+
+// The number of values on the expression VM stack.  This bounds the nesting
+// depth of an expression, including calls to DEF FN functions.
+#define BASIC_VM_STACK_DEPTH					(64)
+
+// Define this to evaluate expressions by walking the parse tree rather than
+// running the compiled bytecode.  Building both ways and running the same
+// programs is how the VM is checked against the tree evaluator.
+// #define BASIC_EXPR_TREE_EVAL
+
+// The number of objects in each slab of a handle table.  Expressions, user
+// functions and strings are each kept in a handle table that grows a slab at
+// a time.  This must be a power of two.
+#define BASIC_HTAB_SLAB_SIZE					(32)
+
+// The number of FOR loops that can be active at once.  The for stack is a
+// fixed array of this many entries, so going deeper is an error rather than
+// an allocation.
+#define BASIC_MAX_FOR_DEPTH						(32)
+
+// The number of GOSUB calls that can be active at once
+#define BASIC_MAX_GOSUB_DEPTH					(64)
+
+// The number of statements the executor runs between checks for a break from
+// the user.
+#define BASIC_BREAK_POLL_INTERVAL				(64)
+
+// How the executor gets from one statement to the next.  GCC builds jump
+// straight to the code for the next statement through a table of label
+// addresses.  Other compilers call the handler stored with each statement.
+// Define BASIC_EXEC_CALL_DISPATCH to call the handlers on GCC as well, or
+// BASIC_EXEC_SWITCH_DISPATCH to switch on the statement token as the executor
+// used to, which is kept to benchmark the other two against.
+// #define BASIC_EXEC_CALL_DISPATCH
+// #define BASIC_EXEC_SWITCH_DISPATCH
+
+// The MAT kernels in basicmat.c use GCC vector extensions on targets with SIMD
+// registers, and loops unrolled four times on the CM4.  Define this to use the
+// unrolled loops everywhere.
+// #define BASIC_MAT_NO_VECTOR
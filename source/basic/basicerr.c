@@ -1,4 +1,4 @@
-#ifdef DESKTOP
+#if defined(DESKTOP) && defined(_MSC_VER)
 #define _CRTDBG_MAP_ALLOC
 #include <stdlib.h>
 #include <crtdbg.h>
@@ -58,7 +58,13 @@ static const char *errMessages[] = {
     "INVALID LINE NUMBER",
     "INVALID VARNAME",
     "TOO MANY STRING VARS",
-    "NO DATA/DATA EXHAUSTED"
+    "NO DATA/DATA EXHAUSTED", // 50
+    "TOO MANY NESTED FOR LOOPS",
+    "TOO MANY NESTED GOSUBS",
+    "OVERFLOW",
+    "SUBSCRIPT OUT OF RANGE",
+    "LINE TOO LONG",
+    "BAD PROGRAM IMAGE"
 };
 
 const char *basic_err_to_string(basic_err_t err)
@@ -56,7 +56,13 @@ typedef enum basic_err {
     BASIC_ERR_INVALID_LINE_NUMBER,
     BASIC_ERR_INVALID_VARNAME,
     BASIC_ERR_TOO_MANY_STRING_VARS,
-    BASIC_ERR_NO_DATA,
+    BASIC_ERR_NO_DATA,                          // 50
+    BASIC_ERR_FOR_STACK_OVERFLOW,
+    BASIC_ERR_GOSUB_STACK_OVERFLOW,
+    BASIC_ERR_OVERFLOW,
+    BASIC_ERR_SUBSCRIPT_OUT_OF_RANGE,
+    BASIC_ERR_LINE_TOO_LONG,
+    BASIC_ERR_BAD_IMAGE,
 
 } basic_err_t ;
 
@@ -1,4 +1,4 @@
-#ifdef DESKTOP
+#if defined(DESKTOP) && defined(_MSC_VER)
 #define _CRTDBG_MAP_ALLOC
 #include <stdlib.h>
 #include <crtdbg.h>
@@ -11,21 +11,21 @@
 #include "basicexpr.h"
 #include "basiccfg.h"
 #include "basicstr.h"
+#include "basicmem.h"
 #include "basictask.h"
+#include "basicmat.h"
 #ifndef DESKTOP
 #include <FreeRTOS.h>
 #include <task.h>
-#endif
 #include <cybsp.h>
 #include <cyhal.h>
 #include <cyhal_gpio.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <memory.h>
 #include <malloc.h>
-#include <FreeRTOS.h>
-#include <event_groups.h>
 
 extern void basic_save(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn) ;
 extern void basic_load(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn) ;
@@ -34,31 +34,320 @@ extern void basic_del(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn
 extern void basic_rename(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn) ;
 
 basic_line_t *program = NULL ;
+basic_mem_stats_t basic_mem_stats ;
 static const char *clearscreen = "\x1b[2J\x1b[;H";
 static const char *spaces = "        " ;
 static int space_count = 8 ;
 static int tab_size = 8 ;
 
-static for_stack_entry_t *for_stack = NULL ;
-static gosub_stack_entry_t *gosub_stack = NULL ;
+//
+// The FOR and GOSUB stacks are fixed arrays so that loops and subroutine
+// calls never touch the heap.  The high water marks are reported by MEM.
+//
+static for_stack_entry_t for_stack[BASIC_MAX_FOR_DEPTH] ;
+static uint32_t for_depth = 0 ;
+static uint32_t for_depth_max = 0 ;
+static gosub_stack_entry_t gosub_stack[BASIC_MAX_GOSUB_DEPTH] ;
+static uint32_t gosub_depth = 0 ;
+static uint32_t gosub_depth_max = 0 ;
 static uint8_t end_program = BTOKEN_RUN ;
 static bool trace = false ;
 
-static int data_index ;
-static exec_context_t data_context ;
+static uint32_t data_pc ;
+static uint32_t data_index ;
+
+static basic_err_t exec_stmts(uint32_t pc, basic_out_fn_t outfn) ;
+static void decode_stmt(basic_stmt_t *stmt) ;
+
+uint64_t basic_stmt_count = 0 ;
+
+//
+// A sorted array of the stored program lines.  This is kept in step with the
+// program list so that a line being stored can find its place with a binary
+// search rather than by walking the list.  If memory for the index cannot be
+// allocated, it is marked invalid and the list is walked instead.
+//
+static basic_line_t **line_index = NULL ;
+static uint32_t line_index_count = 0 ;
+static uint32_t line_index_size = 0 ;
+static bool line_index_valid = true ;
+
+static bool line_index_grow(uint32_t needed)
+{
+    if (needed <= line_index_size)
+        return true ;
+
+    uint32_t newsize = (line_index_size == 0) ? 64 : line_index_size * 2 ;
+    while (newsize < needed)
+        newsize *= 2 ;
+
+    basic_line_t **newindex = (basic_line_t **)basic_realloc(line_index, sizeof(basic_line_t *) * newsize) ;
+    if (newindex == NULL)
+        return false ;
+
+    line_index = newindex ;
+    line_index_size = newsize ;
+    return true ;
+}
+
+static void line_index_free()
+{
+    if (line_index != NULL)
+        basic_free(line_index) ;
+
+    line_index = NULL ;
+    line_index_count = 0 ;
+    line_index_size = 0 ;
+    line_index_valid = true ;
+}
+
+static bool line_index_rebuild()
+{
+    uint32_t count = 0 ;
+
+    for(basic_line_t *line = program ; line ; line = line->next_)
+        count++ ;
+
+    if (!line_index_grow(count)) {
+        line_index_valid = false ;
+        return false ;
+    }
+
+    line_index_count = 0 ;
+    for(basic_line_t *line = program ; line ; line = line->next_)
+        line_index[line_index_count++] = line ;
+
+    line_index_valid = true ;
+    return true ;
+}
+
+//
+// Returns the position of the given line number in the index.  If the line is
+// not stored, this is the position where it would be inserted.
+//
+static uint32_t line_index_search(uint32_t lineno, bool *found)
+{
+    uint32_t low = 0 ;
+    uint32_t high = line_index_count ;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2 ;
+        if (line_index[mid]->lineno_ < lineno)
+            low = mid + 1 ;
+        else
+            high = mid ;
+    }
+
+    *found = (low < line_index_count && line_index[low]->lineno_ == lineno) ;
+    return low ;
+}
+
+//
+// The linked program.  The statements of the stored program are laid out in
+// execution order in one array, so the program counter, the FOR and GOSUB return
+// points and the DATA pointer are plain indexes.  Editing the program marks the
+// array stale, and it is linked again at RUN or when a jump needs it.  The
+// statements of lines typed in immediate mode are kept in a second array so that
+// linking the program does not move them.
+//
+static basic_stmt_t *stmts = NULL ;
+static uint32_t stmt_count = 0 ;
+static uint32_t stmt_size = 0 ;
+static bool stmts_valid = true ;
+
+static basic_stmt_t *imm_stmts = NULL ;
+static uint32_t imm_count = 0 ;
+static uint32_t imm_size = 0 ;
+
+static bool stmt_array_grow(basic_stmt_t **arr, uint32_t *size, uint32_t needed)
+{
+    if (needed <= *size)
+        return true ;
+
+    uint32_t newsize = (*size == 0) ? 64 : *size * 2 ;
+    while (newsize < needed)
+        newsize *= 2 ;
+
+    basic_stmt_t *newarr = (basic_stmt_t *)basic_realloc(*arr, sizeof(basic_stmt_t) * newsize) ;
+    if (newarr == NULL)
+        return false ;
+
+    *arr = newarr ;
+    *size = newsize ;
+    return true ;
+}
+
+static void stmts_free()
+{
+    if (stmts != NULL)
+        basic_free(stmts) ;
+
+    stmts = NULL ;
+    stmt_count = 0 ;
+    stmt_size = 0 ;
+    stmts_valid = true ;
+}
+
+static uint32_t count_stmts(basic_line_t *line)
+{
+    uint32_t count = 1 ;
+
+    for(basic_line_t *child = line->children_ ; child ; child = child->next_)
+        count++ ;
+
+    return count ;
+}
+
+//
+// Lay out the statements of one line starting at arr[index], where base is the
+// program counter of arr[0].  Returns the index following the last statement.
+//
+static uint32_t link_line(basic_line_t *line, basic_stmt_t *arr, uint32_t index, uint32_t base)
+{
+    uint32_t nextline = base + index + count_stmts(line) ;
+    uint32_t stmtno = 0 ;
+    basic_line_t *stmt = line ;
+
+    while (stmt != NULL) {
+        arr[index].line_ = stmt ;
+        arr[index].lineno_ = line->lineno_ ;
+        arr[index].stmtno_ = stmtno++ ;
+        arr[index].nextline_ = nextline ;
+        arr[index].target_ = BASIC_PC_NONE ;
+        decode_stmt(&arr[index]) ;
+        index++ ;
+
+        stmt = (stmt == line) ? line->children_ : stmt->next_ ;
+    }
+
+    return index ;
+}
+
+//
+// Returns the index of the first statement of a line in the linked program, or
+// BASIC_PC_NONE if the line is not stored.
+//
+static uint32_t search_stmts(uint32_t lineno)
+{
+    uint32_t low = 0 ;
+    uint32_t high = stmt_count ;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2 ;
+        if (stmts[mid].lineno_ < lineno)
+            low = mid + 1 ;
+        else
+            high = mid ;
+    }
+
+    if (low < stmt_count && stmts[low].lineno_ == lineno)
+        return low ;
+
+    return BASIC_PC_NONE ;
+}
+
+static bool link_program(basic_err_t *err)
+{
+    uint32_t count = 0 ;
+
+    if (stmts_valid)
+        return true ;
+
+    for(basic_line_t *line = program ; line ; line = line->next_)
+        count += count_stmts(line) ;
+
+    if (!stmt_array_grow(&stmts, &stmt_size, count)) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
+    }
+
+    stmt_count = 0 ;
+    for(basic_line_t *line = program ; line ; line = line->next_)
+        stmt_count = link_line(line, stmts, stmt_count, 0) ;
+
+    //
+    // Resolve the targets of GOTO and GOSUB statements once here rather
+    // than each time they are executed
+    //
+    for(uint32_t i = 0 ; i < stmt_count ; i++) {
+        uint8_t token = stmts[i].line_->tokens_[0] ;
+        if (token == BTOKEN_GOTO || token == BTOKEN_GOSUB)
+            stmts[i].target_ = search_stmts(getU32(stmts[i].line_, 1)) ;
+    }
+
+    stmts_valid = true ;
+    data_pc = 0 ;
+    data_index = 1 ;
+
+    return true ;
+}
+
+static uint32_t find_stmt_by_line(uint32_t lineno, basic_err_t *err)
+{
+    if (!link_program(err))
+        return BASIC_PC_NONE ;
+
+    uint32_t pc = search_stmts(lineno) ;
+    if (pc == BASIC_PC_NONE)
+        *err = BASIC_ERR_INVALID_LINE_NUMBER ;
+
+    return pc ;
+}
+
+static basic_stmt_t *stmt_at(uint32_t pc)
+{
+    if (pc & BASIC_PC_IMMEDIATE) {
+        pc &= ~BASIC_PC_IMMEDIATE ;
+        return (pc < imm_count) ? &imm_stmts[pc] : NULL ;
+    }
+
+    return (stmts_valid && pc < stmt_count) ? &stmts[pc] : NULL ;
+}
 
-extern EventGroupHandle_t brevent ;
+static void clear_stacks()
+{
+    for_depth = 0 ;
+    for_depth_max = 0 ;
+    gosub_depth = 0 ;
+    gosub_depth_max = 0 ;
+}
 
-static basic_line_t *find_line_by_number(uint32_t lineno)
+//
+// Discard the for stack entries above the innermost loop on the given
+// variable.  This is how a loop left with GOTO gets cleaned up when its
+// variable is used by a later FOR or NEXT.  Returns the matching entry, or
+// NULL if no loop on the variable is active, in which case the stack is left
+// untouched.
+//
+static for_stack_entry_t *for_stack_unwind(uint32_t varidx)
 {
-    for(basic_line_t *line = program ; line ; line = line->next_) {
-        if (line->lineno_ == lineno)
-            return line ;
+    uint32_t i = for_depth ;
+
+    while (i > 0) {
+        if (for_stack[i - 1].varidx_ == varidx) {
+            for_depth = i ;
+            return &for_stack[i - 1] ;
+        }
+        i-- ;
     }
 
     return NULL ;
 }
 
+static bool gosub_push(uint32_t pc, basic_err_t *err)
+{
+    if (gosub_depth == BASIC_MAX_GOSUB_DEPTH) {
+        *err = BASIC_ERR_GOSUB_STACK_OVERFLOW ;
+        return false ;
+    }
+
+    gosub_stack[gosub_depth++].pc_ = pc ;
+    if (gosub_depth > gosub_depth_max)
+        gosub_depth_max = gosub_depth ;
+
+    return true ;
+}
+
 static void putSpaces(basic_out_fn_t outfn, int count)
 {
     while (count > 0) {
@@ -72,28 +361,10 @@ static void putSpaces(basic_out_fn_t outfn, int count)
     }
 }
 
-static void forwardOneStmt(exec_context_t *ctxt)
-{
-    if (ctxt->child_ == NULL) {
-        if (ctxt->line_->children_) {
-            ctxt->child_ = ctxt->line_->children_ ;
-        }
-        else {
-            ctxt->line_ = ctxt->line_->next_ ;
-        }
-    }
-    else {
-        ctxt->child_ = ctxt->child_->next_ ;
-        if (ctxt->child_ == NULL) {
-            ctxt->line_ = ctxt->line_->next_ ;
-        }
-    }
-}
-
 static bool dimToString(basic_line_t* line, uint32_t str)
 {
     uint32_t index = 1;
-    uint32_t dimcnt, varnameidx ;
+    uint32_t dimcnt, varidx ;
 
     while (index < line->count_)
     {
@@ -102,10 +373,10 @@ static bool dimToString(basic_line_t* line, uint32_t str)
                 return false;
         }
 
-        varnameidx = getU32(line, index);
+        varidx = getU32(line, index);
         index += 4;
 
-        const char *varname = basic_str_value(varnameidx) ;
+        const char *varname = basic_var_get_name(varidx) ;
         assert(varname != NULL) ;
 
         if (!basic_str_add_str(str, varname))
@@ -152,24 +423,16 @@ static bool evalDims(basic_line_t *line, int index, int dimcnt, uint32_t *dims,
         uint32_t exprindex = getU32(line, index) ;
         index += 4 ;
 
-        basic_value_t* value = basic_expr_eval(exprindex, 0, NULL, NULL, err);
-        if (value == NULL)
-            return false ;
-
-        if (value->type_ == BASIC_VALUE_TYPE_STRING) {
-            basic_value_destroy(value);
-            *err = BASIC_ERR_TYPE_MISMATCH;
+        basic_num_t value ;
+        if (!basic_expr_eval_number(exprindex, &value, err))
             return false ;
-        }
 
-        if (value->value.nvalue_ < 0) {
-            basic_value_destroy(value);
+        if (value < 0) {
             *err = BASIC_ERR_INVALID_DIMENSION;
             return false ;
         }
 
-        dims[i] = (uint32_t)value->value.nvalue_;
-        basic_value_destroy(value);
+        dims[i] = (uint32_t)basic_num_to_int(value);
     }
 
     return true ;
@@ -177,10 +440,10 @@ static bool evalDims(basic_line_t *line, int index, int dimcnt, uint32_t *dims,
 
 static bool letSimpleToString(basic_line_t* line, uint32_t str)
 {
-    uint32_t varnameidx = getU32(line, 1);
+    uint32_t varidx = getU32(line, 1);
     uint32_t expridx = getU32(line, 5);
 
-    const char* varname = basic_str_value(varnameidx);
+    const char* varname = basic_var_get_name(varidx);
     assert(varname);
     if (!basic_str_add_str(str, varname))
         return false;
@@ -207,10 +470,10 @@ static bool letArrayToString(basic_line_t *line, uint32_t str)
 {
     int index = 1;
 
-    uint32_t varnameidx = getU32(line, index);
+    uint32_t varidx = getU32(line, index);
     index += 4;
 
-    const char* varname = basic_str_value(varnameidx) ;
+    const char* varname = basic_var_get_name(varidx) ;
     assert(varname != NULL) ;
 
     if (!basic_str_add_str(str, varname))
@@ -310,7 +573,7 @@ static bool readToString(basic_line_t *line, uint32_t str)
         token = line->tokens_[index++] ;
         varidx = getU32(line, index) ;
         index += 4 ;
-        if (!basic_str_add_handle(str, varidx))
+        if (!basic_str_add_str(str, basic_var_get_name(varidx)))
             return false ;
 
         if (token == BTOKEN_LET_ARRAY)
@@ -350,6 +613,86 @@ static bool readToString(basic_line_t *line, uint32_t str)
     return true ;
 }
 
+static bool matToString(basic_line_t *line, uint32_t str)
+{
+    uint8_t op = line->tokens_[1] ;
+    uint32_t index = 2 ;
+
+    if (op == BASIC_MAT_READ || op == BASIC_MAT_PRINT) {
+        if (!basic_str_add_str(str, op == BASIC_MAT_READ ? "READ " : "PRINT "))
+            return false ;
+
+        while (index < line->count_) {
+            if (index != 2) {
+                if (!basic_str_add_str(str, ","))
+                    return false ;
+            }
+
+            if (!basic_str_add_str(str, basic_var_get_name(getU32(line, index))))
+                return false ;
+            index += 4 ;
+        }
+
+        return true ;
+    }
+
+    if (!basic_str_add_str(str, basic_var_get_name(getU32(line, index))) || !basic_str_add_str(str, " = "))
+        return false ;
+    index += 4 ;
+
+    const char *opstr = NULL ;
+    switch(op) {
+        case BASIC_MAT_ZER:
+            return basic_str_add_str(str, "ZER") ;
+
+        case BASIC_MAT_CON:
+            return basic_str_add_str(str, "CON") ;
+
+        case BASIC_MAT_IDN:
+            return basic_str_add_str(str, "IDN") ;
+
+        case BASIC_MAT_TRN:
+            return basic_str_add_str(str, "TRN(") && basic_str_add_str(str, basic_var_get_name(getU32(line, index))) && basic_str_add_str(str, ")") ;
+
+        case BASIC_MAT_SCALE:
+        {
+            uint32_t strh = basic_expr_to_string(getU32(line, index)) ;
+            index += 4 ;
+
+            if (!basic_str_add_str(str, "(") || !basic_str_add_handle(str, strh)) {
+                basic_str_destroy(strh) ;
+                return false ;
+            }
+            basic_str_destroy(strh) ;
+
+            return basic_str_add_str(str, ") * ") && basic_str_add_str(str, basic_var_get_name(getU32(line, index))) ;
+        }
+
+        case BASIC_MAT_ADD:
+            opstr = " + " ;
+            break ;
+
+        case BASIC_MAT_SUB:
+            opstr = " - " ;
+            break ;
+
+        case BASIC_MAT_MUL:
+            opstr = " * " ;
+            break ;
+    }
+
+    if (!basic_str_add_str(str, basic_var_get_name(getU32(line, index))))
+        return false ;
+    index += 4 ;
+
+    if (opstr != NULL) {
+        if (!basic_str_add_str(str, opstr) || !basic_str_add_str(str, basic_var_get_name(getU32(line, index))))
+            return false ;
+    }
+
+    return true ;
+}
+
 static bool dataToString(basic_line_t *line, uint32_t str)
 {
     uint32_t index = 1 ;
@@ -382,17 +725,17 @@ static bool dataToString(basic_line_t *line, uint32_t str)
         }
         else
         {
-            double d = getDouble(line, index) ;
-            index += sizeof(double) ;
+            basic_num_t d = getNum(line, index) ;
+            index += sizeof(basic_num_t) ;
 
-            if ((d - (int)d) < 1e-6)
+            if (basic_num_is_int(d))
             {
-                if (!basic_str_add_int(str, (int)d))
+                if (!basic_str_add_int(str, basic_num_to_int(d)))
                     return false ;                
             }
             else 
             {
-                if (!basic_str_add_double(str, d))
+                if (!basic_str_add_double(str, basic_num_to_double(d)))
                     return false ;
             }
         }
@@ -466,7 +809,7 @@ static bool printToString(basic_line_t *line, uint32_t str)
 
 static bool remToString(basic_line_t *line, uint32_t str)
 {
-    return basic_str_add_str(str, line->extra_) ;
+    return basic_str_add_str(str, (const char *)&line->tokens_[1]) ;
 }
 
 static bool nextToString(basic_line_t *line, uint32_t str)
@@ -480,7 +823,7 @@ static bool nextToString(basic_line_t *line, uint32_t str)
         }
         uint32_t idx = getU32(line, index);
         index += 4 ;
-        const char* varname = basic_str_value(idx) ;
+        const char* varname = basic_var_get_name(idx) ;
         if (!basic_str_add_str(str, varname)) {
             return false; 
         }
@@ -606,7 +949,7 @@ static bool inputToString(basic_line_t *line, uint32_t str)
 {
     uint32_t strh ;
     uint32_t index = 1 ;
-    uint8_t token = getU32(line, index++) ;
+    uint8_t token = line->tokens_[index++] ;
     bool first = true ;
 
     if (token == BTOKEN_PROMPT) {
@@ -629,11 +972,37 @@ static bool inputToString(basic_line_t *line, uint32_t str)
                 return false ;            
         }
         first = false ;
-        strh = getU32(line, index) ;
+        uint32_t varidx = getU32(line, index) ;
         index += 4 ;    
 
-        if (!basic_str_add_handle(str, strh))
+        if (!basic_str_add_str(str, basic_var_get_name(varidx)))
             return false;        
+
+        uint32_t dimcnt = getU32(line, index) ;
+        index += 4 ;
+
+        if (dimcnt != 0) {
+            if (!basic_str_add_str(str, "("))
+                return false ;
+
+            for(uint32_t i = 0 ; i < dimcnt ; i++) {
+                if (i != 0) {
+                    if (!basic_str_add_str(str, ","))
+                        return false ;
+                }
+
+                strh = basic_expr_to_string(getU32(line, index)) ;
+                index += 4 ;
+                if (!basic_str_add_handle(str, strh)) {
+                    basic_str_destroy(strh) ;
+                    return false ;
+                }
+                basic_str_destroy(strh) ;
+            }
+
+            if (!basic_str_add_str(str, ")"))
+                return false ;
+        }
     }
 
     return true ;
@@ -811,6 +1180,11 @@ static bool oneLineToString(basic_line_t *line, uint32_t str)
                 return false ;
             break ;
 
+        case BTOKEN_MAT:
+            if (!matToString(line, str))
+                return false ;
+            break ;
+
         default:    // No additional args
             assert(false);
             break ;
@@ -863,29 +1237,64 @@ uint32_t lineToString(basic_line_t *line)
     return str ;
 }
 
-static void replace_line(basic_line_t *stay, basic_line_t *newone)
+//
+// Put newone in place of the line link points to and destroy the old line
+//
+static void replace_line(basic_line_t **link, basic_line_t *newone)
 {
-    int tmpcnt ;
-    uint8_t *tmptokens ;
-
-    tmpcnt = stay->count_ ;
-    stay->count_ = newone->count_ ;
-    newone->count_ = tmpcnt ;
+    basic_line_t *old = *link ;
 
-    tmptokens = stay->tokens_ ;
-    stay->tokens_ = newone->tokens_ ;
-    newone->tokens_ = tmptokens ;
+    newone->next_ = old->next_ ;
+    *link = newone ;
 
-    basic_destroy_line(newone) ;
+    basic_destroy_line(old) ;
 }
 
 void basic_store_line(basic_line_t *line)
 {
+    stmts_valid = false ;
+
+    if (line_index_valid || line_index_rebuild()) {
+        //
+        // A saved program has its lines in order, so a line past the last one
+        // goes on the end without a search
+        //
+        bool found = false ;
+        uint32_t pos = line_index_count ;
+        if (pos == 0 || line->lineno_ <= line_index[pos - 1]->lineno_)
+            pos = line_index_search(line->lineno_, &found) ;
+
+        if (found) {
+            replace_line((pos == 0) ? &program : &line_index[pos - 1]->next_, line) ;
+            line_index[pos] = line ;
+            return ;
+        }
+
+        if (pos == 0) {
+            line->next_ = program ;
+            program = line ;
+        }
+        else {
+            line->next_ = line_index[pos - 1]->next_ ;
+            line_index[pos - 1]->next_ = line ;
+        }
+
+        if (line_index_grow(line_index_count + 1)) {
+            memmove(&line_index[pos + 1], &line_index[pos], sizeof(basic_line_t *) * (line_index_count - pos)) ;
+            line_index[pos] = line ;
+            line_index_count++ ;
+        }
+        else {
+            line_index_valid = false ;
+        }
+        return ;
+    }
+
     if (program == NULL) {
         program = line ;
     }
     else if (line->lineno_ == program->lineno_) {
-        replace_line(program, line) ;
+        replace_line(&program, line) ;
     }
     else if (line->lineno_ < program->lineno_) {
         line->next_ = program ;
@@ -902,7 +1311,7 @@ void basic_store_line(basic_line_t *line)
         }
         else {
             if (tmp->next_->lineno_ == line->lineno_) {
-                replace_line(tmp->next_, line) ;
+                replace_line(&tmp->next_, line) ;
             }
             else {
                 line->next_ = tmp->next_ ;
@@ -923,8 +1332,7 @@ void basic_cls(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 
 void basic_restore()
 {
-    data_context.line_ = program ;
-    data_context.child_ = NULL ;
+    data_pc = 0 ;
     data_index = 1 ;
 }
 
@@ -937,14 +1345,13 @@ void basic_run(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
         return ;    
     }
 
-    exec_context_t context ;
-    context.line_ = program ;
-    context.child_ = NULL ;
-    context.next_ = NULL ;
+    if (!link_program(err))
+        return ;
 
+    clear_stacks() ;
     basic_restore() ;
 
-    *err = basic_exec_line(&context, outfn) ;
+    *err = exec_stmts(0, outfn) ;
     if (end_program == BTOKEN_STOP) {
         (outfn)(StoppedMessage, (int)strlen(StoppedMessage)) ;
     }
@@ -1007,6 +1414,9 @@ void basic_clear_int()
     }
 
     program = NULL ;
+    line_index_free() ;
+    stmts_free() ;
+    clear_stacks() ;
 
     basic_str_clear_all() ;
     basic_var_clear_all() ;
@@ -1018,7 +1428,10 @@ void basic_clear(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 {
     *err = BASIC_ERR_NONE ;    
 
-    if (line->lineno_ != -1) {
+    //
+    // A failed LOAD clears the partial program by calling this with no line
+    //
+    if (line != NULL && line->lineno_ != -1) {
         *err = BASIC_ERR_NOT_ALLOWED ;
         return ;
     }
@@ -1026,6 +1439,21 @@ void basic_clear(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     basic_clear_int() ;
 }
 
+//
+// The lines of the program and the bytes they take, which for each statement is
+// the line header and its tokens
+//
+static void program_size(uint32_t *lines, uint32_t *bytes)
+{
+    for(basic_line_t *line = program ; line != NULL ; line = line->next_) {
+        (*lines)++ ;
+        *bytes += sizeof(basic_line_t) + line->count_ ;
+
+        for(basic_line_t *child = line->children_ ; child != NULL ; child = child->next_)
+            *bytes += sizeof(basic_line_t) + child->count_ ;
+    }
+}
+
 static char fmtbuf[64];
 void basic_mem(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 {
@@ -1049,25 +1477,41 @@ void basic_mem(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     outfn(fmtbuf, strlen(fmtbuf));    
 
 #endif
-}
 
-void basic_base(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
-{
-    if (line->count_ > 1) {
-        uint32_t expr = getU32(line, 1) ;
+    sprintf(fmtbuf, "Allocations     %lu\n", (unsigned long)basic_mem_stats.allocs_) ;
+    outfn(fmtbuf, strlen(fmtbuf));
 
-        basic_value_t *value = basic_expr_eval(expr, 0, NULL, NULL, err);
-        if (value == NULL)
-            return ;        
+    sprintf(fmtbuf, "Frees           %lu\n", (unsigned long)basic_mem_stats.frees_) ;
+    outfn(fmtbuf, strlen(fmtbuf));
 
-        if (value->type_ != BASIC_VALUE_TYPE_NUMBER) 
-        {
-            *err = BASIC_ERR_TYPE_MISMATCH ;
-            return ;
-        }
+    sprintf(fmtbuf, "Bytes Allocated %lu\n", (unsigned long)basic_mem_stats.bytes_) ;
+    outfn(fmtbuf, strlen(fmtbuf));
+
+    sprintf(fmtbuf, "Live Blocks     %lu\n", (unsigned long)(basic_mem_stats.allocs_ - basic_mem_stats.frees_)) ;
+    outfn(fmtbuf, strlen(fmtbuf));
+
+    uint32_t lines = 0, bytes = 0 ;
+    program_size(&lines, &bytes) ;
+    sprintf(fmtbuf, "Program         %lu lines, %lu bytes\n", (unsigned long)lines, (unsigned long)bytes) ;
+    outfn(fmtbuf, strlen(fmtbuf));
 
-        int b = (int)value->value.nvalue_ ;
-        basic_value_destroy(value) ;
+    sprintf(fmtbuf, "FOR Depth       %lu of %d\n", (unsigned long)for_depth_max, BASIC_MAX_FOR_DEPTH) ;
+    outfn(fmtbuf, strlen(fmtbuf));
+
+    sprintf(fmtbuf, "GOSUB Depth     %lu of %d\n", (unsigned long)gosub_depth_max, BASIC_MAX_GOSUB_DEPTH) ;
+    outfn(fmtbuf, strlen(fmtbuf));
+}
+
+void basic_base(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
+{
+    if (line->count_ > 1) {
+        uint32_t expr = getU32(line, 1) ;
+
+        basic_num_t value ;
+        if (!basic_expr_eval_number(expr, &value, err))
+            return ;        
+
+        int b = basic_num_to_int(value) ;
 
         if (b != 0 && b != 1) {
             *err = BASIC_ERR_INVALID_ARG_VALUE ;
@@ -1100,12 +1544,12 @@ void basic_vars(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
             return ;
         }
 
-        prefix = value->value.svalue_ ;
+        prefix = basic_value_chars(value) ;
     }
 
     int cnt = basic_var_count() ;
     if (cnt > 0) {
-        uint32_t *all = (uint32_t *)malloc(sizeof(uint32_t) * cnt) ;
+        uint32_t *all = (uint32_t *)basic_malloc(sizeof(uint32_t) * cnt) ;
         basic_var_get_all(all)  ;
 
         for(int i = 0 ; i < cnt ; i++) {
@@ -1117,22 +1561,29 @@ void basic_vars(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
             {
                 if (basic_var_is_array(all[i]) == false) {
                     basic_value_t *value = basic_var_get_value(all[i]) ;
-                    if (value->type_ == BASIC_VALUE_TYPE_NUMBER) {
-                        if ((value->value.nvalue_ - (int)value->value.nvalue_) < 1e-6)
-                            sprintf(fmtbuf, " %d ", (int)value->value.nvalue_);
+                    int32_t *ivalue = basic_var_get_int(all[i]) ;
+                    if (value == NULL && ivalue == NULL)
+                        continue ;
+
+                    if (ivalue != NULL) {
+                        sprintf(fmtbuf, " %d ", (int)*ivalue) ;
+                    }
+                    else if (value->type_ == BASIC_VALUE_TYPE_NUMBER) {
+                        if (basic_num_is_int(value->value.nvalue_))
+                            sprintf(fmtbuf, " %d ", (int)basic_num_to_int(value->value.nvalue_));
                         else
-                            sprintf(fmtbuf, " %f ", value->value.nvalue_);
+                            sprintf(fmtbuf, " %f ", basic_num_to_double(value->value.nvalue_));
                     }
 
                     (*outfn)(varname, (int)strlen(varname)) ;
                     (*outfn)(" = ", 3) ;
-                    if (value->type_ == BASIC_VALUE_TYPE_NUMBER)
+                    if (ivalue != NULL || value->type_ == BASIC_VALUE_TYPE_NUMBER)
                     {
                         (*outfn)(fmtbuf, (int)strlen(fmtbuf)) ;
                     }
                     else
                     {
-                        (*outfn)(value->value.svalue_, (int)strlen(value->value.svalue_)) ;
+                        (*outfn)(basic_value_chars(value), (int)value->length_) ;
                     }
                     (*outfn)("\n", 1) ;
                 }
@@ -1143,13 +1594,26 @@ void basic_vars(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
                 }
             }
         }
-        free(all) ;
+        basic_free(all) ;
     }
 
     if (value != NULL)
         basic_value_destroy(value);
 }
 
+//
+// A number as PRINT shows it, in fmtbuf
+//
+static const char *format_number(basic_num_t value)
+{
+    if (basic_num_is_int(value))
+        sprintf(fmtbuf, " %d ", (int)basic_num_to_int(value));
+    else
+        sprintf(fmtbuf, " %f ", basic_num_to_double(value));
+
+    return fmtbuf ;
+}
+
 void basic_print(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 {
     uint32_t index = 1 ;
@@ -1167,23 +1631,15 @@ void basic_print(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
             uint32_t expr = getU32(line, index) ;
             index += 4 ;
 
-            basic_value_t *value = basic_expr_eval(expr, 0, NULL, NULL, err);
-            if (value == NULL)
+            basic_num_t value ;
+            if (!basic_expr_eval_number(expr, &value, err))
                 return ;
 
-            if (value->type_ != BASIC_VALUE_TYPE_NUMBER)
-            {
-                basic_value_destroy(value);
-                *err = BASIC_ERR_TYPE_MISMATCH ;
-                return ;
-            }
-
-            int n = (int)value->value.nvalue_ ;
+            int n = basic_num_to_int(value) ;
             while (len < n) {
                 (*outfn)(" ", 1) ;
                 len++ ;
             }
-            basic_value_destroy(value);
         }
         else
         {
@@ -1192,26 +1648,24 @@ void basic_print(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
             index += 4 ;
             trailing = true ;
 
-            basic_value_t *value = basic_expr_eval(expr, 0, NULL, NULL, err);
-            if (value == NULL)
+            basic_value_t value ;
+            if (!basic_expr_eval_value(expr, &value, err))
                 return ;
 
             const char* str;
-            if (value->type_ == BASIC_VALUE_TYPE_STRING) {
-                str = value->value.svalue_;
+            int slen ;
+            if (value.type_ == BASIC_VALUE_TYPE_STRING) {
+                str = basic_value_chars(&value) ;
+                slen = (int)value.length_ ;
             }
             else {
-                if ((value->value.nvalue_ - (int)value->value.nvalue_) < 1e-6)
-                    sprintf(fmtbuf, " %d ", (int)value->value.nvalue_);
-                else
-                    sprintf(fmtbuf, " %f ", value->value.nvalue_);
-
-                str = fmtbuf;
+                str = format_number(value.value.nvalue_) ;
+                slen = (int)strlen(str) ;
             }
 
-            len += (int)strlen(str) ;
-            (*outfn)(str, (int)strlen(str)) ;
-            basic_value_destroy(value);
+            len += slen ;
+            (*outfn)(str, slen) ;
+            basic_value_release(&value);
         }
 
         if(index == line->count_)
@@ -1287,7 +1741,7 @@ void updateLine(basic_line_t *line, int count, int *oldlines, int *newlines)
         uint32_t index = 6 ;
 
         while (index < line->count_) {
-            uint32 lineno = getU32(line, index) ;
+            uint32_t lineno = getU32(line, index) ;
             lineno = getNewLine(count, lineno, oldlines, newlines) ;
             putU32(line, index, lineno);
             index += 4 ;
@@ -1295,7 +1749,7 @@ void updateLine(basic_line_t *line, int count, int *oldlines, int *newlines)
     }
     else if (line->tokens_[0] == BTOKEN_GOTO || line->tokens_[0] == BTOKEN_GOSUB)
     {
-        uint32 lineno = getU32(line, 1) ;
+        uint32_t lineno = getU32(line, 1) ;
         lineno = getNewLine(count, lineno, oldlines, newlines) ;
         putU32(line, 1, lineno) ;
     }
@@ -1324,17 +1778,17 @@ void basic_renum(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     }
 
     int count = countLines() ;
-    oldlines = (int *)malloc(sizeof(int) * count) ;
+    oldlines = (int *)basic_malloc(sizeof(int) * count) ;
     if (oldlines == NULL)
     {
         *err = BASIC_ERR_OUT_OF_MEMORY ;
         return ;
     }
 
-    newlines = (int *)malloc(sizeof(int) * count) ;
+    newlines = (int *)basic_malloc(sizeof(int) * count) ;
     if (newlines == NULL)
     {
-        free(oldlines) ;
+        basic_free(oldlines) ;
         *err = BASIC_ERR_OUT_OF_MEMORY ;
         return ;
     }
@@ -1342,17 +1796,23 @@ void basic_renum(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     int start = getU32(line, 1) ;
     int step = getU32(line, 5);
 
+    //
+    // Renumbering keeps the lines in the same order, so the line index
+    // is still sorted and does not need to be rebuilt.
+    //
     createLineMapping(oldlines, newlines, start, step) ;
     updateLines(count, oldlines, newlines) ;
+    stmts_valid = false ;
 
-    free(oldlines) ;
-    free(newlines) ;
+    basic_free(oldlines) ;
+    basic_free(newlines) ;
     sprintf(fmtbuf, "Renumbered %d lines\n", count) ;
     (outfn)(fmtbuf, strlen(fmtbuf));
 }
 
-void basic_on(basic_line_t *line, exec_context_t *current, exec_context_t *nextline, basic_err_t *err, basic_out_fn_t outfn)
+void basic_on(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
 {
+    basic_line_t *line = stmt->line_ ;
     uint8_t token ;
     int index = 1 ;
 
@@ -1362,50 +1822,28 @@ void basic_on(basic_line_t *line, exec_context_t *current, exec_context_t *nextl
     token = line->tokens_[index++] ;
     assert(token == BTOKEN_GOTO || token == BTOKEN_GOSUB);    
 
-    basic_value_t *value = basic_expr_eval(exprindex, 0, NULL, NULL, err) ;
-    if (value == NULL)
-        return ;
-
-    if (value->type_ != BASIC_VALUE_TYPE_NUMBER) {
-        basic_value_destroy(value);
-        *err = BASIC_ERR_TYPE_MISMATCH ;
+    basic_num_t value ;
+    if (!basic_expr_eval_number(exprindex, &value, err))
         return ;
-    }
 
-    int v = (int)(value->value.nvalue_) - 1;
+    int v = basic_num_to_int(value) - 1;
     uint32_t lineidx = index + v * 4 ;
     if (lineidx + 4 <= line->count_) {
-        int lineno = getU32(line, lineidx);
-        basic_line_t *nline = find_line_by_number(lineno) ;
-        if (nline == NULL) {
-            *err = BASIC_ERR_INVALID_LINE_NUMBER ;
+        uint32_t target = find_stmt_by_line(getU32(line, lineidx), err) ;
+        if (target == BASIC_PC_NONE)
             return ;
-        }
 
         if (token == BTOKEN_GOTO) {
-            nextline->line_ = nline ;
-            nextline->child_ = NULL ;
+            *nextpc = target ;
         }
         else {
-            gosub_stack_entry_t *entry = (gosub_stack_entry_t *)malloc(sizeof(gosub_stack_entry_t)) ;
-            if (entry == NULL) {
-                *err = BASIC_ERR_OUT_OF_MEMORY ;
+            if (!gosub_push(pc + 1, err))
                 return ;
-            }
 
-            entry->context_.line_ = current->line_ ;
-            entry->context_.child_ = current->child_ ;
-            forwardOneStmt(&entry->context_);
-
-            entry->next_ = gosub_stack ;
-            gosub_stack = entry ;
-
-            nextline->line_ = nline ;    
-            nextline->child_ = NULL ;
+            *nextpc = target ;
             *err = BASIC_ERR_NONE ;
         }
     }
-    basic_value_destroy(value);
 }
 
 void basic_input(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
@@ -1480,21 +1918,20 @@ void basic_input(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
             //
             // Get the variable name, handle, and type
             //
-            v = getU32(line, index) ;
+            varidx = getU32(line, index) ;
             index += 4 ;
 
-            const char *varname = basic_str_value(v) ;
-            if (!basic_var_get(varname, &varidx, err))
-                return ;            
             bool str = basic_var_is_string(varidx) ;                
             uint32_t dims[BASIC_MAX_DIMS] ;
             uint32_t dimcnt = getU32(line, index) ;
+            index += 4 ;
             basic_value_t *value ;
 
             if (dimcnt != 0) {
                 if (!evalDims(line, index, dimcnt, dims, err)) {
                     return ;
                 }
+                index += 4 * dimcnt ;
             }
 
             if (str) 
@@ -1507,7 +1944,7 @@ void basic_input(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
             }
             else
             {
-                double num ;
+                basic_num_t num ;
                 
                 text = skipSpaces(text) ;
                 if (*text == '\0') {
@@ -1545,7 +1982,7 @@ void basic_input(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
             }
             else 
             {
-                basic_var_set_array_value(varidx, value, dims, err);
+                basic_var_set_array_value(varidx, value, dimcnt, dims, err);
             }
 
             if (index == line->count_)
@@ -1574,29 +2011,14 @@ void basic_rem(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 
 static bool find_next_data_line()
 {
-    basic_line_t *toexec ;
-
-    while (data_context.line_ != NULL) {
-        if (data_context.child_ != NULL)
-            toexec = data_context.child_ ;
-        else
-            toexec = data_context.line_ ;
-
-        if (toexec->tokens_[0] == BTOKEN_DATA)
+    while (data_pc < stmt_count) {
+        if (stmts[data_pc].line_->tokens_[0] == BTOKEN_DATA)
             break; 
 
-        forwardOneStmt(&data_context);
+        data_pc++ ;
     }
 
-    return data_context.line_ != NULL ;
-}
-
-static basic_line_t *get_active_line(exec_context_t *c)
-{
-    if (c->child_ != NULL)
-        return c->child_ ;
-
-    return c->line_ ;
+    return data_pc < stmt_count ;
 }
 
 void basic_read(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
@@ -1606,23 +2028,16 @@ void basic_read(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     static uint32_t dims[BASIC_MAX_DIMS] ;
     uint32_t dimcnt, varidx ;
 
+    if (!link_program(err))
+        return ;
+
     while (index < line->count_) {
 
         vtoken = line->tokens_[index++] ;
 
-        uint32_t varstridx = getU32(line, index) ;
+        varidx = getU32(line, index) ;
         index += 4 ;
 
-        const char *varname = basic_str_value(varstridx) ;
-        if (varname == NULL)
-        {
-            *err = BASIC_ERR_INVALID_VARNAME ;
-            return ;
-        }
-
-        if (!basic_var_get(varname, &varidx, err))
-            return ;
-
         if (vtoken == BTOKEN_LET_ARRAY) 
         {
             dimcnt = getU32(line, index);
@@ -1632,24 +2047,16 @@ void basic_read(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
                 uint32_t exprindex = getU32(line, index) ;
                 index += 4 ;
 
-                basic_value_t* value = basic_expr_eval(exprindex, 0, NULL, NULL, err);
-                if (value == NULL)
-                    return;
-
-                if (value->type_ == BASIC_VALUE_TYPE_STRING) {
-                    basic_value_destroy(value);
-                    *err = BASIC_ERR_TYPE_MISMATCH;
+                basic_num_t value ;
+                if (!basic_expr_eval_number(exprindex, &value, err))
                     return;
-                }
 
-                if (value->value.nvalue_ < 0) {
-                    basic_value_destroy(value);
+                if (value < 0) {
                     *err = BASIC_ERR_INVALID_DIMENSION;
                     return;
                 }
 
-                dims[i] = (uint32_t)value->value.nvalue_;
-                basic_value_destroy(value);
+                dims[i] = (uint32_t)basic_num_to_int(value);
             }
 
             int vardimcnt = basic_var_get_dim_count(varidx, err) ;
@@ -1674,11 +2081,11 @@ void basic_read(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
             return ;
         }
 
-        basic_line_t *dline = get_active_line(&data_context);
+        basic_line_t *dline = stmts[data_pc].line_ ;
         token = dline->tokens_[data_index++] ;
         basic_value_t *dvalue = NULL ;
 
-        if (varname[strlen(varname) - 1] == '$') 
+        if (basic_var_is_string(varidx)) 
         {
             if (token != BTOKEN_STRING) {
                 *err = BASIC_ERR_TYPE_MISMATCH ;
@@ -1702,8 +2109,8 @@ void basic_read(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
                 return ;
             }
 
-            double v = getDouble(dline, data_index) ;
-            data_index += sizeof(double) ;
+            basic_num_t v = getNum(dline, data_index) ;
+            data_index += sizeof(basic_num_t) ;
 
             dvalue = basic_value_create_number(v) ;
             if (dvalue == NULL) {
@@ -1719,44 +2126,289 @@ void basic_read(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
         }
         else
         {
-            if (!basic_var_set_array_value(varidx, dvalue, dims, err))
+            if (!basic_var_set_array_value(varidx, dvalue, dimcnt, dims, err))
                 return ;
         }
 
         if (data_index == dline->count_) {
-            forwardOneStmt(&data_context);
+            data_pc++ ;
             data_index = 1 ;
         }
     }  
 }
 
-void basic_let_simple(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
+//
+// The next number from the DATA statements, for MAT READ
+//
+static bool read_data_number(basic_num_t *value, basic_err_t *err)
 {
-    assert(line->count_ == 9);
-    *err = BASIC_ERR_NONE ;    
+    if (!find_next_data_line()) {
+        *err = BASIC_ERR_NO_DATA ;
+        return false ;
+    }
 
-    uint32_t varindex ;
-    uint32_t varnameidx = getU32(line, 1) ;
-    uint32_t exprindex = getU32(line, 5) ;
-    const char *varname = basic_str_value(varnameidx) ;
-    assert(varname != NULL) ;
+    basic_line_t *dline = stmts[data_pc].line_ ;
+    if (dline->tokens_[data_index++] != BTOKEN_NUMBER) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
+    }
+
+    *value = getNum(dline, data_index) ;
+    data_index += sizeof(basic_num_t) ;
+
+    if (data_index == dline->count_) {
+        data_pc++ ;
+        data_index = 1 ;
+    }
+
+    return true ;
+}
+
+//
+// MAT READ and MAT PRINT go through the arrays a row at a time, the way the
+// elements are written in a program, so they step across the columns
+//
+static void mat_read(basic_line_t *line, basic_err_t *err)
+{
+    uint32_t rows, cols ;
+
+    if (!link_program(err))
+        return ;
+
+    for(uint32_t index = 2 ; index < line->count_ ; index += 4) {
+        basic_num_t *data = basic_var_get_matrix(getU32(line, index), &rows, &cols, err) ;
+        if (data == NULL)
+            return ;
+
+        for(uint32_t i = 0 ; i < rows ; i++) {
+            for(uint32_t j = 0 ; j < cols ; j++) {
+                if (!read_data_number(&data[i + j * rows], err))
+                    return ;
+            }
+        }
+    }
+}
+
+static void mat_print(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
+{
+    uint32_t rows, cols ;
+
+    for(uint32_t index = 2 ; index < line->count_ ; index += 4) {
+        basic_num_t *data = basic_var_get_matrix(getU32(line, index), &rows, &cols, err) ;
+        if (data == NULL)
+            return ;
+
+        if (index != 2)
+            (*outfn)("\n", 1) ;
+
+        for(uint32_t i = 0 ; i < rows ; i++) {
+            int len = 0 ;
+            for(uint32_t j = 0 ; j < cols ; j++) {
+                if (j != 0) {
+                    int count = tab_size - (len % tab_size) ;
+                    putSpaces(outfn, count) ;
+                    len += count ;
+                }
+
+                const char *str = format_number(data[i + j * rows]) ;
+                int slen = (int)strlen(str) ;
+                (*outfn)(str, slen) ;
+                len += slen ;
+            }
+            (*outfn)("\n", 1) ;
+        }
+    }
+}
+
+//
+// Run a MAT assignment.  The arrays must already be dimensioned to the shape of
+// the result.  The product and the transpose are built in a scratch copy when
+// the result is also an operand, the other forms work an element at a time and
+// can update an array in place.
+//
+void basic_mat(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
+{
+    uint8_t op = line->tokens_[1] ;
+    uint32_t rows, cols, arows, acols, brows, bcols ;
+    basic_num_t *a, *b, *result, *scratch = NULL ;
+
+    *err = BASIC_ERR_NONE ;
+
+    if (op == BASIC_MAT_READ) {
+        mat_read(line, err) ;
+        return ;
+    }
+
+    if (op == BASIC_MAT_PRINT) {
+        mat_print(line, err, outfn) ;
+        return ;
+    }
 
-    if (!basic_var_get(varname, &varindex, err))
+    basic_num_t *dst = basic_var_get_matrix(getU32(line, 2), &rows, &cols, err) ;
+    if (dst == NULL)
         return ;
 
-    basic_value_t *value = basic_expr_eval(exprindex, 0, NULL, NULL, err) ;
-    if (value == NULL)
+    switch(op) {
+        case BASIC_MAT_ZER:
+            basic_mat_fill(dst, basic_num_from_int(0), rows * cols) ;
+            break ;
+
+        case BASIC_MAT_CON:
+            basic_mat_fill(dst, basic_num_from_int(1), rows * cols) ;
+            break ;
+
+        case BASIC_MAT_IDN:
+            if (rows != cols) {
+                *err = BASIC_ERR_DIM_MISMATCH ;
+                return ;
+            }
+            basic_mat_idn(dst, rows) ;
+            break ;
+
+        case BASIC_MAT_COPY:
+        case BASIC_MAT_ADD:
+        case BASIC_MAT_SUB:
+            a = basic_var_get_matrix(getU32(line, 6), &arows, &acols, err) ;
+            if (a == NULL)
+                return ;
+
+            if (arows != rows || acols != cols) {
+                *err = BASIC_ERR_DIM_MISMATCH ;
+                return ;
+            }
+
+            if (op == BASIC_MAT_COPY) {
+                memmove(dst, a, sizeof(basic_num_t) * rows * cols) ;
+                break ;
+            }
+
+            b = basic_var_get_matrix(getU32(line, 10), &brows, &bcols, err) ;
+            if (b == NULL)
+                return ;
+
+            if (brows != rows || bcols != cols) {
+                *err = BASIC_ERR_DIM_MISMATCH ;
+                return ;
+            }
+
+            if (op == BASIC_MAT_ADD)
+                basic_mat_add(dst, a, b, rows * cols) ;
+            else
+                basic_mat_sub(dst, a, b, rows * cols) ;
+            break ;
+
+        case BASIC_MAT_SCALE:
+        {
+            basic_num_t k ;
+            if (!basic_expr_eval_number(getU32(line, 6), &k, err))
+                return ;
+
+            a = basic_var_get_matrix(getU32(line, 10), &arows, &acols, err) ;
+            if (a == NULL)
+                return ;
+
+            if (arows != rows || acols != cols) {
+                *err = BASIC_ERR_DIM_MISMATCH ;
+                return ;
+            }
+
+            basic_mat_scale(dst, k, a, rows * cols) ;
+            break ;
+        }
+
+        case BASIC_MAT_TRN:
+        case BASIC_MAT_MUL:
+            a = basic_var_get_matrix(getU32(line, 6), &arows, &acols, err) ;
+            if (a == NULL)
+                return ;
+
+            if (op == BASIC_MAT_TRN) {
+                b = NULL ;
+                if (arows != cols || acols != rows) {
+                    *err = BASIC_ERR_DIM_MISMATCH ;
+                    return ;
+                }
+            }
+            else {
+                b = basic_var_get_matrix(getU32(line, 10), &brows, &bcols, err) ;
+                if (b == NULL)
+                    return ;
+
+                if (acols != brows || arows != rows || bcols != cols) {
+                    *err = BASIC_ERR_DIM_MISMATCH ;
+                    return ;
+                }
+            }
+
+            result = dst ;
+            if (dst == a || dst == b) {
+                scratch = (basic_num_t *)basic_malloc(sizeof(basic_num_t) * rows * cols) ;
+                if (scratch == NULL) {
+                    *err = BASIC_ERR_OUT_OF_MEMORY ;
+                    return ;
+                }
+                result = scratch ;
+            }
+
+            if (op == BASIC_MAT_TRN)
+                basic_mat_trn(result, a, arows, acols) ;
+            else
+                basic_mat_mul(result, a, b, rows, acols, cols) ;
+
+            if (scratch != NULL) {
+                memcpy(dst, scratch, sizeof(basic_num_t) * rows * cols) ;
+                basic_free(scratch) ;
+            }
+            break ;
+    }
+}
+
+void basic_let_simple(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    basic_value_t value ;
+    if (!basic_expr_eval_value(stmt->arg2_, &value, err))
         return ;
 
     //
-    // The variable now owns the value
+    // The variable takes over the value if it is an owned string
     //
-    if (!basic_var_set_value(varindex, value, err))
-        return ;
+    if (!basic_var_store(stmt->arg1_, &value, err))
+        basic_value_release(&value) ;
 
     return ;
 }
 
+//
+// LET A% = X, which assigns an integer without going through a basic_value_t.  If
+// X is an integer expression it is evaluated entirely on integers.
+//
+void basic_let_int(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    int32_t value ;
+    if (!basic_expr_eval_int(stmt->arg2_, &value, err))
+        return ;
+
+    int32_t *var = basic_var_get_int(stmt->arg1_) ;
+    if (var == NULL) {
+        *err = BASIC_ERR_NO_SUCH_VARIABLE ;
+        return ;
+    }
+    *var = value ;
+}
+
+//
+// LET A$ = A$ + X$, where the expression only computes X$
+//
+void basic_let_append(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    basic_value_t value ;
+    if (!basic_expr_eval_value(stmt->arg2_, &value, err))
+        return ;
+
+    basic_var_append(stmt->arg1_, &value, err) ;
+    basic_value_release(&value) ;
+}
+
 void basic_let_array(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 {
     uint32_t dims[BASIC_MAX_DIMS] ;
@@ -1764,12 +2416,7 @@ void basic_let_array(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 
     *err = BASIC_ERR_NONE ;    
 
-    uint32_t varindex ;
-    uint32_t varnameidx = getU32(line, index) ;
-    const char *varname = basic_str_value(varnameidx) ;
-    assert(varname != NULL) ;
-    if (!basic_var_get(varname, &varindex, err))
-        return ;
+    uint32_t varindex = getU32(line, index) ;
     index += 4 ;
 
     uint32_t dimcnt = getU32(line, index);
@@ -1779,37 +2426,29 @@ void basic_let_array(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
         uint32_t exprindex = getU32(line, index) ;
         index += 4 ;
 
-        basic_value_t* value = basic_expr_eval(exprindex, 0, NULL, NULL, err);
-        if (value == NULL)
+        int32_t value ;
+        if (!basic_expr_eval_int(exprindex, &value, err))
             return;
 
-        if (value->type_ == BASIC_VALUE_TYPE_STRING) {
-            basic_value_destroy(value);
-            *err = BASIC_ERR_TYPE_MISMATCH;
-            return;
-        }
-
-        if (value->value.nvalue_ < 0) {
-            basic_value_destroy(value);
+        if (value < 0) {
             *err = BASIC_ERR_INVALID_DIMENSION;
             return;
         }
 
-        dims[i] = (uint32_t)value->value.nvalue_;
-        basic_value_destroy(value);
+        dims[i] = (uint32_t)value;
     }
 
     uint32_t exprindex = getU32(line, index) ;
 
-    basic_value_t *value = basic_expr_eval(exprindex,  0, NULL, NULL, err) ;
-    if (value == NULL)
+    basic_value_t value ;
+    if (!basic_expr_eval_value(exprindex, &value, err))
         return ;
 
     //
-    // The variable now owns the value
+    // The array takes over the value if it is an owned string
     //
-    if (!basic_var_set_array_value(varindex, value, dims, err))
-        return ;
+    if (!basic_var_store_array(varindex, &value, dimcnt, dims, err))
+        basic_value_release(&value) ;
 
     return ;
 }
@@ -1817,17 +2456,12 @@ void basic_let_array(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 void basic_dim(basic_line_t* line, basic_err_t* err, basic_out_fn_t outfn)
 {
     uint32_t dims[BASIC_MAX_DIMS];
-    uint32_t varidx, dimcnt, varnameidx ;
-    const char *varname ;
+    uint32_t varidx, dimcnt ;
     uint32_t index = 1;
 
     while (index < line->count_) {
-        varnameidx = getU32(line, index) ;
+        varidx = getU32(line, index) ;
         index += 4 ;
-        varname = basic_str_value(varnameidx) ;
-        assert(varname != NULL) ;
-        if (!basic_var_get(varname, &varidx, err))
-            return ;
 
         dimcnt = getU32(line, index);
         index += 4;
@@ -1835,28 +2469,18 @@ void basic_dim(basic_line_t* line, basic_err_t* err, basic_out_fn_t outfn)
         for (uint32_t i = 0; i < dimcnt; i++) {
             dims[i] = getU32(line, index);
 
-            basic_value_t *value = basic_expr_eval(dims[i], 0, NULL, NULL, err) ;
-            if (value == NULL)
-                return ;
-
-            if (value->type_ != BASIC_VALUE_TYPE_NUMBER) 
-            {
-                basic_value_destroy(value);
-                *err = BASIC_ERR_TYPE_MISMATCH ;
+            int32_t value ;
+            if (!basic_expr_eval_int(dims[i], &value, err))
                 return ;
-            }
 
-            if (value->value.nvalue_ <= 0.0) 
+            if (value <= 0) 
             {
-                basic_value_destroy(value);
                 *err = BASIC_ERR_INVALID_DIMENSION;
                 return;
             }
 
-            dims[i] = (int)value->value.nvalue_ ;
+            dims[i] = (uint32_t)value ;
             index += 4;
-
-            basic_value_destroy(value);
         }
 
         if (!basic_var_add_dims(varidx, dimcnt, dims, err))
@@ -1866,245 +2490,248 @@ void basic_dim(basic_line_t* line, basic_err_t* err, basic_out_fn_t outfn)
     *err = BASIC_ERR_NONE;
 }
 
-void basic_if(basic_line_t *line, exec_context_t *current, exec_context_t *nextline, basic_err_t *err, basic_out_fn_t outfn)
+void basic_if(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
 {
-    basic_value_t *value = basic_expr_eval(getU32(line, 1), 0, NULL, NULL, err);
-    if (value == NULL)
+    bool value ;
+    if (!basic_expr_eval_condition(stmt->arg1_, &value, err))
         return ;
 
-    if (value->type_ != BASIC_VALUE_TYPE_NUMBER) {
-        basic_value_destroy(value);
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return ;
-    }
-
-    if (value->value.nvalue_ < 1.0e-6) {
+    if (!value) {
         //
         // Conditional is false, jump to the next numbered line
         //
-        nextline->line_ = current->line_->next_ ;
-        nextline->child_ = NULL ;
-
-        if (nextline->line_ == NULL)
-            nextline->lastline_ = true ;
+        *nextpc = stmt->nextline_ ;
     }
 
-    basic_value_destroy(value);
     *err = BASIC_ERR_NONE ;    
     return ;
 }
 
-void basic_then(basic_line_t *line, exec_context_t *nextline, basic_err_t *err, basic_out_fn_t outfn)
+void basic_then(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 {
     *err = BASIC_ERR_NONE ;    
     return ;
 }
 
-void basic_for(basic_line_t *line, exec_context_t *current, exec_context_t *nextline, basic_err_t *err, basic_out_fn_t outfn)
+void basic_for(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
 {
+    basic_line_t *line = stmt->line_ ;
     uint32_t varindex, expridx ;
 
-    uint32_t varnameidx = getU32(line, 1) ;
-    const char *varname = basic_str_value(varnameidx) ;
-    assert(varname != NULL) ;
-    if (!basic_var_get(varname, &varindex, err))
-        return ;
+    varindex = getU32(line, 1) ;
 
     expridx = getU32(line, 5);
 
-    basic_value_t *start = basic_expr_eval(expridx, 0, NULL, NULL, err);
-    if (start == NULL)
+    basic_value_t start ;
+    if (!basic_expr_eval_value(expridx, &start, err))
         return ;
 
-    if (!basic_var_set_value(varindex, start, err)) {
-        basic_value_destroy(start);
-        return;
-    }
-
-    for_stack_entry_t *c = (for_stack_entry_t *)malloc(sizeof(for_stack_entry_t)) ;
-    if (c == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+    if (start.type_ != BASIC_VALUE_TYPE_NUMBER) {
+        basic_value_release(&start);
+        *err = BASIC_ERR_TYPE_MISMATCH ;
         return ;
     }
 
-    c->varidx_ = varindex ;
-    c->endidx_ = getU32(line, 9) ;
-    if (line->count_ > 13) {
-        c->stepidx_ = getU32(line, 13);
+    //
+    // The limit and step are evaluated once, when the loop is entered, and
+    // cached on the for stack so NEXT does not have to evaluate them again.
+    // A loop on an A% variable counts in integers.
+    //
+    bool integer = basic_var_is_integer(varindex) ;
+    basic_num_t limit = 0, step = basic_num_from_int(1) ;
+    int32_t ilimit = 0, istep = 1 ;
+
+    if (integer) {
+        if (!basic_expr_eval_int(getU32(line, 9), &ilimit, err))
+            return ;
+
+        if (line->count_ > 13) {
+            if (!basic_expr_eval_int(getU32(line, 13), &istep, err))
+                return ;
+        }
     }
     else {
-        c->stepidx_ = 0xffffffff ;
+        if (!basic_expr_eval_number(getU32(line, 9), &limit, err))
+            return ;
+
+        if (line->count_ > 13) {
+            if (!basic_expr_eval_number(getU32(line, 13), &step, err))
+                return ;
+        }
     }
 
-    c->context_.line_ = current->line_ ;
-    c->context_.child_ = current->child_ ;
-    forwardOneStmt(&c->context_);
+    if (!basic_var_store(varindex, &start, err)) {
+        basic_value_release(&start);
+        return;
+    }
 
-    c->next_ = for_stack ;
-    for_stack = c ;
+    //
+    // A FOR on a variable that already has an active loop replaces that loop
+    // and any loops nested inside it
+    //
+    if (for_stack_unwind(varindex) != NULL)
+        for_depth-- ;
+
+    if (for_depth == BASIC_MAX_FOR_DEPTH) {
+        *err = BASIC_ERR_FOR_STACK_OVERFLOW ;
+        return ;
+    }
+
+    for_stack_entry_t *c = &for_stack[for_depth++] ;
+    if (for_depth > for_depth_max)
+        for_depth_max = for_depth ;
+
+    c->varidx_ = varindex ;
+    c->limit_ = limit ;
+    c->step_ = step ;
+    c->integer_ = integer ;
+    c->ilimit_ = ilimit ;
+    c->istep_ = istep ;
+    c->pc_ = pc + 1 ;
 
     *err = BASIC_ERR_NONE ;
     return ;
 }
 
-void basic_next(basic_line_t *line, exec_context_t *current, exec_context_t *nextline, basic_err_t *err, basic_out_fn_t outfn)
+void basic_next(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
 {
-    double step = 1.0 ;
+    basic_line_t *line = stmt->line_ ;
     int count = (line->count_ - 1) / 4 ;
+    int index = 1 ;
 
     if (count == 0)
         count = 1 ;
 
     while (count > 0) {
-        if (for_stack == NULL) {
-            *err = BASIC_ERR_UNMATCHED_NEXT ;
-            return ;
-        }
-
         //
-        // Get the current loop variable value
+        // A NEXT that names its variable closes the innermost loop on that
+        // variable, along with any loops left open inside it
         //
-        basic_value_t *loopval = basic_var_get_value(for_stack->varidx_) ;
-        if (loopval->type_ != BASIC_VALUE_TYPE_NUMBER) {
-            *err = BASIC_ERR_TYPE_MISMATCH ;
+        if (index < line->count_) {
+            if (for_stack_unwind(getU32(line, index)) == NULL) {
+                *err = BASIC_ERR_UNMATCHED_NEXT ;
+                return ;
+            }
+            index += 4 ;
+        }
+        else if (for_depth == 0) {
+            *err = BASIC_ERR_UNMATCHED_NEXT ;
             return ;
         }
 
-        //
-        // Evaluate the end of for loop condition
-        //
-        basic_value_t *endval = basic_expr_eval(for_stack->endidx_, 0, NULL, NULL, err) ;
-        if (endval == NULL)
-            return ;
+        for_stack_entry_t *top = &for_stack[for_depth - 1] ;
+        bool done ;
 
-        if (endval->type_ != BASIC_VALUE_TYPE_NUMBER) {
-            basic_value_destroy(endval);
-            *err = BASIC_ERR_TYPE_MISMATCH ;
-            return ;
-        }        
+        if (top->integer_) {
+            //
+            // Stepping past the largest integer is an overflow rather than
+            // wrapping around to start the loop again
+            //
+            int32_t *counter = basic_var_get_int(top->varidx_) ;
+            if (counter == NULL) {
+                *err = BASIC_ERR_NO_SUCH_VARIABLE ;
+                return ;
+            }
 
-        //
-        // Evaluate the step value as it is needed in the determination of the end of loop
-        // condition
-        //
-        if (for_stack->stepidx_ != 0xffffffff) {
-            basic_value_t *stepval = basic_expr_eval(for_stack->stepidx_, 0, NULL, NULL, err) ;
-            if (stepval == NULL)
+            int64_t next = (int64_t)*counter + top->istep_ ;
+            if (next < INT32_MIN || next > INT32_MAX) {
+                *err = BASIC_ERR_OVERFLOW ;
                 return ;
+            }
 
-            if (stepval->type_ != BASIC_VALUE_TYPE_NUMBER) {
+            *counter = (int32_t)next ;
+            done = (top->istep_ < 0 && *counter < top->ilimit_) || (top->istep_ > 0 && *counter > top->ilimit_) ;
+        }
+        else {
+            //
+            // Get the current loop variable value.  This points at the variable's
+            // own storage so the counter can be updated in place.
+            //
+            basic_value_t *loopval = basic_var_get_value(top->varidx_) ;
+            if (loopval == NULL || loopval->type_ != BASIC_VALUE_TYPE_NUMBER) {
                 *err = BASIC_ERR_TYPE_MISMATCH ;
                 return ;
             }
 
-            step = stepval->value.nvalue_ ;
-            basic_value_destroy(stepval);
-        }    
+            basic_num_t step = top->step_ ;
+            loopval->value.nvalue_ += step ;
+
+            done = (step < 0 && loopval->value.nvalue_ < top->limit_) || (step > 0 && loopval->value.nvalue_ > top->limit_) ;
+        }
 
-        if ((step < 0.0 && loopval->value.nvalue_ + step < endval->value.nvalue_) ||
-            (step > 0.0 && loopval->value.nvalue_ + step > endval->value.nvalue_)) {
+        if (done) {
             //
-            // The loop is done, remove the top entry from the for stack
+            // The loop is done, remove the top entry from the for stack.  As in
+            // classic BASIC the loop variable is left one step past the limit.
             //
-            basic_var_destroy(for_stack->varidx_) ;
-            for_stack_entry_t *todel = for_stack ;
-            for_stack = for_stack->next_ ;
-            free(todel) ;
+            for_depth-- ;
             count-- ;
-            basic_value_destroy(endval);
         }
         else {
             //
-            // The loop is still running, update the loop variable and go back to the statement before the
-            // for statement
+            // The loop is still running, go back to the statement after the for statement
             //
-            if (!basic_var_set_value_number(for_stack->varidx_, loopval->value.nvalue_ + step, err)) {
-                basic_value_destroy(endval);
-                return;
-            }
-
-            nextline->line_ = for_stack->context_.line_ ;
-            nextline->child_ = for_stack->context_.child_ ;
+            *nextpc = top->pc_ ;
 
             //
             // We break out of the loop as this for loop level is not done
             //
-            basic_value_destroy(endval);
             break ;
         }
     }
 }
 
-void basic_goto(basic_line_t *line, exec_context_t *nextline, basic_err_t *err, basic_out_fn_t outfn)
+void basic_goto(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
 {
-    basic_line_t *nline = find_line_by_number(getU32(line, 1)) ;
-    if (nline == NULL) {
-        *err = BASIC_ERR_INVALID_LINE_NUMBER ;
-        return ;
+    uint32_t target = stmt->target_ ;
+    if (target == BASIC_PC_NONE) {
+        target = find_stmt_by_line(getU32(stmt->line_, 1), err) ;
+        if (target == BASIC_PC_NONE)
+            return ;
     }
-    nextline->line_ = nline ;
-    nextline->child_ = NULL ;
+
+    *nextpc = target ;
     *err = BASIC_ERR_NONE ;
     return ;
 }
 
-void basic_gosub(basic_line_t *line, exec_context_t *current, exec_context_t *nextline, basic_err_t *err, basic_out_fn_t outfn)
+void basic_gosub(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
 {
-    basic_line_t *nline = find_line_by_number(getU32(line, 1)) ;
-    if (nline == NULL) {
-        *err = BASIC_ERR_INVALID_LINE_NUMBER ;
-        return ;
+    uint32_t target = stmt->target_ ;
+    if (target == BASIC_PC_NONE) {
+        target = find_stmt_by_line(getU32(stmt->line_, 1), err) ;
+        if (target == BASIC_PC_NONE)
+            return ;
     }
 
-    gosub_stack_entry_t *entry = (gosub_stack_entry_t *)malloc(sizeof(gosub_stack_entry_t)) ;
-    if (entry == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+    if (!gosub_push(pc + 1, err))
         return ;
-    }
 
-    entry->context_.line_ = current->line_ ;
-    entry->context_.child_ = current->child_ ;
-    forwardOneStmt(&entry->context_);
-
-    entry->next_ = gosub_stack ;
-    gosub_stack = entry ;
-
-
-    nextline->line_ = nline ;    
-    nextline->child_ = NULL ;
+    *nextpc = target ;
     *err = BASIC_ERR_NONE ;
     return ;
 }
 
-void basic_return(basic_line_t *line, exec_context_t *nextline, basic_err_t *err, basic_out_fn_t outfn)
+void basic_return(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
 {
-    if (gosub_stack == NULL) {
+    if (gosub_depth == 0) {
         *err = BASIC_ERR_NO_GOSUB ;
         return ;
     }
 
-    nextline->line_ = gosub_stack->context_.line_ ;
-    nextline->child_ = gosub_stack->context_.child_ ;
-
-    gosub_stack_entry_t *todel = gosub_stack ;
-    gosub_stack = gosub_stack->next_ ;
-    free(todel) ;
+    *nextpc = gosub_stack[--gosub_depth].pc_ ;
     return ;
 }
 
 void basic_led(basic_line_t *line, basic_err_t *err)
 {
     uint32_t expridx = getU32(line, 1) ;
-    basic_value_t *value = basic_expr_eval(expridx, 0, NULL, NULL, err) ;
-    if (value == NULL)
+    basic_num_t value ;
+    if (!basic_expr_eval_number(expridx, &value, err))
         return ;
 
-    if (value->type_ != BASIC_VALUE_TYPE_NUMBER) {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return ;
-    }
-
-    if ((int)value->value.nvalue_ == 0) 
+#ifndef DESKTOP
+    if (basic_num_to_int(value) == 0) 
     {
         cyhal_gpio_write(CYBSP_USER_LED, CYBSP_LED_STATE_OFF);
     }
@@ -2112,279 +2739,621 @@ void basic_led(basic_line_t *line, basic_err_t *err)
     {
         cyhal_gpio_write(CYBSP_USER_LED, CYBSP_LED_STATE_ON);
     }
+#endif
 }
 
 void basic_sleep(basic_line_t *line, basic_err_t *err)
 {
     uint32_t expridx = getU32(line, 1) ;
-    basic_value_t *value = basic_expr_eval(expridx, 0, NULL, NULL, err) ;
-    if (value == NULL)
+    basic_num_t value ;
+    if (!basic_expr_eval_number(expridx, &value, err))
         return ;
 
-    if (value->type_ != BASIC_VALUE_TYPE_NUMBER) {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return ;
+#ifndef DESKTOP
+    vTaskDelay(basic_num_to_int(value) / portTICK_PERIOD_MS) ;
+#endif
+}
+
+//
+// The statements that only need their tokens, wrapped in the signature shared
+// by every statement handler
+//
+#define BASIC_STMT_HANDLER(name, fn)                                                \
+    static void name(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn) \
+    {                                                                               \
+        fn(stmt->line_, err, outfn) ;                                               \
+    }
+
+BASIC_STMT_HANDLER(exec_cls, basic_cls)
+BASIC_STMT_HANDLER(exec_run, basic_run)
+BASIC_STMT_HANDLER(exec_list, basic_list)
+BASIC_STMT_HANDLER(exec_clear, basic_clear)
+BASIC_STMT_HANDLER(exec_flist, basic_flist)
+BASIC_STMT_HANDLER(exec_del, basic_del)
+BASIC_STMT_HANDLER(exec_rename, basic_rename)
+BASIC_STMT_HANDLER(exec_let_array, basic_let_array)
+BASIC_STMT_HANDLER(exec_dim, basic_dim)
+BASIC_STMT_HANDLER(exec_rem, basic_rem)
+BASIC_STMT_HANDLER(exec_print, basic_print)
+BASIC_STMT_HANDLER(exec_read, basic_read)
+BASIC_STMT_HANDLER(exec_vars, basic_vars)
+BASIC_STMT_HANDLER(exec_base, basic_base)
+BASIC_STMT_HANDLER(exec_mem, basic_mem)
+BASIC_STMT_HANDLER(exec_input, basic_input)
+BASIC_STMT_HANDLER(exec_then, basic_then)
+BASIC_STMT_HANDLER(exec_save, basic_save)
+BASIC_STMT_HANDLER(exec_load, basic_load)
+BASIC_STMT_HANDLER(exec_renum, basic_renum)
+BASIC_STMT_HANDLER(exec_mat, basic_mat)
+
+static void exec_nop(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+}
+
+static void exec_restore(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    basic_restore() ;
+}
+
+static void exec_led(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    basic_led(stmt->line_, err) ;
+}
+
+static void exec_sleep(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    basic_sleep(stmt->line_, err) ;
+}
+
+static void exec_end(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    end_program = BTOKEN_END ;
+}
+
+static void exec_stop(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    end_program = BTOKEN_STOP ;
+}
+
+static void exec_tron(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    trace = true ;
+}
+
+static void exec_troff(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    trace = false ;
+}
+
+static void exec_unknown(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    *err = BASIC_ERR_UNKNOWN_KEYWORD ;
+}
+
+//
+// The handler for each statement token.  Tokens without a handler are not
+// statements and fail with BASIC_ERR_UNKNOWN_KEYWORD.
+//
+static const basic_stmt_fn_t stmt_handlers[] =
+{
+    [BTOKEN_CLS]        = exec_cls,
+    [BTOKEN_RUN]        = exec_run,
+    [BTOKEN_LIST]       = exec_list,
+    [BTOKEN_CLEAR]      = exec_clear,
+    [BTOKEN_FLIST]      = exec_flist,
+    [BTOKEN_DEL]        = exec_del,
+    [BTOKEN_RENAME]     = exec_rename,
+    [BTOKEN_LET_SIMPLE] = basic_let_simple,
+    [BTOKEN_LET_ARRAY]  = exec_let_array,
+    [BTOKEN_DIM]        = exec_dim,
+    [BTOKEN_REM]        = exec_rem,
+    [BTOKEN_PRINT]      = exec_print,
+    [BTOKEN_DATA]       = exec_nop,
+    [BTOKEN_READ]       = exec_read,
+    [BTOKEN_RESTORE]    = exec_restore,
+    [BTOKEN_VARS]       = exec_vars,
+    [BTOKEN_BASE]       = exec_base,
+    [BTOKEN_MEM]        = exec_mem,
+    [BTOKEN_INPUT]      = exec_input,
+    [BTOKEN_THEN]       = exec_then,
+    [BTOKEN_FOR]        = basic_for,
+    [BTOKEN_GOTO]       = basic_goto,
+    [BTOKEN_LED]        = exec_led,
+    [BTOKEN_SLEEP]      = exec_sleep,
+    [BTOKEN_GOSUB]      = basic_gosub,
+    [BTOKEN_RETURN]     = basic_return,
+    [BTOKEN_NEXT]       = basic_next,
+    [BTOKEN_IF]         = basic_if,
+    [BTOKEN_SAVE]       = exec_save,
+    [BTOKEN_LOAD]       = exec_load,
+    [BTOKEN_RENUM]      = exec_renum,
+    [BTOKEN_ON]         = basic_on,
+    [BTOKEN_END]        = exec_end,
+    [BTOKEN_TRON]       = exec_tron,
+    [BTOKEN_TROFF]      = exec_troff,
+    [BTOKEN_STOP]       = exec_stop,
+    [BTOKEN_DEF]        = exec_nop,
+    [BTOKEN_MAT]        = exec_mat,
+} ;
+
+//
+// Entries in the threaded dispatch table.  The statements that run most often
+// have their own entry so their handlers can be inlined into the dispatch loop.
+// Everything else calls the handler stored with the statement.
+//
+typedef enum exec_op {
+    EXEC_OP_CALL,
+    EXEC_OP_NOP,
+    EXEC_OP_LET_SIMPLE,
+    EXEC_OP_LET_APPEND,
+    EXEC_OP_LET_INT,
+    EXEC_OP_IF,
+    EXEC_OP_FOR,
+    EXEC_OP_NEXT,
+    EXEC_OP_GOTO,
+    EXEC_OP_GOSUB,
+    EXEC_OP_RETURN,
+} exec_op_t ;
+
+static const uint8_t stmt_ops[] =
+{
+    [BTOKEN_LET_SIMPLE]     = EXEC_OP_LET_SIMPLE,
+    [BTOKEN_IF]             = EXEC_OP_IF,
+    [BTOKEN_THEN]           = EXEC_OP_NOP,
+    [BTOKEN_FOR]            = EXEC_OP_FOR,
+    [BTOKEN_NEXT]           = EXEC_OP_NEXT,
+    [BTOKEN_GOTO]           = EXEC_OP_GOTO,
+    [BTOKEN_GOSUB]          = EXEC_OP_GOSUB,
+    [BTOKEN_RETURN]         = EXEC_OP_RETURN,
+    [BTOKEN_REM]            = EXEC_OP_NOP,
+    [BTOKEN_DATA]           = EXEC_OP_NOP,
+} ;
+
+//
+// Decode a statement as it is linked: pick its handler and dispatch entry, and
+// pull the operands of the most common statements out of the token stream.
+//
+static void decode_stmt(basic_stmt_t *stmt)
+{
+    basic_line_t *line = stmt->line_ ;
+    uint8_t token = line->tokens_[0] ;
+
+    stmt->fn_ = NULL ;
+    stmt->op_ = EXEC_OP_CALL ;
+    stmt->arg1_ = 0 ;
+    stmt->arg2_ = 0 ;
+
+    if (token < sizeof(stmt_handlers) / sizeof(stmt_handlers[0]))
+        stmt->fn_ = stmt_handlers[token] ;
+
+    if (stmt->fn_ == NULL)
+        stmt->fn_ = exec_unknown ;
+
+    if (token < sizeof(stmt_ops) / sizeof(stmt_ops[0]))
+        stmt->op_ = stmt_ops[token] ;
+
+    switch(token) {
+        case BTOKEN_LET_SIMPLE:
+            stmt->arg1_ = getU32(line, 1) ;
+            stmt->arg2_ = getU32(line, 5) ;
+            if (basic_expr_is_append(stmt->arg2_)) {
+                stmt->fn_ = basic_let_append ;
+                stmt->op_ = EXEC_OP_LET_APPEND ;
+            }
+            else if (basic_var_is_integer(stmt->arg1_)) {
+                stmt->fn_ = basic_let_int ;
+                stmt->op_ = EXEC_OP_LET_INT ;
+            }
+            break ;
+
+        case BTOKEN_IF:
+            stmt->arg1_ = getU32(line, 1) ;
+            break ;
     }
-    vTaskDelay(((int)value->value.nvalue_) / portTICK_PERIOD_MS) ;
 }
 
-static int stmtNumber(basic_line_t *parent, basic_line_t *child)
+static char trbuf[64] ;
+static void trace_stmt(basic_stmt_t *stmt, basic_out_fn_t outfn)
 {
-    int cnt = 0 ;
+    if (stmt->lineno_ == -1)
+        return ;
 
-    if (parent == child) 
+    if (stmt->stmtno_ == 0) 
     {
-        cnt = 0 ;
+        sprintf(trbuf, "[%ld]", (long)stmt->lineno_);
     }
-    else 
+    else
     {
-        cnt = 1 ;
-        basic_line_t *line = parent->children_ ;
-        while (line && line != child) {
-            cnt++ ;
-            line = line->next_ ;
-        }
-
-        if (line == NULL)
-            cnt = -1 ;
+        sprintf(trbuf, "[%ld:%d]", (long)stmt->lineno_, stmt->stmtno_) ;
     }
 
-    return cnt ;
+    (outfn)(trbuf, strlen(trbuf)) ;
 }
 
-static char trbuf[64] ;
-static void exec_one_statement(basic_line_t *line, exec_context_t *current, exec_context_t *nextline, basic_err_t *err, basic_out_fn_t outfn)
+//
+// Called after a statement that failed or ended the program, and every
+// BASIC_BREAK_POLL_INTERVAL statements to look for a break from the user.
+// Returns true if execution should stop.
+//
+static bool exec_check(basic_err_t code, uint32_t pc, basic_out_fn_t outfn)
 {
-    if (trace && current->line_->lineno_ != -1) {
-        int stmt = stmtNumber(current->line_, line) ;
-        if (stmt == 0) 
+    static char tbuf[256];
+
+    //
+    // The statement may have caused the program to be linked again or freed,
+    // so look it up again rather than keeping a pointer across the call
+    //
+    basic_stmt_t *stmt = stmt_at(pc) ;
+    uint32_t lineno = (stmt != NULL) ? stmt->lineno_ : -1 ;
+    uint8_t token = (stmt != NULL) ? stmt->line_->tokens_[0] : BTOKEN_RUN ;
+
+    // Error executing the last line
+    if (code != BASIC_ERR_NONE) {
+        if (lineno != -1) 
         {
-            sprintf(trbuf, "[%ld]", current->line_->lineno_);
+            sprintf(tbuf, "Program failed: line %ld: error code %d: %s\n", (long)lineno, code, basic_err_to_string(code)) ;
         }
-        else
+        else if (token != BTOKEN_LOAD && token != BTOKEN_RUN)
+        {
+            sprintf(tbuf, "Command failed: error code %d: %s\n", code, basic_err_to_string(code)) ;
+        }
+        else 
         {
-            sprintf(trbuf, "[%ld:%d]", current->line_->lineno_, stmt) ;
+            strcpy(tbuf, "") ;
         }
+        (*outfn)(tbuf, strlen(tbuf)) ;
+        return true ;
+    }
 
-        (outfn)(trbuf, strlen(trbuf)) ;
+    if (end_program != BTOKEN_RUN || basic_break_pending) {
+        if (end_program == BTOKEN_BREAK || basic_break_pending) {
+            basic_clear_break() ;
+            sprintf(tbuf, "Program break by user, line %ld\n", (long)lineno);
+            (*outfn)(tbuf, strlen(tbuf)) ;
+        }
+        return true ;
     }
 
-    switch(line->tokens_[0]) {
+    return false ;
+}
+
+#if defined(__GNUC__) && !defined(BASIC_EXEC_CALL_DISPATCH) && !defined(BASIC_EXEC_SWITCH_DISPATCH)
+
+//
+// Threaded dispatch.  Each statement ends by fetching the next one and jumping
+// straight to the code for it, so every entry in the table has its own indirect
+// branch for the processor to predict.  If a statement wants to redirect control
+// flow, it must return the index of the next statement in nextpc.
+//
+static basic_err_t exec_stmts(uint32_t pc, basic_out_fn_t outfn)
+{
+    static void *const dispatch[] = 
+    {
+        [EXEC_OP_CALL]          = &&op_call,
+        [EXEC_OP_NOP]           = &&op_nop,
+        [EXEC_OP_LET_SIMPLE]    = &&op_let_simple,
+        [EXEC_OP_LET_APPEND]    = &&op_let_append,
+        [EXEC_OP_LET_INT]       = &&op_let_int,
+        [EXEC_OP_IF]            = &&op_if,
+        [EXEC_OP_FOR]           = &&op_for,
+        [EXEC_OP_NEXT]          = &&op_next,
+        [EXEC_OP_GOTO]          = &&op_goto,
+        [EXEC_OP_GOSUB]         = &&op_gosub,
+        [EXEC_OP_RETURN]        = &&op_return,
+    } ;
+    basic_err_t code = BASIC_ERR_NONE ;
+    uint32_t poll = BASIC_BREAK_POLL_INTERVAL ;
+    uint64_t count = 0 ;
+    uint32_t nextpc ;
+    basic_stmt_t *stmt ;
+
+#define EXEC_DISPATCH()                                                         \
+    if ((stmt = stmt_at(pc)) == NULL)                                           \
+        goto done ;                                                             \
+    if (trace)                                                                  \
+        trace_stmt(stmt, outfn) ;                                               \
+    count++ ;                                                                   \
+    nextpc = BASIC_PC_NONE ;                                                    \
+    goto *dispatch[stmt->op_]
+
+#define EXEC_NEXT()                                                             \
+    if (code != BASIC_ERR_NONE || end_program != BTOKEN_RUN || --poll == 0)     \
+        goto check ;                                                            \
+    pc = (nextpc != BASIC_PC_NONE) ? nextpc : pc + 1 ;                          \
+    EXEC_DISPATCH()
+
+    EXEC_DISPATCH() ;
+
+op_call:
+    (*stmt->fn_)(stmt, pc, &nextpc, &code, outfn) ;
+    EXEC_NEXT() ;
+
+op_nop:
+    EXEC_NEXT() ;
+
+op_let_simple:
+    basic_let_simple(stmt, pc, &nextpc, &code, outfn) ;
+    EXEC_NEXT() ;
+
+op_let_append:
+    basic_let_append(stmt, pc, &nextpc, &code, outfn) ;
+    EXEC_NEXT() ;
+
+op_let_int:
+    basic_let_int(stmt, pc, &nextpc, &code, outfn) ;
+    EXEC_NEXT() ;
+
+op_if:
+    basic_if(stmt, pc, &nextpc, &code, outfn) ;
+    EXEC_NEXT() ;
+
+op_for:
+    basic_for(stmt, pc, &nextpc, &code, outfn) ;
+    EXEC_NEXT() ;
+
+op_next:
+    basic_next(stmt, pc, &nextpc, &code, outfn) ;
+    EXEC_NEXT() ;
+
+op_goto:
+    basic_goto(stmt, pc, &nextpc, &code, outfn) ;
+    EXEC_NEXT() ;
+
+op_gosub:
+    basic_gosub(stmt, pc, &nextpc, &code, outfn) ;
+    EXEC_NEXT() ;
+
+op_return:
+    basic_return(stmt, pc, &nextpc, &code, outfn) ;
+    EXEC_NEXT() ;
+
+check:
+    if (exec_check(code, pc, outfn))
+        goto done ;
+
+    poll = BASIC_BREAK_POLL_INTERVAL ;
+    pc = (nextpc != BASIC_PC_NONE) ? nextpc : pc + 1 ;
+    EXEC_DISPATCH() ;
+
+done:
+    basic_stmt_count += count ;
+    return code ;
+
+#undef EXEC_DISPATCH
+#undef EXEC_NEXT
+}
+
+#else
+
+#ifdef BASIC_EXEC_SWITCH_DISPATCH
+static void exec_one_statement(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn)
+{
+    switch(stmt->line_->tokens_[0]) {
         case BTOKEN_CLS:
-            basic_cls(line, err, outfn) ;
+            exec_cls(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_RUN:
-            basic_run(line, err, outfn) ;
+            exec_run(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_LIST:
-            basic_list(line, err, outfn) ;
+            exec_list(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_CLEAR:
-            basic_clear(line, err, outfn) ;
+            exec_clear(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_FLIST:
-            basic_flist(line, err, outfn) ;
+            exec_flist(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_DEL:
-            basic_del(line, err,outfn) ;
+            exec_del(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_RENAME:
-            basic_rename(line, err,outfn) ;
-            break ;            
+            exec_rename(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         case BTOKEN_LET_SIMPLE:
-            basic_let_simple(line, err, outfn) ;
+            if (stmt->fn_ == basic_let_append)
+                basic_let_append(stmt, pc, nextpc, err, outfn) ;
+            else if (stmt->fn_ == basic_let_int)
+                basic_let_int(stmt, pc, nextpc, err, outfn) ;
+            else
+                basic_let_simple(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_LET_ARRAY:
-            basic_let_array(line, err, outfn);
-            break;
-
-        case BTOKEN_LET:
-            assert(false);
-            break;
+            exec_let_array(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         case BTOKEN_DIM:
-            basic_dim(line, err, outfn);
-            break;
+            exec_dim(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         case BTOKEN_REM:
-            basic_rem(line, err, outfn) ;
+            exec_rem(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_PRINT:
-            basic_print(line, err, outfn) ;
-            break;
+            exec_print(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         case BTOKEN_DATA:
+            exec_nop(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_READ:
-            basic_read(line, err, outfn) ;
+            exec_read(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_RESTORE:
-            basic_restore() ;
-            break ;            
+            exec_restore(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         case BTOKEN_VARS:
-            basic_vars(line, err, outfn) ;
+            exec_vars(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_BASE:
-            basic_base(line, err, outfn) ;
+            exec_base(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_MEM:
-            basic_mem(line, err, outfn) ;
+            exec_mem(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_INPUT:
-            basic_input(line, err, outfn) ;
+            exec_input(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_THEN:
-            basic_then(line, nextline, err, outfn) ;
+            exec_then(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_FOR:
-            basic_for(line, current, nextline, err, outfn) ;
+            basic_for(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_GOTO:
-            basic_goto(line, nextline, err, outfn) ;
+            basic_goto(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_LED:
-            basic_led(line, err) ;
+            exec_led(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_SLEEP:
-            basic_sleep(line, err) ;
+            exec_sleep(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_GOSUB:
-            basic_gosub(line, current, nextline, err, outfn) ;
-            break ;            
+            basic_gosub(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         case BTOKEN_RETURN:
-            basic_return(line, nextline, err, outfn) ;
+            basic_return(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_NEXT:
-            basic_next(line, current, nextline, err, outfn) ;
+            basic_next(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_IF:
-            basic_if(line, current, nextline, err, outfn);
+            basic_if(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_SAVE:
-            basic_save(line, err, outfn) ;
+            exec_save(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_LOAD:
-            basic_load(line, err, outfn) ;
-            break ;  
+            exec_load(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         case BTOKEN_RENUM:
-            basic_renum(line, err, outfn) ;
-            break ;   
+            exec_renum(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         case BTOKEN_ON:
-            basic_on(line, current, nextline, err, outfn) ;
+            basic_on(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_END:
-            end_program = BTOKEN_END ;
-            break; 
+            exec_end(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         case BTOKEN_TRON:
-            trace = true ;
+            exec_tron(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_TROFF:
-            trace = false ;
+            exec_troff(stmt, pc, nextpc, err, outfn) ;
             break ;
 
         case BTOKEN_STOP:
-            end_program = BTOKEN_STOP ;
-            break ;            
+            exec_stop(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         case BTOKEN_DEF:
-            *err = BASIC_ERR_NONE ;
-            break ;   
+            exec_nop(stmt, pc, nextpc, err, outfn) ;
+            break ;
+
+        case BTOKEN_MAT:
+            exec_mat(stmt, pc, nextpc, err, outfn) ;
+            break ;
 
         default:
             *err = BASIC_ERR_UNKNOWN_KEYWORD ;
             break ;
     }
 }
+#endif
 
-int basic_exec_line(exec_context_t *context, basic_out_fn_t outfn)
+static basic_err_t exec_stmts(uint32_t pc, basic_out_fn_t outfn)
 {
-    exec_context_t nextone ;
     basic_err_t code = BASIC_ERR_NONE ;
-    basic_line_t *toexec ;
-    static char tbuf[256];
+    uint32_t poll = BASIC_BREAK_POLL_INTERVAL ;
+    uint64_t count = 0 ;
+    basic_stmt_t *stmt ;
 
-    while (context->line_ != NULL) {
-        nextone.line_ = NULL ;
-        nextone.child_ = NULL ;
-        nextone.lastline_ = false ;
+    while ((stmt = stmt_at(pc)) != NULL) {
+        uint32_t nextpc = BASIC_PC_NONE ;
 
-        if (context->child_ != NULL)
-            toexec = context->child_ ;
-        else
-            toexec = context->line_ ;
+        if (trace)
+            trace_stmt(stmt, outfn) ;
+
+        count++ ;
 
         //
         // Execute one statement exactly.  If the statement wants to redirect
-        // control flow, it must return a value in the nextone context.
+        // control flow, it must return the index of the next statement in nextpc.
         //
-        exec_one_statement(toexec, context, &nextone, &code, outfn) ;
+#ifdef BASIC_EXEC_SWITCH_DISPATCH
+        exec_one_statement(stmt, pc, &nextpc, &code, outfn) ;
+#else
+        (*stmt->fn_)(stmt, pc, &nextpc, &code, outfn) ;
+#endif
 
-        // Error executing the last line
-        if (code != BASIC_ERR_NONE) {
-            if (context->line_->lineno_ != -1) 
-            {
-                sprintf(tbuf, "Program failed: line %ld: error code %d: %s\n", context->line_->lineno_, code, basic_err_to_string(code)) ;
-            }
-            else if (toexec->tokens_[0] != BTOKEN_LOAD && toexec->tokens_[0] != BTOKEN_RUN)
-            {
-                sprintf(tbuf, "Command failed: error code %d: %s\n", code, basic_err_to_string(code)) ;
-            }
-            else 
-            {
-                strcpy(tbuf, "") ;
-            }
-            (*outfn)(tbuf, strlen(tbuf)) ;
-            break ;
-        }
+        if (code != BASIC_ERR_NONE || end_program != BTOKEN_RUN || --poll == 0) {
+            if (exec_check(code, pc, outfn))
+                break ;
 
-        if (end_program != BTOKEN_RUN || nextone.lastline_ == true || basic_is_break()) {
-            if (end_program == BTOKEN_BREAK || basic_is_break()) {
-                basic_clear_break() ;
-                sprintf(tbuf, "Program break by user, line %ld\n", context->line_->lineno_);
-                (*outfn)(tbuf, strlen(tbuf)) ;
-            }
-            return BASIC_ERR_NONE ;
+            poll = BASIC_BREAK_POLL_INTERVAL ;
         }
 
-        if (nextone.line_ != NULL) 
-        {
-            *context = nextone ;
-        }
-        else {
-            forwardOneStmt(context) ;
-        }
+        pc = (nextpc != BASIC_PC_NONE) ? nextpc : pc + 1 ;
+    }
+
+    basic_stmt_count += count ;
+    return code ;
+}
+
+#endif
+
+//
+// Execute a line typed in immediate mode.  Its statements are placed after those
+// of any immediate line already running, as loading a file can execute lines
+// without line numbers while the LOAD statement itself is still running.
+//
+int basic_exec_line(basic_line_t *line, basic_out_fn_t outfn)
+{
+    uint32_t base = imm_count ;
+    basic_err_t code ;
+
+    if (!stmt_array_grow(&imm_stmts, &imm_size, base + count_stmts(line))) {
+        static char ebuf[64] ;
+        sprintf(ebuf, "Command failed: error code %d: %s\n", BASIC_ERR_OUT_OF_MEMORY, basic_err_to_string(BASIC_ERR_OUT_OF_MEMORY)) ;
+        (*outfn)(ebuf, strlen(ebuf)) ;
+        return BASIC_ERR_OUT_OF_MEMORY ;
     }
 
+    imm_count = link_line(line, imm_stmts, base, BASIC_PC_IMMEDIATE) ;
+    code = exec_stmts(BASIC_PC_IMMEDIATE | base, outfn) ;
+    imm_count = base ;
+
     return code ;
 }
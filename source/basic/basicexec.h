@@ -5,7 +5,36 @@
 #include "basicproc.h"
 #include <memory.h>
 
-int basic_exec_line(exec_context_t *ctx, basic_out_fn_t outfn) ;
+//
+// One statement of the linked program.  The statements of every line are laid out
+// in execution order in a single array, and control flow is expressed as an index
+// into that array.  Indexes with BASIC_PC_IMMEDIATE set refer to the statements of
+// a line typed in immediate mode, which are kept apart from the stored program.
+//
+#define BASIC_PC_IMMEDIATE          (0x80000000)
+#define BASIC_PC_NONE               (0xffffffff)
+
+typedef struct basic_stmt basic_stmt_t ;
+
+typedef void (*basic_stmt_fn_t)(basic_stmt_t *stmt, uint32_t pc, uint32_t *nextpc, basic_err_t *err, basic_out_fn_t outfn) ;
+
+struct basic_stmt
+{
+    basic_line_t *line_ ;               // The tokens for the statement
+    basic_stmt_fn_t fn_ ;               // The handler that executes the statement
+    uint8_t op_ ;                       // The threaded dispatch entry for the statement
+    uint32_t lineno_ ;                  // The number of the line holding the statement
+    uint32_t stmtno_ ;                  // The position of the statement in its line, zero for the first
+    uint32_t nextline_ ;                // The index of the first statement of the following line
+    uint32_t target_ ;                  // The resolved target of a GOTO or GOSUB, or BASIC_PC_NONE
+    uint32_t arg1_ ;                    // Operands decoded from the tokens when the statement is linked
+    uint32_t arg2_ ;
+} ;
+
+// The number of statements executed, for benchmarking the dispatch
+extern uint64_t basic_stmt_count ;
+
+int basic_exec_line(basic_line_t *line, basic_out_fn_t outfn) ;
 void basic_store_line(basic_line_t *line) ;
 
 void basic_cls(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn) ;
@@ -31,10 +60,10 @@ static inline void putU32(basic_line_t *line, int index, uint32_t value)
     line->tokens_[index++] = (value >> 24) & 0xff ;  
 }
 
-static inline double getDouble(basic_line_t *line, int index)
+static inline basic_num_t getNum(basic_line_t *line, int index)
 {
-    double value ;
+    basic_num_t value ;
 
-    memcpy(&value, &line->tokens_[index], sizeof(double)) ;
+    memcpy(&value, &line->tokens_[index], sizeof(basic_num_t)) ;
     return value ;
 }
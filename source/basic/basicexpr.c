@@ -1,4 +1,4 @@
-#ifdef DESKTOP
+#if defined(DESKTOP) && defined(_MSC_VER)
 #define _CRTDBG_MAP_ALLOC
 #include <stdlib.h>
 #include <crtdbg.h>
@@ -8,7 +8,11 @@
 #include "basicexprint.h"
 #include "basiccfg.h"
 #include "basicstr.h"
+#include "basicmem.h"
 #include "basicproc.h"
+#include "basichtab.h"
+#include "basictrie.h"
+#include "basicimg.h"
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
@@ -17,9 +21,13 @@
 #include <malloc.h>
 #include <math.h>
 
-#ifndef DESKTOP
+#ifndef _MSC_VER
 #define _stricmp strcasecmp
+#define _strnicmp strncasecmp
 #define _strdup strdup
+#endif
+
+#ifndef DESKTOP
 #include <cyhal.h>
 static bool crypto_inited = false ;
 static cyhal_trng_t trng_obj ;
@@ -28,70 +36,81 @@ static cyhal_trng_t trng_obj ;
 static int array_base = 0 ;
 
 static basic_expr_user_fn_t* get_user_fn_from_name(const char *name) ;
-static basic_value_t *eval_node(basic_operand_t *op, int cntv, char **names, basic_value_t **values, basic_err_t *err) ;
+static bool eval_node(basic_operand_t *op, int cntv, char **names, basic_value_t *values, basic_value_t *ret, basic_err_t *err) ;
 static const char* parse_operand_top(const char* line, int argcntg, char **argnames, basic_operand_t** ret, basic_err_t* err);
 static bool basic_operand_to_string(basic_operand_t* parent, basic_operand_t* oper, uint32_t str);
 static basic_operand_t *createOperator(operator_table_t *t) ;
-
-static uint32_t next_var_index = 1 ;
-static basic_var_t *vars = NULL ;
-
-static uint32_t next_expr_index = 1 ;
-static basic_expr_t *exprs = NULL ;
-
-static  uint32_t next_user_fn_index = 1;
-static basic_expr_user_fn_t* userfns = NULL;
+static bool is_numeric(basic_operand_t *op) ;
+
+//
+// Variables live in a dense table of slots indexed by the variable index.  Names
+// are bound to slots when a line is parsed, so finding a variable at run time is
+// an array lookup with no string compares.  A slot stays bound to its name until
+// the program is cleared.
+//
+static basic_var_t **vars = NULL ;
+static uint32_t var_count = 0 ;
+static uint32_t var_size = 0 ;
+
+//
+// Expressions and user functions are named by handles into these tables, so
+// finding one when it is evaluated is an array lookup
+//
+static basic_htab_t exprs = BASIC_HTAB_INIT(basic_expr_t) ;
+static basic_htab_t userfns = BASIC_HTAB_INIT(basic_expr_user_fn_t) ;
 
 operator_table_t operators[] = 
 {
-    { BASIC_OPERATOR_PLUS, "+" , 4, false},
-    { BASIC_OPERATOR_MINUS, "-", 4, false },
+    { BASIC_OPERATOR_PLUS, "+" , 6, false},
+    { BASIC_OPERATOR_MINUS, "-", 6, false },
     { BASIC_OPERATOR_TIMES, "*", 3, false },
     { BASIC_OPERATOR_DIVIDE, "/", 3, false },
+    { BASIC_OPERATOR_INT_DIVIDE, "\\", 4, false },
+    { BASIC_OPERATOR_MOD, "MOD", 5, false },
     { BASIC_OPERATOR_POWER, "^", 2, false },
-    { BASIC_OPERATOR_NOT_EQUAL, "<>", 5, false},
-    { BASIC_OPERATOR_EQUAL, "=", 5 , false},
-    { BASIC_OPERATOR_GREATER_EQ, ">=", 5 , false},
-    { BASIC_OPERATOR_GREATER, ">", 5 , false},
-    { BASIC_OPERATOR_LESS_EQ, "<=", 5 , false},
-    { BASIC_OPERATOR_LESS, "<", 5 , false},
-    { BASIC_OPERATOR_OR, "OR", 6 , false},
-    { BASIC_OPERATOR_AND, "AND", 6 , false},
+    { BASIC_OPERATOR_NOT_EQUAL, "<>", 7, false},
+    { BASIC_OPERATOR_EQUAL, "=", 7 , false},
+    { BASIC_OPERATOR_GREATER_EQ, ">=", 7 , false},
+    { BASIC_OPERATOR_GREATER, ">", 7 , false},
+    { BASIC_OPERATOR_LESS_EQ, "<=", 7 , false},
+    { BASIC_OPERATOR_LESS, "<", 7 , false},
+    { BASIC_OPERATOR_OR, "OR", 8 , false},
+    { BASIC_OPERATOR_AND, "AND", 8 , false},
     { BASIC_OPERATOR_UNARY_MINUS, "", -1 , true},
 } ;
 
-static basic_value_t* func_int(int count, basic_value_t** args, basic_err_t *err);
-static basic_value_t* func_rnd(int count, basic_value_t** args, basic_err_t *err);
-static basic_value_t *func_mem(int count, basic_value_t** args, basic_err_t *err) ;
-static basic_value_t *func_sqrt(int count, basic_value_t** args, basic_err_t *err) ;
-static basic_value_t *func_left(int count, basic_value_t**args, basic_err_t *err) ;
-static basic_value_t *func_right(int count, basic_value_t**args, basic_err_t *err) ;
-static basic_value_t *func_mid(int count, basic_value_t**args, basic_err_t *err) ;
-static basic_value_t *func_len(int count, basic_value_t**args, basic_err_t *err) ;
-static basic_value_t *func_str(int count, basic_value_t**args, basic_err_t *err) ;
-static basic_value_t *func_abs(int count, basic_value_t**args, basic_err_t *err) ;
-static basic_value_t *func_chr(int count, basic_value_t**args, basic_err_t *err) ;
-static basic_value_t *func_asc(int count, basic_value_t**args, basic_err_t *err) ;
-static basic_value_t *func_exp(int count, basic_value_t** args, basic_err_t *err) ;
-static basic_value_t *func_val(int count, basic_value_t** args, basic_err_t *err) ;
+static bool func_int(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_rnd(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_mem(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_sqrt(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_left(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_right(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_mid(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_len(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_str(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_abs(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_chr(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_asc(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_exp(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
+static bool func_val(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err) ;
 
 function_table_t functions[] =
 {
-    { 1, "INT", func_int },
-    { 1, "RND", func_rnd },
-    { 1, "MEM", func_mem },
-    { 1, "SQRT", func_sqrt},
-    { 1, "SQR", func_sqrt},
-    { 2, "LEFT$", func_left},
-    { 2, "RIGHT$", func_right},
-    { 3, "MID$", func_mid},
-    { 1, "LEN", func_len},
-    { 1, "STR$", func_str},
-    { 1, "ABS", func_abs},
-    { 1, "CHR$", func_chr},
-    { 1, "EXP", func_exp},
-    { 1, "VAL", func_val},
-    { 1, "ASC", func_asc},
+    { 1, "INT", func_int, true, BASIC_VALUE_TYPE_NUMBER, "N" },
+    { 1, "RND", func_rnd, false, BASIC_VALUE_TYPE_NUMBER, "N" },
+    { 1, "MEM", func_mem, false, BASIC_VALUE_TYPE_NUMBER, "N" },
+    { 1, "SQRT", func_sqrt, true, BASIC_VALUE_TYPE_NUMBER, "N" },
+    { 1, "SQR", func_sqrt, true, BASIC_VALUE_TYPE_NUMBER, "N" },
+    { 2, "LEFT$", func_left, true, BASIC_VALUE_TYPE_STRING, "SN" },
+    { 2, "RIGHT$", func_right, true, BASIC_VALUE_TYPE_STRING, "SN" },
+    { 3, "MID$", func_mid, true, BASIC_VALUE_TYPE_STRING, "SNN" },
+    { 1, "LEN", func_len, true, BASIC_VALUE_TYPE_NUMBER, "S" },
+    { 1, "STR$", func_str, true, BASIC_VALUE_TYPE_STRING, "N" },
+    { 1, "ABS", func_abs, true, BASIC_VALUE_TYPE_NUMBER, "N" },
+    { 1, "CHR$", func_chr, true, BASIC_VALUE_TYPE_STRING, "N" },
+    { 1, "EXP", func_exp, true, BASIC_VALUE_TYPE_NUMBER, "N" },
+    { 1, "VAL", func_val, true, BASIC_VALUE_TYPE_NUMBER, "S" },
+    { 1, "ASC", func_asc, true, BASIC_VALUE_TYPE_NUMBER, "S" },
 };
 
 int basic_array_get_base()
@@ -118,13 +137,13 @@ static operator_table_t *operator_by_type(operator_type_t type)
 static void dump_expr_stack(const char *title)
 {
     #ifdef DUMP_STACK
-    basic_expr_t *top = exprs ;
+    basic_expr_t *top ;
+    uint32_t iter = 0 ;
     int cnt = 1 ;
 
     printf("=============== %s ====================\n", title) ;
-    while (top) {
-        printf("%d: serial = %ld  expr = %08lx  top = %08lx\n", cnt++, top->serial_, (uint32_t)top, (uint32_t)top->top_) ;
-        top = top->next_ ;
+    while ((top = (basic_expr_t *)basic_htab_next(&exprs, &iter, NULL)) != NULL) {
+        printf("%d: index = %08lx  expr = %p  top = %p\n", cnt++, (unsigned long)top->index_, (void *)top, (void *)top->top_) ;
     }
     printf("====================================================================\n") ;    
     #endif
@@ -297,7 +316,7 @@ const char *basic_expr_parse_str(const char *line, uint32_t *value, basic_err_t
     return line ;
 }
 
-const char *basic_expr_parse_number(const char *line, double *value, basic_err_t *err)
+const char *basic_expr_parse_number(const char *line, basic_num_t *value, basic_err_t *err)
 {
     *err = BASIC_ERR_NONE ;
     static char parsebuffer[32];
@@ -384,7 +403,14 @@ const char *basic_expr_parse_number(const char *line, double *value, basic_err_t
     }    
 
     parsebuffer[index] = '\0' ;
-    *value = atof(parsebuffer) ;
+
+    double d = atof(parsebuffer) ;
+    if (!basic_num_holds_double(d)) {
+        *err = BASIC_ERR_OVERFLOW ;
+        return NULL ;
+    }
+
+    *value = basic_num_from_double(d) ;
     return line ;    
 }
 
@@ -434,54 +460,216 @@ const char *basic_expr_parse_int(const char *line, int *value, basic_err_t *err)
     return line ;
 }
 
+//
+// The storage for a string too long to hold in a value.  The characters are
+// always terminated.  A buffer is freed when the last reference to it goes away.
+//
+struct basic_strbuf
+{
+    uint32_t refs_ ;
+    uint32_t size_ ;
+    char data_[] ;
+} ;
+
+static basic_strbuf_t *strbuf_alloc(uint32_t size)
+{
+    basic_strbuf_t *buf = (basic_strbuf_t *)basic_malloc(sizeof(basic_strbuf_t) + size) ;
+    if (buf == NULL)
+        return NULL ;
+
+    buf->refs_ = 1 ;
+    buf->size_ = size ;
+    return buf ;
+}
+
+static inline void strbuf_release(basic_strbuf_t *buf)
+{
+    if (--buf->refs_ == 0)
+        basic_free(buf) ;
+}
+
+void basic_value_release(basic_value_t *value)
+{
+    if (value->type_ == BASIC_VALUE_TYPE_STRING && value->owned_) {
+        strbuf_release(value->value.svalue_.buf_) ;
+    }
+    value->type_ = BASIC_VALUE_TYPE_NUMBER ;
+    value->owned_ = false ;
+    value->inline_ = false ;
+    value->value.nvalue_ = 0.0 ;
+}
+
 void basic_value_destroy(basic_value_t *value)
 {
-    if (value->type_ == BASIC_VALUE_TYPE_STRING) {
-        free(value->value.svalue_);
+    basic_value_release(value) ;
+    basic_free(value) ;
+}
+
+static inline void set_number(basic_value_t *value, basic_num_t v)
+{
+    value->type_ = BASIC_VALUE_TYPE_NUMBER ;
+    value->owned_ = false ;
+    value->inline_ = false ;
+    value->value.nvalue_ = v ;
+}
+
+static inline void set_string_borrowed(basic_value_t *value, const char *v)
+{
+    value->type_ = BASIC_VALUE_TYPE_STRING ;
+    value->owned_ = false ;
+    value->inline_ = false ;
+    value->length_ = (uint32_t)strlen(v) ;
+    value->value.svalue_.chars_ = v ;
+    value->value.svalue_.buf_ = NULL ;
+}
+
+//
+// Make a value a string of len characters and return the space for the
+// characters, which the caller fills in.  The string is held in the value if it
+// is short enough.
+//
+static char *set_string_space(basic_value_t *value, uint32_t len, basic_err_t *err)
+{
+    char *chars ;
+
+    if (len < BASIC_STR_INLINE_SIZE) {
+        value->owned_ = false ;
+        value->inline_ = true ;
+        chars = value->value.ivalue_ ;
+    }
+    else {
+        basic_strbuf_t *buf = strbuf_alloc(len + 1) ;
+        if (buf == NULL) {
+            *err = BASIC_ERR_OUT_OF_MEMORY ;
+            return NULL ;
+        }
+
+        value->owned_ = true ;
+        value->inline_ = false ;
+        value->value.svalue_.chars_ = buf->data_ ;
+        value->value.svalue_.buf_ = buf ;
+        chars = buf->data_ ;
+    }
+
+    value->type_ = BASIC_VALUE_TYPE_STRING ;
+    value->length_ = len ;
+    chars[len] = '\0' ;
+    return chars ;
+}
+
+static bool set_string_copy(basic_value_t *value, const char *v, uint32_t len, basic_err_t *err)
+{
+    char *chars = set_string_space(value, len, err) ;
+    if (chars == NULL)
+        return false ;
+
+    memcpy(chars, v, len) ;
+    return true ;
+}
+
+//
+// Make a value len characters of the string str, starting at start.  A long
+// substring shares the buffer of str rather than copying it.
+//
+static bool set_substring(basic_value_t *value, const basic_value_t *str, uint32_t start, uint32_t len, basic_err_t *err)
+{
+    const char *chars = basic_value_chars(str) + start ;
+
+    if (len >= BASIC_STR_INLINE_SIZE && !str->inline_ && str->value.svalue_.buf_ != NULL) {
+        str->value.svalue_.buf_->refs_++ ;
+
+        value->type_ = BASIC_VALUE_TYPE_STRING ;
+        value->owned_ = true ;
+        value->inline_ = false ;
+        value->length_ = len ;
+        value->value.svalue_.chars_ = chars ;
+        value->value.svalue_.buf_ = str->value.svalue_.buf_ ;
+        return true ;
+    }
+
+    return set_string_copy(value, chars, len, err) ;
+}
+
+//
+// Make sure a string value holds its own storage.  A string in a buffer takes a
+// reference on the buffer, and a string borrowed from C code is copied.
+//
+bool basic_value_own(basic_value_t *value, basic_err_t *err)
+{
+    if (value->type_ != BASIC_VALUE_TYPE_STRING || value->inline_ || value->owned_)
+        return true ;
+
+    if (value->value.svalue_.buf_ != NULL) {
+        value->value.svalue_.buf_->refs_++ ;
+        value->owned_ = true ;
+        return true ;
     }
-    free(value) ;
+
+    const char *chars = value->value.svalue_.chars_ ;
+    return set_string_copy(value, chars, value->length_, err) ;
 }
 
-basic_value_t *basic_value_create_number(double v)
+basic_value_t *basic_value_create_number(basic_num_t v)
 {
-    basic_value_t *ret = (basic_value_t *)malloc(sizeof(basic_value_t)) ;
+    basic_value_t *ret = (basic_value_t *)basic_malloc(sizeof(basic_value_t)) ;
     if (ret == NULL)
         return NULL ;
 
-    ret->type_ = BASIC_VALUE_TYPE_NUMBER ;
-    ret->value.nvalue_ = v ;
+    set_number(ret, v) ;
     return ret;
 }
 
 basic_value_t *basic_value_create_string(const char *v)
 {
+    basic_err_t err ;
+
     if (v == NULL) {
         v = "" ;
     }
 
-    basic_value_t *ret = (basic_value_t *)malloc(sizeof(basic_value_t)) ;
+    basic_value_t *ret = (basic_value_t *)basic_malloc(sizeof(basic_value_t)) ;
     if (ret == NULL)
         return NULL ;
 
-    ret->type_ = BASIC_VALUE_TYPE_STRING ;
-    ret->value.svalue_ = (char *)malloc(strlen(v) + 1) ;
-    if (ret->value.svalue_ == NULL) {
-        free(ret) ;
+    if (!set_string_copy(ret, v, (uint32_t)strlen(v), &err)) {
+        basic_free(ret) ;
         return NULL ;
     }
-    strcpy(ret->value.svalue_, v) ;
+
     return ret;
 }
 
-static basic_value_t *create_string_value_keep(char *v)
+//
+// Move a by-value result into a new heap value.  The string is copied if it is
+// borrowed, or if it is part of a longer string, so that the caller can use it
+// as a C string.
+//
+static basic_value_t *create_value_from(basic_value_t *value, basic_err_t *err)
 {
-    basic_value_t *ret = (basic_value_t *)malloc(sizeof(basic_value_t)) ;
-    if (ret == NULL)
+    if (!basic_value_own(value, err))
         return NULL ;
 
-    ret->type_ = BASIC_VALUE_TYPE_STRING ;
-    ret->value.svalue_ = v ;
-    return ret;
+    if (value->type_ == BASIC_VALUE_TYPE_STRING && basic_value_chars(value)[value->length_] != '\0') {
+        basic_value_t copy ;
+
+        if (!set_string_copy(&copy, basic_value_chars(value), value->length_, err)) {
+            basic_value_release(value) ;
+            return NULL ;
+        }
+
+        basic_value_release(value) ;
+        *value = copy ;
+    }
+
+    basic_value_t *ret = (basic_value_t *)basic_malloc(sizeof(basic_value_t)) ;
+    if (ret == NULL) {
+        basic_value_release(value) ;
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return NULL ;
+    }
+
+    *ret = *value ;
+    return ret ;
 }
 
 const bool value_to_string(uint32_t str, basic_value_t *value)
@@ -492,7 +680,7 @@ const bool value_to_string(uint32_t str, basic_value_t *value)
         if (!basic_str_add_str(str, "\""))
             ret = false;
 
-        if (ret && !basic_str_add_str(str, value->value.svalue_))
+        if (ret && !basic_str_add_chars(str, basic_value_chars(value), value->length_))
             ret = false;
 
         if (!basic_str_add_str(str, "\""))
@@ -500,36 +688,28 @@ const bool value_to_string(uint32_t str, basic_value_t *value)
     }
     else 
     {
-        if ((value->value.nvalue_ - (int)value->value.nvalue_) < 1e-6) {
-            ret = basic_str_add_int(str, (int)value->value.nvalue_);
+        if (basic_num_is_int(value->value.nvalue_)) {
+            ret = basic_str_add_int(str, basic_num_to_int(value->value.nvalue_));
         }
         else {
-            ret = basic_str_add_double(str, value->value.nvalue_);
+            ret = basic_str_add_double(str, basic_num_to_double(value->value.nvalue_));
         }
     }
 
     return ret;
 }
 
-static basic_var_t* get_var_from_index(uint32_t index)
+static inline basic_var_t* get_var_from_index(uint32_t index)
 {
-    for (basic_var_t* var = vars; var != NULL; var = var->next_) {
-        if (var->index_ == index)
-            return var;
-    }
+    if (index >= var_count)
+        return NULL;
 
-    return NULL;
+    return vars[index];
 }
 
 int basic_var_count()
 {
-    int cnt = 0 ;
-
-    for(basic_var_t *var = vars ; var != NULL ; var = var->next_) {
-        cnt++ ;
-    }
-
-    return cnt ;
+    return (int)var_count ;
 }
 
 bool basic_var_is_array(uint32_t index)
@@ -540,81 +720,127 @@ bool basic_var_is_array(uint32_t index)
 
 bool basic_var_get_all(uint32_t *all)
 {
-    int index = 0 ;
-
-    for(basic_var_t *var = vars ; var != NULL ; var = var->next_) {
-        all[index++] = var->index_ ;
+    for(uint32_t index = 0 ; index < var_count ; index++) {
+        all[index] = index ;
     }
     return true ;
 }
 
+static bool is_string_name(const char *name)
+{
+    size_t len = strlen(name) ;
+    return len > 0 && name[len - 1] == '$' ;
+}
+
+static bool is_integer_name(const char *name)
+{
+    size_t len = strlen(name) ;
+    return len > 0 && name[len - 1] == '%' ;
+}
+
+//
+// Find the slot for a variable, creating it if this is the first reference to the
+// name.  This is called when lines are parsed, not when they are run.
+//
 bool basic_var_get(const char *name, uint32_t *index, basic_err_t *err)
 {    
-    for(basic_var_t *var = vars ; var != NULL ; var = var->next_) {
-        if (_stricmp(var->name_, name) == 0) {
-            *index = var->index_ ;
+    for(uint32_t i = 0 ; i < var_count ; i++) {
+        if (_stricmp(vars[i]->name_, name) == 0) {
+            *index = i ;
             return true ;
         }
     }
 
-    basic_var_t *newvar = (basic_var_t *)malloc(sizeof(basic_var_t)) ;
+    if (strlen(name) >= BASIC_MAX_VARIABLE_LENGTH) {
+        *err = BASIC_ERR_VARIABLE_TOO_LONG ;
+        return false ;
+    }
+
+    if (var_count == var_size) {
+        uint32_t size = var_size == 0 ? 16 : var_size * 2 ;
+        basic_var_t **table = (basic_var_t **)basic_realloc(vars, sizeof(basic_var_t *) * size) ;
+        if (table == NULL) {
+            *err = BASIC_ERR_OUT_OF_MEMORY ;
+            return false ;
+        }
+        vars = table ;
+        var_size = size ;
+    }
+
+    basic_var_t *newvar = (basic_var_t *)basic_malloc(sizeof(basic_var_t)) ;
     if (newvar == NULL) {
         *err = BASIC_ERR_OUT_OF_MEMORY ;
         return false ;
     }
 
+    memset(newvar, 0, sizeof(basic_var_t)) ;
     strcpy(newvar->name_, name) ;
-    newvar->value_ = NULL ;
-    newvar->index_ = next_var_index++ ;
-    newvar->next_ = vars ;
-    newvar->dims_ = NULL ;
-    newvar->dimcnt_ = 0 ;
-    vars = newvar ;
+    newvar->index_ = var_count ;
+    newvar->string_ = is_string_name(name) ;
+    newvar->integer_ = is_integer_name(name) ;
+    vars[var_count++] = newvar ;
     
     *index = newvar->index_ ;
 
     return true ;
 }
 
-bool basic_var_destroy(uint32_t index)
+static uint32_t array_size(basic_var_t *var)
 {
-	basic_var_t *var ;
-
-	if (vars->index_ == index) {
-		var = vars ;
-		vars = vars->next_ ;
-	}
-	else {
-		var = vars ;
-		while (var->next_ && var->next_->index_ != index)
-			var = var->next_ ;
-
-		if (var->next_ == NULL)
-			return false ;
+    uint32_t total = 1 ;
+    for(uint32_t i = 0 ; i < var->dimcnt_ ; i++) {
+        total *= var->dims_[i] ;
+    }
 
-		basic_var_t *save = var ;
-		var = save->next_ ;
-		save->next_ = var->next_ ;
-	}
+    return total ;
+}
 
-	if (var->value_ != NULL) {
-		basic_value_destroy(var->value_);
-	}
+static void reset_var(basic_var_t *var)
+{
+    //
+    // An unset numeric variable reads as zero without looking at its type, see
+    // basic_var_read_number()
+    //
+    if (var->value_.type_ != 0) {
+        basic_value_release(&var->value_);
+    }
+    memset(&var->value_, 0, sizeof(var->value_)) ;
+    var->ivalue_ = 0 ;
 
     if (var->dims_ != NULL) {
-        free(var->dims_);
         if (var->darray_)
-            free(var->darray_);
+            basic_free(var->darray_);
+        if (var->iarray_)
+            basic_free(var->iarray_);
         if (var->sarray_) {
-            for (uint32_t i = 0; i < var->dimcnt_; i++) {
-                free(var->sarray_[i]);
+            uint32_t total = array_size(var) ;
+            for (uint32_t i = 0; i < total; i++) {
+                basic_value_release(&var->sarray_[i]);
             }
-            free(var->sarray_);
+            basic_free(var->sarray_);
         }
+        basic_free(var->dims_);
     }
 
-	free(var) ;
-	return true ;
+    var->dims_ = NULL ;
+    var->dimcnt_ = 0 ;
+    var->darray_ = NULL ;
+    var->sarray_ = NULL ;
+    var->iarray_ = NULL ;
+}
+
+//
+// Destroy the value of a variable.  The slot stays bound to the name since parsed
+// lines refer to it.
+//
+bool basic_var_destroy(uint32_t index)
+{
+    basic_var_t *var = get_var_from_index(index) ;
+    if (var == NULL)
+        return false ;
+
+    reset_var(var) ;
+    return true ;
 }
 
 const char *basic_var_get_name(uint32_t index)
@@ -626,15 +852,9 @@ const char *basic_var_get_name(uint32_t index)
     return NULL ;
 }
 
-bool basic_var_set_value(uint32_t index, basic_value_t* value, basic_err_t* err)
+static bool check_var_type(basic_var_t *var, basic_value_t *value, basic_err_t *err)
 {
-    basic_var_t* var = get_var_from_index(index);
-    if (var == NULL) {
-        *err = BASIC_ERR_NO_SUCH_VARIABLE;
-        return false;
-    }
-
-    if (var->name_[strlen(var->name_) - 1] == '$') {
+    if (var->string_) {
         if (value->type_ != BASIC_VALUE_TYPE_STRING) {
             *err = BASIC_ERR_TYPE_MISMATCH;
             return false;
@@ -647,43 +867,188 @@ bool basic_var_set_value(uint32_t index, basic_value_t* value, basic_err_t* err)
         }
     }
 
-    if (var->value_ != NULL) {
-        basic_value_destroy(var->value_);
+    return true ;
+}
+
+//
+// Store a by-value result in a variable.  An owned string is moved into the
+// variable, a borrowed string is copied.  The copy is made before the old value
+// is released since the borrowed string may be the variable's own storage.
+//
+bool basic_var_store(uint32_t index, basic_value_t *value, basic_err_t *err)
+{
+    basic_var_t* var = get_var_from_index(index);
+    if (var == NULL) {
+        *err = BASIC_ERR_NO_SUCH_VARIABLE;
+        return false;
+    }
+
+    if (!check_var_type(var, value, err))
+        return false ;
+
+    if (var->integer_)
+        return basic_num_get_int(value->value.nvalue_, &var->ivalue_, err) ;
+
+    if (!basic_value_own(value, err))
+        return false ;
+
+    if (var->value_.type_ != 0) {
+        basic_value_release(&var->value_);
     }
-    var->value_ = value;
+    var->value_ = *value ;
+    value->owned_ = false ;
     return true;
 }
 
-bool basic_var_set_value_number(uint32_t index, double value, basic_err_t* err)
+//
+// Append a string to a string variable, for LET A$ = A$ + X$.  The variable's
+// buffer is extended in place if nothing else refers to it and it has room.
+// Otherwise the string is copied to a new buffer with room to grow, which leaves
+// any other references to the old buffer as they were.
+//
+bool basic_var_append(uint32_t index, basic_value_t *value, basic_err_t *err)
 {
-    basic_value_t *nval = basic_value_create_number(value) ;
-    if (nval == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+    basic_var_t* var = get_var_from_index(index);
+    if (var == NULL) {
+        *err = BASIC_ERR_NO_SUCH_VARIABLE;
+        return false;
+    }
+
+    if (!check_var_type(var, value, err))
+        return false ;
+
+    basic_value_t *cur = &var->value_ ;
+    if (cur->type_ == 0 && !set_string_copy(cur, "", 0, err))
         return false ;
+
+    uint32_t len = cur->length_ + value->length_ ;
+    basic_strbuf_t *buf = cur->inline_ ? NULL : cur->value.svalue_.buf_ ;
+    char *chars ;
+
+    if (cur->inline_ && len < BASIC_STR_INLINE_SIZE) {
+        chars = cur->value.ivalue_ ;
+    }
+    else if (cur->owned_ && buf->refs_ == 1 && cur->value.svalue_.chars_ + len < buf->data_ + buf->size_) {
+        chars = (char *)cur->value.svalue_.chars_ ;
     }
+    else {
+        uint32_t size = (buf != NULL) ? buf->size_ * 2 : BASIC_STR_INLINE_SIZE * 2 ;
+        while (size <= len)
+            size *= 2 ;
+
+        buf = strbuf_alloc(size) ;
+        if (buf == NULL) {
+            *err = BASIC_ERR_OUT_OF_MEMORY ;
+            return false ;
+        }
+
+        //
+        // The string being added may be borrowed from the old buffer, so it is
+        // copied before the old buffer is released
+        //
+        memcpy(buf->data_, basic_value_chars(cur), cur->length_) ;
+        memcpy(buf->data_ + cur->length_, basic_value_chars(value), value->length_) ;
+        buf->data_[len] = '\0' ;
+
+        basic_value_release(cur) ;
+        cur->type_ = BASIC_VALUE_TYPE_STRING ;
+        cur->owned_ = true ;
+        cur->length_ = len ;
+        cur->value.svalue_.chars_ = buf->data_ ;
+        cur->value.svalue_.buf_ = buf ;
+        return true ;
+    }
+
+    memcpy(chars + cur->length_, basic_value_chars(value), value->length_) ;
+    chars[len] = '\0' ;
+    cur->length_ = len ;
+    return true ;
+}
+
+bool basic_var_set_value(uint32_t index, basic_value_t* value, basic_err_t* err)
+{
+    if (!basic_var_store(index, value, err))
+        return false ;
 
-    return basic_var_set_value(index, nval, err) ;
+    //
+    // The variable now owns the contents of the value
+    //
+    basic_free(value) ;
+    return true;
+}
+
+bool basic_var_set_value_number(uint32_t index, basic_num_t value, basic_err_t* err)
+{
+    basic_value_t nval ;
+
+    set_number(&nval, value) ;
+    return basic_var_store(index, &nval, err) ;
 }
 
 bool basic_var_set_value_string(uint32_t index, const char *value, basic_err_t* err)
 {
-    basic_value_t *nval = basic_value_create_string(value) ;
-    if (nval == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-        return false ;
-    }
+    basic_value_t nval ;
 
-    return basic_var_set_value(index, nval, err) ;
+    set_string_borrowed(&nval, value) ;
+    return basic_var_store(index, &nval, err) ;
 }
 
 basic_value_t *basic_var_get_value(uint32_t index)
+{
+    basic_var_t* var = get_var_from_index(index);
+    if (var == NULL || var->value_.type_ == 0) {
+        return NULL;
+    }
+
+    return &var->value_;
+}
+
+//
+// The storage of an A% variable, or NULL if the variable is not an integer.  An
+// integer variable has no basic_value_t, so basic_var_get_value() returns NULL
+// for it.
+//
+int32_t *basic_var_get_int(uint32_t index)
+{
+    basic_var_t* var = get_var_from_index(index);
+    if (var == NULL || !var->integer_) {
+        return NULL;
+    }
+
+    return &var->ivalue_;
+}
+
+//
+// The storage of a numeric array for MAT, and its number of rows and columns.  A
+// one dimensional array is a single column.  String and A% arrays are a type
+// mismatch since MAT works on basic_num_t.
+//
+basic_num_t *basic_var_get_matrix(uint32_t index, uint32_t *rows, uint32_t *cols, basic_err_t *err)
 {
     basic_var_t* var = get_var_from_index(index);
     if (var == NULL) {
+        *err = BASIC_ERR_NO_SUCH_VARIABLE;
+        return NULL;
+    }
+
+    if (var->dimcnt_ == 0) {
+        *err = BASIC_ERR_NOT_ARRAY;
+        return NULL;
+    }
+
+    if (var->darray_ == NULL) {
+        *err = BASIC_ERR_TYPE_MISMATCH;
+        return NULL;
+    }
+
+    if (var->dimcnt_ > 2) {
+        *err = BASIC_ERR_TOO_MANY_DIMS;
         return NULL;
     }
 
-    return var->value_;
+    *rows = var->dims_[0] ;
+    *cols = (var->dimcnt_ == 2) ? var->dims_[1] : 1 ;
+    return var->darray_ ;
 }
 
 int basic_var_get_dim_count(uint32_t index, basic_err_t *err)
@@ -716,55 +1081,101 @@ bool basic_var_get_dims(uint32_t index, uint32_t* dimcnt, uint32_t* dims, basic_
         return -1;
     }
 
+    //
+    // The dimensions as they were given to DIM
+    //
     *dimcnt = var->dimcnt_;
-    memcpy(dims, var->dims_, sizeof(uint32_t) * var->dimcnt_);
+    for(uint32_t i = 0 ; i < var->dimcnt_ ; i++)
+        dims[i] = var->dims_[i] + var->base_ - 1 ;
     return true;
 }
 
-static int compute_index(int dimcnt, uint32_t *maxdims, uint32_t *dims)
+//
+// The position of an element in the storage of an array, or -1 if the indices do
+// not match the array.  The first index varies fastest.  Each index is checked
+// against its dimension with a single unsigned compare, which also catches an
+// index below the array base.
+//
+static int compute_index(basic_var_t *var, uint32_t dimcnt, uint32_t *dims)
 {
-    int ret = 0 ;
-    int mult = 1 ;
-    for(int i = 0 ; i < dimcnt ; i++) {
-        ret += (dims[i] - array_base) * mult ;
-        mult *= maxdims[i] ;
-    }
+    uint32_t ret = 0 ;
+    uint32_t mult = 1 ;
 
-    return ret ;
-}
+    if (dimcnt != var->dimcnt_)
+        return -1 ;
 
-basic_value_t *basic_var_get_array_value(uint32_t index, uint32_t *dims, basic_err_t *err)
-{
-    basic_value_t *ret ;
+    for(uint32_t i = 0 ; i < dimcnt ; i++) {
+        uint32_t d = dims[i] - var->base_ ;
+        if (d >= var->dims_[i])
+            return -1 ;
 
-    basic_var_t *var = get_var_from_index(index) ;
-    if (var == NULL) {
-        *err = BASIC_ERR_NO_SUCH_VARIABLE ;
-        return NULL ;
+        ret += d * mult ;
+        mult *= var->dims_[i] ;
     }
 
+    return (int)ret ;
+}
+
+//
+// Read an array element by value.  A string element is borrowed from the array.
+//
+static bool read_array_value(basic_var_t *var, uint32_t dimcnt, uint32_t *dims, basic_value_t *ret, basic_err_t *err)
+{
     if (var->dimcnt_ == 0) {
         *err = BASIC_ERR_NOT_ARRAY ;
-        return NULL ;
+        return false ;
     }
 
-    int ain = compute_index(var->dimcnt_, var->dims_, dims) ;
+    int ain = compute_index(var, dimcnt, dims) ;
     if (ain == -1) {
-        *err = BASIC_ERR_INVALID_DIMENSION ;
-        return NULL ;
+        *err = BASIC_ERR_SUBSCRIPT_OUT_OF_RANGE ;
+        return false ;
     }
 
     if (var->sarray_ != NULL) {
-        ret = basic_value_create_string(var->sarray_[ain]);
+        if (var->sarray_[ain].type_ == 0) {
+            set_string_borrowed(ret, "") ;
+        }
+        else {
+            *ret = var->sarray_[ain] ;
+            ret->owned_ = false ;
+        }
+    }
+    else if (var->iarray_ != NULL) {
+        basic_num_t n ;
+        if (!basic_num_put_int(var->iarray_[ain], &n, err))
+            return false ;
+
+        set_number(ret, n) ;
     }
     else {
-        ret = basic_value_create_number(var->darray_[ain]);
+        set_number(ret, var->darray_[ain]) ;
     }
 
-    return ret;
+    return true ;
+}
+
+basic_value_t *basic_var_get_array_value(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_err_t *err)
+{
+    basic_value_t val ;
+
+    basic_var_t *var = get_var_from_index(index) ;
+    if (var == NULL) {
+        *err = BASIC_ERR_NO_SUCH_VARIABLE ;
+        return NULL ;
+    }
+
+    if (!read_array_value(var, dimcnt, dims, &val, err))
+        return NULL ;
+
+    return create_value_from(&val, err) ;
 }
 
-bool basic_var_set_array_value(uint32_t index, basic_value_t *value, uint32_t *dims, basic_err_t *err)
+//
+// Store a by-value result in an array element.  As with basic_var_store() an
+// owned string is moved into the array and a borrowed one is copied.
+//
+bool basic_var_store_array(uint32_t index, basic_value_t *value, uint32_t dimcnt, uint32_t *dims, basic_err_t *err)
 {
     basic_var_t *var = get_var_from_index(index) ;
     if (var == NULL) {
@@ -784,41 +1195,54 @@ bool basic_var_set_array_value(uint32_t index, basic_value_t *value, uint32_t *d
             return false ;
         }
 
-        int ain = compute_index(var->dimcnt_, var->dims_, dims) ;
+        int ain = compute_index(var, dimcnt, dims) ;
         if (ain == -1) {
-            *err = BASIC_ERR_INVALID_DIMENSION ;
+            *err = BASIC_ERR_SUBSCRIPT_OUT_OF_RANGE ;
             return false ;
         }
 
-        var->sarray_[ain] = _strdup(value->value.svalue_) ;
-        if (var->sarray_[ain] == NULL) {
-            *err = BASIC_ERR_OUT_OF_MEMORY ;
+        if (!basic_value_own(value, err))
             return false ;
-        }
+
+        basic_value_release(&var->sarray_[ain]) ;
+        var->sarray_[ain] = *value ;
+        value->owned_ = false ;
     }
     else {
-        // Double array
+        // Number or integer array
         if (value->type_ != BASIC_VALUE_TYPE_NUMBER) {
             *err = BASIC_ERR_TYPE_MISMATCH ;
             return false ;
         }    
 
-        int ain = compute_index(var->dimcnt_, var->dims_, dims) ;
+        int ain = compute_index(var, dimcnt, dims) ;
         if (ain == -1) {
-            *err = BASIC_ERR_INVALID_DIMENSION ;
+            *err = BASIC_ERR_SUBSCRIPT_OUT_OF_RANGE ;
             return false ;
         }
+
+        if (var->iarray_ != NULL)
+            return basic_num_get_int(value->value.nvalue_, &var->iarray_[ain], err) ;
+
         var->darray_[ain] = value->value.nvalue_ ;
     }
 
-    basic_value_destroy(value);
+    return true ;
+}
+
+bool basic_var_set_array_value(uint32_t index, basic_value_t *value, uint32_t dimcnt, uint32_t *dims, basic_err_t *err)
+{
+    if (!basic_var_store_array(index, value, dimcnt, dims, err))
+        return false ;
+
+    basic_free(value);
 
     return true ;
 }
 
 static bool isString(basic_var_t *var)
 {
-    return var->name_[strlen(var->name_) - 1] == '$' ;
+    return var->string_ ;
 }
 
 bool basic_var_is_string(uint32_t index)
@@ -830,7 +1254,13 @@ bool basic_var_is_string(uint32_t index)
     return isString(var) ;
 }
 
-bool basic_var_add_dims(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_err_t *err)
+bool basic_var_is_integer(uint32_t index)
+{
+    basic_var_t *var = get_var_from_index(index) ;
+    return var != NULL && var->integer_ ;
+}
+
+bool basic_var_add_dims(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_err_t *err)
 {
     basic_var_t *var = get_var_from_index(index) ;
     if (var == NULL) {
@@ -838,41 +1268,84 @@ bool basic_var_add_dims(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_e
         return false ;
     }
 
-    var->dimcnt_ = dimcnt ;
-    var->dims_ = (uint32_t *)malloc(sizeof(uint32_t) * dimcnt) ;
-    if (var->dims_ == NULL)
-        return false ;
+    //
+    // DIM A(N) gives indices from the array base up to N, so each dimension is
+    // kept as its number of elements
+    //
+    uint32_t total = 1 ;
+    for(uint32_t i = 0 ; i < dimcnt ; i++) {
+        uint32_t count = dims[i] + 1 - array_base ;
+        if (count == 0 || total > UINT32_MAX / count) {
+            *err = BASIC_ERR_OUT_OF_MEMORY ;
+            return false ;
+        }
+        total *= count ;
+    }
 
-    memcpy(var->dims_, dims, sizeof(int) * dimcnt) ;
+    //
+    // The bytes for the elements must fit in a size_t or the size given to
+    // malloc wraps on the target.  The desktop holds arrays to the same 32 bit
+    // limit so that a program fails the same way on both.
+    //
+    size_t elsize = isString(var) ? sizeof(basic_value_t) : var->integer_ ? sizeof(int32_t) : sizeof(basic_num_t) ;
+    if (total > SIZE_MAX / elsize || total > UINT32_MAX / elsize) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
+    }
 
-    int total = 1 ;
-    for(uint32_t i = 0 ; i < dimcnt ; i++) {
-        total *= dims[i] ;
+    var->dims_ = (uint32_t *)basic_malloc(sizeof(uint32_t) * dimcnt) ;
+    if (var->dims_ == NULL) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
     }
 
+    var->dimcnt_ = dimcnt ;
+    var->base_ = array_base ;
+    for(uint32_t i = 0 ; i < dimcnt ; i++)
+        var->dims_[i] = dims[i] + 1 - array_base ;
+
+    var->darray_ = NULL;
+    var->sarray_ = NULL;
+    var->iarray_ = NULL;
+
     if (isString(var)) {
-        var->darray_ = NULL;
-        var->sarray_ = (char **)malloc(sizeof(char *) * total) ;
+        var->sarray_ = (basic_value_t *)basic_malloc(sizeof(basic_value_t) * total) ;
         if (var->sarray_ == NULL) {
             var->dimcnt_ = 0 ;
-            free(var->dims_);
+            basic_free(var->dims_);
+            var->dims_ = NULL ;
+            *err = BASIC_ERR_OUT_OF_MEMORY ;
             return false;
         }
         else {
-            memset(var->sarray_, 0, sizeof(char *) * total) ;
+            memset(var->sarray_, 0, sizeof(basic_value_t) * total) ;
         }
     }    
+    else if (var->integer_) {
+        var->iarray_ = (int32_t *)basic_malloc(sizeof(int32_t) * total) ;
+        if (var->iarray_ == NULL) {
+            var->dimcnt_ = 0 ;
+            basic_free(var->dims_);
+            var->dims_ = NULL ;
+            *err = BASIC_ERR_OUT_OF_MEMORY ;
+            return false;
+        }
+        else {
+            memset(var->iarray_, 0, sizeof(int32_t) * total) ;
+        }
+    }
     else {
-        var->sarray_ = NULL;
-        var->darray_ = (double *)malloc(sizeof(double) * total) ;
+        var->darray_ = (basic_num_t *)basic_malloc(sizeof(basic_num_t) * total) ;
         if (var->darray_ == NULL) {
             var->dimcnt_ = 0 ;
-            free(var->dims_);
+            basic_free(var->dims_);
+            var->dims_ = NULL ;
+            *err = BASIC_ERR_OUT_OF_MEMORY ;
             return false;
         }
         else {
-            for(int i = 0 ; i < total ; i++) {
-                var->darray_[i] = 0.0 ;
+            for(uint32_t i = 0 ; i < total ; i++) {
+                var->darray_[i] = 0 ;
             }
         }
     }
@@ -880,11 +1353,132 @@ bool basic_var_add_dims(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_e
     return true ;
 }
 
+//
+// Read the value of a variable, or an element of an array variable, for use in an
+// expression.  Numbers are copied into the result and strings are borrowed from the
+// variable, so the result is only good until the variable is next assigned.  A scalar
+// that has never been assigned is given a default value of zero or the empty string.
+//
+bool basic_var_read(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_value_t *ret, basic_err_t *err)
+{
+    basic_var_t *var = get_var_from_index(index) ;
+    if (var == NULL) {
+        *err = BASIC_ERR_NO_SUCH_VARIABLE ;
+        return false ;
+    }
+
+    if (dimcnt != 0)
+        return read_array_value(var, dimcnt, dims, ret, err) ;
+
+    if (var->integer_) {
+        basic_num_t n ;
+        if (!basic_num_put_int(var->ivalue_, &n, err))
+            return false ;
+
+        set_number(ret, n) ;
+        return true ;
+    }
+
+    if (var->value_.type_ == 0) {
+        if (isString(var))
+        {
+            if (!set_string_copy(&var->value_, "", 0, err))
+                return false ;
+        }
+        else
+        {
+            set_number(&var->value_, 0) ;
+        }
+    }
+
+    *ret = var->value_ ;
+    ret->owned_ = false ;
+    return true ;
+}
+
+//
+// Read a numeric variable or array element for the numeric evaluator.  The parser
+// has already checked the variable is not a string.
+//
+bool basic_var_read_number(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_num_t *ret, basic_err_t *err)
+{
+    basic_var_t *var = get_var_from_index(index) ;
+    if (var == NULL) {
+        *err = BASIC_ERR_NO_SUCH_VARIABLE ;
+        return false ;
+    }
+
+    if (dimcnt == 0) {
+        if (var->integer_)
+            return basic_num_put_int(var->ivalue_, ret, err) ;
+
+        *ret = var->value_.value.nvalue_ ;
+        return true ;
+    }
+
+    if (var->dimcnt_ == 0) {
+        *err = BASIC_ERR_NOT_ARRAY ;
+        return false ;
+    }
+
+    int ain = compute_index(var, dimcnt, dims) ;
+    if (ain == -1) {
+        *err = BASIC_ERR_SUBSCRIPT_OUT_OF_RANGE ;
+        return false ;
+    }
+
+    if (var->integer_)
+        return basic_num_put_int(var->iarray_[ain], ret, err) ;
+
+    *ret = var->darray_[ain] ;
+    return true ;
+}
+
+//
+// Read an A% variable or an element of A%() for the integer operations of the
+// VM.  The compiler only uses this for variables whose names end in %.
+//
+bool basic_var_read_int(uint32_t index, uint32_t dimcnt, uint32_t *dims, int32_t *ret, basic_err_t *err)
+{
+    basic_var_t *var = get_var_from_index(index) ;
+    if (var == NULL) {
+        *err = BASIC_ERR_NO_SUCH_VARIABLE ;
+        return false ;
+    }
+
+    assert(var->integer_) ;
+
+    if (dimcnt == 0) {
+        *ret = var->ivalue_ ;
+        return true ;
+    }
+
+    if (var->dimcnt_ == 0) {
+        *err = BASIC_ERR_NOT_ARRAY ;
+        return false ;
+    }
+
+    int ain = compute_index(var, dimcnt, dims) ;
+    if (ain == -1) {
+        *err = BASIC_ERR_SUBSCRIPT_OUT_OF_RANGE ;
+        return false ;
+    }
+
+    *ret = var->iarray_[ain] ;
+    return true ;
+}
+
 void basic_var_clear_all()
 {
-    while (vars != NULL) {
-        basic_var_destroy(vars->index_) ;
+    for(uint32_t i = 0 ; i < var_count ; i++) {
+        reset_var(vars[i]) ;
+        basic_free(vars[i]) ;
     }
+
+    basic_free(vars) ;
+    vars = NULL ;
+    var_count = 0 ;
+    var_size = 0 ;
 }
 
 static void basic_destroy_operand(basic_operand_t *operand)
@@ -905,7 +1499,7 @@ static void basic_destroy_operand(basic_operand_t *operand)
                 for(int i = 0 ; i < operand->operand_.var_.dimcnt_ ; i++) {
                     basic_destroy_operand(operand->operand_.var_.dims_[i]);
                 }
-                free(operand->operand_.var_.dims_) ;
+                basic_free(operand->operand_.var_.dims_) ;
             }
             break; 
 
@@ -913,41 +1507,65 @@ static void basic_destroy_operand(basic_operand_t *operand)
             for (int i = 0; i < operand->operand_.function_.func_->num_args_; i++) {
                 basic_destroy_operand(operand->operand_.function_.args_[i]);
             }
-            free(operand->operand_.function_.args_);
+            basic_free(operand->operand_.function_.args_);
             break;
 
         case BASIC_OPERAND_TYPE_USERFN:
             for (uint32_t i = 0; i < operand->operand_.userfn_.argcnt_; i++) {
                 basic_destroy_operand(operand->operand_.userfn_.args_[i]);
             }
-            free(operand->operand_.userfn_.args_);
+            basic_free(operand->operand_.userfn_.args_);
             break;    
 
         case BASIC_OPERAND_TYPE_BOUNDV:
             break; 
 
+        case BASIC_OPERAND_TYPE_FOLDED:
+            basic_value_destroy(operand->operand_.folded_.value_) ;
+            basic_destroy_operand(operand->operand_.folded_.orig_) ;
+            break ;
+
         default:
             assert(false) ;
             break ;        
     }
 
-    free(operand);
+    basic_free(operand);
 }
 
-static bool create_expr(basic_operand_t *operand, uint32_t *index, basic_err_t *err)
+static bool create_expr(basic_operand_t *operand, uint8_t type, int argcnt, char **argnames, uint32_t *index, basic_err_t *err)
 {
     dump_expr_stack("before create_expr") ;
 
-    basic_expr_t *expr = (basic_expr_t *)malloc(sizeof(basic_expr_t)) ;
+    uint32_t handle ;
+    basic_expr_t *expr = (basic_expr_t *)basic_htab_alloc(&exprs, &handle) ;
     if (expr == NULL) {
         *err = BASIC_ERR_OUT_OF_MEMORY ;
         return false ;
     }
 
-    expr->index_ = next_expr_index++ ;
+    expr->index_ = handle ;
     expr->top_ = operand ;
-    expr->next_ = exprs ;
-    exprs = expr ;
+    expr->code_ = NULL ;
+    expr->codelen_ = 0 ;
+    expr->depth_ = 0 ;
+    expr->append_ = false ;
+    expr->condition_ = false ;
+    expr->type_ = type ;
+    expr->numeric_ = is_numeric(operand) ;
+    expr->integer_ = expr->numeric_ && basic_operand_is_integer(operand) ;
+
+#ifndef BASIC_EXPR_TREE_EVAL
+    //
+    // Compile the tree into bytecode for the VM.  The tree is kept so the
+    // expression can be turned back into text for LIST and SAVE.
+    //
+    if (!basic_vm_compile(expr, argcnt, argnames, err)) {
+        basic_htab_free(&exprs, handle) ;
+        return false ;
+    }
+#endif
+
     *index = expr->index_ ;
 
     dump_expr_stack("after create_expr") ;    
@@ -957,7 +1575,7 @@ static bool create_expr(basic_operand_t *operand, uint32_t *index, basic_err_t *
 
 static basic_operand_t *create_const_operand(basic_value_t *value)
 {
-    basic_operand_t *ret = (basic_operand_t *)malloc(sizeof(basic_operand_t)) ;
+    basic_operand_t *ret = (basic_operand_t *)basic_malloc(sizeof(basic_operand_t)) ;
     if (ret == NULL)
         return NULL ;
 
@@ -966,22 +1584,23 @@ static basic_operand_t *create_const_operand(basic_value_t *value)
     return ret ;
 }
 
-static basic_operand_t *create_var_operand(uint32_t varname, int dimcnt, basic_operand_t **dims)
+static basic_operand_t *create_var_operand(uint32_t varname, uint32_t varidx, int dimcnt, basic_operand_t **dims)
 {
-    basic_operand_t *ret = (basic_operand_t *)malloc(sizeof(basic_operand_t)) ;
+    basic_operand_t *ret = (basic_operand_t *)basic_malloc(sizeof(basic_operand_t)) ;
     if (ret == NULL)
         return NULL ;
 
     ret->type_ = BASIC_OPERAND_TYPE_VAR ;
     ret->operand_.var_.varname_ = varname ;
+    ret->operand_.var_.varidx_ = varidx ;
     ret->operand_.var_.dimcnt_ = dimcnt ;
     if (dimcnt == 0) {
         ret->operand_.var_.dims_ = NULL ;
     }
     else {
-        ret->operand_.var_.dims_ = (basic_operand_t **)malloc(sizeof(basic_operand_t *) * dimcnt) ;
+        ret->operand_.var_.dims_ = (basic_operand_t **)basic_malloc(sizeof(basic_operand_t *) * dimcnt) ;
         if (ret->operand_.var_.dims_ == NULL) {
-            free(ret) ;
+            basic_free(ret) ;
             return NULL ;
         }
         memcpy(ret->operand_.var_.dims_, dims, sizeof(basic_operand_t *) * dimcnt);
@@ -991,15 +1610,15 @@ static basic_operand_t *create_var_operand(uint32_t varname, int dimcnt, basic_o
 
 static basic_operand_t* create_fun_operand(function_table_t *fun)
 {
-    basic_operand_t* ret = (basic_operand_t*)malloc(sizeof(basic_operand_t));
+    basic_operand_t* ret = (basic_operand_t*)basic_malloc(sizeof(basic_operand_t));
     if (ret == NULL)
         return NULL;
 
     ret->type_ = BASIC_OPERAND_TYPE_FUNCTION;
     ret->operand_.function_.func_ = fun;
-    ret->operand_.function_.args_ = (basic_operand_t**)malloc(sizeof(basic_operand_t*) * fun->num_args_);
+    ret->operand_.function_.args_ = (basic_operand_t**)basic_malloc(sizeof(basic_operand_t*) * fun->num_args_);
     if (ret->operand_.function_.args_ == NULL) {
-        free(ret);
+        basic_free(ret);
         return NULL;
     }
 
@@ -1009,16 +1628,16 @@ static basic_operand_t* create_fun_operand(function_table_t *fun)
 
 static basic_operand_t* create_userfn_operand(basic_expr_user_fn_t *ufn)
 {
-    basic_operand_t* ret = (basic_operand_t*)malloc(sizeof(basic_operand_t));
+    basic_operand_t* ret = (basic_operand_t*)basic_malloc(sizeof(basic_operand_t));
     if (ret == NULL)
         return NULL;
 
     ret->type_ = BASIC_OPERAND_TYPE_USERFN;
     ret->operand_.userfn_.func_ = ufn ;
     ret->operand_.userfn_.argcnt_ = ufn->argcnt_;
-    ret->operand_.userfn_.args_ = (basic_operand_t**)malloc(sizeof(basic_operand_t*) * ufn->argcnt_);
+    ret->operand_.userfn_.args_ = (basic_operand_t**)basic_malloc(sizeof(basic_operand_t*) * ufn->argcnt_);
     if (ret->operand_.userfn_.args_ == NULL) {
-        free(ret);
+        basic_free(ret);
         return NULL;
     }
 
@@ -1028,7 +1647,7 @@ static basic_operand_t* create_userfn_operand(basic_expr_user_fn_t *ufn)
 
 static basic_operand_t* create_bound_value(const char *v)
 {
-    basic_operand_t* ret = (basic_operand_t*)malloc(sizeof(basic_operand_t));
+    basic_operand_t* ret = (basic_operand_t*)basic_malloc(sizeof(basic_operand_t));
     if (ret == NULL)
         return NULL;
 
@@ -1037,34 +1656,63 @@ static basic_operand_t* create_bound_value(const char *v)
     return ret ;
 } 
 
-static function_table_t* lookup_function(const char* name)
+//
+// The names of the builtin functions are found through a trie holding the index
+// of each in functions[], built the first time it is needed
+//
+static basic_trie_t function_trie ;
+
+static int find_function(const char *name, size_t *len)
 {
-    for (int i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
-        if (_stricmp(name, functions[i].string_) == 0) {
-            return &functions[i];
+    if (function_trie.count_ == 0) {
+        for (int i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+            bool added = basic_trie_add(&function_trie, functions[i].string_, (uint8_t)i) ;
+            assert(added) ;
+            (void)added ;
         }
     }
 
-    return NULL;
+    return basic_trie_match(&function_trie, name, len) ;
+}
+
+static function_table_t* lookup_function(const char* name)
+{
+    size_t len ;
+    int i = find_function(name, &len) ;
+    if (i == -1 || name[len] != '\0')
+        return NULL;
+
+    return &functions[i];
 }
 
-static basic_value_t *func_mem(int count, basic_value_t **args, basic_err_t *err)
+//
+// Returns true if the text starts with the name of a builtin function.  Some
+// functions, MEM for instance, share their name with a statement keyword.
+//
+static bool is_function_name(const char *line)
+{
+    size_t len ;
+    int i = find_function(line, &len) ;
+    return i != -1 && !isalnum((uint8_t)line[len]) ;
+}
+
+static bool func_mem(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 1) {
         *err = BASIC_ERR_ARG_COUNT_MISMATCH ;
-        return NULL ;
+        return false ;
     }
 
-    if (args[0]->type_ != BASIC_VALUE_TYPE_NUMBER) {
+    if (args[0].type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
+        return false ;
     }
 
-    int mtype = (int)args[0]->value.nvalue_ ;
+    int mtype = basic_num_to_int(args[0].value.nvalue_) ;
 
-    if (mtype < 1 || mtype > 5) {
+    if (mtype < 1 || mtype > 8) {
         *err = BASIC_ERR_INVALID_ARG_VALUE ;
-        return NULL ;
+        return false ;
     }
 
 #ifndef DESKTOP
@@ -1078,49 +1726,53 @@ static basic_value_t *func_mem(int count, basic_value_t **args, basic_err_t *err
     uint32_t heap_size = (uint32_t)(heap_limit - heap_base);    
 #endif
 
-    int ret = 0 ;
+    int value = 0 ;
 
-#ifndef DESKTOP
     switch(mtype)
     {
+#ifndef DESKTOP
         case 1:
-            ret = heap_size ;
+            value = heap_size ;
             break ;
         case 2:
-            ret = mall_info.uordblks ;
+            value = mall_info.uordblks ;
             break ;
         case 3:
-            ret = mall_info.arena ;
+            value = mall_info.arena ;
             break;
         case 4:
-            ret = basic_str_memsize(false) ;
+            value = basic_str_memsize(false) ;
             break ;
         case 5:
-            ret = basic_str_memsize(true) ;
+            value = basic_str_memsize(true) ;
             break ;            
-    }
 #endif
-
-    basic_value_t *v = basic_value_create_number(ret);
-    if (v == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-        return NULL ;
+        case 6:
+            value = basic_mem_stats.allocs_ ;
+            break ;
+        case 7:
+            value = basic_mem_stats.allocs_ - basic_mem_stats.frees_ ;
+            break ;
+        case 8:
+            value = basic_mem_stats.bytes_ ;
+            break ;
     }
 
-    return v ;
+    set_number(ret, basic_num_from_int(value)) ;
+    return true ;
 }
 
-static basic_value_t* func_rnd(int count, basic_value_t** args, basic_err_t* err)
+static bool func_rnd(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 1) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* v = args[0];
+    basic_value_t* v = &args[0];
     if (v->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
     double value ;
@@ -1133,7 +1785,7 @@ static basic_value_t* func_rnd(int count, basic_value_t** args, basic_err_t* err
         cy_rslt_t res = cyhal_trng_init(&trng_obj);
         if (res != CY_RET_SUCCESS) {
             *err = BASIC_ERR_TRNG_FAILED ;
-            return NULL ;
+            return false ;
         }
         crypto_inited = true ;
     }
@@ -1141,345 +1793,309 @@ static basic_value_t* func_rnd(int count, basic_value_t** args, basic_err_t* err
     value = (double)cyhal_trng_generate(&trng_obj) / (double)(0xffffffff);
 #endif
 
-    return basic_value_create_number(value) ;
+    set_number(ret, basic_num_from_double(value)) ;
+    return true ;
 }
 
-static basic_value_t* func_int(int count, basic_value_t** args, basic_err_t *err)
+static bool func_int(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 1) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* v = args[0];
+    basic_value_t* v = &args[0];
     if (v->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
-    return basic_value_create_number((int)v->value.nvalue_);
+    set_number(ret, basic_num_from_int(basic_num_to_int(v->value.nvalue_))) ;
+    return true ;
 }
 
-static basic_value_t* func_sqrt(int count, basic_value_t** args, basic_err_t *err)
+static bool func_sqrt(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 1) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* v = args[0];
+    basic_value_t* v = &args[0];
     if (v->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
-    if (v->value.nvalue_ < 0.0) {
+    if (v->value.nvalue_ < 0) {
         *err = BASIC_ERR_INVALID_ARG_VALUE ;
-        return NULL ;
+        return false ;
     }
 
-    return basic_value_create_number(sqrt(v->value.nvalue_)) ;
+    set_number(ret, basic_num_sqrt(v->value.nvalue_)) ;
+    return true ;
 }
 
-static basic_value_t* func_exp(int count, basic_value_t** args, basic_err_t *err)
+static bool func_exp(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 1) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* v = args[0];
+    basic_value_t* v = &args[0];
     if (v->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
-    return basic_value_create_number(exp(v->value.nvalue_)) ;
+    set_number(ret, basic_num_exp(v->value.nvalue_)) ;
+    return true ;
 }
 
-static basic_value_t* func_val(int count, basic_value_t** args, basic_err_t *err)
+static bool func_val(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
-    double value ;
+    basic_num_t value ;
 
     if (count != 1) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* v = args[0];
+    basic_value_t* v = &args[0];
     if (v->type_ != BASIC_VALUE_TYPE_STRING) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
+    }
+
+    //
+    // The string may be part of a longer one, so parse a terminated copy
+    //
+    char buf[BASIC_PARSE_BUFFER_LENGTH] ;
+    if (v->length_ >= sizeof(buf)) {
+        *err = BASIC_ERR_BAD_NUMBER_VALUE ;
+        return false ;
     }
+    memcpy(buf, basic_value_chars(v), v->length_) ;
+    buf[v->length_] = '\0' ;
 
-    const char *text = skipSpaces(v->value.svalue_) ;
+    const char *text = skipSpaces(buf) ;
     const char *line = basic_expr_parse_number(text, &value, err) ;
     if (line != NULL)
         line = skipSpaces(line) ;
     if (line == NULL || *line != '\0') {
         *err = BASIC_ERR_BAD_NUMBER_VALUE ;
-        return NULL ;
+        return false ;
     }
 
-    return basic_value_create_number(value) ;
+    set_number(ret, value) ;
+    return true ;
 }
 
-static basic_value_t* func_left(int count, basic_value_t** args, basic_err_t *err)
+static bool func_left(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 2) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* str = args[0];
+    basic_value_t* str = &args[0];
     if (str->type_ != BASIC_VALUE_TYPE_STRING) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* len = args[1] ;
+    basic_value_t* len = &args[1] ;
     if (len->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
-    }
-
-    int nlen = (int)len->value.nvalue_ ;
-    char *strv = (char *)malloc(nlen + 1) ;
-    if (strv == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-        return NULL ;
+        return false;
     }
 
-    strncpy(strv, str->value.svalue_, nlen);
-    strv[nlen] = '\0' ;
-
-    basic_value_t *ret = basic_value_create_string(strv) ;
-    free(strv) ;
-
-    if (ret == NULL)
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+    int nlen = basic_num_to_int(len->value.nvalue_) ;
+    if (nlen < 0)
+        nlen = 0 ;
+    else if (nlen > (int)str->length_)
+        nlen = (int)str->length_ ;
 
-    return ret ;
+    return set_substring(ret, str, 0, nlen, err) ;
 }
 
-static basic_value_t* func_right(int count, basic_value_t** args, basic_err_t *err)
+static bool func_right(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 2) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* str = args[0];
+    basic_value_t* str = &args[0];
     if (str->type_ != BASIC_VALUE_TYPE_STRING) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* len = args[1] ;
+    basic_value_t* len = &args[1] ;
     if (len->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
-    }
-
-    int nlen = (int)len->value.nvalue_ ;
-    char *strv = (char *)malloc(nlen + 1) ;
-    if (strv == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-        return NULL ;
-    }
-
-    int slen = (int)strlen(str->value.svalue_) ;
-    if (nlen > slen) 
-    {
-        strcpy(strv, str->value.svalue_); 
-    } 
-    else
-    {
-        strncpy(strv, str->value.svalue_ + slen - nlen, nlen);
+        return false;
     }
-    strv[nlen] = '\0' ;
 
-    basic_value_t *ret = basic_value_create_string(strv) ;
-    free(strv) ;
+    int nlen = basic_num_to_int(len->value.nvalue_) ;
+    int slen = (int)str->length_ ;
+    if (nlen < 0)
+        nlen = 0 ;
+    else if (nlen > slen)
+        nlen = slen ;
 
-    if (ret == NULL)
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-
-    return ret ;
+    return set_substring(ret, str, slen - nlen, nlen, err) ;
 }
 
-static basic_value_t* func_mid(int count, basic_value_t** args, basic_err_t *err)
+static bool func_mid(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 3) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* str = args[0];
+    basic_value_t* str = &args[0];
     if (str->type_ != BASIC_VALUE_TYPE_STRING) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* pos = args[1] ;
+    basic_value_t* pos = &args[1] ;
     if (pos->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
-    int npos = (int)pos->value.nvalue_ - 1;
+    int npos = basic_num_to_int(pos->value.nvalue_) - 1;
 
-    basic_value_t* len = args[2] ;
+    basic_value_t* len = &args[2] ;
     if (len->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
-    }
-    int nlen = (int)len->value.nvalue_ ;
-
-    char *strv = (char *)malloc(nlen + 1) ;
-    if (strv == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-        return NULL ;
+        return false;
     }
+    int nlen = basic_num_to_int(len->value.nvalue_) ;
+    int slen = (int)str->length_ ;
 
-    int slen = (int)strlen(str->value.svalue_) ;
+    if (npos < 0)
+        npos = 0 ;
+    if (nlen < 0)
+        nlen = 0 ;
 
     if (npos > slen) 
     {
         // Position is past the end of the source string
-        *strv = '\0' ;
+        npos = slen ;
+        nlen = 0 ;
     }
     else if (npos + nlen > slen) 
     {
         // Position plus length exceeds the length of the source string
-        strcpy(strv, &str->value.svalue_[npos]) ;
+        nlen = slen - npos ;
     }
-    else
-    {
-        strncpy(strv, &str->value.svalue_[npos], nlen) ;
-        strv[nlen] = '\0'; 
-    }
-
-    basic_value_t *ret = basic_value_create_string(strv) ;
-    free(strv) ;
 
-    if (ret == NULL)
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-
-    return ret ;
+    return set_substring(ret, str, npos, nlen, err) ;
 }
 
-static basic_value_t* func_len(int count, basic_value_t** args, basic_err_t *err)
+static bool func_len(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 1) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* str = args[0];
+    basic_value_t* str = &args[0];
     if (str->type_ != BASIC_VALUE_TYPE_STRING) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
-    return basic_value_create_number((double)(strlen(str->value.svalue_))) ;
+    set_number(ret, basic_num_from_int((int32_t)str->length_)) ;
+    return true ;
 }
 
-static basic_value_t* func_str(int count, basic_value_t** args, basic_err_t *err)
+static bool func_str(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     static char buf[16] ;
 
     if (count != 1) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* value = args[0];
+    basic_value_t* value = &args[0];
     if (value->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
-    if ((value->value.nvalue_ - (int)value->value.nvalue_) < 1e-6)
-        sprintf(buf, " %d ", (int)value->value.nvalue_);
+    if (basic_num_is_int(value->value.nvalue_))
+        sprintf(buf, " %d ", (int)basic_num_to_int(value->value.nvalue_));
     else
-        sprintf(buf, " %f ", value->value.nvalue_);
-
-    basic_value_t *ret = basic_value_create_string(buf) ;
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-    }
+        sprintf(buf, " %f ", basic_num_to_double(value->value.nvalue_));
 
-    return ret ;
+    return set_string_copy(ret, buf, (uint32_t)strlen(buf), err) ;
 }
 
-static basic_value_t* func_abs(int count, basic_value_t** args, basic_err_t *err)
+static bool func_abs(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 1) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* v = args[0];
+    basic_value_t* v = &args[0];
     if (v->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
-    return basic_value_create_number(fabs(v->value.nvalue_)) ;
+    set_number(ret, basic_num_abs(v->value.nvalue_)) ;
+    return true ;
 }
 
-static basic_value_t* func_chr(int count, basic_value_t** args, basic_err_t *err)
+static bool func_chr(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
-    char buf[2] ;
+    char buf[1] ;
 
     if (count != 1) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* v = args[0];
+    basic_value_t* v = &args[0];
     if (v->type_ != BASIC_VALUE_TYPE_NUMBER) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
+        return false;
     }
 
-    int n = (int)v->value.nvalue_ ;
+    int n = basic_num_to_int(v->value.nvalue_) ;
     if (n < 0 || n > 255) 
     {
         *err = BASIC_ERR_INVALID_ARG_VALUE ;
-        return NULL ;
+        return false ;
     }
 
     buf[0] = n ;
-    buf[1] = 0 ;
-
-    basic_value_t *ret = basic_value_create_string(buf) ;
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-    }
 
-    return ret;
+    return set_string_copy(ret, buf, 1, err) ;
 }
 
-static basic_value_t* func_asc(int count, basic_value_t** args, basic_err_t *err)
+static bool func_asc(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err)
 {
     if (count != 1) {
         *err = BASIC_ERR_BAD_ARG_COUNT;
-        return NULL;
+        return false;
     }
 
-    basic_value_t* v = args[0];
+    basic_value_t* v = &args[0];
     if (v->type_ != BASIC_VALUE_TYPE_STRING) {
         *err = BASIC_ERR_TYPE_MISMATCH;
-        return NULL;
-    }
-
-    basic_value_t *ret = basic_value_create_number((int)v->value.svalue_[0]) ;
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false;
     }
 
-    return ret;
+    set_number(ret, basic_num_from_int(v->length_ > 0 ? (int)basic_value_chars(v)[0] : 0)) ;
+    return true ;
 }
 
 static int match_def_local(expr_ctxt_t *ctxt)
@@ -1592,8 +2208,13 @@ static const char *parse_operand(expr_ctxt_t *ctxt, const char *line, basic_oper
         }
         ctxt->parsebuffer[bind] = '\0' ;
 
-        double fv = atof(ctxt->parsebuffer) ;
-        basic_value_t *value = basic_value_create_number(fv);
+        double d = atof(ctxt->parsebuffer) ;
+        if (!basic_num_holds_double(d)) {
+            *err = BASIC_ERR_OVERFLOW ;
+            return NULL ;
+        }
+
+        basic_value_t *value = basic_value_create_number(basic_num_from_double(d));
         if (value == NULL) {
             *err = BASIC_ERR_OUT_OF_MEMORY ;
             return NULL ;
@@ -1628,14 +2249,14 @@ static const char *parse_operand(expr_ctxt_t *ctxt, const char *line, basic_oper
         *operand = create_const_operand(value) ;
     }
     else if (isalpha((uint8_t)*line)) {
-        while (*line && (isalpha((uint8_t)*line) || isdigit((uint8_t)*line)) && !basic_is_keyword(line) && bind < BASIC_PARSE_BUFFER_LENGTH) {
+        while (*line && (isalpha((uint8_t)*line) || isdigit((uint8_t)*line)) && (!basic_is_keyword(line) || (bind == 0 && is_function_name(line))) && bind < BASIC_PARSE_BUFFER_LENGTH) {
             ctxt->parsebuffer[bind++] = toupper(*line++) ;
             if (bind > BASIC_MAX_VARIABLE_LENGTH) {
                 *err = BASIC_ERR_VARIABLE_TOO_LONG;
                 return NULL;
             }
         }
-        if (*line == '$') {
+        if (*line == '$' || *line == '%') {
             ctxt->parsebuffer[bind++] = toupper(*line++) ;
             if (bind > BASIC_MAX_VARIABLE_LENGTH) {
                 *err = BASIC_ERR_VARIABLE_TOO_LONG;
@@ -1739,7 +2360,12 @@ static const char *parse_operand(expr_ctxt_t *ctxt, const char *line, basic_oper
                     *err = BASIC_ERR_OUT_OF_MEMORY ;
                     return NULL ;
                 }
-                *operand = create_var_operand(index, dimcnt, dims);
+
+                uint32_t varidx ;
+                if (!basic_var_get(ctxt->parsebuffer, &varidx, err))
+                    return NULL ;
+
+                *operand = create_var_operand(index, varidx, dimcnt, dims);
             }
         }
     }
@@ -1888,6 +2514,9 @@ static bool basic_operand_to_string(basic_operand_t *parent, basic_operand_t *op
                 ret = false ;
             break ;
 
+        case BASIC_OPERAND_TYPE_FOLDED:
+            ret = basic_operand_to_string(parent, oper->operand_.folded_.orig_, str) ;
+            break ;
     }
     
     return ret;
@@ -1937,7 +2566,7 @@ static basic_operand_t *peek_operator(expr_ctxt_t* ctxt)
 
 static basic_operand_t *createOperator(operator_table_t *t)
 {
-    basic_operand_t *ret = (basic_operand_t *)malloc(sizeof(basic_operand_t));
+    basic_operand_t *ret = (basic_operand_t *)basic_malloc(sizeof(basic_operand_t));
     if (ret == NULL)
         return NULL ;
 
@@ -2042,7 +2671,7 @@ static const char* parse_operand_top(const char* line, int argcnt, char **argnam
     basic_operand_t* op;
     expr_ctxt_t* ctxt;
 
-    ctxt = (expr_ctxt_t*)malloc(sizeof(expr_ctxt_t));
+    ctxt = (expr_ctxt_t*)basic_malloc(sizeof(expr_ctxt_t));
     if (ctxt == NULL) {
         *err = BASIC_ERR_OUT_OF_MEMORY;
         return NULL;
@@ -2054,641 +2683,984 @@ static const char* parse_operand_top(const char* line, int argcnt, char **argnam
     ctxt->argnames_ = argnames;
 
     line = parse_expr(ctxt, line, &op, err);
-    free(ctxt);
+    basic_free(ctxt);
 
     *ret = op;
     return line;
 }
 
 
-const char *basic_expr_parse(const char *line, int argcnt, char **argnames, uint32_t *index, basic_err_t *err)
+//
+// Checks the type of an operand given the type it produces
+//
+static bool check_type(uint8_t type, uint8_t expected, basic_err_t *err)
 {
-    basic_operand_t* op;
-    
-    line = parse_operand_top(line, argcnt, argnames, &op, err);
-    if (line == NULL)
-        return NULL ;
-
-    //
-    // The expr is a simple operand
-    //
-    if (!create_expr(op, index, err))
-        return NULL ;
+    if (type != BASIC_EXPR_TYPE_ANY && type != expected) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
+    }
 
-    return line ;
+    return true ;
 }
 
-static basic_expr_t *get_expr_from_index(uint32_t index)
+//
+// Work out the type of an operand as it is parsed.  The type of a variable is
+// fixed by its name and the type of a function by the function table, so a
+// mismatch such as A$ * 2 is reported when the line is entered instead of when it
+// runs.  DEF FN arguments are typed by their names the same way, but the result
+// of calling a DEF FN function is only known when it runs.
+//
+static bool infer_type(basic_operand_t *op, uint8_t *type, basic_err_t *err)
 {
-    for(basic_expr_t *expr = exprs ; expr != NULL ; expr = expr->next_)
+    uint8_t left, right ;
+
+    switch(op->type_)
     {
-        if (expr->index_ == index)
-            return expr ;
-    }
+        case BASIC_OPERAND_TYPE_CONST:
+            *type = op->operand_.const_->type_ ;
+            break ;
 
-    return NULL ;
-}
+        case BASIC_OPERAND_TYPE_FOLDED:
+            *type = op->operand_.folded_.value_->type_ ;
+            break ;
 
-bool basic_expr_destroy(uint32_t index)
-{
-    dump_expr_stack("before basic_expr_destroy") ;
+        case BASIC_OPERAND_TYPE_VAR:
+            for(int i = 0 ; i < op->operand_.var_.dimcnt_ ; i++) {
+                if (!infer_type(op->operand_.var_.dims_[i], &left, err) || !check_type(left, BASIC_VALUE_TYPE_NUMBER, err))
+                    return false ;
+            }
+            *type = basic_var_is_string(op->operand_.var_.varidx_) ? BASIC_VALUE_TYPE_STRING : BASIC_VALUE_TYPE_NUMBER ;
+            break ;
 
-    basic_expr_t *expr = get_expr_from_index(index) ;
-    if (expr == NULL)
-        return false ;
+        case BASIC_OPERAND_TYPE_FUNCTION:
+            {
+                function_table_t *fun = op->operand_.function_.func_ ;
+                for(int i = 0 ; i < fun->num_args_ ; i++) {
+                    uint8_t expected = (fun->args_[i] == 'S') ? BASIC_VALUE_TYPE_STRING : BASIC_VALUE_TYPE_NUMBER ;
+                    if (!infer_type(op->operand_.function_.args_[i], &left, err) || !check_type(left, expected, err))
+                        return false ;
+                }
+                *type = fun->type_ ;
+            }
+            break ;
 
-    basic_destroy_operand(expr->top_) ;
+        case BASIC_OPERAND_TYPE_USERFN:
+            for(uint32_t i = 0 ; i < op->operand_.userfn_.argcnt_ ; i++) {
+                if (!infer_type(op->operand_.userfn_.args_[i], &left, err))
+                    return false ;
+            }
+            *type = BASIC_EXPR_TYPE_ANY ;
+            break ;
 
-    if (exprs == expr) {
-        exprs = expr->next_ ;
-    }
-    else {
-        basic_expr_t *e = exprs ;
-        while (e != NULL && e->next_ != expr)
-            e = e->next_ ;
+        case BASIC_OPERAND_TYPE_BOUNDV:
+            *type = is_string_name(op->operand_.boundv_) ? BASIC_VALUE_TYPE_STRING : BASIC_VALUE_TYPE_NUMBER ;
+            break ;
 
-        assert(e != NULL) ;
-        e->next_ = expr->next_ ;
-    }
+        case BASIC_OPERAND_TYPE_OPERATOR:
+            if (!infer_type(op->operand_.operator_.left_, &left, err))
+                return false ;
+
+            if (op->operand_.operator_.operator_->unary) {
+                if (!check_type(left, BASIC_VALUE_TYPE_NUMBER, err))
+                    return false ;
+                *type = BASIC_VALUE_TYPE_NUMBER ;
+                break ;
+            }
 
+            if (!infer_type(op->operand_.operator_.right_, &right, err))
+                return false ;
 
-    free(expr) ;
+            switch(op->operand_.operator_.operator_->oper_)
+            {
+                case BASIC_OPERATOR_PLUS:
+                    if (left != BASIC_EXPR_TYPE_ANY && !check_type(right, left, err))
+                        return false ;
+                    *type = (left != BASIC_EXPR_TYPE_ANY) ? left : right ;
+                    break ;
+
+                case BASIC_OPERATOR_NOT_EQUAL:
+                case BASIC_OPERATOR_EQUAL:
+                case BASIC_OPERATOR_GREATER:
+                case BASIC_OPERATOR_GREATER_EQ:
+                case BASIC_OPERATOR_LESS:
+                case BASIC_OPERATOR_LESS_EQ:
+                    if (left != BASIC_EXPR_TYPE_ANY && !check_type(right, left, err))
+                        return false ;
+                    *type = BASIC_VALUE_TYPE_NUMBER ;
+                    break ;
+
+                default:
+                    if (!check_type(left, BASIC_VALUE_TYPE_NUMBER, err) || !check_type(right, BASIC_VALUE_TYPE_NUMBER, err))
+                        return false ;
+                    *type = BASIC_VALUE_TYPE_NUMBER ;
+                    break ;
+            }
+            break ;
+
+        default:
+            assert(false) ;
+            break ;
+    }
 
-    dump_expr_stack("after basic_expr_destroy") ;    
     return true ;
 }
 
-static basic_value_t *clone_value(basic_value_t *v)
+//
+// Returns true if an operand and everything below it is a number, so it can be
+// evaluated by basic_vm_eval_number()
+//
+static bool is_numeric(basic_operand_t *op)
 {
-    basic_value_t *ret ;
+    switch(op->type_)
+    {
+        case BASIC_OPERAND_TYPE_CONST:
+            return op->operand_.const_->type_ == BASIC_VALUE_TYPE_NUMBER ;
 
-    if (v->type_ == BASIC_VALUE_TYPE_NUMBER)
-        ret = basic_value_create_number(v->value.nvalue_) ;
-    else
-        ret = basic_value_create_string(v->value.svalue_) ;
+        case BASIC_OPERAND_TYPE_FOLDED:
+            return op->operand_.folded_.value_->type_ == BASIC_VALUE_TYPE_NUMBER ;
 
-    return ret;
-}
+        case BASIC_OPERAND_TYPE_VAR:
+            if (basic_var_is_string(op->operand_.var_.varidx_))
+                return false ;
 
-static basic_value_t *eval_plus(basic_value_t *left, basic_value_t *right, basic_err_t *err)
-{
-    basic_value_t *ret ;
+            for(int i = 0 ; i < op->operand_.var_.dimcnt_ ; i++) {
+                if (!is_numeric(op->operand_.var_.dims_[i]))
+                    return false ;
+            }
+            return true ;
 
-    if (left->type_ != right->type_) {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
+        case BASIC_OPERAND_TYPE_FUNCTION:
+            if (op->operand_.function_.func_->type_ != BASIC_VALUE_TYPE_NUMBER)
+                return false ;
 
-    if (left->type_ == BASIC_VALUE_TYPE_NUMBER) {
-        ret = basic_value_create_number(left->value.nvalue_ + right->value.nvalue_);
-    }
-    else {
-        char *combined  = (char *)malloc(strlen(left->value.svalue_) + strlen(right->value.svalue_) + 1) ;
-        if (combined == NULL) {
-            *err = BASIC_ERR_OUT_OF_MEMORY ;
-            return NULL ;
-        }
-        strcpy(combined, left->value.svalue_) ;
-        strcat(combined, right->value.svalue_) ;        
-        ret = create_string_value_keep(combined) ;
-        if (ret == NULL) {
-            free(combined) ;
-        }
-    }
+            for(int i = 0 ; i < op->operand_.function_.func_->num_args_ ; i++) {
+                if (!is_numeric(op->operand_.function_.args_[i]))
+                    return false ;
+            }
+            return true ;
 
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-    }
+        case BASIC_OPERAND_TYPE_OPERATOR:
+            if (!is_numeric(op->operand_.operator_.left_))
+                return false ;
+            return op->operand_.operator_.operator_->unary || is_numeric(op->operand_.operator_.right_) ;
 
-    return ret;
+        case BASIC_OPERAND_TYPE_BOUNDV:
+            return !is_string_name(op->operand_.boundv_) ;
+
+        default:
+            return false ;
+    }
 }
 
-static basic_value_t *eval_unary_minus(basic_value_t *left, basic_err_t *err)
+//
+// Returns true if an operand is an integer, so the VM keeps it as an int32_t.
+// These are A% variables, integer constants, + - * and the comparisons when both
+// sides are integers, and \ and MOD, which always give an integer.  Everything
+// else, including DEF FN arguments, is a number.
+//
+bool basic_operand_is_integer(basic_operand_t *op)
 {
-    basic_value_t *ret ;
+    basic_value_t *v ;
 
-    if (left->type_ != BASIC_VALUE_TYPE_NUMBER) {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
+    switch(op->type_)
+    {
+        case BASIC_OPERAND_TYPE_CONST:
+        case BASIC_OPERAND_TYPE_FOLDED:
+            v = (op->type_ == BASIC_OPERAND_TYPE_CONST) ? op->operand_.const_ : op->operand_.folded_.value_ ;
+            return v->type_ == BASIC_VALUE_TYPE_NUMBER && basic_num_fits_int(v->value.nvalue_) &&
+                    basic_num_from_int(basic_num_to_int(v->value.nvalue_)) == v->value.nvalue_ ;
 
-    ret = basic_value_create_number(-left->value.nvalue_);
+        case BASIC_OPERAND_TYPE_VAR:
+            return basic_var_is_integer(op->operand_.var_.varidx_) ;
 
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-    }
+        case BASIC_OPERAND_TYPE_OPERATOR:
+            switch(op->operand_.operator_.operator_->oper_)
+            {
+                case BASIC_OPERATOR_INT_DIVIDE:
+                case BASIC_OPERATOR_MOD:
+                    return true ;
+
+                case BASIC_OPERATOR_UNARY_MINUS:
+                    return basic_operand_is_integer(op->operand_.operator_.left_) ;
+
+                case BASIC_OPERATOR_PLUS:
+                case BASIC_OPERATOR_MINUS:
+                case BASIC_OPERATOR_TIMES:
+                case BASIC_OPERATOR_NOT_EQUAL:
+                case BASIC_OPERATOR_EQUAL:
+                case BASIC_OPERATOR_GREATER:
+                case BASIC_OPERATOR_GREATER_EQ:
+                case BASIC_OPERATOR_LESS:
+                case BASIC_OPERATOR_LESS_EQ:
+                    return basic_operand_is_integer(op->operand_.operator_.left_) &&
+                            basic_operand_is_integer(op->operand_.operator_.right_) ;
+
+                default:
+                    return false ;
+            }
 
-    return ret;    
+        default:
+            return false ;
+    }
 }
 
-static basic_value_t *eval_minus(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+//
+// Returns true if an operand only involves constants and functions whose result
+// depends only on their arguments
+//
+static bool is_constant(basic_operand_t *op)
 {
-    basic_value_t *ret ;
+    switch(op->type_)
+    {
+        case BASIC_OPERAND_TYPE_CONST:
+        case BASIC_OPERAND_TYPE_FOLDED:
+            return true ;
 
-    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
+        case BASIC_OPERAND_TYPE_OPERATOR:
+            if (!is_constant(op->operand_.operator_.left_))
+                return false ;
+            return op->operand_.operator_.operator_->unary || is_constant(op->operand_.operator_.right_) ;
+
+        case BASIC_OPERAND_TYPE_FUNCTION:
+            if (!op->operand_.function_.func_->pure_)
+                return false ;
 
-    ret = basic_value_create_number(left->value.nvalue_ - right->value.nvalue_);
+            for(int i = 0 ; i < op->operand_.function_.func_->num_args_ ; i++) {
+                if (!is_constant(op->operand_.function_.args_[i]))
+                    return false ;
+            }
+            return true ;
 
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        default:
+            return false ;
     }
-
-    return ret;
 }
 
-static basic_value_t *eval_times(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+//
+// Constant folding.  Each largest subtree that is constant, such as 2*3.14159/360
+// or CHR$(65), is evaluated once here and replaced by a folded node holding the
+// result.  The original subtree stays in the folded node so LIST shows what was
+// typed.  A subtree that fails to evaluate, such as 1/0, is left alone so that the
+// error is reported when the line runs, as it always has been.
+//
+static void fold_operand(basic_operand_t **opp)
 {
-    basic_value_t *ret ;
+    basic_operand_t *op = *opp ;
 
-    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
+    if (op->type_ == BASIC_OPERAND_TYPE_CONST || op->type_ == BASIC_OPERAND_TYPE_FOLDED)
+        return ;
 
-    ret = basic_value_create_number(left->value.nvalue_ * right->value.nvalue_);
+    if (is_constant(op)) {
+        basic_value_t result ;
+        basic_err_t err ;
 
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        if (!eval_node(op, 0, NULL, NULL, &result, &err))
+            return ;
+
+        basic_value_t *value = create_value_from(&result, &err) ;
+        if (value == NULL)
+            return ;
+
+        basic_operand_t *folded = (basic_operand_t *)basic_malloc(sizeof(basic_operand_t)) ;
+        if (folded == NULL) {
+            basic_value_destroy(value) ;
+            return ;
+        }
+
+        folded->type_ = BASIC_OPERAND_TYPE_FOLDED ;
+        folded->operand_.folded_.value_ = value ;
+        folded->operand_.folded_.orig_ = op ;
+        *opp = folded ;
+        return ;
     }
 
-    return ret;
+    switch(op->type_)
+    {
+        case BASIC_OPERAND_TYPE_OPERATOR:
+            fold_operand(&op->operand_.operator_.left_) ;
+            if (!op->operand_.operator_.operator_->unary)
+                fold_operand(&op->operand_.operator_.right_) ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_VAR:
+            for(int i = 0 ; i < op->operand_.var_.dimcnt_ ; i++)
+                fold_operand(&op->operand_.var_.dims_[i]) ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_FUNCTION:
+            for(int i = 0 ; i < op->operand_.function_.func_->num_args_ ; i++)
+                fold_operand(&op->operand_.function_.args_[i]) ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_USERFN:
+            for(uint32_t i = 0 ; i < op->operand_.userfn_.argcnt_ ; i++)
+                fold_operand(&op->operand_.userfn_.args_[i]) ;
+            break ;
+    }
 }
 
-static basic_value_t *eval_divide(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+const char *basic_expr_parse(const char *line, int argcnt, char **argnames, uint32_t *index, basic_err_t *err)
 {
-    basic_value_t *ret ;
+    basic_operand_t* op;
+    
+    line = parse_operand_top(line, argcnt, argnames, &op, err);
+    if (line == NULL)
+        return NULL ;
 
-    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
+    uint8_t type ;
+    if (!infer_type(op, &type, err)) {
+        basic_destroy_operand(op) ;
         return NULL ;
     }
 
-    if (right->value.nvalue_ == 0) {
-        *err = BASIC_ERR_DIVIDE_ZERO ;
+    fold_operand(&op) ;
+
+    //
+    // The expr is a simple operand
+    //
+    if (!create_expr(op, type, argcnt, argnames, index, err)) {
+        basic_destroy_operand(op) ;
         return NULL ;
     }
 
-    ret = basic_value_create_number(left->value.nvalue_ / right->value.nvalue_);
+    return line ;
+}
 
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-    }
+//
+// Returns true if op is V$ + X, or a chain of additions starting with V$ such as
+// V$ + X + Y, where V$ is the variable varidx
+//
+static bool is_append_chain(basic_operand_t *op, uint32_t varidx)
+{
+    if (op->type_ != BASIC_OPERAND_TYPE_OPERATOR || op->operand_.operator_.operator_->oper_ != BASIC_OPERATOR_PLUS)
+        return false ;
 
-    return ret;
+    basic_operand_t *left = op->operand_.operator_.left_ ;
+    if (left->type_ == BASIC_OPERAND_TYPE_VAR)
+        return left->operand_.var_.varidx_ == varidx && left->operand_.var_.dimcnt_ == 0 ;
+
+    return is_append_chain(left, varidx) ;
 }
 
-static basic_value_t *eval_power(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+//
+// Called by LET with the variable the expression is assigned to.  If this is a
+// string variable and the expression adds to it, as in A$ = A$ + X$, only the
+// part added is compiled, and LET appends it to the variable in place rather
+// than building a new string.  The whole tree is kept for LIST.
+//
+bool basic_expr_compile_append(uint32_t index, uint32_t varidx, basic_err_t *err)
 {
-    basic_value_t *ret ;
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    assert(expr != NULL) ;
 
-    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
+    if (!basic_var_is_string(varidx) || !is_append_chain(expr->top_, varidx))
+        return true ;
 
-    double p = pow(left->value.nvalue_, right->value.nvalue_);
-    ret = basic_value_create_number(p) ;
+    expr->append_ = true ;
 
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+#ifndef BASIC_EXPR_TREE_EVAL
+    uint8_t *code = expr->code_ ;
+    if (!basic_vm_compile(expr, 0, NULL, err)) {
+        expr->append_ = false ;
+        return false ;
     }
+    basic_free(code) ;
+#endif
 
-    return ret;
+    return true ;
 }
 
-static basic_value_t *eval_not_equal(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+bool basic_expr_is_append(uint32_t index)
 {
-    basic_value_t *ret = NULL ;
-    int p ;
-
-    if (left->type_ == BASIC_VALUE_TYPE_STRING && right->type_ == BASIC_VALUE_TYPE_STRING) 
-    {
-        p = (strcmp(left->value.svalue_, right->value.svalue_) != 0) ;
-    }
-    else if (left->type_ == BASIC_VALUE_TYPE_NUMBER && right->type_ == BASIC_VALUE_TYPE_NUMBER) 
-    {
-        p = (left->value.nvalue_ != right->value.nvalue_) ;
-    }
-    else 
-    {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
-
-    ret = basic_value_create_number(p) ;
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
-    }
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    assert(expr != NULL) ;
 
-    return ret;
+    return expr->append_ ;
 }
 
-static basic_value_t *eval_equal(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+//
+// Called by IF for its condition.  A numeric condition is compiled to leave the
+// integer 1 when IF takes it as true, so a comparison such as A < B compares the
+// two numbers and branches on the result without making a number of it.
+//
+bool basic_expr_compile_condition(uint32_t index, basic_err_t *err)
 {
-    basic_value_t *ret = NULL ;
-    int p ;
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    assert(expr != NULL) ;
 
-    if (left->type_ == BASIC_VALUE_TYPE_STRING && right->type_ == BASIC_VALUE_TYPE_STRING) 
-    {
-        p = (strcmp(left->value.svalue_, right->value.svalue_) == 0) ;
-    }
-    else if (left->type_ == BASIC_VALUE_TYPE_NUMBER && right->type_ == BASIC_VALUE_TYPE_NUMBER) 
-    {
-        p = (left->value.nvalue_ == right->value.nvalue_) ;
-    }
-    else 
-    {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
+    if (!expr->numeric_)
+        return true ;
 
-    ret = basic_value_create_number(p) ;
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+    expr->condition_ = true ;
+
+#ifndef BASIC_EXPR_TREE_EVAL
+    uint8_t *code = expr->code_ ;
+    if (!basic_vm_compile(expr, 0, NULL, err)) {
+        expr->condition_ = false ;
+        return false ;
     }
+    basic_free(code) ;
+#endif
 
-    return ret;
+    return true ;
 }
 
-static basic_value_t *eval_greater(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+//
+// Called by statements that need a value of a given type, such as LET and FOR, to
+// report a mismatch when the line is parsed.  An expression whose type is only
+// known when it runs is checked then.
+//
+bool basic_expr_check_type(uint32_t index, basic_value_type_t type, basic_err_t *err)
+{
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    assert(expr != NULL) ;
+
+    return check_type(expr->type_, (uint8_t)type, err) ;
+}
+
+basic_expr_t *get_expr_from_index(uint32_t index)
+{
+    return (basic_expr_t *)basic_htab_get(&exprs, index) ;
+}
+
+bool basic_expr_destroy(uint32_t index)
+{
+    dump_expr_stack("before basic_expr_destroy") ;
+
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    if (expr == NULL)
+        return false ;
+
+    basic_destroy_operand(expr->top_) ;
+    if (expr->code_ != NULL)
+        basic_free(expr->code_) ;
+
+    basic_htab_free(&exprs, index) ;
+
+    dump_expr_stack("after basic_expr_destroy") ;    
+    return true ;
+}
+
+static bool eval_plus(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
+{
+    if (left->type_ != right->type_) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
+    }
+
+    if (left->type_ == BASIC_VALUE_TYPE_NUMBER) {
+        set_number(ret, left->value.nvalue_ + right->value.nvalue_);
+    }
+    else {
+        char *combined = set_string_space(ret, left->length_ + right->length_, err) ;
+        if (combined == NULL)
+            return false ;
+
+        memcpy(combined, basic_value_chars(left), left->length_) ;
+        memcpy(combined + left->length_, basic_value_chars(right), right->length_) ;
+    }
+
+    return true ;
+}
+
+static bool eval_unary_minus(basic_value_t *left, basic_value_t *ret, basic_err_t *err)
+{
+    if (left->type_ != BASIC_VALUE_TYPE_NUMBER) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
+    }
+
+    set_number(ret, -left->value.nvalue_) ;
+    return true ;
+}
+
+static bool eval_minus(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
+{
+    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
+    }
+
+    set_number(ret, left->value.nvalue_ - right->value.nvalue_) ;
+    return true ;
+}
+
+static bool eval_times(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
+{
+    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
+    }
+
+    set_number(ret, basic_num_mul(left->value.nvalue_, right->value.nvalue_)) ;
+    return true ;
+}
+
+static bool eval_divide(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
+{
+    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
+    }
+
+    if (right->value.nvalue_ == 0) {
+        *err = BASIC_ERR_DIVIDE_ZERO ;
+        return false ;
+    }
+
+    set_number(ret, basic_num_div(left->value.nvalue_, right->value.nvalue_)) ;
+    return true ;
+}
+
+//
+// \ and MOD truncate both sides to integers, see basic_int_operator().  This is
+// also used for the other operators when both sides are integers.
+//
+static bool eval_int_operator(operator_type_t oper, basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
+{
+    int32_t l, r, p ;
+
+    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
+    }
+
+    if (!basic_num_get_int(left->value.nvalue_, &l, err) || !basic_num_get_int(right->value.nvalue_, &r, err))
+        return false ;
+
+    basic_num_t n ;
+    if (!basic_int_operator(oper, l, r, &p, err) || !basic_num_put_int(p, &n, err))
+        return false ;
+
+    set_number(ret, n) ;
+    return true ;
+}
+
+static bool eval_power(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
+{
+    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
+    }
+
+    basic_num_t p ;
+    if (basic_is_power_int(right->value.nvalue_))
+        p = basic_power_int(left->value.nvalue_, basic_num_to_int(right->value.nvalue_)) ;
+    else
+        p = basic_num_pow(left->value.nvalue_, right->value.nvalue_);
+    set_number(ret, p) ;
+    return true ;
+}
+
+//
+// Compare two strings the way strcmp() does
+//
+static int compare_strings(const basic_value_t *left, const basic_value_t *right)
+{
+    uint32_t len = left->length_ < right->length_ ? left->length_ : right->length_ ;
+
+    int ret = memcmp(basic_value_chars(left), basic_value_chars(right), len) ;
+    if (ret == 0)
+        ret = (left->length_ > right->length_) - (left->length_ < right->length_) ;
+
+    return ret ;
+}
+
+static bool eval_not_equal(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
 {
-    basic_value_t *ret ;
     int p ;
 
     if (left->type_ == BASIC_VALUE_TYPE_STRING && right->type_ == BASIC_VALUE_TYPE_STRING) 
     {
-        p = (strcmp(left->value.svalue_, right->value.svalue_) > 0) ;
+        p = (compare_strings(left, right) != 0) ;
     }
     else if (left->type_ == BASIC_VALUE_TYPE_NUMBER && right->type_ == BASIC_VALUE_TYPE_NUMBER) 
     {
-        p = (left->value.nvalue_ > right->value.nvalue_) ;
+        p = (left->value.nvalue_ != right->value.nvalue_) ;
     }
     else 
     {
         *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
-
-    ret = basic_value_create_number(p) ;
-
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
     }
 
-    return ret;
+    set_number(ret, basic_num_from_int(p)) ;
+    return true ;
 }
 
-static basic_value_t *eval_greater_eq(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+static bool eval_equal(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
 {
-    basic_value_t *ret ;
     int p ;
 
     if (left->type_ == BASIC_VALUE_TYPE_STRING && right->type_ == BASIC_VALUE_TYPE_STRING) 
     {
-        p = (strcmp(left->value.svalue_, right->value.svalue_) >= 0) ;
+        p = (compare_strings(left, right) == 0) ;
     }
     else if (left->type_ == BASIC_VALUE_TYPE_NUMBER && right->type_ == BASIC_VALUE_TYPE_NUMBER) 
     {
-        p = (left->value.nvalue_ >= right->value.nvalue_) ;
+        p = (left->value.nvalue_ == right->value.nvalue_) ;
     }
     else 
     {
         *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
-
-    ret = basic_value_create_number(p) ;
-
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
     }
 
-    return ret;
+    set_number(ret, basic_num_from_int(p)) ;
+    return true ;
 }
 
-static basic_value_t *eval_less(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+static bool eval_greater(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
 {
-    basic_value_t *ret ;
     int p ;
 
     if (left->type_ == BASIC_VALUE_TYPE_STRING && right->type_ == BASIC_VALUE_TYPE_STRING) 
     {
-        p = (strcmp(left->value.svalue_, right->value.svalue_) < 0) ;
+        p = (compare_strings(left, right) > 0) ;
     }
     else if (left->type_ == BASIC_VALUE_TYPE_NUMBER && right->type_ == BASIC_VALUE_TYPE_NUMBER) 
     {
-        p = (left->value.nvalue_ < right->value.nvalue_) ;
+        p = (left->value.nvalue_ > right->value.nvalue_) ;
     }
     else 
     {
         *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
-
-    ret = basic_value_create_number(p) ;
-
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
     }
 
-    return ret;
+    set_number(ret, basic_num_from_int(p)) ;
+    return true ;
 }
 
-static basic_value_t *eval_less_eq(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+static bool eval_greater_eq(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
 {
-    basic_value_t *ret ;
     int p ;
 
     if (left->type_ == BASIC_VALUE_TYPE_STRING && right->type_ == BASIC_VALUE_TYPE_STRING) 
     {
-        p = (strcmp(left->value.svalue_, right->value.svalue_) <= 0) ;
+        p = (compare_strings(left, right) >= 0) ;
     }
     else if (left->type_ == BASIC_VALUE_TYPE_NUMBER && right->type_ == BASIC_VALUE_TYPE_NUMBER) 
     {
-        p = (left->value.nvalue_ <= right->value.nvalue_) ;
+        p = (left->value.nvalue_ >= right->value.nvalue_) ;
     }
     else 
     {
         *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
-    }
-    ret = basic_value_create_number(p) ;
-
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
     }
 
-    return ret;
+    set_number(ret, basic_num_from_int(p)) ;
+    return true ;
 }
 
-static basic_value_t *eval_or(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+static bool eval_less(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
 {
-    basic_value_t *ret ;
+    int p ;
 
-    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
-        *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
+    if (left->type_ == BASIC_VALUE_TYPE_STRING && right->type_ == BASIC_VALUE_TYPE_STRING) 
+    {
+        p = (compare_strings(left, right) < 0) ;
     }
-
-    int l = fabs(left->value.nvalue_) > 1e-6 ;
-    int r = fabs(right->value.nvalue_) > 1e-6 ;
-    double p = (l || r) ;
-    ret = basic_value_create_number(p) ;
-
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+    else if (left->type_ == BASIC_VALUE_TYPE_NUMBER && right->type_ == BASIC_VALUE_TYPE_NUMBER) 
+    {
+        p = (left->value.nvalue_ < right->value.nvalue_) ;
+    }
+    else 
+    {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
     }
 
-    return ret;
+    set_number(ret, basic_num_from_int(p)) ;
+    return true ;
 }
 
-static basic_value_t *eval_and(basic_value_t *left, basic_value_t *right, basic_err_t *err)
+static bool eval_less_eq(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
 {
-    basic_value_t *ret ;
+    int p ;
 
-    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
+    if (left->type_ == BASIC_VALUE_TYPE_STRING && right->type_ == BASIC_VALUE_TYPE_STRING) 
+    {
+        p = (compare_strings(left, right) <= 0) ;
+    }
+    else if (left->type_ == BASIC_VALUE_TYPE_NUMBER && right->type_ == BASIC_VALUE_TYPE_NUMBER) 
+    {
+        p = (left->value.nvalue_ <= right->value.nvalue_) ;
+    }
+    else 
+    {
         *err = BASIC_ERR_TYPE_MISMATCH ;
-        return NULL ;
+        return false ;
     }
+    set_number(ret, basic_num_from_int(p)) ;
+    return true ;
+}
 
-    int l = fabs(left->value.nvalue_) > 1e-6 ;
-    int r = fabs(right->value.nvalue_) > 1e-6 ;
-    double p = (l && r) ;
-    ret = basic_value_create_number(p) ;
-
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+static bool eval_or(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
+{
+    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
     }
 
-    return ret;
+    int l = basic_num_is_true(left->value.nvalue_) ;
+    int r = basic_num_is_true(right->value.nvalue_) ;
+    int p = (l || r) ;
+    set_number(ret, basic_num_from_int(p)) ;
+    return true ;
 }
 
-static basic_value_t *eval_unary_operator(operator_table_t *oper, int vcnt, char **names, basic_value_t **values, basic_operand_t *left, basic_err_t *err)
+static bool eval_and(basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
 {
-    basic_value_t* ret = NULL;
-    basic_value_t *leftval ;
-
-    leftval = eval_node(left,  vcnt, names, values, err) ;
-    if (leftval == NULL)
-        return NULL ;
-
-    switch(oper->oper_) 
-    {
-        case BASIC_OPERATOR_UNARY_MINUS:
-            ret = eval_unary_minus(leftval, err) ;
-            break ;    
-        default:
-            assert(false) ;
-            break ;            
+    if (left->type_ == BASIC_VALUE_TYPE_STRING || right->type_ == BASIC_VALUE_TYPE_STRING) {
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
     }
 
-    basic_value_destroy(leftval) ;
-    return ret;    
+    int l = basic_num_is_true(left->value.nvalue_) ;
+    int r = basic_num_is_true(right->value.nvalue_) ;
+    int p = (l && r) ;
+    set_number(ret, basic_num_from_int(p)) ;
+    return true ;
 }
 
-static basic_value_t *eval_operator(operator_table_t *oper, int vcnt, char **names, basic_value_t **values, basic_operand_t *left, basic_operand_t *right, basic_err_t *err)
+bool basic_expr_apply_operator(operator_type_t oper, basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err)
 {
-    basic_value_t* ret = NULL;
-    basic_value_t *leftval, *rightval ;
-
-    leftval = eval_node(left,  vcnt, names, values, err) ;
-    if (leftval == NULL)
-        return NULL ;
-
-    rightval = eval_node(right,  vcnt, names, values, err) ;
-    if (rightval == NULL) {
-        basic_value_destroy(leftval) ;
-        return NULL ;
-    }
+    bool ok = false ;
 
-    switch(oper->oper_) {
+    switch(oper) {
 
         case BASIC_OPERATOR_PLUS:
-            ret = eval_plus(leftval, rightval, err) ;
+            ok = eval_plus(left, right, ret, err) ;
             break ;
         case BASIC_OPERATOR_MINUS:
-            ret = eval_minus(leftval, rightval, err) ;
+            ok = eval_minus(left, right, ret, err) ;
             break ;
         case BASIC_OPERATOR_TIMES:
-            ret = eval_times(leftval, rightval, err) ;
+            ok = eval_times(left, right, ret, err) ;
             break ;
         case BASIC_OPERATOR_DIVIDE:
-            ret = eval_divide(leftval, rightval, err) ;
+            ok = eval_divide(left, right, ret, err) ;
             break ;      
+        case BASIC_OPERATOR_INT_DIVIDE:
+        case BASIC_OPERATOR_MOD:
+            ok = eval_int_operator(oper, left, right, ret, err) ;
+            break ;
         case BASIC_OPERATOR_POWER:
-            ret = eval_power(leftval, rightval, err) ;
+            ok = eval_power(left, right, ret, err) ;
             break ;
         case BASIC_OPERATOR_NOT_EQUAL:
-            ret = eval_not_equal(leftval, rightval, err) ;
+            ok = eval_not_equal(left, right, ret, err) ;
             break ;        
         case BASIC_OPERATOR_EQUAL:
-            ret = eval_equal(leftval, rightval, err) ;
+            ok = eval_equal(left, right, ret, err) ;
             break ;        
         case BASIC_OPERATOR_GREATER:
-            ret = eval_greater(leftval, rightval, err) ;
+            ok = eval_greater(left, right, ret, err) ;
             break ;        
         case BASIC_OPERATOR_GREATER_EQ:
-            ret = eval_greater_eq(leftval, rightval, err) ;
+            ok = eval_greater_eq(left, right, ret, err) ;
             break ;        
         case BASIC_OPERATOR_LESS:
-            ret = eval_less(leftval, rightval, err) ;
+            ok = eval_less(left, right, ret, err) ;
             break ;        
         case BASIC_OPERATOR_LESS_EQ:
-            ret = eval_less_eq(leftval, rightval, err) ;
+            ok = eval_less_eq(left, right, ret, err) ;
             break ;        
         case BASIC_OPERATOR_OR:
-            ret = eval_or(leftval, rightval, err) ;
+            ok = eval_or(left, right, ret, err) ;
             break ;        
         case BASIC_OPERATOR_AND:
-            ret = eval_and(leftval, rightval, err) ;
+            ok = eval_and(left, right, ret, err) ;
             break ;        
+        case BASIC_OPERATOR_UNARY_MINUS:
+            ok = eval_unary_minus(left, ret, err) ;
+            break ;    
         default:
             assert(false) ;
             break ;
     }
 
-    basic_value_destroy(leftval) ;
-    basic_value_destroy(rightval) ;
-    return ret;
+    return ok ;
+}
+
+//
+// An operator whose operands are integers, see basic_operand_is_integer(), is done
+// on integers as the VM does it, so it overflows in the same places
+//
+static bool eval_unary_operator(operator_table_t *oper, bool integer, int vcnt, char **names, basic_value_t *values, basic_operand_t *left, basic_value_t *ret, basic_err_t *err)
+{
+    basic_value_t leftval ;
+    bool ok ;
+
+    if (!eval_node(left,  vcnt, names, values, &leftval, err))
+        return false ;
+
+    if (integer)
+        ok = eval_int_operator(oper->oper_, &leftval, &leftval, ret, err) ;
+    else
+        ok = basic_expr_apply_operator(oper->oper_, &leftval, NULL, ret, err) ;
+
+    basic_value_release(&leftval) ;
+    return ok ;
+}
+
+static bool eval_operator(operator_table_t *oper, bool integer, int vcnt, char **names, basic_value_t *values, basic_operand_t *left, basic_operand_t *right, basic_value_t *ret, basic_err_t *err)
+{
+    basic_value_t leftval, rightval ;
+    bool ok ;
+
+    if (!eval_node(left,  vcnt, names, values, &leftval, err))
+        return false ;
+
+    //
+    // The right side of AND and OR is not evaluated when the left side decides
+    // the result
+    //
+    if ((oper->oper_ == BASIC_OPERATOR_AND || oper->oper_ == BASIC_OPERATOR_OR) && leftval.type_ == BASIC_VALUE_TYPE_NUMBER) {
+        bool l = basic_num_is_true(leftval.value.nvalue_) ;
+        if (l == (oper->oper_ == BASIC_OPERATOR_OR)) {
+            set_number(ret, basic_num_from_int(l)) ;
+            return true ;
+        }
+    }
+
+    if (!eval_node(right,  vcnt, names, values, &rightval, err)) {
+        basic_value_release(&leftval) ;
+        return false ;
+    }
+
+    if (integer)
+        ok = eval_int_operator(oper->oper_, &leftval, &rightval, ret, err) ;
+    else
+        ok = basic_expr_apply_operator(oper->oper_, &leftval, &rightval, ret, err) ;
+
+    basic_value_release(&leftval) ;
+    basic_value_release(&rightval) ;
+    return ok ;
 }
 
-static basic_value_t *lookup_userfn_value(const char *name, uint32_t cnt, char **names, basic_value_t **values)
+static basic_value_t *lookup_userfn_value(const char *name, uint32_t cnt, char **names, basic_value_t *values)
 {
     for(uint32_t i = 0 ; i < cnt ; i++) {
         if (_stricmp(name, names[i]) == 0) {
-            return values[i] ;
+            return &values[i] ;
         }
     }
 
     return NULL ;
 }
 
-static basic_value_t *eval_node(basic_operand_t *op, int vcnt, char **names, basic_value_t **values, basic_err_t *err)
+static void release_values(int count, basic_value_t *values)
+{
+    for (int i = 0; i < count; i++) {
+        basic_value_release(&values[i]);
+    }
+}
+
+//
+// Evaluate a node of the parse tree.  Numbers are returned by value and strings
+// may be borrowed from a constant, a variable, or an argument, so the caller must
+// call basic_value_release() on the result when it is done with it.
+//
+static bool eval_node(basic_operand_t *op, int vcnt, char **names, basic_value_t *values, basic_value_t *ret, basic_err_t *err)
 {
-    basic_value_t *ret = NULL ;
+    basic_value_t argvals[BASIC_MAX_DEFFN_ARGS] ;
     uint32_t dims[BASIC_MAX_DIMS];
+    bool ok = false ;
 
     switch(op->type_)
     {
         case BASIC_OPERAND_TYPE_CONST:
-            ret = clone_value(op->operand_.const_) ;
+            *ret = *op->operand_.const_ ;
+            ret->owned_ = false ;
+            ok = true ;
+            break ;
+        case BASIC_OPERAND_TYPE_FOLDED:
+            *ret = *op->operand_.folded_.value_ ;
+            ret->owned_ = false ;
+            ok = true ;
             break ;
         case BASIC_OPERAND_TYPE_OPERATOR:
             if (op->operand_.operator_.operator_->unary)
             {
-                ret = eval_unary_operator(op->operand_.operator_.operator_, 
+                ok = eval_unary_operator(op->operand_.operator_.operator_, basic_operand_is_integer(op),
                                     vcnt, names, values,
-                                    op->operand_.operator_.left_, err) ;
+                                    op->operand_.operator_.left_, ret, err) ;
             }
             else
             {
-                ret = eval_operator(op->operand_.operator_.operator_, 
+                ok = eval_operator(op->operand_.operator_.operator_, basic_operand_is_integer(op),
                                     vcnt, names, values,
                                     op->operand_.operator_.left_,
-                                    op->operand_.operator_.right_, err) ;
+                                    op->operand_.operator_.right_, ret, err) ;
             }
             break; 
         case BASIC_OPERAND_TYPE_VAR:
             {
-                uint32_t varidx ;
-                const char *varname = basic_str_value(op->operand_.var_.varname_);
-                assert(varname != NULL) ;
+                for (int i = 0; i < op->operand_.var_.dimcnt_; i++) {
+                    basic_operand_t *dimexpr = op->operand_.var_.dims_[i];
+                    basic_value_t dimval ;
+                    
+                    if (!eval_node(dimexpr,  0, NULL, NULL, &dimval, err))
+                        return false ;
+
+                    if (dimval.type_ == BASIC_VALUE_TYPE_STRING) {
+                        basic_value_release(&dimval);
+                        *err = BASIC_ERR_TYPE_MISMATCH;
+                        return false ;
+                    }
 
-                if (!basic_var_get(varname, &varidx, err))
-                    return NULL ;
+                    dims[i] = basic_num_to_int(dimval.value.nvalue_);
+                }
 
-                if (op->operand_.var_.dimcnt_ == 0) {
-                    basic_value_t* val = basic_var_get_value(varidx);
-                    if (val == NULL) {
-                        if (varname[strlen(varname) - 1] == '$') 
-                        {
-                            val = basic_value_create_string("");
-                        }
-                        else 
-                        {
-                            val = basic_value_create_number(0);
-                        }
-                        basic_var_set_value(varidx, val, err) ;
-                    }
-                    ret = clone_value(val);
-                }
-                else {
-                    //
-                    // We create a new value here since the storage is just the values and not a
-                    // basic_value_t object.
-                    //
-                    for (int i = 0; i < op->operand_.var_.dimcnt_; i++) {
-                        basic_operand_t *dimexpr = op->operand_.var_.dims_[i];
-                        basic_value_t* dimval = eval_node(dimexpr,  0, NULL, NULL, err);
-                        if (dimval == NULL)
-                            return NULL ;
-
-                        if (dimval->type_ == BASIC_VALUE_TYPE_STRING) {
-                            *err = BASIC_ERR_TYPE_MISMATCH;
-                            return NULL ;
-                        }
-
-                        dims[i] = (int)dimval->value.nvalue_;
-                        basic_value_destroy(dimval);
-                    }
-
-                    ret = basic_var_get_array_value(varidx, dims, err) ;
-                }
+                ok = basic_var_read(op->operand_.var_.varidx_, op->operand_.var_.dimcnt_, dims, ret, err) ;
             }
             break; 
 
         case BASIC_OPERAND_TYPE_FUNCTION:
             {
                 int argcnt = op->operand_.function_.func_->num_args_;
-                basic_value_t** argvals = (basic_value_t**)malloc(sizeof(basic_value_t*) * argcnt);
-                if (argvals == NULL) {
-                    *err = BASIC_ERR_OUT_OF_MEMORY;
-                    return NULL;
-                }
+                assert(argcnt <= BASIC_MAX_DEFFN_ARGS) ;
 
                 for (int i = 0; i < argcnt ; i++) {
                     basic_operand_t* argexpr = op->operand_.function_.args_[i];
-                    argvals[i] = eval_node(argexpr,  vcnt, names, values, err);
-                    if (argvals[i] == NULL)
-                        return NULL;
-                }
-
-                ret = op->operand_.function_.func_->eval_(argcnt, argvals, err);
-                for (int i = 0; i < argcnt; i++) {
-                    basic_value_destroy(argvals[i]);
+                    if (!eval_node(argexpr,  vcnt, names, values, &argvals[i], err)) {
+                        release_values(i, argvals) ;
+                        return false;
+                    }
                 }
 
-                free(argvals);
+                ok = op->operand_.function_.func_->eval_(argcnt, argvals, ret, err);
+                release_values(argcnt, argvals) ;
             }
             break;
 
         case BASIC_OPERAND_TYPE_USERFN:
             {
-                int argcnt = op->operand_.userfn_.func_->argcnt_;
-                basic_value_t** argvals = (basic_value_t**)malloc(sizeof(basic_value_t*) * argcnt);
-                if (argvals == NULL) {
-                    *err = BASIC_ERR_OUT_OF_MEMORY;
-                    return NULL;
-                }
+                basic_expr_user_fn_t *fn = op->operand_.userfn_.func_ ;
+                int argcnt = fn->argcnt_;
 
                 for (int i = 0; i < argcnt ; i++) {
                     basic_operand_t* argexpr = op->operand_.userfn_.args_[i];
-                    argvals[i] = eval_node(argexpr,  0, NULL, NULL, err);
-                    if (argvals[i] == NULL)
-                        return NULL;
+                    if (!eval_node(argexpr,  0, NULL, NULL, &argvals[i], err)) {
+                        release_values(i, argvals) ;
+                        return false;
+                    }
                 }
 
-                ret = basic_expr_eval(op->operand_.userfn_.func_->expridx_,
-                                      op->operand_.userfn_.func_->argcnt_,
-                                      op->operand_.userfn_.func_->args_, 
-                                      argvals, err);
-                for (int i = 0; i < argcnt; i++) {
-                    basic_value_destroy(argvals[i]);
-                }
-                free(argvals);
+                basic_expr_t *expr = get_expr_from_index(fn->expridx_) ;
+                ok = eval_node(expr->top_, argcnt, fn->args_, argvals, ret, err) ;
+
+                //
+                // The result may be borrowed from one of the arguments, which are
+                // about to go away
+                //
+                if (ok)
+                    ok = basic_value_own(ret, err) ;
+
+                release_values(argcnt, argvals) ;
             }
             break ;
 
@@ -2697,33 +3669,188 @@ static basic_value_t *eval_node(basic_operand_t *op, int vcnt, char **names, bas
                 basic_value_t *v = lookup_userfn_value(op->operand_.boundv_, vcnt, names, values) ;
                 if (v == NULL) {
                     *err = BASIC_ERR_UNBOUND_LOCAL_VAR ;
-                    ret = NULL ;
                 }
                 else {
-                    ret = clone_value(v);
+                    *ret = *v ;
+                    ret->owned_ = false ;
+                    ok = true ;
                 }
             }
             break ;        
     }
 
 #ifdef _PRINT_EVALS_
-    uint32_t strh = basic_str_create() ;
-    basic_operand_to_string(NULL, op, strh);
-    basic_str_add_str(strh, "=");
-    value_to_string(strh, ret);
-    const char *strval = basic_str_value(strh);
-    printf("%s\n", strval);
+    if (ok) {
+        uint32_t strh = basic_str_create() ;
+        basic_operand_to_string(NULL, op, strh);
+        basic_str_add_str(strh, "=");
+        value_to_string(strh, ret);
+        const char *strval = basic_str_value(strh);
+        printf("%s\n", strval);
+    }
 #endif
 
-    return ret ;
+    return ok ;
+}
+
+#ifdef BASIC_EXPR_TREE_EVAL
+//
+// Evaluate the part of V$ + X + Y that is added to V$, see basic_expr_compile_append()
+//
+static bool eval_append(basic_operand_t *op, basic_value_t *ret, basic_err_t *err)
+{
+    basic_operand_t *left = op->operand_.operator_.left_ ;
+    basic_operand_t *right = op->operand_.operator_.right_ ;
+
+    if (left->type_ == BASIC_OPERAND_TYPE_VAR)
+        return eval_node(right, 0, NULL, NULL, ret, err) ;
+
+    basic_value_t leftval, rightval ;
+    bool ok ;
+
+    if (!eval_append(left, &leftval, err))
+        return false ;
+
+    if (!eval_node(right, 0, NULL, NULL, &rightval, err)) {
+        basic_value_release(&leftval) ;
+        return false ;
+    }
+
+    ok = basic_expr_apply_operator(BASIC_OPERATOR_PLUS, &leftval, &rightval, ret, err) ;
+
+    basic_value_release(&leftval) ;
+    basic_value_release(&rightval) ;
+    return ok ;
+}
+#endif
+
+static bool eval_expr(basic_expr_t *expr, uint32_t cntv, char **names, basic_value_t *values, basic_value_t *ret, basic_err_t *err)
+{
+#ifdef BASIC_EXPR_TREE_EVAL
+    if (expr->append_)
+        return eval_append(expr->top_, ret, err) ;
+
+    return eval_node(expr->top_, cntv, names, values, ret, err) ;
+#else
+    if (expr->numeric_) {
+        basic_num_t d ;
+
+        if (!basic_vm_eval_number(expr, cntv, values, &d, err))
+            return false ;
+
+        set_number(ret, d) ;
+        return true ;
+    }
+
+    return basic_vm_eval(expr, cntv, values, ret, err) ;
+#endif
+}
+
+bool basic_expr_eval_value(uint32_t index, basic_value_t *value, basic_err_t *err)
+{
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    assert(expr != NULL) ;
+
+    return eval_expr(expr, 0, NULL, NULL, value, err) ;
+}
+
+bool basic_expr_eval_number(uint32_t index, basic_num_t *value, basic_err_t *err)
+{
+    basic_value_t val ;
+
+#ifndef BASIC_EXPR_TREE_EVAL
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    assert(expr != NULL) ;
+
+    if (expr->numeric_)
+        return basic_vm_eval_number(expr, 0, NULL, value, err) ;
+#endif
+
+    if (!basic_expr_eval_value(index, &val, err))
+        return false ;
+
+    if (val.type_ != BASIC_VALUE_TYPE_NUMBER) {
+        basic_value_release(&val) ;
+        *err = BASIC_ERR_TYPE_MISMATCH ;
+        return false ;
+    }
+
+    *value = val.value.nvalue_ ;
+    return true ;
+}
+
+//
+// Evaluate an expression for an A% variable or an array index.  An integer
+// expression runs entirely on integers, anything else is evaluated as a number
+// and truncated.
+//
+bool basic_expr_eval_int(uint32_t index, int32_t *value, basic_err_t *err)
+{
+    basic_num_t num ;
+
+#ifndef BASIC_EXPR_TREE_EVAL
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    assert(expr != NULL) ;
+
+    if (expr->integer_)
+        return basic_vm_eval_int(expr, value, err) ;
+#endif
+
+    if (!basic_expr_eval_number(index, &num, err))
+        return false ;
+
+    return basic_num_get_int(num, value, err) ;
+}
+
+//
+// Evaluate the condition of an IF.  As IF has always done, a value less than
+// BASIC_NUM_EPSILON is false, so a negative number is false as well as zero.
+//
+bool basic_expr_eval_condition(uint32_t index, bool *value, basic_err_t *err)
+{
+    basic_num_t num ;
+
+#ifndef BASIC_EXPR_TREE_EVAL
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    assert(expr != NULL) ;
+
+    if (expr->condition_)
+        return basic_vm_eval_condition(expr, value, err) ;
+#endif
+
+    if (!basic_expr_eval_number(index, &num, err))
+        return false ;
+
+    *value = (num >= BASIC_NUM_EPSILON) ;
+    return true ;
+}
+
+bool basic_expr_is_integer(uint32_t index)
+{
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    assert(expr != NULL) ;
+
+    return expr->integer_ ;
 }
 
 basic_value_t *basic_expr_eval(uint32_t index, uint32_t cntv, char **names, basic_value_t **values, basic_err_t *err)
 {
+    basic_value_t args[BASIC_MAX_DEFFN_ARGS] ;
+    basic_value_t val ;
+
     basic_expr_t *expr = get_expr_from_index(index) ;
     assert(expr != NULL) ;
+    assert(cntv <= BASIC_MAX_DEFFN_ARGS) ;
+
+    for(uint32_t i = 0 ; i < cntv ; i++) {
+        args[i] = *values[i] ;
+        args[i].owned_ = false ;
+    }
+
+    if (!eval_expr(expr, cntv, names, args, &val, err))
+        return NULL ;
 
-    return eval_node(expr->top_, cntv, names, values, err) ;
+    return create_value_from(&val, err) ;
 }
 
 uint32_t basic_expr_to_string(uint32_t index)
@@ -2746,10 +3873,13 @@ uint32_t basic_expr_to_string(uint32_t index)
 #ifdef DEBUG
 void basic_expr_dump()
 {
-    for (basic_expr_t* expr = exprs; expr != NULL; expr = expr->next_) {
+    basic_expr_t *expr ;
+    uint32_t iter = 0 ;
+
+    while ((expr = (basic_expr_t *)basic_htab_next(&exprs, &iter, NULL)) != NULL) {
         uint32_t exprhand = basic_expr_to_string(expr->index_);
         const char* exprstr = basic_str_value(exprhand);
-        printf("%ld: '%s'\n", expr->index_, exprstr);
+        printf("%08lx: '%s'\n", (unsigned long)expr->index_, exprstr);
         basic_str_destroy(exprhand);
     }
 }
@@ -2762,25 +3892,27 @@ void basic_expr_clear_all()
     basic_expr_dump();
 #endif
 
-    while (exprs) {
-        basic_expr_destroy(exprs->index_);
+    basic_expr_t *expr ;
+    uint32_t iter = 0 ;
+
+    while ((expr = (basic_expr_t *)basic_htab_next(&exprs, &iter, NULL)) != NULL) {
+        basic_expr_destroy(expr->index_);
     }
+
+    basic_htab_reset(&exprs) ;
 }
 
 basic_expr_user_fn_t* get_user_fn_from_index(uint32_t index)
 {
-    for (basic_expr_user_fn_t* fn = userfns; fn != NULL; fn = fn->next_)
-    {
-        if (fn->index_ == index)
-            return fn;
-    }
-
-    return NULL;
+    return (basic_expr_user_fn_t *)basic_htab_get(&userfns, index) ;
 }
 
 static basic_expr_user_fn_t* get_user_fn_from_name(const char *name)
 {
-    for (basic_expr_user_fn_t* fn = userfns; fn != NULL; fn = fn->next_)
+    basic_expr_user_fn_t* fn ;
+    uint32_t iter = 0 ;
+
+    while ((fn = (basic_expr_user_fn_t *)basic_htab_next(&userfns, &iter, NULL)) != NULL)
     {
         if (_stricmp(name, fn->name_) == 0)
             return fn ;
@@ -2791,21 +3923,19 @@ static basic_expr_user_fn_t* get_user_fn_from_name(const char *name)
 
 bool basic_userfn_bind(char* fnname, uint32_t argcnt, char** argnames, uint32_t exprindex, uint32_t *fnindex, basic_err_t* err)
 {
-    basic_expr_user_fn_t* ufn = (basic_expr_user_fn_t*)malloc(sizeof(basic_expr_user_fn_t));
+    uint32_t handle ;
+    basic_expr_user_fn_t* ufn = (basic_expr_user_fn_t*)basic_htab_alloc(&userfns, &handle);
     if (ufn == NULL)
         return false;
 
-    ufn->index_ = next_user_fn_index++;
-    ufn->next_ = userfns;
-    userfns = ufn;
-
+    ufn->index_ = handle;
     ufn->name_ = fnname;
     ufn->argcnt_ = argcnt;
     ufn->expridx_ = exprindex;
 
-    ufn->args_ = (char **)malloc(sizeof(char *) * argcnt);
+    ufn->args_ = (char **)basic_malloc(sizeof(char *) * argcnt);
     if (ufn->args_ == NULL) {
-        free(ufn) ;
+        basic_htab_free(&userfns, handle) ;
         return false;
     }
 
@@ -2844,33 +3974,515 @@ bool basic_userfn_destroy(uint32_t index)
     if (ufn == NULL)
         return false;
 
-    if (userfns == ufn) {
-        userfns = userfns->next_;
-    }
-    else {
-        basic_expr_user_fn_t* f = userfns;
-        while (f != NULL && f->next_ != ufn)
-            f = f->next_;
-
-        assert(f != NULL);
-        f->next_ = ufn->next_;
-    }
-
     for (uint32_t i = 0; i < ufn->argcnt_; i++) {
-        free(ufn->args_[i]);
+        basic_free(ufn->args_[i]);
     }
 
     basic_expr_destroy(ufn->expridx_);
-    free(ufn->name_);
-    free(ufn->args_);
-    free(ufn);
+    basic_free(ufn->name_);
+    basic_free(ufn->args_);
+    basic_htab_free(&userfns, index);
 
     return true;
 }
 
 void basic_userfn_clear_all()
 {
-    while (userfns) {
-        basic_userfn_destroy(userfns->index_) ;
+    basic_expr_user_fn_t* fn ;
+    uint32_t iter = 0 ;
+
+    while ((fn = (basic_expr_user_fn_t *)basic_htab_next(&userfns, &iter, NULL)) != NULL) {
+        basic_userfn_destroy(fn->index_) ;
+    }
+
+    basic_htab_reset(&userfns) ;
+}
+
+//
+// An expression in a program image is its type, whether basic_expr_compile_append()
+// or basic_expr_compile_condition() compiled it, and its tree written top down.
+// Each operand is its type followed by
+//
+//   CONST      the value
+//   VAR        the variable, its name as it was typed and its subscripts
+//   OPERATOR   the operator and its operands
+//   FUNCTION   the index of the function in functions[] and its arguments
+//   USERFN     the DEF FN and its arguments
+//   BOUNDV     the index of the DEF FN argument
+//   FOLDED     the value and the operand it was folded from
+//
+// A value is its type followed by the basic_num_t or the string.
+//
+#define IMG_EXPR_APPEND                 (0x01)
+#define IMG_EXPR_CONDITION              (0x02)
+
+//
+// Add the operators and functions to the hash of the tables a program image
+// depends on, since operators are saved by their type and functions by their
+// index in functions[]
+//
+uint32_t basic_expr_img_tables(uint32_t hash)
+{
+    for(int i = 0 ; i < sizeof(operators) / sizeof(operators[0]) ; i++) {
+        uint8_t oper = (uint8_t)operators[i].oper_ ;
+        hash = basic_img_hash(hash, &oper, 1) ;
+        hash = basic_img_hash(hash, operators[i].string_, (uint32_t)strlen(operators[i].string_) + 1) ;
+    }
+
+    for(int i = 0 ; i < sizeof(functions) / sizeof(functions[0]) ; i++) {
+        uint8_t args = (uint8_t)functions[i].num_args_ ;
+        hash = basic_img_hash(hash, &args, 1) ;
+        hash = basic_img_hash(hash, functions[i].string_, (uint32_t)strlen(functions[i].string_) + 1) ;
     }
+
+    return hash ;
+}
+
+static void img_write_value(basic_img_writer_t *w, basic_value_t *value)
+{
+    basic_img_put_u8(w, value->type_) ;
+    if (value->type_ == BASIC_VALUE_TYPE_NUMBER)
+        basic_img_put(w, &value->value.nvalue_, sizeof(basic_num_t)) ;
+    else
+        basic_img_put_str(w, basic_value_chars(value), value->length_) ;
+}
+
+static bool img_write_operand(basic_img_writer_t *w, basic_operand_t *op, int argcnt, char **argnames)
+{
+    const char *name ;
+    int i ;
+
+    basic_img_put_u8(w, op->type_) ;
+
+    switch(op->type_)
+    {
+        case BASIC_OPERAND_TYPE_CONST:
+            img_write_value(w, op->operand_.const_) ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_VAR:
+            name = basic_str_value(op->operand_.var_.varname_) ;
+            basic_img_put_u32(w, op->operand_.var_.varidx_) ;
+            basic_img_put_str(w, name, (uint32_t)strlen(name)) ;
+            basic_img_put_u8(w, (uint8_t)op->operand_.var_.dimcnt_) ;
+            for(i = 0 ; i < op->operand_.var_.dimcnt_ ; i++) {
+                if (!img_write_operand(w, op->operand_.var_.dims_[i], argcnt, argnames))
+                    return false ;
+            }
+            break ;
+
+        case BASIC_OPERAND_TYPE_OPERATOR:
+            basic_img_put_u8(w, (uint8_t)op->operand_.operator_.operator_->oper_) ;
+            if (!img_write_operand(w, op->operand_.operator_.left_, argcnt, argnames))
+                return false ;
+            if (!op->operand_.operator_.operator_->unary && !img_write_operand(w, op->operand_.operator_.right_, argcnt, argnames))
+                return false ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_FUNCTION:
+            basic_img_put_u8(w, (uint8_t)(op->operand_.function_.func_ - functions)) ;
+            for(i = 0 ; i < op->operand_.function_.func_->num_args_ ; i++) {
+                if (!img_write_operand(w, op->operand_.function_.args_[i], argcnt, argnames))
+                    return false ;
+            }
+            break ;
+
+        case BASIC_OPERAND_TYPE_USERFN:
+            basic_img_put_u32(w, op->operand_.userfn_.func_->index_) ;
+            for(uint32_t j = 0 ; j < op->operand_.userfn_.argcnt_ ; j++) {
+                if (!img_write_operand(w, op->operand_.userfn_.args_[j], argcnt, argnames))
+                    return false ;
+            }
+            break ;
+
+        case BASIC_OPERAND_TYPE_BOUNDV:
+            for(i = 0 ; i < argcnt ; i++) {
+                if (_stricmp(op->operand_.boundv_, argnames[i]) == 0)
+                    break ;
+            }
+
+            if (i == argcnt)
+                return false ;
+
+            basic_img_put_u8(w, (uint8_t)i) ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_FOLDED:
+            img_write_value(w, op->operand_.folded_.value_) ;
+            return img_write_operand(w, op->operand_.folded_.orig_, argcnt, argnames) ;
+
+        default:
+            return false ;
+    }
+
+    return w->err_ == BASIC_ERR_NONE ;
+}
+
+bool basic_expr_img_write(basic_img_writer_t *w, uint32_t index, int argcnt, char **argnames)
+{
+    basic_expr_t *expr = get_expr_from_index(index) ;
+    if (expr == NULL)
+        return false ;
+
+    basic_img_put_u8(w, expr->type_) ;
+    basic_img_put_u8(w, (expr->append_ ? IMG_EXPR_APPEND : 0) | (expr->condition_ ? IMG_EXPR_CONDITION : 0)) ;
+
+    return img_write_operand(w, expr->top_, argcnt, argnames) ;
+}
+
+static basic_value_t *img_read_value(basic_img_reader_t *r)
+{
+    basic_value_t *value = NULL ;
+    const char *chars ;
+    basic_num_t num ;
+    basic_err_t err ;
+    uint32_t len ;
+
+    switch(basic_img_get_u8(r))
+    {
+        case BASIC_VALUE_TYPE_NUMBER:
+            if (!basic_img_get(r, &num, sizeof(num)))
+                return NULL ;
+
+            value = basic_value_create_number(num) ;
+            break ;
+
+        case BASIC_VALUE_TYPE_STRING:
+            chars = basic_img_get_chars(r, &len) ;
+            if (chars == NULL)
+                return NULL ;
+
+            value = (basic_value_t *)basic_malloc(sizeof(basic_value_t)) ;
+            if (value != NULL && !set_string_copy(value, chars, len, &err)) {
+                basic_free(value) ;
+                value = NULL ;
+            }
+            break ;
+
+        default:
+            basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+            return NULL ;
+    }
+
+    if (value == NULL)
+        basic_img_fail(r, BASIC_ERR_OUT_OF_MEMORY) ;
+
+    return value ;
+}
+
+static void img_destroy_operands(uint32_t count, basic_operand_t **ops)
+{
+    for(uint32_t i = 0 ; i < count ; i++)
+        basic_destroy_operand(ops[i]) ;
+}
+
+static basic_operand_t *img_read_operand(basic_img_reader_t *r, int argcnt, char **argnames) ;
+
+//
+// Read count operands into ops.  If one fails the ones before it are destroyed.
+//
+static bool img_read_operands(basic_img_reader_t *r, int argcnt, char **argnames, uint32_t count, basic_operand_t **ops)
+{
+    for(uint32_t i = 0 ; i < count ; i++) {
+        ops[i] = img_read_operand(r, argcnt, argnames) ;
+        if (ops[i] == NULL) {
+            img_destroy_operands(i, ops) ;
+            return false ;
+        }
+    }
+
+    return true ;
+}
+
+//
+// The children of an operand are read before it is created, so that a failure
+// part way through leaves no operand that is partly filled in
+//
+static basic_operand_t *img_read_operand(basic_img_reader_t *r, int argcnt, char **argnames)
+{
+    char name[BASIC_MAX_VARIABLE_LENGTH + 1] ;
+    basic_operand_t *args[BASIC_MAX_DIMS > 2 ? BASIC_MAX_DIMS : 2] ;
+    basic_operand_t *ret = NULL ;
+    basic_value_t *value ;
+    operator_table_t *oper ;
+    uint32_t varidx, varname, count ;
+    uint8_t type, index ;
+
+    type = basic_img_get_u8(r) ;
+    if (r->err_ != BASIC_ERR_NONE)
+        return NULL ;
+
+    switch(type)
+    {
+        case BASIC_OPERAND_TYPE_CONST:
+            value = img_read_value(r) ;
+            if (value == NULL)
+                return NULL ;
+
+            ret = create_const_operand(value) ;
+            if (ret == NULL)
+                basic_value_destroy(value) ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_VAR:
+            if (!basic_img_get_var(r, &varidx) || !basic_img_get_str(r, name, sizeof(name)))
+                return NULL ;
+
+            count = basic_img_get_u8(r) ;
+            if (count > BASIC_MAX_DIMS) {
+                basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+                return NULL ;
+            }
+
+            if (!img_read_operands(r, argcnt, argnames, count, args))
+                return NULL ;
+
+            varname = basic_str_create_str(name) ;
+            if (varname != BASIC_STR_INVALID)
+                ret = create_var_operand(varname, varidx, count, args) ;
+
+            if (ret == NULL)
+                img_destroy_operands(count, args) ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_OPERATOR:
+            oper = operator_by_type((operator_type_t)basic_img_get_u8(r)) ;
+            if (oper == NULL) {
+                basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+                return NULL ;
+            }
+
+            count = oper->unary ? 1 : 2 ;
+            if (!img_read_operands(r, argcnt, argnames, count, args))
+                return NULL ;
+
+            ret = createOperator(oper) ;
+            if (ret == NULL) {
+                img_destroy_operands(count, args) ;
+                break ;
+            }
+
+            ret->operand_.operator_.left_ = args[0] ;
+            if (!oper->unary)
+                ret->operand_.operator_.right_ = args[1] ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_FUNCTION:
+            index = basic_img_get_u8(r) ;
+            if (r->err_ != BASIC_ERR_NONE || index >= sizeof(functions) / sizeof(functions[0])) {
+                basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+                return NULL ;
+            }
+
+            ret = create_fun_operand(&functions[index]) ;
+            if (ret != NULL && !img_read_operands(r, argcnt, argnames, functions[index].num_args_, ret->operand_.function_.args_)) {
+                basic_free(ret->operand_.function_.args_) ;
+                basic_free(ret) ;
+                return NULL ;
+            }
+            break ;
+
+        case BASIC_OPERAND_TYPE_USERFN:
+            if (!basic_img_get_userfn(r, &varidx))
+                return NULL ;
+
+            ret = create_userfn_operand(get_user_fn_from_index(varidx)) ;
+            if (ret != NULL && !img_read_operands(r, argcnt, argnames, ret->operand_.userfn_.argcnt_, ret->operand_.userfn_.args_)) {
+                basic_free(ret->operand_.userfn_.args_) ;
+                basic_free(ret) ;
+                return NULL ;
+            }
+            break ;
+
+        case BASIC_OPERAND_TYPE_BOUNDV:
+            index = basic_img_get_u8(r) ;
+            if (r->err_ != BASIC_ERR_NONE || index >= argcnt) {
+                basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+                return NULL ;
+            }
+
+            ret = create_bound_value(argnames[index]) ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_FOLDED:
+            value = img_read_value(r) ;
+            if (value == NULL)
+                return NULL ;
+
+            if (!img_read_operands(r, argcnt, argnames, 1, args)) {
+                basic_value_destroy(value) ;
+                return NULL ;
+            }
+
+            ret = (basic_operand_t *)basic_malloc(sizeof(basic_operand_t)) ;
+            if (ret == NULL) {
+                basic_value_destroy(value) ;
+                basic_destroy_operand(args[0]) ;
+                break ;
+            }
+
+            ret->type_ = BASIC_OPERAND_TYPE_FOLDED ;
+            ret->operand_.folded_.value_ = value ;
+            ret->operand_.folded_.orig_ = args[0] ;
+            break ;
+
+        default:
+            basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+            return NULL ;
+    }
+
+    if (ret == NULL)
+        basic_img_fail(r, BASIC_ERR_OUT_OF_MEMORY) ;
+
+    return ret ;
+}
+
+//
+// The variable a string is appended to, which is the one at the left of the chain
+// of additions, see is_append_chain()
+//
+static uint32_t img_append_var(basic_operand_t *op)
+{
+    while (op->type_ == BASIC_OPERAND_TYPE_OPERATOR)
+        op = op->operand_.operator_.left_ ;
+
+    return (op->type_ == BASIC_OPERAND_TYPE_VAR) ? op->operand_.var_.varidx_ : BASIC_HTAB_NONE ;
+}
+
+bool basic_expr_img_read(basic_img_reader_t *r, int argcnt, char **argnames, uint32_t *index)
+{
+    basic_err_t err ;
+
+    uint8_t type = basic_img_get_u8(r) ;
+    uint8_t flags = basic_img_get_u8(r) ;
+
+    basic_operand_t *op = img_read_operand(r, argcnt, argnames) ;
+    if (op == NULL)
+        return false ;
+
+    if (!create_expr(op, type, argcnt, argnames, index, &err)) {
+        basic_destroy_operand(op) ;
+        return basic_img_fail(r, err) ;
+    }
+
+    //
+    // The statement that held the expression compiled it again for an append or
+    // a condition
+    //
+    if (((flags & IMG_EXPR_APPEND) != 0 && !basic_expr_compile_append(*index, img_append_var(op), &err)) ||
+            ((flags & IMG_EXPR_CONDITION) != 0 && !basic_expr_compile_condition(*index, &err))) {
+        basic_expr_destroy(*index) ;
+        return basic_img_fail(r, err) ;
+    }
+
+    return true ;
+}
+
+//
+// The DEF FNs in a program image are the count, then the handle, name and
+// argument names of each, then the expression of each.  The expressions come
+// after all of the names since one function may call another.
+//
+bool basic_userfn_img_write(basic_img_writer_t *w)
+{
+    basic_expr_user_fn_t *fn ;
+    uint32_t iter = 0 ;
+    uint32_t count = 0 ;
+
+    while (basic_htab_next(&userfns, &iter, NULL) != NULL)
+        count++ ;
+
+    basic_img_put_u32(w, count) ;
+
+    iter = 0 ;
+    while ((fn = (basic_expr_user_fn_t *)basic_htab_next(&userfns, &iter, NULL)) != NULL) {
+        basic_img_put_u32(w, fn->index_) ;
+        basic_img_put_str(w, fn->name_, (uint32_t)strlen(fn->name_)) ;
+        basic_img_put_u8(w, (uint8_t)fn->argcnt_) ;
+        for(uint32_t i = 0 ; i < fn->argcnt_ ; i++)
+            basic_img_put_str(w, fn->args_[i], (uint32_t)strlen(fn->args_[i])) ;
+    }
+
+    iter = 0 ;
+    while ((fn = (basic_expr_user_fn_t *)basic_htab_next(&userfns, &iter, NULL)) != NULL) {
+        if (!basic_expr_img_write(w, fn->expridx_, fn->argcnt_, fn->args_))
+            return false ;
+    }
+
+    return w->err_ == BASIC_ERR_NONE ;
+}
+
+//
+// Read the name and arguments of a function and bind them.  The expression is
+// read once every function has a handle.
+//
+static bool img_read_userfn(basic_img_reader_t *r, uint32_t *fnindex)
+{
+    char buf[BASIC_MAX_VARIABLE_LENGTH + 1] ;
+    char *args[BASIC_MAX_DEFFN_ARGS] ;
+    char *fnname = NULL ;
+    uint32_t argcnt = 0 ;
+    basic_err_t err ;
+
+    if (basic_img_get_str(r, buf, sizeof(buf)) && (fnname = basic_strdup(buf)) == NULL)
+        basic_img_fail(r, BASIC_ERR_OUT_OF_MEMORY) ;
+
+    uint32_t count = basic_img_get_u8(r) ;
+    if (count > BASIC_MAX_DEFFN_ARGS)
+        basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+
+    while (r->err_ == BASIC_ERR_NONE && argcnt < count) {
+        if (basic_img_get_str(r, buf, sizeof(buf))) {
+            args[argcnt] = basic_strdup(buf) ;
+            if (args[argcnt] == NULL)
+                basic_img_fail(r, BASIC_ERR_OUT_OF_MEMORY) ;
+            else
+                argcnt++ ;
+        }
+    }
+
+    if (r->err_ == BASIC_ERR_NONE && !basic_userfn_bind(fnname, argcnt, args, BASIC_HTAB_NONE, fnindex, &err))
+        basic_img_fail(r, BASIC_ERR_OUT_OF_MEMORY) ;
+
+    if (r->err_ != BASIC_ERR_NONE) {
+        basic_free(fnname) ;
+        for(uint32_t i = 0 ; i < argcnt ; i++)
+            basic_free(args[i]) ;
+        return false ;
+    }
+
+    return true ;
+}
+
+bool basic_userfn_img_read(basic_img_reader_t *r)
+{
+    uint32_t count = basic_img_get_u32(r) ;
+    if (r->err_ != BASIC_ERR_NONE)
+        return false ;
+
+    // Each function takes at least its handle, its name and its argument count
+    if (count > (r->size_ - r->pos_) / 7)
+        return basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+
+    if (count > 0) {
+        r->fns_ = (uint32_t *)basic_malloc(sizeof(uint32_t) * 2 * count) ;
+        if (r->fns_ == NULL)
+            return basic_img_fail(r, BASIC_ERR_OUT_OF_MEMORY) ;
+    }
+
+    for(uint32_t i = 0 ; i < count ; i++) {
+        r->fns_[i * 2] = basic_img_get_u32(r) ;
+        if (!img_read_userfn(r, &r->fns_[i * 2 + 1]))
+            return false ;
+
+        r->fncnt_++ ;
+    }
+
+    for(uint32_t i = 0 ; i < count ; i++) {
+        basic_expr_user_fn_t *fn = get_user_fn_from_index(r->fns_[i * 2 + 1]) ;
+        if (!basic_expr_img_read(r, (int)fn->argcnt_, fn->args_, &fn->expridx_))
+            return false ;
+    }
+
+    return true ;
 }
\ No newline at end of file
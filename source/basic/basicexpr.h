@@ -1,6 +1,8 @@
 #pragma once
 
 #include "basicerr.h"
+#include "basiccfg.h"
+#include "basicnum.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <ctype.h>
@@ -12,15 +14,45 @@ typedef enum basic_value_type {
     BASIC_VALUE_TYPE_STRING = 2,
 } basic_value_type_t ;
 
+typedef struct basic_strbuf basic_strbuf_t ;
+
+//
+// A value produced by an expression.  Values are normally passed around by value.
+//
+// A string is a length and a pointer to its characters.  Short strings are held in
+// the value itself.  Longer ones live in a reference counted buffer that is never
+// changed once it is shared, so copying a string or taking a substring of it only
+// adds a reference.  A value that owns a reference releases it when the value is
+// released.  A value that borrows the storage of a variable or constant is only
+// valid until the next statement modifies that variable.  A string that is not in a
+// buffer and is not inline is borrowed from C code and is copied when it is kept.
+//
 typedef struct basic_value
 {
     uint8_t type_ ;
+    uint8_t owned_ ;
+    uint8_t inline_ ;
+    uint32_t length_ ;
     union {
-        char *svalue_ ;
-        double nvalue_ ;
+        basic_num_t nvalue_ ;
+        char ivalue_[BASIC_STR_INLINE_SIZE] ;
+        struct {
+            const char *chars_ ;
+            basic_strbuf_t *buf_ ;
+        } svalue_ ;
     } value ;
 } basic_value_t ;
 
+//
+// The characters of a string value.  These are not always terminated, since a
+// substring shares its parent's characters, so use the length_ of the value.  The
+// values returned by basic_expr_eval() are always terminated.
+//
+static inline const char *basic_value_chars(const basic_value_t *value)
+{
+    return value->inline_ ? value->value.ivalue_ : value->value.svalue_.chars_ ;
+}
+
 static inline const char *skipSpaces(const char *line)
 {
     while (isspace((uint8_t)*line))
@@ -30,8 +62,9 @@ static inline const char *skipSpaces(const char *line)
 }
 
 extern basic_value_t *basic_value_create_string(const char *v) ;
-extern basic_value_t *basic_value_create_number(double d) ;
+extern basic_value_t *basic_value_create_number(basic_num_t d) ;
 extern void basic_value_destroy(basic_value_t* value);
+extern void basic_value_release(basic_value_t* value);
 
 extern int basic_array_get_base() ;
 extern void basic_array_set_base(int val) ;
@@ -41,11 +74,14 @@ extern bool basic_var_get_all(uint32_t *all) ;
 extern bool basic_var_get(const char *name, uint32_t *index, basic_err_t *err) ;
 extern bool basic_var_destroy(uint32_t index) ;
 extern bool basic_var_set_value(uint32_t index, basic_value_t *value, basic_err_t *err) ;
-extern bool basic_var_set_value_number(uint32_t index, double value, basic_err_t *err) ;
+extern bool basic_var_set_value_number(uint32_t index, basic_num_t value, basic_err_t *err) ;
 extern bool basic_var_set_value_string(uint32_t index, const char *value, basic_err_t* err) ;
-extern bool basic_var_set_array_value(uint32_t index, basic_value_t *value, uint32_t *dims, basic_err_t *err) ;
+extern bool basic_var_set_array_value(uint32_t index, basic_value_t *value, uint32_t dimcnt, uint32_t *dims, basic_err_t *err) ;
+extern bool basic_var_store(uint32_t index, basic_value_t *value, basic_err_t *err) ;
+extern bool basic_var_store_array(uint32_t index, basic_value_t *value, uint32_t dimcnt, uint32_t *dims, basic_err_t *err) ;
+extern bool basic_var_append(uint32_t index, basic_value_t *value, basic_err_t *err) ;
 extern basic_value_t *basic_var_get_value(uint32_t index) ;
-extern basic_value_t *basic_var_get_array_value(uint32_t index, uint32_t *dims, basic_err_t *err) ;
+extern basic_value_t *basic_var_get_array_value(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_err_t *err) ;
 extern const char *basic_var_get_name(uint32_t index) ;
 extern bool basic_var_add_dims(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_err_t *err);
 extern bool basic_var_is_array(uint32_t index) ;
@@ -53,15 +89,27 @@ extern int basic_var_get_dim_count(uint32_t index, basic_err_t *err) ;
 extern bool basic_var_get_dims(uint32_t index, uint32_t *dimcnt, uint32_t *dims, basic_err_t* err);
 extern void basic_var_clear_all() ;
 extern bool basic_var_is_string(uint32_t index) ;
+extern bool basic_var_is_integer(uint32_t index) ;
+extern int32_t *basic_var_get_int(uint32_t index) ;
+extern basic_num_t *basic_var_get_matrix(uint32_t index, uint32_t *rows, uint32_t *cols, basic_err_t *err) ;
 
 extern const char *basic_expr_parse_int(const char *line, int *value, basic_err_t *err) ;
-extern const char *basic_expr_parse_number(const char *line, double *value, basic_err_t *err) ;
+extern const char *basic_expr_parse_number(const char *line, basic_num_t *value, basic_err_t *err) ;
 extern const char *basic_expr_parse_str(const char *line, uint32_t *value, basic_err_t *err) ;
 extern const char* basic_expr_parse_dims_const(const char* line, uint32_t* dimcnt, uint32_t* dims, basic_err_t* err);
 extern const char* basic_expr_parse_dims_expr(const char* line, uint32_t* dimcnt, uint32_t *dims, basic_err_t* err);
 
 extern const char *basic_expr_parse(const char *line, int argcnt, char **argnames, uint32_t *index, basic_err_t *err) ;
 extern basic_value_t *basic_expr_eval(uint32_t index, uint32_t cntv, char **names, basic_value_t **values, basic_err_t *err);
+extern bool basic_expr_eval_value(uint32_t index, basic_value_t *value, basic_err_t *err) ;
+extern bool basic_expr_eval_number(uint32_t index, basic_num_t *value, basic_err_t *err) ;
+extern bool basic_expr_eval_int(uint32_t index, int32_t *value, basic_err_t *err) ;
+extern bool basic_expr_eval_condition(uint32_t index, bool *value, basic_err_t *err) ;
+extern bool basic_expr_is_integer(uint32_t index) ;
+extern bool basic_expr_compile_append(uint32_t index, uint32_t varidx, basic_err_t *err) ;
+extern bool basic_expr_is_append(uint32_t index) ;
+extern bool basic_expr_compile_condition(uint32_t index, basic_err_t *err) ;
+extern bool basic_expr_check_type(uint32_t index, basic_value_type_t type, basic_err_t *err) ;
 extern bool basic_expr_destroy(uint32_t index) ;
 extern uint32_t basic_expr_to_string(uint32_t ) ;
 extern bool basic_expr_operand_array_to_str(uint32_t str, int cnt, basic_operand_t** args);
@@ -3,6 +3,7 @@
 #include "basicline.h"
 #include "basicexpr.h"
 #include "basiccfg.h"
+#include <assert.h>
 
 #define BASIC_OPERAND_TYPE_VAR          (1)
 #define BASIC_OPERAND_TYPE_CONST        (2)
@@ -10,6 +11,13 @@
 #define BASIC_OPERAND_TYPE_FUNCTION     (4)
 #define BASIC_OPERAND_TYPE_USERFN       (5)
 #define BASIC_OPERAND_TYPE_BOUNDV       (6)
+#define BASIC_OPERAND_TYPE_FOLDED       (7)
+
+//
+// The type given to an operand whose type is only known when it is evaluated,
+// such as a DEF FN argument.  Otherwise the type is a basic_value_type_t.
+//
+#define BASIC_EXPR_TYPE_ANY             (0)
 
 typedef enum operator_type {
     BASIC_OPERATOR_PLUS = 1,
@@ -26,6 +34,8 @@ typedef enum operator_type {
     BASIC_OPERATOR_OR = 12,
     BASIC_OPERATOR_AND = 13,
     BASIC_OPERATOR_UNARY_MINUS = 14,
+    BASIC_OPERATOR_INT_DIVIDE = 15,
+    BASIC_OPERATOR_MOD = 16,
 } operator_type_t ;
 
 typedef struct operator_table
@@ -48,6 +58,7 @@ typedef struct basic_operator_args
 typedef struct basic_var_args
 {
     uint32_t varname_ ;
+    uint32_t varidx_ ;
     int dimcnt_ ;
     basic_operand_t** dims_;
 } basic_var_args_t ;
@@ -56,7 +67,10 @@ typedef struct function_table
 {
     int num_args_;
     const char* string_;
-    basic_value_t* (*eval_)(int count, basic_value_t **args, basic_err_t *err);
+    bool (*eval_)(int count, basic_value_t *args, basic_value_t *ret, basic_err_t *err);
+    bool pure_;                         // The result depends only on the arguments, so it can be folded
+    uint8_t type_;                      // The type of the result
+    const char *args_;                  // The type of each argument, N for a number and S for a string
 } function_table_t;
 
 typedef struct basic_expr_user_fn
@@ -66,7 +80,6 @@ typedef struct basic_expr_user_fn
     uint32_t argcnt_;
     char** args_;
     uint32_t expridx_;
-    struct basic_expr_user_fn* next_;
 } basic_expr_user_fn_t ;
 
 typedef struct basic_function_args
@@ -82,6 +95,16 @@ typedef struct user_function_args
     basic_operand_t** args_;
 } user_function_args_t ;
 
+//
+// A constant subtree that was evaluated when it was parsed.  The original
+// subtree is kept to turn the expression back into text.
+//
+typedef struct basic_folded_args
+{
+    basic_value_t *value_ ;
+    basic_operand_t *orig_ ;
+} basic_folded_args_t ;
+
 typedef struct basic_operand
 {
     uint8_t type_ ;
@@ -92,6 +115,7 @@ typedef struct basic_operand
         basic_function_args_t function_;
         user_function_args_t userfn_ ;
         const char *boundv_ ;
+        basic_folded_args_t folded_ ;
     } operand_ ;
 } basic_operand_t ;
 
@@ -99,19 +123,30 @@ typedef struct basic_var
 {
     char name_[BASIC_MAX_VARIABLE_LENGTH] ;
     uint32_t index_ ;
+    bool string_ ;                      // The name ends in $
+    bool integer_ ;                     // The name ends in %, the value is held in ivalue_ or iarray_
     uint32_t dimcnt_ ;
-    uint32_t *dims_;
-    basic_value_t *value_ ;
-    double *darray_ ;
-    char **sarray_ ;
-    struct basic_var *next_ ;
+    uint32_t *dims_;                    // The number of elements in each dimension
+    uint32_t base_ ;                    // The array base when the array was dimensioned
+    basic_value_t value_ ;
+    int32_t ivalue_ ;
+    basic_num_t *darray_ ;
+    basic_value_t *sarray_ ;
+    int32_t *iarray_ ;
 } basic_var_t ;
 
 typedef struct basic_expr
 {
     basic_operand_t *top_ ;
+    uint8_t *code_ ;
+    uint32_t codelen_ ;
+    uint32_t depth_ ;
     uint32_t index_ ;
-    struct basic_expr *next_ ;
+    bool append_ ;                      // Only the part added to the variable is evaluated, see basic_expr_compile_append()
+    bool condition_ ;                   // Compiled as the condition of an IF, see basic_expr_compile_condition()
+    uint8_t type_ ;                     // The type of the result, or BASIC_EXPR_TYPE_ANY if it is only known when run
+    bool numeric_ ;                     // Nothing in the expression is a string, see basic_vm_eval_number()
+    bool integer_ ;                     // The result is an integer, see basic_operand_is_integer()
 } basic_expr_t ;
 
 typedef struct expr_ctxt
@@ -125,3 +160,177 @@ typedef struct expr_ctxt
     char** argnames_;
 } expr_ctxt_t;
 
+
+//
+// Opcodes for the expression VM.  Operands follow the opcode in the code
+// stream and are stored in little endian order.  Integer operands, which are
+// A% variables, integer constants and the results of integer operators, are
+// pushed as int32_t and only converted when they meet a number, see
+// basic_operand_is_integer().  Array indices are always converted to integers
+// before the array is loaded.  AND and OR jump over their right side when the
+// left side decides the result.  The code for the condition of an IF leaves an
+// integer that is greater than zero if the condition is true.
+//
+typedef enum basic_vm_op {
+    BASIC_VM_OP_END = 0,                // End of the expression, result is on top of the stack
+    BASIC_VM_OP_PUSH_NUM = 1,           // basic_num_t, push a numeric constant
+    BASIC_VM_OP_PUSH_STR = 2,           // pointer to the constant's value, push a string constant
+    BASIC_VM_OP_LOAD_VAR = 3,           // uint32 variable index, push the value of a variable
+    BASIC_VM_OP_LOAD_ARRAY = 4,         // uint32 variable index, uint8 dimcnt, pop integer indices, push element
+    BASIC_VM_OP_LOAD_LOCAL = 5,         // uint8 index, push an argument of a DEF FN
+    BASIC_VM_OP_CALL = 6,               // uint8 function, pop arguments, push result
+    BASIC_VM_OP_CALL_USER = 7,          // uint32 user function, uint8 argcnt, pop arguments, push result
+    BASIC_VM_OP_POWER_INT = 8,          // uint8 power, raise the number on top of the stack to a small integer power
+    BASIC_VM_OP_PUSH_INT = 9,           // int32, push an integer constant
+    BASIC_VM_OP_LOAD_INT_VAR = 10,      // uint32 variable index, push the value of an A% variable
+    BASIC_VM_OP_LOAD_INT_ARRAY = 11,    // uint32 variable index, uint8 dimcnt, pop integer indices, push element of A%()
+    BASIC_VM_OP_TO_NUM = 12,            // convert the integer on top of the stack to a number
+    BASIC_VM_OP_TO_INT = 13,            // convert the number on top of the stack to an integer, truncating
+    BASIC_VM_OP_AND_JUMP = 14,          // uint32 offset, if the top of the stack is false make it 0 and jump, else pop it
+    BASIC_VM_OP_OR_JUMP = 15,           // uint32 offset, if the top of the stack is true make it 1 and jump, else pop it
+    BASIC_VM_OP_OPERATOR = 16,          // BASIC_VM_OP_OPERATOR + operator_type_t, pop operands, push result
+    BASIC_VM_OP_INT_OPERATOR = 48,      // BASIC_VM_OP_INT_OPERATOR + operator_type_t, pop integers, push integer result
+    BASIC_VM_OP_TO_BOOL = 80,           // replace the number on top of the stack with 1 if it is true and 0 if not
+    BASIC_VM_OP_TEST = 81,              // replace the number on top of the stack with the integer 1 if IF takes it as true
+    BASIC_VM_OP_COMPARE = 96,           // BASIC_VM_OP_COMPARE + relational operator_type_t, pop numbers, push integer 1 or 0
+} basic_vm_op_t ;
+
+//
+// Powers from 2 up to this are computed by repeated multiplies rather than pow()
+//
+#define BASIC_POWER_INT_MAX             (4)
+
+static inline bool basic_is_power_int(basic_num_t p)
+{
+    int32_t i = basic_num_to_int(p) ;
+    return i >= 2 && i <= BASIC_POWER_INT_MAX && basic_num_from_int(i) == p ;
+}
+
+static inline basic_num_t basic_power_int(basic_num_t x, int p)
+{
+    basic_num_t ret = x ;
+    while (--p > 0)
+        ret = basic_num_mul(ret, x) ;
+
+    return ret ;
+}
+
+//
+// Convert a number to an integer for an A% variable or an integer operator.  The
+// fraction is dropped, and a number outside the range of an int32_t is an overflow.
+//
+static inline bool basic_num_get_int(basic_num_t n, int32_t *ret, basic_err_t *err)
+{
+    if (!basic_num_fits_int(n)) {
+        *err = BASIC_ERR_OVERFLOW ;
+        return false ;
+    }
+
+    *ret = basic_num_to_int(n) ;
+    return true ;
+}
+
+//
+// Convert an integer to a number.  In the fixed point build an integer outside
+// the range of a number is an overflow, in the others every integer fits.
+//
+static inline bool basic_num_put_int(int32_t i, basic_num_t *ret, basic_err_t *err)
+{
+    if (!basic_num_holds_int(i)) {
+        *err = BASIC_ERR_OVERFLOW ;
+        return false ;
+    }
+
+    *ret = basic_num_from_int(i) ;
+    return true ;
+}
+
+//
+// Apply an operator to two integers.  This is + - * \ MOD, unary minus and the
+// comparisons, which are the operators that give an integer result for integer
+// operands.  A result that does not fit in an int32_t is an overflow rather than
+// being carried over into a number.
+//
+static inline bool basic_int_operator(operator_type_t oper, int32_t left, int32_t right, int32_t *ret, basic_err_t *err)
+{
+    int64_t r ;
+
+    switch(oper)
+    {
+        case BASIC_OPERATOR_PLUS:
+            r = (int64_t)left + right ;
+            break ;
+        case BASIC_OPERATOR_MINUS:
+            r = (int64_t)left - right ;
+            break ;
+        case BASIC_OPERATOR_TIMES:
+            r = (int64_t)left * right ;
+            break ;
+        case BASIC_OPERATOR_UNARY_MINUS:
+            r = -(int64_t)left ;
+            break ;
+        case BASIC_OPERATOR_INT_DIVIDE:
+        case BASIC_OPERATOR_MOD:
+            if (right == 0) {
+                *err = BASIC_ERR_DIVIDE_ZERO ;
+                return false ;
+            }
+
+            //
+            // Divide in 32 bits, which is a single instruction on the target.  Only
+            // INT32_MIN / -1 does not fit.
+            //
+            if (right == -1)
+                r = (oper == BASIC_OPERATOR_MOD) ? 0 : -(int64_t)left ;
+            else
+                r = (oper == BASIC_OPERATOR_MOD) ? left % right : left / right ;
+            break ;
+        case BASIC_OPERATOR_NOT_EQUAL:
+            r = left != right ;
+            break ;
+        case BASIC_OPERATOR_EQUAL:
+            r = left == right ;
+            break ;
+        case BASIC_OPERATOR_GREATER:
+            r = left > right ;
+            break ;
+        case BASIC_OPERATOR_GREATER_EQ:
+            r = left >= right ;
+            break ;
+        case BASIC_OPERATOR_LESS:
+            r = left < right ;
+            break ;
+        case BASIC_OPERATOR_LESS_EQ:
+            r = left <= right ;
+            break ;
+        default:
+            assert(false) ;
+            *err = BASIC_ERR_INVALID_OPERATOR ;
+            return false ;
+    }
+
+    if (r < INT32_MIN || r > INT32_MAX) {
+        *err = BASIC_ERR_OVERFLOW ;
+        return false ;
+    }
+
+    *ret = (int32_t)r ;
+    return true ;
+}
+
+extern function_table_t functions[] ;
+
+extern basic_expr_t *get_expr_from_index(uint32_t index) ;
+extern basic_expr_user_fn_t* get_user_fn_from_index(uint32_t index) ;
+extern bool basic_expr_apply_operator(operator_type_t oper, basic_value_t *left, basic_value_t *right, basic_value_t *ret, basic_err_t *err) ;
+extern bool basic_var_read(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_value_t *ret, basic_err_t *err) ;
+extern bool basic_var_read_number(uint32_t index, uint32_t dimcnt, uint32_t *dims, basic_num_t *ret, basic_err_t *err) ;
+extern bool basic_var_read_int(uint32_t index, uint32_t dimcnt, uint32_t *dims, int32_t *ret, basic_err_t *err) ;
+extern bool basic_operand_is_integer(basic_operand_t *op) ;
+extern bool basic_value_own(basic_value_t *value, basic_err_t *err) ;
+
+extern bool basic_vm_compile(basic_expr_t *expr, int argcnt, char **argnames, basic_err_t *err) ;
+extern bool basic_vm_eval(basic_expr_t *expr, uint32_t cntv, basic_value_t *values, basic_value_t *ret, basic_err_t *err) ;
+extern bool basic_vm_eval_number(basic_expr_t *expr, uint32_t cntv, basic_value_t *values, basic_num_t *ret, basic_err_t *err) ;
+extern bool basic_vm_eval_int(basic_expr_t *expr, int32_t *ret, basic_err_t *err) ;
+extern bool basic_vm_eval_condition(basic_expr_t *expr, bool *ret, basic_err_t *err) ;
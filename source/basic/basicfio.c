@@ -3,6 +3,9 @@
 #include "basicproc.h"
 #include "basicexpr.h"
 #include "basicstr.h"
+#include "basicimg.h"
+#include "basicmem.h"
+#include "basiccfg.h"
 #include <FreeRTOS.h>
 #include <ff.h>
 #include <assert.h>
@@ -61,8 +64,43 @@ static bool unlockfs(basic_err_t *err)
 }
 #endif
 
+#ifdef BASIC_PROGRAM_IMAGES
+//
+// Write the image of the program in memory next to its text.  An image that
+// cannot be written is removed, since LOAD ignores one that does not match.
+//
+static void save_image(const char *fname, uint32_t srchash, uint32_t srclen)
+{
+    char imgname[64] ;
+    basic_err_t err ;
+    uint8_t *image ;
+    uint32_t size ;
+    UINT written ;
+    FIL fp ;
+
+    if (!basic_img_name(fname, imgname, sizeof(imgname)))
+        return ;
+
+    if (!basic_img_build(srchash, srclen, &image, &size, &err)) {
+        f_unlink(imgname) ;
+        return ;
+    }
+
+    if (f_open(&fp, imgname, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK) {
+        FRESULT res = f_write(&fp, image, size, &written) ;
+        f_close(&fp) ;
+        if (res != FR_OK || written != size)
+            f_unlink(imgname) ;
+    }
+
+    basic_free(image) ;
+}
+#endif
+
 void basic_save(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 {
+    uint32_t srchash = BASIC_IMG_HASH_INIT ;
+    uint32_t srclen = 0 ;
     FIL fp ;
     FRESULT res ;
     UINT written ;
@@ -84,7 +122,7 @@ void basic_save(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     }
 
     strcpy(filename, "/") ;
-    strcat(filename, value->value.svalue_);
+    strcat(filename, basic_value_chars(value));
 
     if (!lockfs(err))
         return ;
@@ -116,6 +154,8 @@ void basic_save(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
 
         const char *strval = basic_str_value(str) ;
         UINT towrite = strlen(strval) ;
+        srchash = basic_img_hash(srchash, strval, towrite) ;
+        srclen += towrite ;
         res = f_write(&fp, strval, towrite, &written) ;
         basic_str_destroy(str) ;
         if (res != FR_OK || towrite != written) {
@@ -126,6 +166,11 @@ void basic_save(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     }
 
     f_close(&fp) ;
+
+#ifdef BASIC_PROGRAM_IMAGES
+    save_image(filename, srchash, srclen) ;
+#endif
+
     unlockfs(err) ;
 }
 
@@ -148,7 +193,7 @@ void basic_load(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     }
 
     strcpy(filename, "/") ;
-    strcat(filename, value->value.svalue_);
+    strcat(filename, basic_value_chars(value));
 
     basic_clear_int() ;
 
@@ -244,7 +289,7 @@ void basic_del(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     }
 
     strcpy(filename, "/") ;
-    strcat(filename, value->value.svalue_);
+    strcat(filename, basic_value_chars(value));
 
     if (!lockfs(err))
         return ;
@@ -275,7 +320,7 @@ void basic_rename(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     }
 
     strcpy(filename, "/") ;
-    strcat(filename, value->value.svalue_);
+    strcat(filename, basic_value_chars(value));
 
     expr = getU32(line, 5);
     value = basic_expr_eval(expr,  0, NULL, NULL, err) ;
@@ -288,7 +333,7 @@ void basic_rename(basic_line_t *line, basic_err_t *err, basic_out_fn_t outfn)
     }
 
     strcpy(filename2, "/") ;
-    strcat(filename2, value->value.svalue_);
+    strcat(filename2, basic_value_chars(value));
 
     if (!lockfs(err))
         return ;
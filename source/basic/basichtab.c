@@ -0,0 +1,127 @@
+#if defined(DESKTOP) && defined(_MSC_VER)
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include "basichtab.h"
+#include "basicmem.h"
+#include <string.h>
+
+static bool add_slab(basic_htab_t *tab)
+{
+    uint8_t **slabs = (uint8_t **)basic_realloc(tab->slabs_, sizeof(uint8_t *) * (tab->slabcnt_ + 1)) ;
+    if (slabs == NULL)
+        return false ;
+
+    tab->slabs_ = slabs ;
+
+    uint8_t *slab = (uint8_t *)basic_malloc(tab->entsize_ * BASIC_HTAB_SLAB_SIZE) ;
+    if (slab == NULL)
+        return false ;
+
+    tab->slabs_[tab->slabcnt_++] = slab ;
+    return true ;
+}
+
+//
+// Allocate a zeroed object from the table.  Freed slots are reused first.
+// Returns NULL if memory is exhausted or every slot a handle can name is in
+// use.
+//
+void *basic_htab_alloc(basic_htab_t *tab, uint32_t *handle)
+{
+    basic_htab_entry_t *entry ;
+    uint32_t slot ;
+
+    if (tab->free_ != BASIC_HTAB_NONE) {
+        slot = tab->free_ ;
+        entry = basic_htab_entry(tab, slot) ;
+        tab->free_ = entry->next_ ;
+    }
+    else {
+        //
+        // The last slot is never used so that no handle is ever BASIC_HTAB_NONE
+        //
+        if (tab->count_ == BASIC_HTAB_SLOT_MASK)
+            return NULL ;
+
+        if (tab->count_ == tab->slabcnt_ * BASIC_HTAB_SLAB_SIZE && !add_slab(tab))
+            return NULL ;
+
+        slot = tab->count_++ ;
+        entry = basic_htab_entry(tab, slot) ;
+        entry->gen_ = 1 ;
+    }
+
+    entry->used_ = 1 ;
+    entry->next_ = BASIC_HTAB_NONE ;
+    tab->live_++ ;
+
+    memset(entry + 1, 0, tab->entsize_ - sizeof(basic_htab_entry_t)) ;
+    *handle = ((uint32_t)entry->gen_ << BASIC_HTAB_SLOT_BITS) | slot ;
+    return entry + 1 ;
+}
+
+//
+// Return an object's slot to the table.  The slot's generation moves on so
+// the handle just freed no longer finds anything.
+//
+bool basic_htab_free(basic_htab_t *tab, uint32_t handle)
+{
+    if (basic_htab_get(tab, handle) == NULL)
+        return false ;
+
+    uint32_t slot = handle & BASIC_HTAB_SLOT_MASK ;
+    basic_htab_entry_t *entry = basic_htab_entry(tab, slot) ;
+
+    entry->used_ = 0 ;
+    entry->gen_ = (entry->gen_ == BASIC_HTAB_MAX_GEN) ? 1 : entry->gen_ + 1 ;
+    entry->next_ = tab->free_ ;
+    tab->free_ = slot ;
+    tab->live_-- ;
+
+    return true ;
+}
+
+//
+// Walk the live objects in a table.  *iter starts at zero.  Objects may be
+// freed during the walk.  Returns NULL when there are no more objects.
+//
+void *basic_htab_next(basic_htab_t *tab, uint32_t *iter, uint32_t *handle)
+{
+    while (*iter < tab->count_) {
+        uint32_t slot = (*iter)++ ;
+        basic_htab_entry_t *entry = basic_htab_entry(tab, slot) ;
+        if (entry->used_) {
+            if (handle != NULL)
+                *handle = ((uint32_t)entry->gen_ << BASIC_HTAB_SLOT_BITS) | slot ;
+            return entry + 1 ;
+        }
+    }
+
+    return NULL ;
+}
+
+//
+// Release the slabs of a table.  The objects in it must already have been
+// cleaned up by the owner.
+//
+void basic_htab_reset(basic_htab_t *tab)
+{
+    for(uint32_t i = 0 ; i < tab->slabcnt_ ; i++)
+        basic_free(tab->slabs_[i]) ;
+
+    basic_free(tab->slabs_) ;
+
+    tab->slabs_ = NULL ;
+    tab->slabcnt_ = 0 ;
+    tab->count_ = 0 ;
+    tab->live_ = 0 ;
+    tab->free_ = BASIC_HTAB_NONE ;
+}
+
+uint32_t basic_htab_memsize(basic_htab_t *tab)
+{
+    return tab->slabcnt_ * (tab->entsize_ * BASIC_HTAB_SLAB_SIZE + (uint32_t)sizeof(uint8_t *)) ;
+}
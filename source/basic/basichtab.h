@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "basiccfg.h"
+
+//
+// A handle table hands out 32 bit handles for objects of a fixed size.  The
+// objects live in slabs of BASIC_HTAB_SLAB_SIZE entries, so an object never
+// moves once it is allocated, and the slot number in a handle finds the object
+// with no search.  The upper bits of a handle hold the generation of the slot,
+// which changes each time the slot is freed, so a stale handle is caught
+// rather than quietly finding whatever object reused the slot.
+//
+#define BASIC_HTAB_SLOT_BITS            (20)
+#define BASIC_HTAB_SLOT_MASK            ((1u << BASIC_HTAB_SLOT_BITS) - 1)
+#define BASIC_HTAB_MAX_GEN              ((1u << (32 - BASIC_HTAB_SLOT_BITS)) - 1)
+#define BASIC_HTAB_NONE                 (0xffffffff)
+
+typedef struct basic_htab_entry
+{
+    uint16_t gen_ ;
+    uint16_t used_ ;
+    uint32_t next_ ;
+} basic_htab_entry_t ;
+
+typedef struct basic_htab
+{
+    uint32_t entsize_ ;                 // Bytes per entry, the header included
+    uint32_t count_ ;                   // Slots handed out, live or free
+    uint32_t live_ ;                    // Slots holding an object
+    uint32_t free_ ;                    // First slot on the free list
+    uint32_t slabcnt_ ;
+    uint8_t **slabs_ ;
+} basic_htab_t ;
+
+#define BASIC_HTAB_INIT(type)           { (uint32_t)((sizeof(basic_htab_entry_t) + sizeof(type) + 7) & ~7), 0, 0, BASIC_HTAB_NONE, 0, NULL }
+
+static inline basic_htab_entry_t *basic_htab_entry(basic_htab_t *tab, uint32_t slot)
+{
+    return (basic_htab_entry_t *)(tab->slabs_[slot / BASIC_HTAB_SLAB_SIZE] + (slot % BASIC_HTAB_SLAB_SIZE) * tab->entsize_) ;
+}
+
+//
+// Return the object for a handle, or NULL if the handle is stale or was
+// never handed out
+//
+static inline void *basic_htab_get(basic_htab_t *tab, uint32_t handle)
+{
+    uint32_t slot = handle & BASIC_HTAB_SLOT_MASK ;
+    if (slot >= tab->count_)
+        return NULL ;
+
+    basic_htab_entry_t *entry = basic_htab_entry(tab, slot) ;
+    if (!entry->used_ || entry->gen_ != (handle >> BASIC_HTAB_SLOT_BITS))
+        return NULL ;
+
+    return entry + 1 ;
+}
+
+extern void *basic_htab_alloc(basic_htab_t *tab, uint32_t *handle) ;
+extern bool basic_htab_free(basic_htab_t *tab, uint32_t handle) ;
+extern void *basic_htab_next(basic_htab_t *tab, uint32_t *iter, uint32_t *handle) ;
+extern void basic_htab_reset(basic_htab_t *tab) ;
+extern uint32_t basic_htab_memsize(basic_htab_t *tab) ;
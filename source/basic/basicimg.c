@@ -0,0 +1,623 @@
+#if defined(DESKTOP) && defined(_MSC_VER)
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include "basicimg.h"
+#include "basicexec.h"
+#include "basicexpr.h"
+#include "basicexprint.h"
+#include "basicstr.h"
+#include "basicmem.h"
+#include "basiccfg.h"
+#include <ctype.h>
+#include <string.h>
+
+//
+// Numbers are stored as the basic_num_t they are held in, so an image only
+// loads into a build with the same number type
+//
+#define IMG_NUM_FORMAT                  ((uint32_t)((BASIC_NUM_TYPE << 8) | sizeof(basic_num_t)))
+
+extern basic_line_t *program ;
+
+//
+// The hash of the keyword, operator and function tables, which an image is only
+// good for as long as they are unchanged
+//
+static uint32_t tables_hash()
+{
+    return basic_line_img_tables(basic_expr_img_tables(BASIC_IMG_HASH_INIT)) ;
+}
+
+//
+// FNV-1a, which is enough to tell one version of a program from the next
+//
+uint32_t basic_img_hash(uint32_t hash, const void *data, uint32_t len)
+{
+    const uint8_t *p = (const uint8_t *)data ;
+
+    while (len-- > 0) {
+        hash ^= *p++ ;
+        hash *= 16777619u ;
+    }
+
+    return hash ;
+}
+
+//
+// The name of the image of a program, which is the name of the program with its
+// extension replaced by .BBC in the same case as the extension
+//
+bool basic_img_name(const char *srcname, char *imgname, uint32_t size)
+{
+    const char *ext = strrchr(srcname, '.') ;
+    const char *slash = strrchr(srcname, '/') ;
+
+    if (ext != NULL && slash != NULL && ext < slash)
+        ext = NULL ;
+
+    size_t len = (ext != NULL) ? (size_t)(ext - srcname) : strlen(srcname) ;
+    if (len + 5 > size)
+        return false ;
+
+    memcpy(imgname, srcname, len) ;
+    strcpy(imgname + len, (ext != NULL && islower((uint8_t)ext[1])) ? ".bbc" : ".BBC") ;
+    return true ;
+}
+
+static bool grow(basic_img_writer_t *w, uint32_t len)
+{
+    if (w->err_ != BASIC_ERR_NONE)
+        return false ;
+
+    if (w->count_ + len > w->size_) {
+        uint32_t size = (w->size_ == 0) ? 1024 : w->size_ ;
+        while (size < w->count_ + len)
+            size *= 2 ;
+
+        uint8_t *data = (uint8_t *)basic_realloc(w->data_, size) ;
+        if (data == NULL) {
+            w->err_ = BASIC_ERR_OUT_OF_MEMORY ;
+            return false ;
+        }
+
+        w->data_ = data ;
+        w->size_ = size ;
+    }
+
+    return true ;
+}
+
+void basic_img_put(basic_img_writer_t *w, const void *data, uint32_t len)
+{
+    if (grow(w, len)) {
+        memcpy(w->data_ + w->count_, data, len) ;
+        w->count_ += len ;
+    }
+}
+
+void basic_img_put_u8(basic_img_writer_t *w, uint8_t value)
+{
+    basic_img_put(w, &value, 1) ;
+}
+
+void basic_img_put_u32(basic_img_writer_t *w, uint32_t value)
+{
+    uint8_t bytes[4] ;
+
+    bytes[0] = (value >> 0) & 0xff ;
+    bytes[1] = (value >> 8) & 0xff ;
+    bytes[2] = (value >> 16) & 0xff ;
+    bytes[3] = (value >> 24) & 0xff ;
+    basic_img_put(w, bytes, sizeof(bytes)) ;
+}
+
+void basic_img_put_str(basic_img_writer_t *w, const char *str, uint32_t len)
+{
+    if (len > 0xffff) {
+        if (w->err_ == BASIC_ERR_NONE)
+            w->err_ = BASIC_ERR_STRING_TOO_LONG ;
+        return ;
+    }
+
+    basic_img_put_u8(w, len & 0xff) ;
+    basic_img_put_u8(w, (len >> 8) & 0xff) ;
+    basic_img_put(w, str, len) ;
+}
+
+//
+// Record the first error found reading an image.  Always returns false.
+//
+bool basic_img_fail(basic_img_reader_t *r, basic_err_t err)
+{
+    if (r->err_ == BASIC_ERR_NONE)
+        r->err_ = err ;
+
+    return false ;
+}
+
+bool basic_img_get(basic_img_reader_t *r, void *data, uint32_t len)
+{
+    if (r->err_ != BASIC_ERR_NONE)
+        return false ;
+
+    if (len > r->size_ - r->pos_)
+        return basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+
+    memcpy(data, r->data_ + r->pos_, len) ;
+    r->pos_ += len ;
+    return true ;
+}
+
+uint8_t basic_img_get_u8(basic_img_reader_t *r)
+{
+    uint8_t value = 0 ;
+
+    basic_img_get(r, &value, 1) ;
+    return value ;
+}
+
+uint32_t basic_img_get_u32(basic_img_reader_t *r)
+{
+    uint8_t bytes[4] = { 0 } ;
+
+    basic_img_get(r, bytes, sizeof(bytes)) ;
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24) ;
+}
+
+//
+// The characters of a string, which are left where they are in the image and
+// are not terminated
+//
+const char *basic_img_get_chars(basic_img_reader_t *r, uint32_t *len)
+{
+    uint8_t bytes[2] ;
+
+    if (!basic_img_get(r, bytes, sizeof(bytes)))
+        return NULL ;
+
+    *len = bytes[0] | (bytes[1] << 8) ;
+    if (*len > r->size_ - r->pos_) {
+        basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+        return NULL ;
+    }
+
+    const char *ret = (const char *)r->data_ + r->pos_ ;
+    r->pos_ += *len ;
+    return ret ;
+}
+
+bool basic_img_get_str(basic_img_reader_t *r, char *buf, uint32_t size)
+{
+    uint32_t len ;
+
+    const char *chars = basic_img_get_chars(r, &len) ;
+    if (chars == NULL)
+        return false ;
+
+    if (len >= size || memchr(chars, '\0', len) != NULL)
+        return basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+
+    memcpy(buf, chars, len) ;
+    buf[len] = '\0' ;
+    return true ;
+}
+
+bool basic_img_get_var(basic_img_reader_t *r, uint32_t *varidx)
+{
+    uint32_t index = basic_img_get_u32(r) ;
+    if (r->err_ != BASIC_ERR_NONE)
+        return false ;
+
+    if (index >= r->varcnt_)
+        return basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+
+    *varidx = r->vars_[index] ;
+    return true ;
+}
+
+bool basic_img_get_userfn(basic_img_reader_t *r, uint32_t *fnindex)
+{
+    uint32_t handle = basic_img_get_u32(r) ;
+    if (r->err_ != BASIC_ERR_NONE)
+        return false ;
+
+    for(uint32_t i = 0 ; i < r->fncnt_ ; i++) {
+        if (r->fns_[i * 2] == handle) {
+            *fnindex = r->fns_[i * 2 + 1] ;
+            return true ;
+        }
+    }
+
+    return basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+}
+
+//
+// Write the object a handle in the tokens of a statement refers to.  Variables
+// and functions are written first, so only their handles are needed here.
+//
+static bool write_ref(basic_line_t *line, uint32_t offset, basic_line_ref_t kind, void *ctx)
+{
+    basic_img_writer_t *w = (basic_img_writer_t *)ctx ;
+    uint32_t handle = getU32(line, offset) ;
+    const char *str ;
+
+    switch(kind)
+    {
+        case BASIC_LINE_REF_EXPR:
+            return basic_expr_img_write(w, handle, 0, NULL) ;
+
+        case BASIC_LINE_REF_STR:
+            str = basic_str_value(handle) ;
+            if (str == NULL)
+                return false ;
+
+            basic_img_put_str(w, str, (uint32_t)strlen(str)) ;
+            break ;
+
+        case BASIC_LINE_REF_VAR:
+        case BASIC_LINE_REF_USERFN:
+            basic_img_put_u32(w, handle) ;
+            break ;
+
+        default:
+            return false ;
+    }
+
+    return w->err_ == BASIC_ERR_NONE ;
+}
+
+static bool write_stmt(basic_img_writer_t *w, basic_line_t *stmt)
+{
+    basic_img_put_u32(w, stmt->lineno_) ;
+    basic_img_put_u32(w, stmt->count_) ;
+    basic_img_put(w, stmt->tokens_, stmt->count_) ;
+
+    return basic_line_refs(stmt, write_ref, w) ;
+}
+
+static bool write_vars(basic_img_writer_t *w)
+{
+    uint32_t count = (uint32_t)basic_var_count() ;
+
+    basic_img_put_u32(w, count) ;
+    for(uint32_t i = 0 ; i < count ; i++) {
+        const char *name = basic_var_get_name(i) ;
+        basic_img_put_str(w, name, (uint32_t)strlen(name)) ;
+    }
+
+    return w->err_ == BASIC_ERR_NONE ;
+}
+
+static bool write_lines(basic_img_writer_t *w)
+{
+    uint32_t count = 0 ;
+
+    for(basic_line_t *line = program ; line != NULL ; line = line->next_)
+        count++ ;
+
+    basic_img_put_u32(w, count) ;
+
+    for(basic_line_t *line = program ; line != NULL ; line = line->next_) {
+        uint32_t stmts = 1 ;
+        for(basic_line_t *child = line->children_ ; child != NULL ; child = child->next_)
+            stmts++ ;
+
+        basic_img_put_u32(w, stmts) ;
+        if (!write_stmt(w, line))
+            return false ;
+
+        for(basic_line_t *child = line->children_ ; child != NULL ; child = child->next_) {
+            if (!write_stmt(w, child))
+                return false ;
+        }
+    }
+
+    return w->err_ == BASIC_ERR_NONE ;
+}
+
+//
+// Build the image of the program in memory.  srchash and srclen are the hash and
+// length of the text the program was saved as.  The image is allocated with
+// basic_malloc() and is the caller's to free.
+//
+bool basic_img_build(uint32_t srchash, uint32_t srclen, uint8_t **image, uint32_t *size, basic_err_t *err)
+{
+    basic_img_writer_t w = { NULL, 0, 0, BASIC_ERR_NONE } ;
+
+    //
+    // The header is written last, once the size and checksum are known
+    //
+    if (grow(&w, BASIC_IMG_HEADER_SIZE))
+        w.count_ = BASIC_IMG_HEADER_SIZE ;
+
+    if (!write_vars(&w) || !basic_userfn_img_write(&w) || !write_lines(&w)) {
+        *err = (w.err_ != BASIC_ERR_NONE) ? w.err_ : BASIC_ERR_BAD_IMAGE ;
+        basic_free(w.data_) ;
+        return false ;
+    }
+
+    uint32_t total = w.count_ ;
+
+    w.count_ = 0 ;
+    basic_img_put_u32(&w, BASIC_IMG_MAGIC) ;
+    basic_img_put_u32(&w, IMG_NUM_FORMAT) ;
+    basic_img_put_u32(&w, tables_hash()) ;
+    basic_img_put_u32(&w, srchash) ;
+    basic_img_put_u32(&w, srclen) ;
+    basic_img_put_u32(&w, total) ;
+    basic_img_put_u32(&w, basic_img_hash(BASIC_IMG_HASH_INIT, w.data_ + BASIC_IMG_HEADER_SIZE, total - BASIC_IMG_HEADER_SIZE)) ;
+
+    *image = w.data_ ;
+    *size = total ;
+    *err = BASIC_ERR_NONE ;
+    return true ;
+}
+
+//
+// Returns true if the header at the start of an image is for this build and its
+// tables, and for the program text with the given hash and length
+//
+bool basic_img_matches(const uint8_t *image, uint32_t size, uint32_t srchash, uint32_t srclen)
+{
+    basic_img_reader_t r ;
+
+    memset(&r, 0, sizeof(r)) ;
+    r.data_ = image ;
+    r.size_ = size ;
+
+    return basic_img_get_u32(&r) == BASIC_IMG_MAGIC && basic_img_get_u32(&r) == IMG_NUM_FORMAT &&
+            basic_img_get_u32(&r) == tables_hash() && basic_img_get_u32(&r) == srchash && basic_img_get_u32(&r) == srclen && r.err_ == BASIC_ERR_NONE ;
+}
+
+static bool read_vars(basic_img_reader_t *r)
+{
+    char name[BASIC_MAX_VARIABLE_LENGTH + 1] ;
+    basic_err_t err ;
+
+    uint32_t count = basic_img_get_u32(r) ;
+    if (r->err_ != BASIC_ERR_NONE)
+        return false ;
+
+    // Each name takes at least its length
+    if (count > (r->size_ - r->pos_) / 2)
+        return basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+
+    if (count > 0) {
+        r->vars_ = (uint32_t *)basic_malloc(sizeof(uint32_t) * count) ;
+        if (r->vars_ == NULL)
+            return basic_img_fail(r, BASIC_ERR_OUT_OF_MEMORY) ;
+    }
+
+    for(uint32_t i = 0 ; i < count ; i++) {
+        if (!basic_img_get_str(r, name, sizeof(name)))
+            return false ;
+
+        if (!basic_var_get(name, &r->vars_[i], &err))
+            return basic_img_fail(r, err) ;
+
+        r->varcnt_++ ;
+    }
+
+    return true ;
+}
+
+//
+// Read the object a handle in the tokens of a statement refers to, and put the
+// handle of the object in the tokens in place of the saved one
+//
+static bool read_ref(basic_line_t *line, uint32_t offset, basic_line_ref_t kind, void *ctx)
+{
+    basic_img_reader_t *r = (basic_img_reader_t *)ctx ;
+    char str[BASIC_PARSE_BUFFER_LENGTH] ;
+    uint32_t handle ;
+
+    switch(kind)
+    {
+        case BASIC_LINE_REF_EXPR:
+            if (!basic_expr_img_read(r, 0, NULL, &handle))
+                return false ;
+            break ;
+
+        case BASIC_LINE_REF_STR:
+            if (!basic_img_get_str(r, str, sizeof(str)))
+                return false ;
+
+            handle = basic_str_create_str(str) ;
+            if (handle == BASIC_STR_INVALID)
+                return basic_img_fail(r, BASIC_ERR_OUT_OF_MEMORY) ;
+            break ;
+
+        case BASIC_LINE_REF_VAR:
+            if (!basic_img_get_var(r, &handle))
+                return false ;
+            break ;
+
+        case BASIC_LINE_REF_USERFN:
+            if (!basic_img_get_userfn(r, &handle))
+                return false ;
+
+            //
+            // A DEF holds its function followed by the function's expression
+            //
+            putU32(line, offset + 4, get_user_fn_from_index(handle)->expridx_) ;
+            break ;
+
+        default:
+            return basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+    }
+
+    putU32(line, offset, handle) ;
+    return true ;
+}
+
+static basic_line_t *read_stmt(basic_img_reader_t *r)
+{
+    uint32_t lineno = basic_img_get_u32(r) ;
+    uint32_t count = basic_img_get_u32(r) ;
+    if (r->err_ != BASIC_ERR_NONE)
+        return NULL ;
+
+    if (count > r->size_ - r->pos_) {
+        basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+        return NULL ;
+    }
+
+    basic_line_t *stmt = (basic_line_t *)basic_malloc(sizeof(basic_line_t) + count) ;
+    if (stmt == NULL) {
+        basic_img_fail(r, BASIC_ERR_OUT_OF_MEMORY) ;
+        return NULL ;
+    }
+
+    stmt->lineno_ = lineno ;
+    stmt->count_ = count ;
+    stmt->children_ = NULL ;
+    stmt->next_ = NULL ;
+    basic_img_get(r, stmt->tokens_, count) ;
+
+    if (!basic_line_refs(stmt, read_ref, r)) {
+        //
+        // Some of the handles in the tokens are still the saved ones, so only
+        // the statement itself is freed.  Clearing the program frees the rest.
+        //
+        basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+        basic_free(stmt) ;
+        return NULL ;
+    }
+
+    return stmt ;
+}
+
+static bool read_lines(basic_img_reader_t *r)
+{
+    uint32_t count = basic_img_get_u32(r) ;
+
+    for(uint32_t i = 0 ; i < count && r->err_ == BASIC_ERR_NONE ; i++) {
+        uint32_t stmts = basic_img_get_u32(r) ;
+        if (stmts == 0)
+            return basic_img_fail(r, BASIC_ERR_BAD_IMAGE) ;
+
+        basic_line_t *line = read_stmt(r) ;
+        if (line == NULL)
+            return false ;
+
+        basic_line_t *last = NULL ;
+        for(uint32_t j = 1 ; j < stmts ; j++) {
+            basic_line_t *child = read_stmt(r) ;
+            if (child == NULL) {
+                basic_destroy_line(line) ;
+                return false ;
+            }
+
+            if (last == NULL)
+                line->children_ = child ;
+            else
+                last->next_ = child ;
+
+            last = child ;
+        }
+
+        basic_store_line(line) ;
+    }
+
+    return r->err_ == BASIC_ERR_NONE ;
+}
+
+//
+// Load a program from its image, adding its lines to the program as LOAD does.
+// A program that fails to load is cleared.
+//
+bool basic_img_load(const uint8_t *image, uint32_t size, basic_err_t *err)
+{
+    basic_img_reader_t r ;
+
+    memset(&r, 0, sizeof(r)) ;
+    r.data_ = image ;
+    r.size_ = size ;
+
+    uint32_t magic = basic_img_get_u32(&r) ;
+    uint32_t format = basic_img_get_u32(&r) ;
+    uint32_t tables = basic_img_get_u32(&r) ;
+
+    // The hash and length of the text were checked by the caller
+    basic_img_get_u32(&r) ;
+    basic_img_get_u32(&r) ;
+
+    uint32_t total = basic_img_get_u32(&r) ;
+    uint32_t checksum = basic_img_get_u32(&r) ;
+    if (r.err_ != BASIC_ERR_NONE || magic != BASIC_IMG_MAGIC || format != IMG_NUM_FORMAT || tables != tables_hash() || total != size ||
+            checksum != basic_img_hash(BASIC_IMG_HASH_INIT, image + BASIC_IMG_HEADER_SIZE, size - BASIC_IMG_HEADER_SIZE)) {
+        *err = BASIC_ERR_BAD_IMAGE ;
+        return false ;
+    }
+
+    if (read_vars(&r) && basic_userfn_img_read(&r) && read_lines(&r) && r.pos_ != r.size_)
+        basic_img_fail(&r, BASIC_ERR_BAD_IMAGE) ;
+
+    basic_free(r.vars_) ;
+    basic_free(r.fns_) ;
+
+    *err = r.err_ ;
+    if (r.err_ != BASIC_ERR_NONE) {
+        basic_err_t ignored ;
+        basic_clear(NULL, &ignored, NULL) ;
+        return false ;
+    }
+
+    return true ;
+}
+
+static bool read_all(basic_read_fn_t readfn, void *ctx, uint8_t *buf, uint32_t size)
+{
+    while (size > 0) {
+        int got = (*readfn)(ctx, (char *)buf, size) ;
+        if (got <= 0)
+            return false ;
+
+        buf += got ;
+        size -= (uint32_t)got ;
+    }
+
+    return true ;
+}
+
+//
+// Load the image of a program if it was saved from the text read through
+// srcctx.  Both are read with readfn.  Returns false if there is no image for
+// the text or it did not load, and the text is then loaded in the usual way.
+// The text has been read to the end either way.
+//
+static char hashbuf[BASIC_LOAD_CHUNK] ;
+
+bool basic_img_load_file(basic_read_fn_t readfn, void *imgctx, void *srcctx)
+{
+    uint32_t srchash = BASIC_IMG_HASH_INIT ;
+    uint32_t srclen = 0 ;
+    int got ;
+
+    while ((got = (*readfn)(srcctx, hashbuf, sizeof(hashbuf))) > 0) {
+        srchash = basic_img_hash(srchash, hashbuf, (uint32_t)got) ;
+        srclen += (uint32_t)got ;
+    }
+
+    uint8_t header[BASIC_IMG_HEADER_SIZE] ;
+    if (got < 0 || !read_all(readfn, imgctx, header, sizeof(header)) || !basic_img_matches(header, sizeof(header), srchash, srclen))
+        return false ;
+
+    uint32_t size = header[20] | (header[21] << 8) | (header[22] << 16) | ((uint32_t)header[23] << 24) ;
+    if (size < BASIC_IMG_HEADER_SIZE)
+        return false ;
+
+    uint8_t *image = (uint8_t *)basic_malloc(size) ;
+    if (image == NULL)
+        return false ;
+
+    basic_err_t err ;
+    memcpy(image, header, sizeof(header)) ;
+    bool ret = read_all(readfn, imgctx, image + BASIC_IMG_HEADER_SIZE, size - BASIC_IMG_HEADER_SIZE) && basic_img_load(image, size, &err) ;
+    basic_free(image) ;
+
+    return ret ;
+}
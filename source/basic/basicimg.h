@@ -0,0 +1,89 @@
+#pragma once
+
+#include "basicerr.h"
+#include "basicproc.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+//
+// A program image is the program as it is held in memory, written out so that
+// LOAD can rebuild it without parsing the text.  SAVE writes X.BBC next to
+// X.BAS, and LOAD uses the image when the length and hash of X.BAS are the
+// ones stored in it, so an image that is out of date is ignored.
+//
+// Everything is little endian, and no address or handle is used as it is
+// stored.  Tokens, operators and functions are stored by their number, so the
+// header holds a hash of the keyword, operator and function tables and an
+// image made with different tables is not loaded.  After the header come
+//
+//   the variables      the count, then the name of each in slot order
+//   the DEF FNs        the count, the handle, name and argument names of each,
+//                      then the expression of each
+//   the lines          the count, then for each line the number of statements
+//                      and for each statement its line number, its tokens and
+//                      the objects its tokens refer to, see basic_line_refs()
+//
+// Loading creates the variables and functions first.  The tokens of each
+// statement are then copied as they are and each handle in them is replaced by
+// the handle of the object rebuilt from the image.  Expressions are stored as
+// their parse trees, with the values that were folded, and are compiled for
+// the VM again as they are loaded.  Strings are stored as a 16 bit length and
+// the characters.
+//
+#define BASIC_IMG_MAGIC                 (0x04434242)        // "BBC" and the version of the format
+#define BASIC_IMG_HEADER_SIZE           (28)
+#define BASIC_IMG_HASH_INIT             (2166136261u)
+
+typedef struct basic_img_writer
+{
+    uint8_t *data_ ;
+    uint32_t count_ ;
+    uint32_t size_ ;
+    basic_err_t err_ ;                  // The first error, nothing more is written after one
+} basic_img_writer_t ;
+
+typedef struct basic_img_reader
+{
+    const uint8_t *data_ ;
+    uint32_t pos_ ;
+    uint32_t size_ ;
+    basic_err_t err_ ;                  // The first error, every read fails after one
+    uint32_t *vars_ ;                   // The slot of each variable in the image
+    uint32_t varcnt_ ;
+    uint32_t *fns_ ;                    // Pairs of the handle a DEF FN was saved with and its handle now
+    uint32_t fncnt_ ;
+} basic_img_reader_t ;
+
+extern uint32_t basic_img_hash(uint32_t hash, const void *data, uint32_t len) ;
+extern bool basic_img_name(const char *srcname, char *imgname, uint32_t size) ;
+extern bool basic_img_build(uint32_t srchash, uint32_t srclen, uint8_t **image, uint32_t *size, basic_err_t *err) ;
+extern bool basic_img_matches(const uint8_t *image, uint32_t size, uint32_t srchash, uint32_t srclen) ;
+extern bool basic_img_load(const uint8_t *image, uint32_t size, basic_err_t *err) ;
+extern bool basic_img_load_file(basic_read_fn_t readfn, void *imgctx, void *srcctx) ;
+
+extern bool basic_img_fail(basic_img_reader_t *r, basic_err_t err) ;
+extern void basic_img_put(basic_img_writer_t *w, const void *data, uint32_t len) ;
+extern void basic_img_put_u8(basic_img_writer_t *w, uint8_t value) ;
+extern void basic_img_put_u32(basic_img_writer_t *w, uint32_t value) ;
+extern void basic_img_put_str(basic_img_writer_t *w, const char *str, uint32_t len) ;
+extern bool basic_img_get(basic_img_reader_t *r, void *data, uint32_t len) ;
+extern uint8_t basic_img_get_u8(basic_img_reader_t *r) ;
+extern uint32_t basic_img_get_u32(basic_img_reader_t *r) ;
+extern bool basic_img_get_str(basic_img_reader_t *r, char *buf, uint32_t size) ;
+extern const char *basic_img_get_chars(basic_img_reader_t *r, uint32_t *len) ;
+extern bool basic_img_get_var(basic_img_reader_t *r, uint32_t *varidx) ;
+extern bool basic_img_get_userfn(basic_img_reader_t *r, uint32_t *fnindex) ;
+
+//
+// The parts of the image that belong to expressions, in basicexpr.c
+//
+extern bool basic_expr_img_write(basic_img_writer_t *w, uint32_t index, int argcnt, char **argnames) ;
+extern bool basic_expr_img_read(basic_img_reader_t *r, int argcnt, char **argnames, uint32_t *index) ;
+extern bool basic_userfn_img_write(basic_img_writer_t *w) ;
+extern bool basic_userfn_img_read(basic_img_reader_t *r) ;
+extern uint32_t basic_expr_img_tables(uint32_t hash) ;
+
+//
+// The part of the image that belongs to statements, in basicproc.c
+//
+extern uint32_t basic_line_img_tables(uint32_t hash) ;
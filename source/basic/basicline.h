@@ -1,4 +1,5 @@
 #pragma once
+#include "basicnum.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -57,40 +58,39 @@ typedef enum btokens {
     BTOKEN_RESTORE,
     BTOKEN_LED,
     BTOKEN_SLEEP,
-    BTOKEN_RENUM
+    BTOKEN_RENUM,
+    BTOKEN_MAT,
+
+    BTOKEN_COUNT                        // The number of tokens, not a token
 } btoken_t ;
 
+//
+// A statement and its tokens are a single allocation, with the tokens stored
+// after the header.  The text of a REM follows its token, ending in a '\0'.
+//
 typedef struct basic_line
 {
     uint32_t lineno_ ;
     uint32_t count_ ;
-    uint8_t *tokens_ ;
-    char *extra_ ;
     struct basic_line *children_ ;
     struct basic_line *next_ ;
+    uint8_t tokens_[] ;
 } basic_line_t ;
 
-typedef struct exec_context
-{
-    basic_line_t *line_ ;
-    basic_line_t *child_ ;
-    bool lastline_ ;
-    struct exec_context *next_ ;         // Not always used, but these can be linked to create a stack
-} exec_context_t ;
-
 typedef struct for_stack_entry
 {
-    exec_context_t context_ ;
+    uint32_t pc_ ;
     uint32_t varidx_ ;
-    uint32_t endidx_ ;
-    uint32_t stepidx_ ;
-    struct for_stack_entry *next_ ;
+    basic_num_t limit_ ;
+    basic_num_t step_ ;
+    bool integer_ ;                     // The loop variable is an A% variable, which uses ilimit_ and istep_
+    int32_t ilimit_ ;
+    int32_t istep_ ;
 } for_stack_entry_t ;
 
 typedef struct gosub_stack_entry
 {
-    exec_context_t context_ ;
-    struct gosub_stack_entry *next_ ;
+    uint32_t pc_ ;
 } gosub_stack_entry_t ;
 
 typedef struct token_table
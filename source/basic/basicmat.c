@@ -0,0 +1,200 @@
+#include "basicmat.h"
+#include "basiccfg.h"
+#include <string.h>
+
+//
+// On targets with vector registers GCC vector extensions do a register full of
+// numbers at a time, which is SSE or AVX on the desktop.  The CM4 has no SIMD
+// for floating point, so there the loops are unrolled four times in the way the
+// CMSIS-DSP kernels are, which keeps the FPU busy and cuts the loop overhead.
+// A Q16.16 multiply needs a 64 bit product, so the fixed point build always
+// scales with the unrolled loops.
+//
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__ARM_NEON)) && !defined(BASIC_MAT_NO_VECTOR)
+#define MAT_VECTOR
+#if BASIC_NUM_TYPE != BASIC_NUM_FIXED
+#define MAT_VECTOR_MUL
+#endif
+#endif
+
+#ifdef MAT_VECTOR
+#ifdef __AVX__
+#define MAT_VECTOR_BYTES    (32)
+#else
+#define MAT_VECTOR_BYTES    (16)
+#endif
+
+typedef basic_num_t mat_vec_t __attribute__((vector_size(MAT_VECTOR_BYTES))) ;
+
+#define MAT_LANES           (sizeof(mat_vec_t) / sizeof(basic_num_t))
+
+//
+// Columns start anywhere, so vectors are moved with memcpy(), which GCC turns
+// into an unaligned load or store
+//
+static inline mat_vec_t vec_load(const basic_num_t *p)
+{
+    mat_vec_t v ;
+    memcpy(&v, p, sizeof(v)) ;
+    return v ;
+}
+
+static inline void vec_store(basic_num_t *p, mat_vec_t v)
+{
+    memcpy(p, &v, sizeof(v)) ;
+}
+#endif
+
+void basic_mat_fill(basic_num_t *dst, basic_num_t value, uint32_t n)
+{
+    uint32_t i = 0 ;
+
+#ifdef MAT_VECTOR
+    mat_vec_t v = (mat_vec_t){ 0 } + value ;
+    for( ; i + MAT_LANES <= n ; i += MAT_LANES)
+        vec_store(dst + i, v) ;
+#else
+    for( ; i + 4 <= n ; i += 4) {
+        dst[i] = value ;
+        dst[i + 1] = value ;
+        dst[i + 2] = value ;
+        dst[i + 3] = value ;
+    }
+#endif
+
+    for( ; i < n ; i++)
+        dst[i] = value ;
+}
+
+void basic_mat_add(basic_num_t *dst, const basic_num_t *a, const basic_num_t *b, uint32_t n)
+{
+    uint32_t i = 0 ;
+
+#ifdef MAT_VECTOR
+    for( ; i + MAT_LANES <= n ; i += MAT_LANES)
+        vec_store(dst + i, vec_load(a + i) + vec_load(b + i)) ;
+#else
+    for( ; i + 4 <= n ; i += 4) {
+        basic_num_t s0 = a[i] + b[i] ;
+        basic_num_t s1 = a[i + 1] + b[i + 1] ;
+        basic_num_t s2 = a[i + 2] + b[i + 2] ;
+        basic_num_t s3 = a[i + 3] + b[i + 3] ;
+        dst[i] = s0 ;
+        dst[i + 1] = s1 ;
+        dst[i + 2] = s2 ;
+        dst[i + 3] = s3 ;
+    }
+#endif
+
+    for( ; i < n ; i++)
+        dst[i] = a[i] + b[i] ;
+}
+
+void basic_mat_sub(basic_num_t *dst, const basic_num_t *a, const basic_num_t *b, uint32_t n)
+{
+    uint32_t i = 0 ;
+
+#ifdef MAT_VECTOR
+    for( ; i + MAT_LANES <= n ; i += MAT_LANES)
+        vec_store(dst + i, vec_load(a + i) - vec_load(b + i)) ;
+#else
+    for( ; i + 4 <= n ; i += 4) {
+        basic_num_t s0 = a[i] - b[i] ;
+        basic_num_t s1 = a[i + 1] - b[i + 1] ;
+        basic_num_t s2 = a[i + 2] - b[i + 2] ;
+        basic_num_t s3 = a[i + 3] - b[i + 3] ;
+        dst[i] = s0 ;
+        dst[i + 1] = s1 ;
+        dst[i + 2] = s2 ;
+        dst[i + 3] = s3 ;
+    }
+#endif
+
+    for( ; i < n ; i++)
+        dst[i] = a[i] - b[i] ;
+}
+
+void basic_mat_scale(basic_num_t *dst, basic_num_t k, const basic_num_t *a, uint32_t n)
+{
+    uint32_t i = 0 ;
+
+#ifdef MAT_VECTOR_MUL
+    for( ; i + MAT_LANES <= n ; i += MAT_LANES)
+        vec_store(dst + i, vec_load(a + i) * k) ;
+#else
+    for( ; i + 4 <= n ; i += 4) {
+        basic_num_t s0 = basic_num_mul(k, a[i]) ;
+        basic_num_t s1 = basic_num_mul(k, a[i + 1]) ;
+        basic_num_t s2 = basic_num_mul(k, a[i + 2]) ;
+        basic_num_t s3 = basic_num_mul(k, a[i + 3]) ;
+        dst[i] = s0 ;
+        dst[i + 1] = s1 ;
+        dst[i + 2] = s2 ;
+        dst[i + 3] = s3 ;
+    }
+#endif
+
+    for( ; i < n ; i++)
+        dst[i] = basic_num_mul(k, a[i]) ;
+}
+
+//
+// dst += k * a over n numbers, the inner step of basic_mat_mul()
+//
+static inline void mat_axpy(basic_num_t *dst, basic_num_t k, const basic_num_t *a, uint32_t n)
+{
+    uint32_t i = 0 ;
+
+#ifdef MAT_VECTOR_MUL
+    for( ; i + MAT_LANES <= n ; i += MAT_LANES)
+        vec_store(dst + i, vec_load(dst + i) + vec_load(a + i) * k) ;
+#else
+    for( ; i + 4 <= n ; i += 4) {
+        dst[i] += basic_num_mul(k, a[i]) ;
+        dst[i + 1] += basic_num_mul(k, a[i + 1]) ;
+        dst[i + 2] += basic_num_mul(k, a[i + 2]) ;
+        dst[i + 3] += basic_num_mul(k, a[i + 3]) ;
+    }
+#endif
+
+    for( ; i < n ; i++)
+        dst[i] += basic_num_mul(k, a[i]) ;
+}
+
+void basic_mat_idn(basic_num_t *dst, uint32_t n)
+{
+    basic_mat_fill(dst, basic_num_from_int(0), n * n) ;
+    for(uint32_t i = 0 ; i < n ; i++)
+        dst[i + i * n] = basic_num_from_int(1) ;
+}
+
+//
+// dst is cols by rows.  Columns of a are read in order, so the reads are
+// sequential and the writes stride through dst.
+//
+void basic_mat_trn(basic_num_t *dst, const basic_num_t *a, uint32_t rows, uint32_t cols)
+{
+    for(uint32_t j = 0 ; j < cols ; j++) {
+        const basic_num_t *col = a + j * rows ;
+        for(uint32_t i = 0 ; i < rows ; i++)
+            dst[j + i * cols] = col[i] ;
+    }
+}
+
+//
+// dst (rows by cols) = a (rows by inner) * b (inner by cols).  Since columns are
+// contiguous, each column of dst is built as a sum of the columns of a scaled by
+// the matching column of b, so the work is all in mat_axpy() over contiguous
+// numbers rather than in dot products that stride across rows.
+//
+void basic_mat_mul(basic_num_t *dst, const basic_num_t *a, const basic_num_t *b, uint32_t rows, uint32_t inner, uint32_t cols)
+{
+    for(uint32_t j = 0 ; j < cols ; j++) {
+        basic_num_t *col = dst + j * rows ;
+        const basic_num_t *bcol = b + j * inner ;
+
+        basic_mat_fill(col, basic_num_from_int(0), rows) ;
+        for(uint32_t k = 0 ; k < inner ; k++)
+            mat_axpy(col, bcol[k], a + k * rows, rows) ;
+    }
+}
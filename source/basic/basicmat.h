@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "basicnum.h"
+
+//
+// The forms of the MAT statement.  The byte after BTOKEN_MAT holds one of
+// these, followed by the variable slots it works on:
+//
+//   MAT READ A, B          BASIC_MAT_READ, the slot of each array
+//   MAT PRINT A, B         BASIC_MAT_PRINT, the slot of each array
+//   MAT A = B              BASIC_MAT_COPY, A, B
+//   MAT A = B + C          BASIC_MAT_ADD, A, B, C (and BASIC_MAT_SUB for -)
+//   MAT A = B * C          BASIC_MAT_MUL, A, B, C
+//   MAT A = (K) * B        BASIC_MAT_SCALE, A, the expression for K, B
+//   MAT A = TRN(B)         BASIC_MAT_TRN, A, B
+//   MAT A = ZER            BASIC_MAT_ZER, A (and CON and IDN)
+//
+typedef enum basic_mat_op {
+    BASIC_MAT_READ,
+    BASIC_MAT_PRINT,
+    BASIC_MAT_COPY,
+    BASIC_MAT_ADD,
+    BASIC_MAT_SUB,
+    BASIC_MAT_MUL,
+    BASIC_MAT_SCALE,
+    BASIC_MAT_TRN,
+    BASIC_MAT_ZER,
+    BASIC_MAT_CON,
+    BASIC_MAT_IDN,
+} basic_mat_op_t ;
+
+//
+// The kernels behind MAT.  A matrix is the storage of a numeric array, which
+// holds A(I,J) at (I - base) + (J - base) * rows, so each column is contiguous.
+// A one dimensional array is a single column.  The element wise kernels work
+// on n numbers and the destination may be one of the sources.  The
+// destination of basic_mat_mul() and basic_mat_trn() must not be a source.
+//
+extern void basic_mat_fill(basic_num_t *dst, basic_num_t value, uint32_t n) ;
+extern void basic_mat_add(basic_num_t *dst, const basic_num_t *a, const basic_num_t *b, uint32_t n) ;
+extern void basic_mat_sub(basic_num_t *dst, const basic_num_t *a, const basic_num_t *b, uint32_t n) ;
+extern void basic_mat_scale(basic_num_t *dst, basic_num_t k, const basic_num_t *a, uint32_t n) ;
+extern void basic_mat_idn(basic_num_t *dst, uint32_t n) ;
+extern void basic_mat_trn(basic_num_t *dst, const basic_num_t *a, uint32_t rows, uint32_t cols) ;
+extern void basic_mat_mul(basic_num_t *dst, const basic_num_t *a, const basic_num_t *b, uint32_t rows, uint32_t inner, uint32_t cols) ;
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Heap statistics for the interpreter.  All allocations made by the interpreter
+// go through these macros so that MEM can report the heap traffic a program
+// causes.  The counts are cumulative since power up, the number of live blocks
+// is allocs_ - frees_.  These are macros, not functions, so the debug heap on
+// the desktop still records the file and line of each allocation.
+//
+typedef struct basic_mem_stats
+{
+    uint32_t allocs_ ;
+    uint32_t frees_ ;
+    uint32_t bytes_ ;
+} basic_mem_stats_t ;
+
+extern basic_mem_stats_t basic_mem_stats ;
+
+#define basic_malloc(size)          (basic_mem_stats.allocs_++, basic_mem_stats.bytes_ += (uint32_t)(size), malloc(size))
+#define basic_realloc(ptr, size)    (basic_mem_stats.allocs_++, basic_mem_stats.frees_ += ((ptr) != NULL), basic_mem_stats.bytes_ += (uint32_t)(size), realloc((ptr), (size)))
+#define basic_strdup(str)           (basic_mem_stats.allocs_++, basic_mem_stats.bytes_ += (uint32_t)strlen(str) + 1, _strdup(str))
+#define basic_free(ptr)             (basic_mem_stats.frees_ += ((ptr) != NULL), free(ptr))
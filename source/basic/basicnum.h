@@ -0,0 +1,133 @@
+#pragma once
+
+#include "basiccfg.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+//
+// The type BASIC numbers are held in, chosen by BASIC_NUM_TYPE in basiccfg.h.
+// Addition, subtraction, negation and comparison are done on basic_num_t with
+// the C operators whatever the type.  Everything else, including converting to
+// and from C numbers, goes through these functions so the fixed point build
+// scales correctly.  Printing and the transcendental functions work in double
+// for every type.
+//
+#if BASIC_NUM_TYPE == BASIC_NUM_DOUBLE
+
+typedef double basic_num_t ;
+
+// Numbers closer to zero than this are false for AND, OR and IF
+#define BASIC_NUM_EPSILON               (1.0e-6)
+
+static inline basic_num_t basic_num_from_double(double d) { return d ; }
+static inline double basic_num_to_double(basic_num_t n) { return n ; }
+static inline basic_num_t basic_num_from_int(int32_t i) { return (basic_num_t)i ; }
+static inline int32_t basic_num_to_int(basic_num_t n) { return (int32_t)n ; }
+static inline basic_num_t basic_num_mul(basic_num_t a, basic_num_t b) { return a * b ; }
+static inline basic_num_t basic_num_div(basic_num_t a, basic_num_t b) { return a / b ; }
+static inline basic_num_t basic_num_abs(basic_num_t n) { return fabs(n) ; }
+static inline basic_num_t basic_num_sqrt(basic_num_t n) { return sqrt(n) ; }
+static inline basic_num_t basic_num_exp(basic_num_t n) { return exp(n) ; }
+static inline basic_num_t basic_num_pow(basic_num_t a, basic_num_t b) { return pow(a, b) ; }
+static inline bool basic_num_is_true(basic_num_t n) { return fabs(n) > BASIC_NUM_EPSILON ; }
+static inline bool basic_num_fits_int(basic_num_t n) { return n > -2147483649.0 && n < 2147483648.0 ; }
+static inline bool basic_num_holds_int(int32_t i) { return true ; }
+static inline bool basic_num_holds_double(double d) { return true ; }
+
+#elif BASIC_NUM_TYPE == BASIC_NUM_FLOAT
+
+typedef float basic_num_t ;
+
+#define BASIC_NUM_EPSILON               (1.0e-6f)
+
+static inline basic_num_t basic_num_from_double(double d) { return (float)d ; }
+static inline double basic_num_to_double(basic_num_t n) { return n ; }
+static inline basic_num_t basic_num_from_int(int32_t i) { return (basic_num_t)i ; }
+static inline int32_t basic_num_to_int(basic_num_t n) { return (int32_t)n ; }
+static inline basic_num_t basic_num_mul(basic_num_t a, basic_num_t b) { return a * b ; }
+static inline basic_num_t basic_num_div(basic_num_t a, basic_num_t b) { return a / b ; }
+static inline basic_num_t basic_num_abs(basic_num_t n) { return fabsf(n) ; }
+static inline basic_num_t basic_num_sqrt(basic_num_t n) { return sqrtf(n) ; }
+static inline basic_num_t basic_num_exp(basic_num_t n) { return expf(n) ; }
+static inline basic_num_t basic_num_pow(basic_num_t a, basic_num_t b) { return powf(a, b) ; }
+static inline bool basic_num_is_true(basic_num_t n) { return fabsf(n) > BASIC_NUM_EPSILON ; }
+static inline bool basic_num_fits_int(basic_num_t n) { return n >= -2147483648.0f && n < 2147483648.0f ; }
+static inline bool basic_num_holds_int(int32_t i) { return true ; }
+static inline bool basic_num_holds_double(double d) { return true ; }
+
+#elif BASIC_NUM_TYPE == BASIC_NUM_FIXED
+
+//
+// Q16.16, a 32 bit integer holding the number times 65536.  The range is about
+// +/-32767 with a resolution of 1/65536.  Results that do not fit wrap around,
+// but a constant or an A% integer that does not fit is an overflow, see
+// basic_num_holds_int() and basic_num_holds_double().
+//
+typedef int32_t basic_num_t ;
+
+#define BASIC_NUM_FRAC_BITS             (16)
+
+// The smallest step, anything below this is zero
+#define BASIC_NUM_EPSILON               (1)
+
+static inline basic_num_t basic_num_from_double(double d)
+{
+    return (basic_num_t)(d * (1 << BASIC_NUM_FRAC_BITS) + (d < 0 ? -0.5 : 0.5)) ;
+}
+
+static inline double basic_num_to_double(basic_num_t n)
+{
+    return (double)n / (1 << BASIC_NUM_FRAC_BITS) ;
+}
+
+static inline basic_num_t basic_num_from_int(int32_t i)
+{
+    return (basic_num_t)((uint32_t)i << BASIC_NUM_FRAC_BITS) ;
+}
+
+// Truncates toward zero, as a cast of a double does
+static inline int32_t basic_num_to_int(basic_num_t n)
+{
+    return n >= 0 ? (n >> BASIC_NUM_FRAC_BITS) : -((-n) >> BASIC_NUM_FRAC_BITS) ;
+}
+
+static inline basic_num_t basic_num_mul(basic_num_t a, basic_num_t b)
+{
+    return (basic_num_t)(((int64_t)a * b) >> BASIC_NUM_FRAC_BITS) ;
+}
+
+static inline basic_num_t basic_num_div(basic_num_t a, basic_num_t b)
+{
+    return (basic_num_t)(((int64_t)a << BASIC_NUM_FRAC_BITS) / b) ;
+}
+
+static inline basic_num_t basic_num_abs(basic_num_t n) { return n < 0 ? -n : n ; }
+static inline basic_num_t basic_num_sqrt(basic_num_t n) { return basic_num_from_double(sqrt(basic_num_to_double(n))) ; }
+static inline basic_num_t basic_num_exp(basic_num_t n) { return basic_num_from_double(exp(basic_num_to_double(n))) ; }
+static inline basic_num_t basic_num_pow(basic_num_t a, basic_num_t b) { return basic_num_from_double(pow(basic_num_to_double(a), basic_num_to_double(b))) ; }
+static inline bool basic_num_is_true(basic_num_t n) { return n != 0 ; }
+static inline bool basic_num_fits_int(basic_num_t n) { return true ; }
+
+// Returns true if an integer is in the range of a Q16.16
+static inline bool basic_num_holds_int(int32_t i)
+{
+    return i >= -(1 << (31 - BASIC_NUM_FRAC_BITS)) && i < (1 << (31 - BASIC_NUM_FRAC_BITS)) ;
+}
+
+static inline bool basic_num_holds_double(double d)
+{
+    return d >= -(double)(1 << (31 - BASIC_NUM_FRAC_BITS)) && d < (double)(1 << (31 - BASIC_NUM_FRAC_BITS)) ;
+}
+
+#else
+#error BASIC_NUM_TYPE must be BASIC_NUM_DOUBLE, BASIC_NUM_FLOAT or BASIC_NUM_FIXED
+#endif
+
+//
+// Returns true if a number is printed as an integer
+//
+static inline bool basic_num_is_int(basic_num_t n)
+{
+    return n - basic_num_from_int(basic_num_to_int(n)) < BASIC_NUM_EPSILON ;
+}
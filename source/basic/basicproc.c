@@ -1,4 +1,4 @@
-#ifdef DESKTOP
+#if defined(DESKTOP) && defined(_MSC_VER)
 #define _CRTDBG_MAP_ALLOC
 #include <stdlib.h>
 #include <crtdbg.h>
@@ -11,6 +11,10 @@
 #include "basicexpr.h"
 #include "basiccfg.h"
 #include "basicstr.h"
+#include "basicmem.h"
+#include "basicmat.h"
+#include "basictrie.h"
+#include "basicimg.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -20,6 +24,9 @@
 
 #ifndef DESKTOP
 #include <ff.h>
+#endif
+
+#ifndef _MSC_VER
 #define _stricmp strcasecmp
 #define _strdup strdup
 #define _strnicmp strncasecmp
@@ -69,6 +76,7 @@ token_table_t tokens[] =
     { BTOKEN_LET, "LET"},
     { BTOKEN_LED, "LED"},
     { BTOKEN_SLEEP, "SLEEP"},
+    { BTOKEN_MAT, "MAT"},
 
     //
     // These must be after the BTOKEN_LET line above as it needs to be used for parsing
@@ -77,51 +85,115 @@ token_table_t tokens[] =
     { BTOKEN_LET_ARRAY, "LET"},
 } ;
 
-static char linebuf[256] ;
-static char other[256] ;
 static char msg[256];
 
-bool basic_is_keyword(const char *line)
+//
+// Keywords are found through a trie built from tokens[], which holds the index
+// of each keyword's entry, and turned back into text through token_names.
+// Both are built the first time they are needed.  LET is in tokens[] more than
+// once, the first entry is the one that is found.
+//
+static basic_trie_t keyword_trie ;
+static const char *token_names[BTOKEN_COUNT] ;
+
+static void build_keywords()
 {
+    if (keyword_trie.count_ != 0)
+        return ;
+
     for(int i = 0 ; i < sizeof(tokens)/sizeof(tokens[0]) ; i++) {
-        size_t len = strlen(tokens[i].str_) ;
-        if (_strnicmp(line, tokens[i].str_, len) == 0) {
-            return true ;
-        }
+        bool added = basic_trie_add(&keyword_trie, tokens[i].str_, (uint8_t)i) ;
+        assert(added) ;
+        (void)added ;
+
+        if (token_names[tokens[i].token_] == NULL)
+            token_names[tokens[i].token_] = tokens[i].str_ ;
     }
-    return false ;
+}
+
+//
+// Returns the index in tokens[] of the keyword the line starts with, or -1.  As
+// with the rest of the parser, a keyword does not need a space after it.
+//
+static int find_keyword(const char *line, size_t *len)
+{
+    build_keywords() ;
+    return basic_trie_match(&keyword_trie, line, len) ;
+}
+
+bool basic_is_keyword(const char *line)
+{
+    size_t len ;
+    return find_keyword(line, &len) != -1 ;
 }
 
 const char *basic_token_to_str(uint8_t token)
 {
-    for(int i = 0 ; i < sizeof(tokens) / sizeof(tokens[0]) ; i++) {
-        if (tokens[i].token_ == token) {
-            return tokens[i].str_;
-        }
-    }
+    build_keywords() ;
+    if (token < BTOKEN_COUNT && token_names[token] != NULL)
+        return token_names[token] ;
 
     return "!ERROR!" ;
 }
 
-static basic_line_t *create_line()
+//
+// Statements are tokenized into a scratch line that is kept from one line of
+// text to the next, then copied to a line of exactly the right size.  The
+// scratch is made big enough for the whole line of text before any of it is
+// parsed, doubling when it has to grow, so the parse functions can hold on to
+// it.  No statement needs more than sizeof(basic_num_t) + 1 bytes of tokens for
+// each character of text, DATA 1,2,3 being the worst case.
+//
+static basic_line_t *scratch = NULL ;
+static uint32_t scratch_size = 0 ;      // The bytes of tokens scratch has room for
+
+static bool reserve_scratch(size_t textlen)
+{
+    uint32_t needed = (uint32_t)((textlen + 1) * (sizeof(basic_num_t) + 1)) ;
+    if (needed <= scratch_size)
+        return true ;
+
+    uint32_t size = (scratch_size == 0) ? 64 : scratch_size ;
+    while (size < needed)
+        size *= 2 ;
+
+    basic_line_t *line = (basic_line_t *)basic_realloc(scratch, sizeof(basic_line_t) + size) ;
+    if (line == NULL)
+        return false ;
+
+    scratch = line ;
+    scratch_size = size ;
+    return true ;
+}
+
+static basic_line_t *start_line()
+{
+    scratch->lineno_ = -1 ;
+    scratch->count_ = 0 ;
+    scratch->next_ = NULL ;
+    scratch->children_ = NULL ;
+
+    return scratch ;
+}
+
+static basic_line_t *commit_line()
 {
-    basic_line_t *ret = (basic_line_t *)malloc(sizeof(basic_line_t)) ;
+    size_t size = sizeof(basic_line_t) + scratch->count_ ;
+
+    basic_line_t *ret = (basic_line_t *)basic_malloc(size) ;
     if (ret == NULL)
         return NULL ;
 
-    ret->lineno_ = -1 ;
-    ret->count_ = 0 ;
-    ret->next_ = NULL ;
-    ret->children_ = NULL ;
-    ret->tokens_ = NULL ;
-    ret->extra_ = NULL ;
-
+    memcpy(ret, scratch, size) ;
     return ret ;
 }
 
-void basic_destroy_line(basic_line_t *line)
+//
+// Free the expressions and strings the tokens of a line refer to
+//
+static void destroy_tokens(basic_line_t *line)
 {
-    if (line->tokens_ != NULL) {
+    if (line->count_ > 0) {
         switch (line->tokens_[0])
         {
             case BTOKEN_DIM:
@@ -129,7 +201,7 @@ void basic_destroy_line(basic_line_t *line)
                 uint32_t index = 1 ;
 
                 while (index < line->count_) {
-                    basic_str_destroy(getU32(line, index)) ;
+                    // Variable slot
                     index += 4 ;
 
                     uint32_t dimcnt = getU32(line, index) ;
@@ -145,16 +217,13 @@ void basic_destroy_line(basic_line_t *line)
             break;
 
             case BTOKEN_LET_SIMPLE:
-                basic_str_destroy(getU32(line, 1)) ;
                 basic_expr_destroy(getU32(line, 5));
                 break;
 
             case BTOKEN_LET_ARRAY:
             {
-                uint32_t index = 1;
-
-                basic_str_destroy(getU32(line, index)) ;
-                index += 4 ;
+                // Skip the variable slot
+                uint32_t index = 5;
 
                 uint32_t dimcnt = getU32(line, index);
                 index += 4;
@@ -193,9 +262,9 @@ void basic_destroy_line(basic_line_t *line)
                 uint32_t index = 1;
                 while (index < line->count_) {
                     token = line->tokens_[index++] ;
-                    uint32_t stridx = getU32(line, index);
+
+                    // Variable slot
                     index += 4;
-                    basic_str_destroy(stridx);
 
                     if (token == BTOKEN_LET_ARRAY)
                     {
@@ -219,11 +288,15 @@ void basic_destroy_line(basic_line_t *line)
                 uint32_t index = 1;
                 while (index < line->count_) {
                     uint8_t token = line->tokens_[index++] ;
-                    uint32_t value = getU32(line, index) ;
-                    index += 4 ;
                     if (token == BTOKEN_STRING) 
                     {
-                        basic_str_destroy(value) ;
+                        basic_str_destroy(getU32(line, index)) ;
+                        index += 4 ;
+                    }
+                    else
+                    {
+                        // Numbers are stored as a basic_num_t
+                        index += sizeof(basic_num_t) ;
                     }
                 }
             }
@@ -249,14 +322,24 @@ void basic_destroy_line(basic_line_t *line)
 
             case BTOKEN_INPUT:
             {
-                uint32_t strh ;
-                uint32_t index = 2 ;
+                uint32_t index = 1 ;
+
+                if (line->tokens_[index++] == BTOKEN_PROMPT) {
+                    basic_str_destroy(getU32(line, index)) ;
+                    index += 4 ;
+                }
 
                 while (index < line->count_) {
-                    strh = getU32(line, index) ;
+                    // Variable slot
+                    index += 4 ;
+
+                    uint32_t dimcnt = getU32(line, index) ;
                     index += 4 ;
 
-                    basic_str_destroy(strh) ;
+                    for(uint32_t i = 0 ; i < dimcnt ; i++) {
+                        basic_expr_destroy(getU32(line, index)) ;
+                        index += 4 ;
+                    }
                 }
             }
             break ;
@@ -265,6 +348,12 @@ void basic_destroy_line(basic_line_t *line)
                 basic_expr_destroy(getU32(line, 2));
                 break ;
 
+            case BTOKEN_MAT:
+                // Only the scale factor is an expression
+                if (line->count_ >= 10 && line->tokens_[1] == BASIC_MAT_SCALE)
+                    basic_expr_destroy(getU32(line, 6));
+                break ;
+
             case BTOKEN_REM:
             case BTOKEN_LIST:
             case BTOKEN_RUN: 
@@ -295,34 +384,25 @@ void basic_destroy_line(basic_line_t *line)
                 break;    
 
             case BTOKEN_FOR:
-                basic_str_destroy(getU32(line, 1)) ;
                 basic_expr_destroy(getU32(line, 5)) ;
                 basic_expr_destroy(getU32(line, 9)) ;
-                basic_expr_destroy(getU32(line, 13)) ;
+                if (line->count_ > 13)
+                    basic_expr_destroy(getU32(line, 13)) ;
                 break ;
 
             case BTOKEN_NEXT:
-                {
-                    uint32_t index = 1 ;
-                    while (index < line->count_) {
-                        uint32_t varh = getU32(line, index) ;
-                        index += 4 ;
-                        basic_str_destroy(varh) ;
-                    }
-                }
                 break;
 
             default:
                 assert(false);
                 break;
         }
-
-        free(line->tokens_);
     }
+}
 
-    if (line->extra_) {
-        free(line->extra_);
-    }
+void basic_destroy_line(basic_line_t *line)
+{
+    destroy_tokens(line) ;
 
     basic_line_t *child = line->children_ ;
     while (child) {
@@ -331,21 +411,235 @@ void basic_destroy_line(basic_line_t *line)
         child = next ;
     }
     
-    free(line) ;
+    basic_free(line) ;
 }
 
-static bool add_token(basic_line_t *line, uint8_t token)
+static bool line_ref(basic_line_t *line, uint32_t offset, basic_line_ref_t kind, basic_line_ref_fn_t fn, void *ctx)
 {
-    if (line->count_ == 0) {
-        // First token in a line
-        line->tokens_ = (uint8_t *)malloc(sizeof(uint8_t)) ;
+    if (offset + 4 > line->count_)
+        return false ;
+
+    return (*fn)(line, offset, kind, ctx) ;
+}
+
+//
+// The subscripts of a variable, which are the count followed by an expression
+// for each
+//
+static bool line_ref_dims(basic_line_t *line, uint32_t *index, basic_line_ref_fn_t fn, void *ctx)
+{
+    if (*index + 4 > line->count_)
+        return false ;
+
+    uint32_t dimcnt = getU32(line, *index) ;
+    *index += 4 ;
+
+    for(uint32_t i = 0 ; i < dimcnt ; i++) {
+        if (!line_ref(line, *index, BASIC_LINE_REF_EXPR, fn, ctx))
+            return false ;
+        *index += 4 ;
     }
-    else {
-        // Additional tokens in a line
-        line->tokens_ = (uint8_t *)realloc(line->tokens_, sizeof(uint8_t) * (line->count_ + 1)) ;
+
+    return true ;
+}
+
+//
+// Call fn with the offset of each handle in the tokens of a statement, in the
+// order the tokens hold them.  This is how a program image finds the objects
+// to save with a statement and the handles to replace when it is loaded.
+// Returns false if fn does, or if the tokens are not laid out as expected.
+//
+bool basic_line_refs(basic_line_t *line, basic_line_ref_fn_t fn, void *ctx)
+{
+    uint32_t index = 1 ;
+
+    if (line->count_ == 0)
+        return true ;
+
+    switch (line->tokens_[0])
+    {
+        case BTOKEN_DIM:
+            while (index < line->count_) {
+                if (!line_ref(line, index, BASIC_LINE_REF_VAR, fn, ctx))
+                    return false ;
+                index += 4 ;
+
+                if (!line_ref_dims(line, &index, fn, ctx))
+                    return false ;
+            }
+            break ;
+
+        case BTOKEN_LET_SIMPLE:
+            return line_ref(line, 1, BASIC_LINE_REF_VAR, fn, ctx) && line_ref(line, 5, BASIC_LINE_REF_EXPR, fn, ctx) ;
+
+        case BTOKEN_LET_ARRAY:
+            index = 5 ;
+            return line_ref(line, 1, BASIC_LINE_REF_VAR, fn, ctx) && line_ref_dims(line, &index, fn, ctx) &&
+                    line_ref(line, index, BASIC_LINE_REF_EXPR, fn, ctx) ;
+
+        case BTOKEN_PRINT:
+            while (index < line->count_) {
+                // The EXPR or TAB token comes before the expression
+                if (!line_ref(line, index + 1, BASIC_LINE_REF_EXPR, fn, ctx))
+                    return false ;
+                index += 5 ;
+
+                // Then the COMMA or SEMICOLON if there is one
+                if (index < line->count_)
+                    index++ ;
+            }
+            break ;
+
+        case BTOKEN_READ:
+            while (index < line->count_) {
+                uint8_t token = line->tokens_[index++] ;
+
+                if (!line_ref(line, index, BASIC_LINE_REF_VAR, fn, ctx))
+                    return false ;
+                index += 4 ;
+
+                if (token == BTOKEN_LET_ARRAY && !line_ref_dims(line, &index, fn, ctx))
+                    return false ;
+            }
+            break ;
+
+        case BTOKEN_DATA:
+            while (index < line->count_) {
+                if (line->tokens_[index++] == BTOKEN_STRING) {
+                    if (!line_ref(line, index, BASIC_LINE_REF_STR, fn, ctx))
+                        return false ;
+                    index += 4 ;
+                }
+                else {
+                    index += sizeof(basic_num_t) ;
+                }
+            }
+            break ;
+
+        case BTOKEN_VARS:
+        case BTOKEN_BASE:
+            if (line->count_ > 1)
+                return line_ref(line, 1, BASIC_LINE_REF_EXPR, fn, ctx) ;
+            break ;
+
+        case BTOKEN_INPUT:
+            if (line->count_ < 2)
+                return false ;
+
+            if (line->tokens_[index++] == BTOKEN_PROMPT) {
+                if (!line_ref(line, index, BASIC_LINE_REF_STR, fn, ctx))
+                    return false ;
+                index += 4 ;
+            }
+
+            while (index < line->count_) {
+                if (!line_ref(line, index, BASIC_LINE_REF_VAR, fn, ctx))
+                    return false ;
+                index += 4 ;
+
+                if (!line_ref_dims(line, &index, fn, ctx))
+                    return false ;
+            }
+            break ;
+
+        case BTOKEN_ON:
+        case BTOKEN_IF:
+        case BTOKEN_DEL:
+        case BTOKEN_LED:
+        case BTOKEN_SLEEP:
+        case BTOKEN_LOAD:
+        case BTOKEN_SAVE:
+            return line_ref(line, 1, BASIC_LINE_REF_EXPR, fn, ctx) ;
+
+        case BTOKEN_RENAME:
+            return line_ref(line, 1, BASIC_LINE_REF_EXPR, fn, ctx) && line_ref(line, 5, BASIC_LINE_REF_EXPR, fn, ctx) ;
+
+        case BTOKEN_DEF:
+            // The expression that follows the function belongs to the function
+            if (line->count_ < 9)
+                return false ;
+            return line_ref(line, 1, BASIC_LINE_REF_USERFN, fn, ctx) ;
+
+        case BTOKEN_FOR:
+            if (!line_ref(line, 1, BASIC_LINE_REF_VAR, fn, ctx) || !line_ref(line, 5, BASIC_LINE_REF_EXPR, fn, ctx) ||
+                    !line_ref(line, 9, BASIC_LINE_REF_EXPR, fn, ctx))
+                return false ;
+
+            if (line->count_ > 13)
+                return line_ref(line, 13, BASIC_LINE_REF_EXPR, fn, ctx) ;
+            break ;
+
+        case BTOKEN_NEXT:
+            while (index < line->count_) {
+                if (!line_ref(line, index, BASIC_LINE_REF_VAR, fn, ctx))
+                    return false ;
+                index += 4 ;
+            }
+            break ;
+
+        case BTOKEN_MAT:
+            // The operation, then the arrays, with the factor of a scale after the first
+            if (line->count_ < 2)
+                return false ;
+
+            for(index = 2 ; index < line->count_ ; index += 4) {
+                basic_line_ref_t kind = BASIC_LINE_REF_VAR ;
+                if (index == 6 && line->tokens_[1] == BASIC_MAT_SCALE)
+                    kind = BASIC_LINE_REF_EXPR ;
+
+                if (!line_ref(line, index, kind, fn, ctx))
+                    return false ;
+            }
+            break ;
+
+        case BTOKEN_REM:
+        case BTOKEN_LIST:
+        case BTOKEN_RUN:
+        case BTOKEN_CLEAR:
+        case BTOKEN_FLIST:
+        case BTOKEN_CLS:
+        case BTOKEN_GOTO:
+        case BTOKEN_GOSUB:
+        case BTOKEN_RETURN:
+        case BTOKEN_END:
+        case BTOKEN_STOP:
+        case BTOKEN_TRON:
+        case BTOKEN_TROFF:
+        case BTOKEN_RESTORE:
+        case BTOKEN_MEM:
+        case BTOKEN_RENUM:
+            break ;
+
+        default:
+            return false ;
+    }
+
+    return true ;
+}
+
+//
+// Add the keywords and their token values to the hash of the tables a program
+// image depends on, since the tokens of a statement are saved as they are
+//
+uint32_t basic_line_img_tables(uint32_t hash)
+{
+    for(int i = 0 ; i < sizeof(tokens)/sizeof(tokens[0]) ; i++) {
+        uint8_t token = tokens[i].token_ ;
+        hash = basic_img_hash(hash, &token, 1) ;
+        hash = basic_img_hash(hash, tokens[i].str_, (uint32_t)strlen(tokens[i].str_) + 1) ;
     }
 
-    if (line->tokens_ == NULL)
+    return hash ;
+}
+
+static bool has_room(basic_line_t *line, uint32_t size)
+{
+    return line->count_ + size <= scratch_size ;
+}
+
+static bool add_token(basic_line_t *line, uint8_t token)
+{
+    if (!has_room(line, 1))
         return false ;
 
     line->tokens_[line->count_++] = token ;
@@ -354,16 +648,7 @@ static bool add_token(basic_line_t *line, uint8_t token)
 
 static bool add_uint32(basic_line_t *line, uint32_t value)
 {
-    if (line->count_ == 0) {
-        // First token in a line
-        line->tokens_ = (uint8_t *)malloc(sizeof(uint32_t)) ;
-    }
-    else {
-        // Additional tokens in a line
-        line->tokens_ = (uint8_t *)realloc(line->tokens_, sizeof(uint8_t) * (line->count_ + sizeof(uint32_t))) ;
-    }
-
-    if (line->tokens_ == NULL)
+    if (!has_room(line, sizeof(uint32_t)))
         return false ;
 
     line->tokens_[line->count_++] = (value & 0xff) ;
@@ -374,43 +659,38 @@ static bool add_uint32(basic_line_t *line, uint32_t value)
     return true ;    
 }
 
-static bool add_double(basic_line_t *line, double value)
+static bool add_num(basic_line_t *line, basic_num_t value)
 {
-    if (line->count_ == 0) {
-        // First token in a line
-        line->tokens_ = (uint8_t *)malloc(sizeof(double)) ;
-    }
-    else {
-        // Additional tokens in a line
-        line->tokens_ = (uint8_t *)realloc(line->tokens_, sizeof(uint8_t) * (line->count_ + sizeof(double))) ;
-    }
-
-    if (line->tokens_ == NULL)
+    if (!has_room(line, sizeof(basic_num_t)))
         return false ;
 
-    memcpy(&line->tokens_[line->count_], &value, sizeof(double)) ;
-    line->count_ += sizeof(double) ;
+    memcpy(&line->tokens_[line->count_], &value, sizeof(basic_num_t)) ;
+    line->count_ += sizeof(basic_num_t) ;
 
     return true ;    
 }
 
 static const char *parse_keyword(const char *line, uint8_t *token, basic_err_t *err)
 {
+    size_t len ;
+
     *err = BASIC_ERR_NONE ;
     line = skipSpaces(line) ;
 
-    for(int i = 0 ; i < sizeof(tokens)/sizeof(tokens[0]) ; i++) {
-        size_t len = strlen(tokens[i].str_) ;
-        if (_strnicmp(line, tokens[i].str_, len) == 0) {
-            *token = tokens[i].token_ ;
-            return line + len ;
-        }
+    int i = find_keyword(line, &len) ;
+    if (i != -1) {
+        *token = tokens[i].token_ ;
+        return line + len ;
     }
 
     *err = BASIC_ERR_UNKNOWN_KEYWORD ;
     return NULL ;
 }
 
+//
+// Parse a variable name and bind it to its variable slot.  Names are stored in
+// upper case, the same as the expression parser, so A and a are the same variable.
+//
 static const char *parse_varname(const char *line, uint32_t *varindex, basic_err_t *err)
 {
     char keyword[BASIC_MAX_VARIABLE_LENGTH + 1] ;
@@ -427,14 +707,14 @@ static const char *parse_varname(const char *line, uint32_t *varindex, basic_err
 
     while (isalpha((uint8_t)*line) || isdigit((uint8_t)*line))
     {
-        keyword[stored++] = *line++ ;
+        keyword[stored++] = toupper(*line++) ;
         if (stored == BASIC_MAX_VARIABLE_LENGTH + 1) {
             *err = BASIC_ERR_VARIABLE_TOO_LONG ;
             return NULL ;
         }
     }
 
-    if (*line == '$') {
+    if (*line == '$' || *line == '%') {
         keyword[stored++] = *line++ ;
         if (stored == BASIC_MAX_VARIABLE_LENGTH + 1) {
             *err = BASIC_ERR_VARIABLE_TOO_LONG ;
@@ -449,11 +729,8 @@ static const char *parse_varname(const char *line, uint32_t *varindex, basic_err
         return NULL ;
     }
 
-    *varindex = basic_str_create_str(keyword) ;
-    if (*varindex == BASIC_STR_INVALID) {
-        *err = BASIC_ERR_OUT_OF_MEMORY ;
+    if (!basic_var_get(keyword, varindex, err))
         return NULL ;
-    }
 
     return line ;
 }
@@ -476,7 +753,7 @@ static const char* parse_def(basic_line_t* bline, const char* line, basic_err_t*
     }
     keyword[stored] = '\0';
 
-    char* fnname = _strdup(keyword);
+    char* fnname = basic_strdup(keyword);
     if (fnname == NULL) {
         *err = BASIC_ERR_OUT_OF_MEMORY;
         return NULL;
@@ -500,7 +777,7 @@ static const char* parse_def(basic_line_t* bline, const char* line, basic_err_t*
             }
         }
         keyword[stored] = '\0';
-        argnames[index] = _strdup(keyword);
+        argnames[index] = basic_strdup(keyword);
         if (argnames[index] == NULL) {
             *err = BASIC_ERR_OUT_OF_MEMORY;
             return NULL;
@@ -723,7 +1000,7 @@ static const char *parse_data(basic_line_t *bline, const char *line, basic_err_t
         }
         else 
         {
-            double value ;
+            basic_num_t value ;
             line = basic_expr_parse_number(line, &value, err) ;
             if (line == NULL)
                 return NULL ;
@@ -733,7 +1010,7 @@ static const char *parse_data(basic_line_t *bline, const char *line, basic_err_t
                 return NULL ;
             }
 
-            if (!add_double(bline, value)) {
+            if (!add_num(bline, value)) {
                 *err = BASIC_ERR_OUT_OF_MEMORY ;
                 return NULL ;
             }            
@@ -884,8 +1161,7 @@ static const char *parse_input(basic_line_t *bline, const char *line, basic_err_
         if (line == NULL)
             return NULL ;
 
-        const char *varname = basic_str_value(v) ;
-        if (varname[strlen(varname) - 1] == '$')
+        if (basic_var_is_string(v))
             cntstr++ ;
 
         if (!add_uint32(bline, v)) {
@@ -895,10 +1171,6 @@ static const char *parse_input(basic_line_t *bline, const char *line, basic_err_
 
         line = skipSpaces(line) ;
 
-        if (basic_is_end_of_line(line)) {
-            break ;
-        }
-
         if (*line == '(') {
             uint32_t dimcnt ;
             uint32_t dims[BASIC_MAX_DIMS] ;
@@ -925,6 +1197,11 @@ static const char *parse_input(basic_line_t *bline, const char *line, basic_err_
             }            
         }
 
+        line = skipSpaces(line) ;
+        if (basic_is_end_of_line(line)) {
+            break ;
+        }
+
         if (*line != ',') {
             *err = BASIC_ERR_EXPECTED_COMMA ;
             return NULL ;
@@ -1027,6 +1304,13 @@ static const char *parse_let(basic_line_t *bline, const char *line, basic_err_t
         return NULL ;        
     }
 
+    basic_value_type_t type = basic_var_is_string(getU32(bline, 1)) ? BASIC_VALUE_TYPE_STRING : BASIC_VALUE_TYPE_NUMBER ;
+    if (!basic_expr_check_type(exprindex, type, err))
+        return NULL ;
+
+    if (bline->tokens_[0] == BTOKEN_LET_SIMPLE && !basic_expr_compile_append(exprindex, getU32(bline, 1), err))
+        return NULL ;
+
     return line ;
 }
 
@@ -1181,7 +1465,7 @@ static const char* parse_for(basic_line_t* bline, const char* line, basic_err_t*
     line = skipSpaces(line + 1);
 
     line = basic_expr_parse(line, 0, NULL, &initexpr, err) ;
-    if (line == NULL)
+    if (line == NULL || !basic_expr_check_type(initexpr, BASIC_VALUE_TYPE_NUMBER, err))
         return NULL ;
 
     line = parse_keyword(line, &token, err) ;
@@ -1191,7 +1475,7 @@ static const char* parse_for(basic_line_t* bline, const char* line, basic_err_t*
     }
 
     line = basic_expr_parse(line, 0, NULL, &endexpr, err) ;
-    if (line == NULL)
+    if (line == NULL || !basic_expr_check_type(endexpr, BASIC_VALUE_TYPE_NUMBER, err))
         return NULL ;
 
     if (!add_uint32(bline, varidx)) {
@@ -1219,7 +1503,7 @@ static const char* parse_for(basic_line_t* bline, const char* line, basic_err_t*
         }
 
         line = basic_expr_parse(line, 0, NULL, &stepexpr, err) ;
-        if (line == NULL)
+        if (line == NULL || !basic_expr_check_type(stepexpr, BASIC_VALUE_TYPE_NUMBER, err))
             return NULL ;
 
         if (!add_uint32(bline, stepexpr)) {
@@ -1321,7 +1605,7 @@ static const char *parse_if(basic_line_t* bline, const char* line, basic_err_t*
 
     line = skipSpaces(line) ;
     line = basic_expr_parse(line, 0, NULL, &expridx, err) ;
-    if (line == NULL)
+    if (line == NULL || !basic_expr_check_type(expridx, BASIC_VALUE_TYPE_NUMBER, err) || !basic_expr_compile_condition(expridx, err))
         return NULL ;
 
     if (!add_uint32(bline, expridx)) {
@@ -1339,6 +1623,205 @@ static const char *parse_if(basic_line_t* bline, const char* line, basic_err_t*
     return line ;
 }
 
+//
+// Match one of the words of a MAT statement, which must not run on into a
+// variable name
+//
+static const char *parse_mat_word(const char *line, const char *word)
+{
+    size_t len = strlen(word) ;
+
+    if (_strnicmp(line, word, len) != 0)
+        return NULL ;
+
+    if (isalnum((uint8_t)line[len]) || line[len] == '$' || line[len] == '%')
+        return NULL ;
+
+    return line + len ;
+}
+
+static const char *parse_mat_var(basic_line_t *bline, const char *line, basic_err_t *err)
+{
+    uint32_t varidx ;
+
+    line = parse_varname(line, &varidx, err) ;
+    if (line == NULL)
+        return NULL ;
+
+    if (!add_uint32(bline, varidx)) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return NULL ;
+    }
+
+    return skipSpaces(line) ;
+}
+
+//
+// The MAT statement, see basicmat.h for the forms and how they are stored
+//
+static const char *parse_mat(basic_line_t *bline, const char *line, basic_err_t *err)
+{
+    const char *next ;
+    uint8_t op ;
+
+    line = skipSpaces(line) ;
+
+    if ((next = parse_mat_word(line, "READ")) != NULL || (next = parse_mat_word(line, "PRINT")) != NULL) {
+        op = (toupper((uint8_t)*line) == 'R') ? BASIC_MAT_READ : BASIC_MAT_PRINT ;
+        if (!add_token(bline, op)) {
+            *err = BASIC_ERR_OUT_OF_MEMORY ;
+            return NULL ;
+        }
+
+        line = next ;
+        while (true) {
+            line = parse_mat_var(bline, line, err) ;
+            if (line == NULL)
+                return NULL ;
+
+            if (basic_is_end_of_line(line))
+                break ;
+
+            if (*line != ',') {
+                *err = BASIC_ERR_EXPECTED_COMMA ;
+                return NULL ;
+            }
+            line++ ;
+        }
+
+        return line ;
+    }
+
+    uint32_t dstidx ;
+    line = parse_varname(line, &dstidx, err) ;
+    if (line == NULL)
+        return NULL ;
+
+    line = skipSpaces(line) ;
+    if (*line != '=') {
+        *err = BASIC_ERR_EXPECTED_EQUAL ;
+        return NULL ;
+    }
+    line = skipSpaces(line + 1) ;
+
+    uint32_t expridx = 0 ;
+    if ((next = parse_mat_word(line, "ZER")) != NULL)
+        op = BASIC_MAT_ZER ;
+    else if ((next = parse_mat_word(line, "CON")) != NULL)
+        op = BASIC_MAT_CON ;
+    else if ((next = parse_mat_word(line, "IDN")) != NULL)
+        op = BASIC_MAT_IDN ;
+    else if ((next = parse_mat_word(line, "TRN")) != NULL && *skipSpaces(next) == '(') {
+        op = BASIC_MAT_TRN ;
+        next = skipSpaces(next) + 1 ;
+    }
+    else if (*line == '(') {
+        //
+        // MAT A = (K) * B, the factor is any numeric expression
+        //
+        op = BASIC_MAT_SCALE ;
+        next = basic_expr_parse(line + 1, 0, NULL, &expridx, err) ;
+        if (next == NULL || !basic_expr_check_type(expridx, BASIC_VALUE_TYPE_NUMBER, err))
+            return NULL ;
+
+        next = skipSpaces(next) ;
+        if (*next != ')') {
+            *err = BASIC_ERR_EXPECTED_CLOSEPAREN ;
+            return NULL ;
+        }
+
+        next = skipSpaces(next + 1) ;
+        if (*next != '*') {
+            *err = BASIC_ERR_INVALID_OPERATOR ;
+            return NULL ;
+        }
+        next++ ;
+    }
+    else {
+        op = BASIC_MAT_COPY ;
+        next = line ;
+    }
+
+    if (!add_token(bline, op) || !add_uint32(bline, dstidx)) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return NULL ;
+    }
+
+    line = skipSpaces(next) ;
+
+    switch(op) {
+        case BASIC_MAT_ZER:
+        case BASIC_MAT_CON:
+        case BASIC_MAT_IDN:
+            break ;
+
+        case BASIC_MAT_TRN:
+            line = parse_mat_var(bline, line, err) ;
+            if (line == NULL)
+                return NULL ;
+
+            if (*line != ')') {
+                *err = BASIC_ERR_EXPECTED_CLOSEPAREN ;
+                return NULL ;
+            }
+            line = skipSpaces(line + 1) ;
+            break ;
+
+        case BASIC_MAT_SCALE:
+            if (!add_uint32(bline, expridx)) {
+                *err = BASIC_ERR_OUT_OF_MEMORY ;
+                return NULL ;
+            }
+
+            line = parse_mat_var(bline, line, err) ;
+            break ;
+
+        default:
+            //
+            // MAT A = B, or B followed by +, - or * and another array
+            //
+            line = parse_mat_var(bline, line, err) ;
+            if (line == NULL || basic_is_end_of_line(line))
+                break ;
+
+            if (*line == '+')
+                bline->tokens_[1] = BASIC_MAT_ADD ;
+            else if (*line == '-')
+                bline->tokens_[1] = BASIC_MAT_SUB ;
+            else if (*line == '*')
+                bline->tokens_[1] = BASIC_MAT_MUL ;
+            else {
+                *err = BASIC_ERR_INVALID_OPERATOR ;
+                return NULL ;
+            }
+
+            line = parse_mat_var(bline, line + 1, err) ;
+            break ;
+    }
+
+    return line ;
+}
+
+//
+// Copy the statement in the scratch line to a line of its own, or if it did
+// not parse free what its tokens refer to
+//
+static const char *finish_line(const char *line, basic_line_t **bline, basic_err_t *err)
+{
+    if (line == NULL) {
+        destroy_tokens(scratch) ;
+        return NULL ;
+    }
+
+    *bline = commit_line() ;
+    if (*bline == NULL) {
+        destroy_tokens(scratch) ;
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return NULL ;
+    }
+    return line ;
+}
+
 static const char* tokenize_one(const char* line, basic_line_t *prev, basic_line_t** bline, basic_err_t* err)
 {
     basic_line_t* ret;
@@ -1346,13 +1829,8 @@ static const char* tokenize_one(const char* line, basic_line_t *prev, basic_line
 
     line = skipSpaces(line);
 
-    ret = create_line();
-    if (ret == NULL) {
-        *err = BASIC_ERR_OUT_OF_MEMORY;
-        *bline = NULL;
-        return NULL;
-    }
-    *bline = ret;
+    ret = start_line();
+    *bline = NULL;
 
     if (prev != NULL && prev->tokens_[0] == BTOKEN_IF && isdigit((uint8_t)*line)) {
         //
@@ -1381,14 +1859,19 @@ static const char* tokenize_one(const char* line, basic_line_t *prev, basic_line
             //
             line = parse_let(ret, line, err);
             if (line == NULL) {
-                *err = errsave;
-                basic_destroy_line(ret);
-                *bline = NULL;
-                return NULL;
-            }
-            else {
-                return line;
+                //
+                // A type mismatch or a constant too big for a number means
+                // this was an assignment, so that is the error to report
+                //
+                if (*err != BASIC_ERR_TYPE_MISMATCH && *err != BASIC_ERR_OVERFLOW)
+                    *err = errsave;
             }
+            return finish_line(line, bline, err);
+        }
+
+        if (token == BTOKEN_TO || token == BTOKEN_STEP) {
+            *err = BASIC_ERR_INVALID_TOKEN;
+            return NULL;
         }
 
         if (!add_token(ret, token)) {
@@ -1396,12 +1879,7 @@ static const char* tokenize_one(const char* line, basic_line_t *prev, basic_line
             return NULL ;
         }
 
-        if (token == BTOKEN_TO || token == BTOKEN_STEP) {
-            basic_destroy_line(ret);
-            *err = BASIC_ERR_INVALID_TOKEN;
-            ret = NULL;
-        }
-        else if (token == BTOKEN_CLEAR || token == BTOKEN_CLS || token == BTOKEN_RUN || token == BTOKEN_END ||
+        if (token == BTOKEN_CLEAR || token == BTOKEN_CLS || token == BTOKEN_RUN || token == BTOKEN_END ||
                 token == BTOKEN_THEN || token == BTOKEN_FLIST || token == BTOKEN_RETURN || token == BTOKEN_RESTORE ||
                 token == BTOKEN_STOP || token == BTOKEN_TRON || token == BTOKEN_TROFF || token == BTOKEN_MEM)
         {
@@ -1415,16 +1893,14 @@ static const char* tokenize_one(const char* line, basic_line_t *prev, basic_line
             line = parse_list(ret, line, err) ;
         }
         else if (token == BTOKEN_REM) {
-            ret->extra_ = _strdup(line);
-            if (ret->extra_ == NULL) {
-                *err = BASIC_ERR_OUT_OF_MEMORY;
-                basic_destroy_line(ret);
-                ret = NULL;
-            }
-            int len = (int)strlen(ret->extra_);
-            if (ret->extra_[len - 1] == '\n') {
-                ret->extra_[len - 1] = '\0';
-            }
+            const char *end = line + strlen(line);
+            if (end > line && end[-1] == '\n')
+                end--;
+
+            while (line < end)
+                add_token(ret, (uint8_t)*line++);
+            add_token(ret, '\0');
+
             while (*line != '\0')
                 line++;
         }
@@ -1479,14 +1955,12 @@ static const char* tokenize_one(const char* line, basic_line_t *prev, basic_line
         else if (token == BTOKEN_RENUM) {
             line = parse_renum(ret, line, err) ;
         }
+        else if (token == BTOKEN_MAT) {
+            line = parse_mat(ret, line, err) ;
+        }
     }
 
-    if (line == NULL) {
-        basic_destroy_line(ret) ;
-        *bline = NULL ;
-        line = NULL ;
-    }
-    return line ;
+    return finish_line(line, bline, err) ;
 }
 
 static basic_line_t *tokenize(const char *line, basic_err_t *err)
@@ -1510,6 +1984,11 @@ static basic_line_t *tokenize(const char *line, basic_err_t *err)
         line = skipSpaces(line) ;
     }
 
+    if (!reserve_scratch(strlen(line))) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return NULL ;
+    }
+
     while (true) {
         line = skipSpaces(line) ;
 
@@ -1525,8 +2004,10 @@ static basic_line_t *tokenize(const char *line, basic_err_t *err)
         }
         else {
             line = tokenize_one(line, parsed, &child, err) ;
-            if (line == NULL)
+            if (line == NULL) {
+                basic_destroy_line(ret) ;
                 return NULL ;
+            }
 
             if (last == NULL) {
                 ret->children_ = child ;
@@ -1550,6 +2031,7 @@ static basic_line_t *tokenize(const char *line, basic_err_t *err)
         if (parsed->tokens_[0] != BTOKEN_IF) {
             if (*line != ':') {
                 *err = BASIC_ERR_EXTRA_CHARS ;
+                basic_destroy_line(ret) ;
                 return NULL ;
             }
 
@@ -1586,12 +2068,7 @@ bool basic_line_proc(const char *line, basic_out_fn_t outfn)
         return true ;
 
     if (ret->lineno_ == -1) {
-        exec_context_t ctx ;
-
-        ctx.line_ = ret ;
-        ctx.child_ = NULL ;
-
-        basic_exec_line(&ctx, outfn) ;
+        basic_exec_line(ret, outfn) ;
         basic_destroy_line(ret);
     }
     else {
@@ -1601,49 +2078,79 @@ bool basic_line_proc(const char *line, basic_out_fn_t outfn)
     return rval;
 }
 
-#ifndef DESKTOP
-static UINT got = 0 ;               // The number of chars read into line buf
-static UINT oindex = 0 ;            // Index into the line buffer (other)
-static UINT rdindex = 0 ;            // Index into the read buffer (linebuf)
+//
+// The file is read into loadbuf in whole chunks where it can be, and each line
+// is parsed where it lies with its newline replaced by the terminator.  The
+// start of a line left at the end of the buffer is moved to the front before
+// the next read.  A program that fails to load is cleared.
+//
+static char loadbuf[BASIC_LOAD_BUFFER_LENGTH + 1] ;
 
-static int read_line(FIL *fp)
+static bool load_failed(basic_err_t code, basic_err_t *err, basic_out_fn_t outfn)
 {
-    FRESULT res ;
+    basic_clear(NULL, err, outfn) ;
+    *err = code ;
+    return false ;
+}
 
-    oindex = 0 ;
+bool basic_proc_load_stream(basic_read_fn_t readfn, void *ctx, basic_err_t *err, basic_out_fn_t outfn)
+{
+    uint32_t count = 0 ;                // The bytes in loadbuf
+    bool eof = false ;
 
-    while (true) {
-        if (got == 0) {
-            if (f_eof(fp)) {
-                if (oindex != 0)
-                    return 1 ;
+    *err = BASIC_ERR_NONE ;
 
-                return 0 ;
-            }
-                
+    while (!eof) {
+        if (count == BASIC_LOAD_BUFFER_LENGTH)
+            return load_failed(BASIC_ERR_LINE_TOO_LONG, err, outfn) ;
+
+        uint32_t space = BASIC_LOAD_BUFFER_LENGTH - count ;
+        if (space >= BASIC_LOAD_CHUNK)
+            space -= space % BASIC_LOAD_CHUNK ;
+
+        int got = (*readfn)(ctx, loadbuf + count, space) ;
+        if (got < 0)
+            return load_failed(BASIC_ERR_IO_ERROR, err, outfn) ;
+
+        if (got == 0) {
             //
-            // We need more characters, but buffer is empty
+            // The last line may not end in a newline
             //
-            res = f_read(fp, linebuf, sizeof(linebuf), &got) ;
-            if (res != FR_OK) {
-                return -1 ;
-            }
-            rdindex = 0 ;
+            eof = true ;
+            loadbuf[count++] = '\n' ;
+        }
+        else {
+            count += (uint32_t)got ;
         }
 
-        //
-        // We now have 'got' characters starting at 'rindex'
-        //
-        while (got > 0) {
-            other[oindex++] = linebuf[rdindex++] ;
-            got-- ;
+        char *start = loadbuf ;
+        char *end = loadbuf + count ;
+        char *nl ;
 
-            if (other[oindex - 1] == '\n') {
-                other[oindex] = '\0';
-                return 1 ;
-            }
+        while ((nl = (char *)memchr(start, '\n', end - start)) != NULL) {
+            *nl = '\0' ;
+            if (!basic_line_proc(start, outfn))
+                return load_failed(BASIC_ERR_NONE, err, outfn) ;
+
+            start = nl + 1 ;
         }
+
+        count = (uint32_t)(end - start) ;
+        memmove(loadbuf, start, count) ;
     }
+
+    return true ;
+}
+
+#ifndef DESKTOP
+static int read_file(void *ctx, char *buf, uint32_t size)
+{
+    UINT got ;
+
+    if (f_read((FIL *)ctx, buf, size, &got) != FR_OK)
+        return -1 ;
+
+    return (int)got ;
 }
 
 bool basic_proc_load(const char *filename, basic_err_t *err, basic_out_fn_t outfn)
@@ -1657,27 +2164,31 @@ bool basic_proc_load(const char *filename, basic_err_t *err, basic_out_fn_t outf
         return false ;
     }
 
-    while (true) {
-        int st = read_line(&fp) ;
-        if (st == -1) {
-            basic_clear(NULL, err, outfn);
-            *err = BASIC_ERR_IO_ERROR ;
-            return false ;            
-        }
-        else if (st == 0) {
-            break ;
-        }
-        else {
-            if (!basic_line_proc(other, outfn)) {
-                basic_clear(NULL, err, outfn) ;
-                return false ;
-            }
+#ifdef BASIC_PROGRAM_IMAGES
+    //
+    // Use the image saved with the program if it is for this text
+    //
+    char imgname[64] ;
+    FIL ifp ;
+
+    if (basic_img_name(filename, imgname, sizeof(imgname)) && f_open(&ifp, imgname, FA_READ | FA_OPEN_EXISTING) == FR_OK) {
+        bool loaded = basic_img_load_file(read_file, &ifp, &fp) ;
+        f_close(&ifp) ;
+
+        if (loaded) {
+            f_close(&fp) ;
+            *err = BASIC_ERR_NONE ;
+            return true ;
         }
+
+        f_lseek(&fp, 0) ;
     }
+#endif
 
+    bool ret = basic_proc_load_stream(read_file, &fp, err, outfn) ;
     f_close(&fp) ;
 
-    return true;
+    return ret ;
 }
 #endif
 
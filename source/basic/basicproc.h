@@ -8,17 +8,37 @@
 
 typedef cy_rslt_t (*basic_out_fn_t)(const char *, size_t) ;
 
+//
+// Reads up to size bytes of a file being loaded into buf.  Returns the number
+// of bytes read, zero at the end of the file or -1 on an error.
+//
+typedef int (*basic_read_fn_t)(void *ctx, char *buf, uint32_t size) ;
+
+//
+// The kinds of object the tokens of a statement refer to by a uint32 handle
+//
+typedef enum basic_line_ref {
+    BASIC_LINE_REF_EXPR,                // An expression
+    BASIC_LINE_REF_STR,                 // A string constant
+    BASIC_LINE_REF_VAR,                 // A variable slot
+    BASIC_LINE_REF_USERFN,              // A DEF FN, which the handle of its expression follows
+} basic_line_ref_t ;
+
+typedef bool (*basic_line_ref_fn_t)(basic_line_t *line, uint32_t offset, basic_line_ref_t kind, void *ctx) ;
+
 extern bool basic_line_proc(const char *line, basic_out_fn_t outfn) ;
 extern void basic_prompt(basic_out_fn_t outfn) ;
 
 extern void basic_destroy_line(basic_line_t *line) ;
+extern bool basic_line_refs(basic_line_t *line, basic_line_ref_fn_t fn, void *ctx) ;
 extern const char *basic_token_to_str(uint8_t token) ;
 
 extern bool basic_proc_load(const char *filename, basic_err_t *err, basic_out_fn_t outfn);
+extern bool basic_proc_load_stream(basic_read_fn_t readfn, void *ctx, basic_err_t *err, basic_out_fn_t outfn);
 extern bool basic_proc_save(const char *filename, basic_err_t *err, basic_out_fn_t outfn);
 
 extern bool basic_is_keyword(const char *line) ;
 
-inline bool basic_is_end_of_line(const char *line) {
+static inline bool basic_is_end_of_line(const char *line) {
     return *line == '\0' || *line == ':' ;
 }
\ No newline at end of file
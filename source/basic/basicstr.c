@@ -1,191 +1,343 @@
-#ifdef DESKTOP
+#if defined(DESKTOP) && defined(_MSC_VER)
 #define _CRTDBG_MAP_ALLOC
 #include <stdlib.h>
 #include <crtdbg.h>
 #endif
 
 #include "basicstr.h"
+#include "basicmem.h"
+#include "basichtab.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 
-#ifndef DESKTOP
+#ifndef _MSC_VER
 #define _strdup strdup
 #endif
 
 #define MY_STR_BLOCK_SIZE       (32)
+#define MY_STR_MIN_BUCKETS      (64)
 
 typedef struct one_string
 {
     char *string_ ;
+    uint32_t length_ ;
     uint32_t allocated_ ;
-    struct one_string *next_ ;
     uint32_t ref_cnt_ ;
+    uint32_t hash_ ;
+    uint32_t next_ ;
     bool frozen_ ;
 } one_string_t ;
 
-static one_string_t *string_table = NULL ;
+//
+// A string handle names a slot in this table, so handles stay 32 bits wide
+// whatever the size of a pointer on the host
+//
+static basic_htab_t string_table = BASIC_HTAB_INIT(one_string_t) ;
+
+//
+// Frozen strings are interned through a hash table so that creating one finds
+// an existing copy without comparing against every string.  Each bucket holds
+// the handle of the first string in a chain linked through next_.  The bucket
+// count doubles whenever there are more frozen strings than buckets.
+//
+static uint32_t *buckets = NULL ;
+static uint32_t bucket_count = 0 ;
+static uint32_t frozen_count = 0 ;
+
+static inline one_string_t *get_str_from_handle(uint32_t h)
+{
+    one_string_t *one = (one_string_t *)basic_htab_get(&string_table, h) ;
+    assert(one != NULL) ;
+    return one ;
+}
+
+//
+// FNV-1a
+//
+static uint32_t hash_str(const char *str)
+{
+    uint32_t hash = 2166136261u ;
+
+    while (*str) {
+        hash ^= (uint8_t)*str++ ;
+        hash *= 16777619u ;
+    }
+
+    return hash ;
+}
+
+static bool resize_buckets(uint32_t count)
+{
+    uint32_t *table = (uint32_t *)basic_malloc(sizeof(uint32_t) * count) ;
+    if (table == NULL)
+        return false ;
+
+    for(uint32_t i = 0 ; i < count ; i++)
+        table[i] = BASIC_STR_INVALID ;
+
+    uint32_t iter = 0, h ;
+    one_string_t *one ;
+
+    while ((one = (one_string_t *)basic_htab_next(&string_table, &iter, &h)) != NULL) {
+        if (one->frozen_) {
+            uint32_t b = one->hash_ & (count - 1) ;
+            one->next_ = table[b] ;
+            table[b] = h ;
+        }
+    }
+
+    if (buckets != NULL)
+        basic_free(buckets) ;
+
+    buckets = table ;
+    bucket_count = count ;
+    return true ;
+}
+
+static void unlink_str(uint32_t h, one_string_t *str)
+{
+    uint32_t *link = &buckets[str->hash_ & (bucket_count - 1)] ;
+
+    while (*link != h) {
+        assert(*link != BASIC_STR_INVALID) ;
+        link = &get_str_from_handle(*link)->next_ ;
+    }
+
+    *link = str->next_ ;
+    frozen_count-- ;
+}
 
 uint32_t basic_str_create_str(const char *strval)
 {
-    for(one_string_t *one = string_table ; one != NULL ; one = one->next_) {
-        if (one->string_ != NULL && strcmp(one->string_, strval) == 0 && one->frozen_) {
-            one->ref_cnt_++;
-            return (uint32_t)one ;
+    uint32_t hash = hash_str(strval) ;
+    uint32_t h ;
+
+    if (bucket_count != 0) {
+        h = buckets[hash & (bucket_count - 1)] ;
+        while (h != BASIC_STR_INVALID) {
+            one_string_t *one = get_str_from_handle(h) ;
+            if (one->hash_ == hash && strcmp(one->string_, strval) == 0) {
+                one->ref_cnt_++;
+                return h ;
+            }
+            h = one->next_ ;
         }
     }
 
-    one_string_t *str = (one_string_t *)malloc(sizeof(one_string_t)) ;
+    if (frozen_count >= bucket_count) {
+        if (!resize_buckets(bucket_count == 0 ? MY_STR_MIN_BUCKETS : bucket_count * 2) && bucket_count == 0)
+            return BASIC_STR_INVALID ;
+    }
+
+    one_string_t *str = (one_string_t *)basic_htab_alloc(&string_table, &h) ;
     if (str == NULL)
         return BASIC_STR_INVALID ;
 
-    str->next_ = string_table ;
-    str->string_ = _strdup(strval) ;
-    str->allocated_ = (uint32_t)strlen(strval) + 1 ;
+    str->string_ = basic_strdup(strval) ;
+    if (str->string_ == NULL) {
+        basic_htab_free(&string_table, h) ;
+        return BASIC_STR_INVALID ;
+    }
+
+    str->length_ = (uint32_t)strlen(strval) ;
+    str->allocated_ = str->length_ + 1 ;
     str->frozen_ = true ;
     str->ref_cnt_ = 1 ;
-    string_table = str ;
-    return (uint32_t)str ;
+    str->hash_ = hash ;
+
+    uint32_t b = hash & (bucket_count - 1) ;
+    str->next_ = buckets[b] ;
+    buckets[b] = h ;
+    frozen_count++ ;
+
+    return h ;
 }
 
 uint32_t basic_str_create()
 {
-    one_string_t *str = (one_string_t *)malloc(sizeof(one_string_t)) ;
+    uint32_t h ;
+
+    one_string_t *str = (one_string_t *)basic_htab_alloc(&string_table, &h) ;
     if (str == NULL)
         return BASIC_STR_INVALID ;
 
-    str->next_ = string_table ;
     str->string_ = NULL ;
+    str->length_ = 0 ;
     str->allocated_ = 0 ;
     str->frozen_ = false ;
     str->ref_cnt_ = 0xffffffff ;
-    string_table = str ;
-    return (uint32_t)str ;
+    return h ;
 }
 
-static void basic_str_destroy_int(one_string_t *str)
+static void basic_str_destroy_int(uint32_t h, one_string_t *str)
 {
-    if (str == string_table) {
-        //
-        // It is the first entry in the table
-        //
-        string_table = string_table->next_ ;
-    }
-    else {
-        one_string_t *var ;
-        for(var = string_table ; var != NULL && var->next_ != str ; var = var->next_) /* EMPTY */ ;
-        assert(var != NULL) ;
-        var->next_ = str->next_ ;
-	}
+    if (str->frozen_)
+        unlink_str(h, str) ;
 
     if (str->string_)
-        free(str->string_) ;
+        basic_free(str->string_) ;
 
-    free(str);
+    basic_htab_free(&string_table, h) ;
 }
 
-void basic_str_destroy(uint32_t index)
+void basic_str_destroy(uint32_t h)
 {
-    one_string_t *str = (one_string_t *)index ;
+    one_string_t *str = (one_string_t *)basic_htab_get(&string_table, h) ;
+    assert(str != NULL) ;
+    if (str == NULL)
+        return ;
 
     if (str->frozen_) {
         str->ref_cnt_-- ;
         if (str->ref_cnt_ == 0)
-            basic_str_destroy_int(str);
+            basic_str_destroy_int(h, str);
     }
     else {
-        basic_str_destroy_int(str) ;
+        basic_str_destroy_int(h, str) ;
     }
 }
 
 void basic_str_clear_all()
 {
-    while (string_table != NULL) {
-        basic_str_destroy_int(string_table);
+    uint32_t iter = 0 ;
+    one_string_t *one ;
+
+    while ((one = (one_string_t *)basic_htab_next(&string_table, &iter, NULL)) != NULL) {
+        if (one->string_)
+            basic_free(one->string_) ;
     }
+
+    basic_htab_reset(&string_table) ;
+
+    if (buckets != NULL)
+        basic_free(buckets) ;
+
+    buckets = NULL ;
+    bucket_count = 0 ;
+    frozen_count = 0 ;
 }
 
-bool basic_str_add_int(uint32_t h, int num)
+//
+// Make room for a string of needed bytes, the terminator included.  The
+// buffer doubles in size so that building a string one piece at a time is
+// linear in its final length.  On failure the string is left as it was.
+//
+static bool reserve(one_string_t *one, uint32_t needed)
 {
-    char buf[32] ;
-    sprintf(buf, "%d", num) ;
-    return basic_str_add_str(h, buf) ;
+    assert(one->frozen_ == false) ;
+
+    if (needed <= one->allocated_)
+        return true ;
+
+    uint32_t size = (one->allocated_ != 0) ? one->allocated_ : MY_STR_BLOCK_SIZE ;
+    while (size < needed)
+        size *= 2 ;
+
+    char *buf = (char *)basic_realloc(one->string_, size) ;
+    if (buf == NULL)
+        return false ;
+
+    if (one->string_ == NULL)
+        buf[0] = '\0' ;
+
+    one->string_ = buf ;
+    one->allocated_ = size ;
+    return true ;
 }
 
-bool basic_str_add_double(uint32_t h, double num)
+static bool append(one_string_t *one, const char *str, uint32_t len)
 {
-    char buf[32] ;
-    sprintf(buf, "%f", num) ;
-    return basic_str_add_str(h, buf);
+    if (!reserve(one, one->length_ + len + 1))
+        return false ;
+
+    memcpy(one->string_ + one->length_, str, len) ;
+    one->length_ += len ;
+    one->string_[one->length_] = '\0' ;
+    return true ;
 }
 
-extern bool basic_str_add_str(uint32_t h, const char *str)
+bool basic_str_add_int(uint32_t h, int num)
 {
-    one_string_t *one = (one_string_t *)h ;
+    one_string_t *one = get_str_from_handle(h) ;
 
-    assert(one->frozen_ == false) ;
-    uint32_t needed = (uint32_t)((one->string_ ? strlen(one->string_) : 0) + strlen(str) + 1);
-    if (needed > one->allocated_) {
-        int size = needed / MY_STR_BLOCK_SIZE ;
-        if ((needed % MY_STR_BLOCK_SIZE) != 0)
-            size++ ;
-
-        if (one->allocated_ == 0) {
-            one->string_ = (char *)malloc(size * MY_STR_BLOCK_SIZE);
-        }
-        else {
-            one->string_ = (char *)realloc(one->string_, size * MY_STR_BLOCK_SIZE);
-        }
+    // Room for the longest int, "-2147483648", and the terminator
+    if (!reserve(one, one->length_ + 12))
+        return false ;
 
-        if (one->string_ == NULL) {
-            one->allocated_ = 0 ;
-            one->string_ = NULL ;
-        }
-        else {
-            if (one->allocated_ == 0) {
-                strcpy(one->string_, str) ;
-            }
-            else {
-                strcat(one->string_, str);
-            }
-            one->allocated_ = size * MY_STR_BLOCK_SIZE ;
-        }
-    }
-    else {
-        strcat(one->string_, str) ;
+    one->length_ += sprintf(one->string_ + one->length_, "%d", num) ;
+    return true ;
+}
+
+bool basic_str_add_double(uint32_t h, double num)
+{
+    one_string_t *one = get_str_from_handle(h) ;
+
+    if (!reserve(one, one->length_ + MY_STR_BLOCK_SIZE))
+        return false ;
+
+    //
+    // Most numbers fit in the space reserved.  A very large one is formatted
+    // again once there is room for all of it.
+    //
+    uint32_t room = one->allocated_ - one->length_ ;
+    int len = snprintf(one->string_ + one->length_, room, "%f", num) ;
+    if (len < 0)
+        return false ;
+
+    if ((uint32_t)len >= room) {
+        if (!reserve(one, one->length_ + len + 1))
+            return false ;
+
+        snprintf(one->string_ + one->length_, len + 1, "%f", num) ;
     }
 
+    one->length_ += len ;
     return true ;
 }
 
+bool basic_str_add_str(uint32_t h, const char *str)
+{
+    return append(get_str_from_handle(h), str, (uint32_t)strlen(str)) ;
+}
+
+bool basic_str_add_chars(uint32_t h, const char *str, uint32_t len)
+{
+    return append(get_str_from_handle(h), str, len) ;
+}
+
 bool basic_str_add_handle(uint32_t h, uint32_t hadd)
 {
-    if (!basic_str_add_str(h, basic_str_value(hadd)))
-        return false ;
+    one_string_t *add = get_str_from_handle(hadd) ;
 
-    return true ;
+    if (add->length_ == 0)
+        return true ;
+
+    return append(get_str_from_handle(h), add->string_, add->length_) ;
 }
 
 const char *basic_str_value(uint32_t h)
 {
-    one_string_t *one = (one_string_t *)h ;
+    one_string_t *one = get_str_from_handle(h) ;
     return one->string_ ;
 }
 
 uint32_t basic_str_memsize(bool overhead)
 {
-    uint32_t ret = 0 ;
+    uint32_t ret = 0, iter = 0 ;
     one_string_t *t ;
 
-    for(t = string_table ; t != NULL ; t = t ->next_) {
+    if (overhead)
+        ret += basic_htab_memsize(&string_table) + bucket_count * (uint32_t)sizeof(uint32_t) ;
+
+    while ((t = (one_string_t *)basic_htab_next(&string_table, &iter, NULL)) != NULL) {
         if (overhead) {
             ret += t->allocated_ ;
-            ret += sizeof(one_string_t) ;
         }
-        else {
-            ret += (uint32_t)strlen(t->string_) + 1 ;
+        else if (t->string_ != NULL) {
+            ret += t->length_ + 1 ;
         }
     }
 
@@ -16,18 +16,27 @@ static bool store_input_ = false ;
 static QueueHandle_t line_queue ;
 EventGroupHandle_t brevent ;
 
+//
+// Mirrors the break bit in brevent so that the executor can poll it with a
+// plain load rather than a call into the RTOS
+//
+volatile bool basic_break_pending = false ;
+
 void basic_break_isr()
 {
+    basic_break_pending = true ;
     xEventGroupSetBitsFromISR(brevent, 1, NULL) ;
 }
 
 void basic_break()
 {
+    basic_break_pending = true ;
     xEventGroupSetBits(brevent, 1);
 }
 
 void basic_clear_break()
 {
+    basic_break_pending = false ;
     xEventGroupClearBits(brevent, 1) ;
 }
 
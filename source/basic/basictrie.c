@@ -0,0 +1,84 @@
+#include "basictrie.h"
+#include <ctype.h>
+
+static uint8_t find_sibling(const basic_trie_t *trie, uint8_t node, uint8_t ch)
+{
+    while (node != 0 && trie->nodes_[node].ch_ != ch)
+        node = trie->nodes_[node].next_ ;
+
+    return node ;
+}
+
+//
+// Add a word with its value.  If the word is already in the trie it keeps the
+// value it was first given.  Returns false if the word does not start with a
+// letter or the trie is full.
+//
+bool basic_trie_add(basic_trie_t *trie, const char *word, uint8_t value)
+{
+    uint8_t ch = (uint8_t)toupper((uint8_t)*word) ;
+    if (ch < 'A' || ch > 'Z')
+        return false ;
+
+    uint8_t *link = &trie->root_[ch - 'A'] ;
+    uint8_t node = 0 ;
+
+    while (*word != '\0') {
+        ch = (uint8_t)toupper((uint8_t)*word++) ;
+
+        node = find_sibling(trie, *link, ch) ;
+        if (node == 0) {
+            if (trie->count_ == BASIC_TRIE_MAX_NODES)
+                return false ;
+
+            node = ++trie->count_ ;
+            trie->nodes_[node].ch_ = ch ;
+            trie->nodes_[node].child_ = 0 ;
+            trie->nodes_[node].next_ = *link ;
+            trie->nodes_[node].value_ = BASIC_TRIE_NO_VALUE ;
+            *link = node ;
+        }
+
+        link = &trie->nodes_[node].child_ ;
+    }
+
+    if (trie->nodes_[node].value_ == BASIC_TRIE_NO_VALUE)
+        trie->nodes_[node].value_ = value ;
+
+    return true ;
+}
+
+//
+// Find the longest word the text starts with.  Returns its value and stores its
+// length in len, or returns -1 if the text does not start with a word.  The
+// text may go on past the word, so callers that need a whole word check the
+// character that follows.
+//
+int basic_trie_match(const basic_trie_t *trie, const char *text, size_t *len)
+{
+    int ret = -1 ;
+    uint8_t ch = (uint8_t)toupper((uint8_t)*text) ;
+
+    if (ch < 'A' || ch > 'Z')
+        return -1 ;
+
+    uint8_t node = trie->root_[ch - 'A'] ;
+    size_t i = 1 ;
+
+    while (node != 0) {
+        const basic_trie_node_t *n = &trie->nodes_[node] ;
+        if (n->value_ != BASIC_TRIE_NO_VALUE) {
+            ret = n->value_ ;
+            *len = i ;
+        }
+
+        ch = (uint8_t)toupper((uint8_t)text[i]) ;
+        if (ch == '\0')
+            break ;
+
+        node = find_sibling(trie, n->child_, ch) ;
+        i++ ;
+    }
+
+    return ret ;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//
+// A trie of the words in a keyword table, so finding the word a line starts
+// with walks the characters of the line once rather than comparing against
+// every entry of the table.  Words start with a letter, which finds the first
+// node directly through root_.  Below that a node holds the index of its first
+// child and of its next sibling in nodes_, with zero meaning none, so the trie
+// is four bytes a node and needs no allocation.  Words are matched without
+// regard to case.
+//
+#define BASIC_TRIE_MAX_NODES            (255)
+#define BASIC_TRIE_NO_VALUE             (0xff)
+
+typedef struct basic_trie_node
+{
+    uint8_t ch_ ;                       // The character, in upper case
+    uint8_t child_ ;
+    uint8_t next_ ;
+    uint8_t value_ ;                    // The value of the word ending here, or BASIC_TRIE_NO_VALUE
+} basic_trie_node_t ;
+
+typedef struct basic_trie
+{
+    uint8_t count_ ;                    // The last node used, node zero is never used
+    uint8_t root_[26] ;
+    basic_trie_node_t nodes_[BASIC_TRIE_MAX_NODES + 1] ;
+} basic_trie_t ;
+
+extern bool basic_trie_add(basic_trie_t *trie, const char *word, uint8_t value) ;
+extern int basic_trie_match(const basic_trie_t *trie, const char *text, size_t *len) ;
@@ -0,0 +1,1214 @@
+#if defined(DESKTOP) && defined(_MSC_VER)
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include "basicexpr.h"
+#include "basicexprint.h"
+#include "basiccfg.h"
+#include "basicstr.h"
+#include "basicmem.h"
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#ifndef _MSC_VER
+#define _stricmp strcasecmp
+#endif
+
+//
+// The expression VM.  Each expression tree produced by the parser is compiled
+// into a linear sequence of stack operations.  Evaluating the expression is then a
+// single loop over the code with no recursion through the tree.  The value stack is
+// allocated once and shared by all expressions, including nested calls to DEF FN
+// functions, which run on the part of the stack above their arguments.  Values are
+// held on the stack by value, and strings pushed from constants, variables and
+// arguments are borrowed, so evaluating a numeric expression never touches the heap.
+//
+
+typedef struct vm_code_buf
+{
+    uint8_t *code_ ;
+    uint32_t count_ ;
+    uint32_t size_ ;
+    uint32_t depth_ ;
+    uint32_t maxdepth_ ;
+} vm_code_buf_t ;
+
+static basic_value_t vm_stack[BASIC_VM_STACK_DEPTH] ;
+static uint32_t vm_top = 0 ;
+
+static bool emit_bytes(vm_code_buf_t *buf, const void *data, uint32_t count)
+{
+    if (buf->count_ + count > buf->size_) {
+        uint32_t size = buf->size_ == 0 ? 32 : buf->size_ * 2 ;
+        while (size < buf->count_ + count)
+            size *= 2 ;
+
+        uint8_t *code = (uint8_t *)basic_realloc(buf->code_, size) ;
+        if (code == NULL)
+            return false ;
+
+        buf->code_ = code ;
+        buf->size_ = size ;
+    }
+
+    memcpy(buf->code_ + buf->count_, data, count) ;
+    buf->count_ += count ;
+    return true ;
+}
+
+static bool emit_op(vm_code_buf_t *buf, uint8_t op)
+{
+    return emit_bytes(buf, &op, sizeof(op)) ;
+}
+
+static bool emit_u8(vm_code_buf_t *buf, uint8_t v)
+{
+    return emit_bytes(buf, &v, sizeof(v)) ;
+}
+
+static bool emit_u32(vm_code_buf_t *buf, uint32_t v)
+{
+    uint8_t data[4] ;
+
+    data[0] = (uint8_t)(v & 0xff) ;
+    data[1] = (uint8_t)((v >> 8) & 0xff) ;
+    data[2] = (uint8_t)((v >> 16) & 0xff) ;
+    data[3] = (uint8_t)((v >> 24) & 0xff) ;
+    return emit_bytes(buf, data, sizeof(data)) ;
+}
+
+static bool emit_num(vm_code_buf_t *buf, basic_num_t v)
+{
+    return emit_bytes(buf, &v, sizeof(v)) ;
+}
+
+//
+// Fill in a uint32 emitted earlier, such as the offset of a jump
+//
+static void patch_u32(vm_code_buf_t *buf, uint32_t at, uint32_t v)
+{
+    buf->code_[at + 0] = (uint8_t)(v & 0xff) ;
+    buf->code_[at + 1] = (uint8_t)((v >> 8) & 0xff) ;
+    buf->code_[at + 2] = (uint8_t)((v >> 16) & 0xff) ;
+    buf->code_[at + 3] = (uint8_t)((v >> 24) & 0xff) ;
+}
+
+//
+// Track the stack depth the code will need as it is emitted
+//
+static void stack_push(vm_code_buf_t *buf)
+{
+    buf->depth_++ ;
+    if (buf->depth_ > buf->maxdepth_)
+        buf->maxdepth_ = buf->depth_ ;
+}
+
+static void stack_pop(vm_code_buf_t *buf, uint32_t count)
+{
+    assert(buf->depth_ >= count) ;
+    buf->depth_ -= count ;
+}
+
+//
+// Returns true if an operand is a constant small integer power
+//
+static bool is_power_int(basic_operand_t *op)
+{
+    basic_value_t *v ;
+
+    if (op->type_ == BASIC_OPERAND_TYPE_CONST)
+        v = op->operand_.const_ ;
+    else if (op->type_ == BASIC_OPERAND_TYPE_FOLDED)
+        v = op->operand_.folded_.value_ ;
+    else
+        return false ;
+
+    return v->type_ == BASIC_VALUE_TYPE_NUMBER && basic_is_power_int(v->value.nvalue_) ;
+}
+
+static bool compile_operand(vm_code_buf_t *buf, basic_operand_t *op, int argcnt, char **argnames, basic_err_t *err) ;
+
+//
+// Returns true if an operand is a relational operator
+//
+static bool is_compare(basic_operand_t *op)
+{
+    if (op->type_ != BASIC_OPERAND_TYPE_OPERATOR)
+        return false ;
+
+    operator_type_t oper = op->operand_.operator_.operator_->oper_ ;
+    return oper >= BASIC_OPERATOR_NOT_EQUAL && oper <= BASIC_OPERATOR_LESS_EQ ;
+}
+
+//
+// Returns true if an operand is always 1 or 0
+//
+static bool is_boolean(basic_operand_t *op)
+{
+    if (is_compare(op))
+        return true ;
+
+    if (op->type_ != BASIC_OPERAND_TYPE_OPERATOR)
+        return false ;
+
+    operator_type_t oper = op->operand_.operator_.operator_->oper_ ;
+    return oper == BASIC_OPERATOR_AND || oper == BASIC_OPERATOR_OR ;
+}
+
+//
+// Compile an operand where a number is needed, converting it if it is an integer
+//
+static bool compile_number(vm_code_buf_t *buf, basic_operand_t *op, int argcnt, char **argnames, basic_err_t *err)
+{
+    if (op->type_ == BASIC_OPERAND_TYPE_CONST || op->type_ == BASIC_OPERAND_TYPE_FOLDED) {
+        //
+        // A constant such as the 2 in X * 2 is pushed as a number to start with
+        //
+        basic_value_t *v = (op->type_ == BASIC_OPERAND_TYPE_CONST) ? op->operand_.const_ : op->operand_.folded_.value_ ;
+        if (v->type_ == BASIC_VALUE_TYPE_NUMBER) {
+            if (!emit_op(buf, BASIC_VM_OP_PUSH_NUM) || !emit_num(buf, v->value.nvalue_)) {
+                *err = BASIC_ERR_OUT_OF_MEMORY ;
+                return false ;
+            }
+            stack_push(buf) ;
+            return true ;
+        }
+    }
+
+    if (!compile_operand(buf, op, argcnt, argnames, err))
+        return false ;
+
+    if (basic_operand_is_integer(op) && !emit_op(buf, BASIC_VM_OP_TO_NUM)) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
+    }
+
+    return true ;
+}
+
+//
+// Compile an operand where an integer is needed, converting it if it is a number
+//
+static bool compile_int(vm_code_buf_t *buf, basic_operand_t *op, int argcnt, char **argnames, basic_err_t *err)
+{
+    if (!compile_operand(buf, op, argcnt, argnames, err))
+        return false ;
+
+    if (!basic_operand_is_integer(op) && !emit_op(buf, BASIC_VM_OP_TO_INT)) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
+    }
+
+    return true ;
+}
+
+//
+// Compile an operand, leaving an integer on the stack if basic_operand_is_integer()
+// is true for it and a number or string otherwise
+//
+static bool compile_operand(vm_code_buf_t *buf, basic_operand_t *op, int argcnt, char **argnames, basic_err_t *err)
+{
+    bool ret = true ;
+
+    switch(op->type_)
+    {
+        case BASIC_OPERAND_TYPE_CONST:
+        case BASIC_OPERAND_TYPE_FOLDED:
+            {
+                basic_value_t *v = (op->type_ == BASIC_OPERAND_TYPE_CONST) ? op->operand_.const_ : op->operand_.folded_.value_ ;
+                if (basic_operand_is_integer(op)) {
+                    ret = emit_op(buf, BASIC_VM_OP_PUSH_INT) && emit_u32(buf, (uint32_t)basic_num_to_int(v->value.nvalue_)) ;
+                }
+                else if (v->type_ == BASIC_VALUE_TYPE_NUMBER) {
+                    ret = emit_op(buf, BASIC_VM_OP_PUSH_NUM) && emit_num(buf, v->value.nvalue_) ;
+                }
+                else {
+                    //
+                    // The constant lives as long as the code does, so the code
+                    // refers to it and pushing it shares its storage
+                    //
+                    ret = emit_op(buf, BASIC_VM_OP_PUSH_STR) && emit_bytes(buf, &v, sizeof(v)) ;
+                }
+                stack_push(buf) ;
+            }
+            break ;
+
+        case BASIC_OPERAND_TYPE_OPERATOR:
+            {
+                operator_table_t *oper = op->operand_.operator_.operator_ ;
+
+                if (basic_operand_is_integer(op)) {
+                    //
+                    // Both sides are integers, or this is \ or MOD, which works on
+                    // the integer part of each side
+                    //
+                    if (!compile_int(buf, op->operand_.operator_.left_, argcnt, argnames, err))
+                        return false ;
+
+                    if (!oper->unary) {
+                        if (!compile_int(buf, op->operand_.operator_.right_, argcnt, argnames, err))
+                            return false ;
+                        stack_pop(buf, 1) ;
+                    }
+
+                    ret = emit_op(buf, BASIC_VM_OP_INT_OPERATOR + oper->oper_) ;
+                    break ;
+                }
+
+                if (!compile_number(buf, op->operand_.operator_.left_, argcnt, argnames, err))
+                    return false ;
+
+                if (oper->oper_ == BASIC_OPERATOR_AND || oper->oper_ == BASIC_OPERATOR_OR) {
+                    //
+                    // The jump skips the right side when the left side decides the
+                    // result, and the left side is popped when it does not
+                    //
+                    uint32_t at ;
+
+                    if (!emit_op(buf, oper->oper_ == BASIC_OPERATOR_AND ? BASIC_VM_OP_AND_JUMP : BASIC_VM_OP_OR_JUMP)) {
+                        *err = BASIC_ERR_OUT_OF_MEMORY ;
+                        return false ;
+                    }
+
+                    at = buf->count_ ;
+                    if (!emit_u32(buf, 0)) {
+                        *err = BASIC_ERR_OUT_OF_MEMORY ;
+                        return false ;
+                    }
+                    stack_pop(buf, 1) ;
+
+                    if (!compile_number(buf, op->operand_.operator_.right_, argcnt, argnames, err))
+                        return false ;
+
+                    if (!is_boolean(op->operand_.operator_.right_))
+                        ret = emit_op(buf, BASIC_VM_OP_TO_BOOL) ;
+
+                    patch_u32(buf, at, buf->count_ - (at + 4)) ;
+                }
+                else if (oper->unary) {
+                    ret = emit_op(buf, BASIC_VM_OP_OPERATOR + oper->oper_) ;
+                }
+                else if (oper->oper_ == BASIC_OPERATOR_POWER && is_power_int(op->operand_.operator_.right_)) {
+                    //
+                    // X^2 and other small integer powers are repeated multiplies
+                    //
+                    basic_operand_t *right = op->operand_.operator_.right_ ;
+                    basic_value_t *p = (right->type_ == BASIC_OPERAND_TYPE_CONST) ? right->operand_.const_ : right->operand_.folded_.value_ ;
+                    ret = emit_op(buf, BASIC_VM_OP_POWER_INT) && emit_u8(buf, (uint8_t)basic_num_to_int(p->value.nvalue_)) ;
+                }
+                else {
+                    if (!compile_number(buf, op->operand_.operator_.right_, argcnt, argnames, err))
+                        return false ;
+
+                    ret = emit_op(buf, BASIC_VM_OP_OPERATOR + oper->oper_) ;
+                    stack_pop(buf, 1) ;
+                }
+            }
+            break ;
+
+        case BASIC_OPERAND_TYPE_VAR:
+            {
+                //
+                // Array indices are evaluated without access to DEF FN arguments, the
+                // same as the tree evaluator.  They are left on the stack as integers
+                // so loading the element needs no conversion when they already are.
+                //
+                bool integer = basic_var_is_integer(op->operand_.var_.varidx_) ;
+
+                for(int i = 0 ; i < op->operand_.var_.dimcnt_ ; i++) {
+                    if (!compile_int(buf, op->operand_.var_.dims_[i], 0, NULL, err))
+                        return false ;
+                }
+
+                if (op->operand_.var_.dimcnt_ == 0) {
+                    ret = emit_op(buf, integer ? BASIC_VM_OP_LOAD_INT_VAR : BASIC_VM_OP_LOAD_VAR) && emit_u32(buf, op->operand_.var_.varidx_) ;
+                    stack_push(buf) ;
+                }
+                else {
+                    ret = emit_op(buf, integer ? BASIC_VM_OP_LOAD_INT_ARRAY : BASIC_VM_OP_LOAD_ARRAY) && emit_u32(buf, op->operand_.var_.varidx_) &&
+                            emit_u8(buf, (uint8_t)op->operand_.var_.dimcnt_) ;
+                    stack_pop(buf, op->operand_.var_.dimcnt_ - 1) ;
+                }
+            }
+            break ;
+
+        case BASIC_OPERAND_TYPE_FUNCTION:
+            {
+                function_table_t *fun = op->operand_.function_.func_ ;
+                for(int i = 0 ; i < fun->num_args_ ; i++) {
+                    if (!compile_number(buf, op->operand_.function_.args_[i], argcnt, argnames, err))
+                        return false ;
+                }
+
+                ret = emit_op(buf, BASIC_VM_OP_CALL) && emit_u8(buf, (uint8_t)(fun - functions)) ;
+                stack_pop(buf, fun->num_args_) ;
+                stack_push(buf) ;
+            }
+            break ;
+
+        case BASIC_OPERAND_TYPE_USERFN:
+            for(uint32_t i = 0 ; i < op->operand_.userfn_.argcnt_ ; i++) {
+                if (!compile_number(buf, op->operand_.userfn_.args_[i], 0, NULL, err))
+                    return false ;
+            }
+
+            ret = emit_op(buf, BASIC_VM_OP_CALL_USER) && emit_u32(buf, op->operand_.userfn_.func_->index_) &&
+                    emit_u8(buf, (uint8_t)op->operand_.userfn_.argcnt_) ;
+            stack_pop(buf, op->operand_.userfn_.argcnt_) ;
+            stack_push(buf) ;
+            break ;
+
+        case BASIC_OPERAND_TYPE_BOUNDV:
+            {
+                int index ;
+
+                for(index = 0 ; index < argcnt ; index++) {
+                    if (_stricmp(op->operand_.boundv_, argnames[index]) == 0)
+                        break ;
+                }
+
+                if (index == argcnt) {
+                    *err = BASIC_ERR_UNBOUND_LOCAL_VAR ;
+                    return false ;
+                }
+
+                ret = emit_op(buf, BASIC_VM_OP_LOAD_LOCAL) && emit_u8(buf, (uint8_t)index) ;
+                stack_push(buf) ;
+            }
+            break ;
+
+        default:
+            assert(false) ;
+            break ;
+    }
+
+    if (!ret)
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+
+    return ret ;
+}
+
+//
+// Compile the part of V$ + X + Y that is added to V$, see basic_expr_compile_append()
+//
+static bool compile_append(vm_code_buf_t *buf, basic_operand_t *op, int argcnt, char **argnames, basic_err_t *err)
+{
+    basic_operand_t *left = op->operand_.operator_.left_ ;
+    basic_operand_t *right = op->operand_.operator_.right_ ;
+
+    if (left->type_ == BASIC_OPERAND_TYPE_VAR)
+        return compile_operand(buf, right, argcnt, argnames, err) ;
+
+    if (!compile_append(buf, left, argcnt, argnames, err) || !compile_operand(buf, right, argcnt, argnames, err))
+        return false ;
+
+    if (!emit_op(buf, BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_PLUS)) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
+    }
+    stack_pop(buf, 1) ;
+
+    return true ;
+}
+
+//
+// Compile the condition of an IF, see basic_expr_compile_condition().  This leaves
+// an integer on the stack that is greater than zero if the condition is true.
+//
+static bool compile_condition(vm_code_buf_t *buf, basic_operand_t *op, basic_err_t *err)
+{
+    if (basic_operand_is_integer(op))
+        return compile_operand(buf, op, 0, NULL, err) ;
+
+    if (is_compare(op)) {
+        if (!compile_number(buf, op->operand_.operator_.left_, 0, NULL, err) ||
+            !compile_number(buf, op->operand_.operator_.right_, 0, NULL, err))
+            return false ;
+
+        if (!emit_op(buf, BASIC_VM_OP_COMPARE + op->operand_.operator_.operator_->oper_)) {
+            *err = BASIC_ERR_OUT_OF_MEMORY ;
+            return false ;
+        }
+        stack_pop(buf, 1) ;
+        return true ;
+    }
+
+    if (!compile_operand(buf, op, 0, NULL, err))
+        return false ;
+
+    if (!emit_op(buf, BASIC_VM_OP_TEST)) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        return false ;
+    }
+
+    return true ;
+}
+
+bool basic_vm_compile(basic_expr_t *expr, int argcnt, char **argnames, basic_err_t *err)
+{
+    vm_code_buf_t buf ;
+
+    buf.code_ = NULL ;
+    buf.count_ = 0 ;
+    buf.size_ = 0 ;
+    buf.depth_ = 0 ;
+    buf.maxdepth_ = 0 ;
+
+    bool ok ;
+    if (expr->append_)
+        ok = compile_append(&buf, expr->top_, argcnt, argnames, err) ;
+    else if (expr->condition_)
+        ok = compile_condition(&buf, expr->top_, err) ;
+    else
+        ok = compile_operand(&buf, expr->top_, argcnt, argnames, err) ;
+
+    if (!ok) {
+        basic_free(buf.code_) ;
+        return false ;
+    }
+
+    if (!emit_op(&buf, BASIC_VM_OP_END)) {
+        *err = BASIC_ERR_OUT_OF_MEMORY ;
+        basic_free(buf.code_) ;
+        return false ;
+    }
+
+    assert(buf.depth_ == 1) ;
+
+    //
+    // Trim the code to its final size
+    //
+    uint8_t *code = (uint8_t *)basic_realloc(buf.code_, buf.count_) ;
+    if (code != NULL)
+        buf.code_ = code ;
+
+    expr->code_ = buf.code_ ;
+    expr->codelen_ = buf.count_ ;
+    expr->depth_ = buf.maxdepth_ ;
+
+    return true ;
+}
+
+static inline uint32_t read_u32(const uint8_t *pc)
+{
+    return (uint32_t)pc[0] | ((uint32_t)pc[1] << 8) | ((uint32_t)pc[2] << 16) | ((uint32_t)pc[3] << 24) ;
+}
+
+static void unwind_stack(uint32_t base)
+{
+    while (vm_top > base) {
+        basic_value_release(&vm_stack[--vm_top]) ;
+    }
+}
+
+//
+// Apply an operator to two numbers in place, returns false if the operator
+// needs the general path (e.g. divide, which checks for zero)
+//
+static inline bool numeric_operator(operator_type_t oper, basic_num_t left, basic_num_t right, basic_num_t *ret)
+{
+    switch(oper)
+    {
+        case BASIC_OPERATOR_PLUS:
+            *ret = left + right ;
+            break ;
+        case BASIC_OPERATOR_MINUS:
+            *ret = left - right ;
+            break ;
+        case BASIC_OPERATOR_TIMES:
+            *ret = basic_num_mul(left, right) ;
+            break ;
+        case BASIC_OPERATOR_NOT_EQUAL:
+            *ret = basic_num_from_int(left != right) ;
+            break ;
+        case BASIC_OPERATOR_EQUAL:
+            *ret = basic_num_from_int(left == right) ;
+            break ;
+        case BASIC_OPERATOR_GREATER:
+            *ret = basic_num_from_int(left > right) ;
+            break ;
+        case BASIC_OPERATOR_GREATER_EQ:
+            *ret = basic_num_from_int(left >= right) ;
+            break ;
+        case BASIC_OPERATOR_LESS:
+            *ret = basic_num_from_int(left < right) ;
+            break ;
+        case BASIC_OPERATOR_LESS_EQ:
+            *ret = basic_num_from_int(left <= right) ;
+            break ;
+        default:
+            return false ;
+    }
+
+    return true ;
+}
+
+static inline void set_number(basic_value_t *v, basic_num_t d)
+{
+    v->type_ = BASIC_VALUE_TYPE_NUMBER ;
+    v->owned_ = false ;
+    v->inline_ = false ;
+    v->value.nvalue_ = d ;
+}
+
+static inline void push_number(basic_num_t d)
+{
+    set_number(&vm_stack[vm_top++], d) ;
+}
+
+bool basic_vm_eval(basic_expr_t *expr, uint32_t cntv, basic_value_t *values, basic_value_t *ret, basic_err_t *err)
+{
+    uint32_t base = vm_top ;
+    const uint8_t *pc = expr->code_ ;
+    basic_value_t *v ;
+    uint32_t dims[BASIC_MAX_DIMS] ;
+
+    if (vm_top + expr->depth_ > BASIC_VM_STACK_DEPTH) {
+        *err = BASIC_ERR_TOO_COMPLEX ;
+        return false ;
+    }
+
+    while (true) {
+        uint8_t op = *pc++ ;
+
+        switch(op)
+        {
+            case BASIC_VM_OP_END:
+                assert(vm_top == base + 1) ;
+                *ret = vm_stack[--vm_top] ;
+                return true ;
+
+            case BASIC_VM_OP_PUSH_NUM:
+                {
+                    basic_num_t d ;
+                    memcpy(&d, pc, sizeof(d)) ;
+                    pc += sizeof(d) ;
+                    push_number(d) ;
+                }
+                break ;
+
+            case BASIC_VM_OP_PUSH_STR:
+                {
+                    basic_value_t *c ;
+                    memcpy(&c, pc, sizeof(c)) ;
+                    pc += sizeof(c) ;
+
+                    v = &vm_stack[vm_top++] ;
+                    *v = *c ;
+                    v->owned_ = false ;
+                }
+                break ;
+
+            //
+            // The integer opcodes work on numbers here, since an expression with
+            // strings in it is not worth a second representation on this stack
+            //
+            case BASIC_VM_OP_PUSH_INT:
+                push_number(basic_num_from_int((int32_t)read_u32(pc))) ;
+                pc += 4 ;
+                break ;
+
+            case BASIC_VM_OP_TO_NUM:
+                break ;
+
+            case BASIC_VM_OP_TO_INT:
+                {
+                    int32_t i ;
+
+                    v = &vm_stack[vm_top - 1] ;
+                    if (v->type_ != BASIC_VALUE_TYPE_NUMBER) {
+                        *err = BASIC_ERR_TYPE_MISMATCH ;
+                        unwind_stack(base) ;
+                        return false ;
+                    }
+
+                    if (!basic_num_get_int(v->value.nvalue_, &i, err)) {
+                        unwind_stack(base) ;
+                        return false ;
+                    }
+                    v->value.nvalue_ = basic_num_from_int(i) ;
+                }
+                break ;
+
+            case BASIC_VM_OP_AND_JUMP:
+            case BASIC_VM_OP_OR_JUMP:
+                {
+                    uint32_t offset = read_u32(pc) ;
+                    pc += 4 ;
+
+                    v = &vm_stack[vm_top - 1] ;
+                    if (v->type_ != BASIC_VALUE_TYPE_NUMBER) {
+                        *err = BASIC_ERR_TYPE_MISMATCH ;
+                        unwind_stack(base) ;
+                        return false ;
+                    }
+
+                    bool b = basic_num_is_true(v->value.nvalue_) ;
+                    if (b == (op == BASIC_VM_OP_OR_JUMP)) {
+                        v->value.nvalue_ = basic_num_from_int(b) ;
+                        pc += offset ;
+                    }
+                    else {
+                        vm_top-- ;
+                    }
+                }
+                break ;
+
+            case BASIC_VM_OP_TO_BOOL:
+                v = &vm_stack[vm_top - 1] ;
+                if (v->type_ != BASIC_VALUE_TYPE_NUMBER) {
+                    *err = BASIC_ERR_TYPE_MISMATCH ;
+                    unwind_stack(base) ;
+                    return false ;
+                }
+                v->value.nvalue_ = basic_num_from_int(basic_num_is_true(v->value.nvalue_)) ;
+                break ;
+
+            case BASIC_VM_OP_LOAD_VAR:
+            case BASIC_VM_OP_LOAD_INT_VAR:
+                if (!basic_var_read(read_u32(pc), 0, NULL, &vm_stack[vm_top], err)) {
+                    unwind_stack(base) ;
+                    return false ;
+                }
+                pc += 4 ;
+                vm_top++ ;
+                break ;
+
+            case BASIC_VM_OP_LOAD_ARRAY:
+            case BASIC_VM_OP_LOAD_INT_ARRAY:
+                {
+                    uint32_t varidx = read_u32(pc) ;
+                    uint8_t dimcnt = pc[4] ;
+                    pc += 5 ;
+
+                    for(uint8_t i = 0 ; i < dimcnt ; i++) {
+                        v = &vm_stack[vm_top - dimcnt + i] ;
+                        if (v->type_ == BASIC_VALUE_TYPE_STRING) {
+                            *err = BASIC_ERR_TYPE_MISMATCH ;
+                            unwind_stack(base) ;
+                            return false ;
+                        }
+                        dims[i] = basic_num_to_int(v->value.nvalue_) ;
+                    }
+                    vm_top -= dimcnt ;
+
+                    if (!basic_var_read(varidx, dimcnt, dims, &vm_stack[vm_top], err)) {
+                        unwind_stack(base) ;
+                        return false ;
+                    }
+                    vm_top++ ;
+                }
+                break ;
+
+            case BASIC_VM_OP_LOAD_LOCAL:
+                {
+                    uint8_t index = *pc++ ;
+                    if (index >= cntv) {
+                        *err = BASIC_ERR_UNBOUND_LOCAL_VAR ;
+                        unwind_stack(base) ;
+                        return false ;
+                    }
+
+                    v = &vm_stack[vm_top++] ;
+                    *v = values[index] ;
+                    v->owned_ = false ;
+                }
+                break ;
+
+            case BASIC_VM_OP_POWER_INT:
+                v = &vm_stack[vm_top - 1] ;
+                if (v->type_ != BASIC_VALUE_TYPE_NUMBER) {
+                    *err = BASIC_ERR_TYPE_MISMATCH ;
+                    unwind_stack(base) ;
+                    return false ;
+                }
+                v->value.nvalue_ = basic_power_int(v->value.nvalue_, *pc++) ;
+                break ;
+
+            case BASIC_VM_OP_CALL:
+                {
+                    function_table_t *fun = &functions[*pc++] ;
+                    uint32_t first = vm_top - fun->num_args_ ;
+                    basic_value_t result ;
+
+                    bool ok = (*fun->eval_)(fun->num_args_, &vm_stack[first], &result, err) ;
+                    unwind_stack(first) ;
+
+                    if (!ok) {
+                        unwind_stack(base) ;
+                        return false ;
+                    }
+                    vm_stack[vm_top++] = result ;
+                }
+                break ;
+
+            case BASIC_VM_OP_CALL_USER:
+                {
+                    basic_expr_user_fn_t *ufn = get_user_fn_from_index(read_u32(pc)) ;
+                    uint8_t argcnt = pc[4] ;
+                    uint32_t first = vm_top - argcnt ;
+                    basic_value_t result ;
+                    pc += 5 ;
+
+                    if (ufn == NULL || ufn->argcnt_ != argcnt) {
+                        *err = BASIC_ERR_ARG_COUNT_MISMATCH ;
+                        unwind_stack(base) ;
+                        return false ;
+                    }
+
+                    basic_expr_t *fnexpr = get_expr_from_index(ufn->expridx_) ;
+                    assert(fnexpr != NULL) ;
+
+                    //
+                    // The result may be borrowed from an argument, so it must be
+                    // copied before the arguments are popped
+                    //
+                    bool ok ;
+                    if (fnexpr->numeric_) {
+                        basic_num_t d ;
+                        ok = basic_vm_eval_number(fnexpr, argcnt, &vm_stack[first], &d, err) ;
+                        if (ok)
+                            set_number(&result, d) ;
+                    }
+                    else {
+                        ok = basic_vm_eval(fnexpr, argcnt, &vm_stack[first], &result, err) ;
+                        if (ok && !basic_value_own(&result, err)) {
+                            ok = false ;
+                        }
+                    }
+                    unwind_stack(first) ;
+
+                    if (!ok) {
+                        unwind_stack(base) ;
+                        return false ;
+                    }
+                    vm_stack[vm_top++] = result ;
+                }
+                break ;
+
+            default:
+                if (op >= BASIC_VM_OP_INT_OPERATOR) {
+                    //
+                    // The operands were converted to integers when they were pushed.
+                    // The condition opcodes above these are only in numeric code.
+                    //
+                    assert(op <= BASIC_VM_OP_INT_OPERATOR + BASIC_OPERATOR_MOD) ;
+                    operator_type_t oper = (operator_type_t)(op - BASIC_VM_OP_INT_OPERATOR) ;
+                    uint32_t count = (oper == BASIC_OPERATOR_UNARY_MINUS) ? 1 : 2 ;
+                    basic_value_t *left = &vm_stack[vm_top - count] ;
+                    basic_value_t *right = &vm_stack[vm_top - 1] ;
+                    int32_t result ;
+
+                    if (!basic_int_operator(oper, basic_num_to_int(left->value.nvalue_), basic_num_to_int(right->value.nvalue_), &result, err) ||
+                            !basic_num_put_int(result, &left->value.nvalue_, err)) {
+                        unwind_stack(base) ;
+                        return false ;
+                    }
+                    vm_top -= count - 1 ;
+                }
+                else
+                {
+                    operator_type_t oper = (operator_type_t)(op - BASIC_VM_OP_OPERATOR) ;
+                    basic_value_t result ;
+                    bool ok ;
+                    assert(op >= BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_PLUS && op <= BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_MOD) ;
+
+                    if (oper == BASIC_OPERATOR_UNARY_MINUS) {
+                        v = &vm_stack[vm_top - 1] ;
+                        if (v->type_ == BASIC_VALUE_TYPE_NUMBER) {
+                            v->value.nvalue_ = -v->value.nvalue_ ;
+                            break ;
+                        }
+
+                        ok = basic_expr_apply_operator(oper, v, NULL, &result, err) ;
+                        unwind_stack(vm_top - 1) ;
+                    }
+                    else {
+                        basic_value_t *left = &vm_stack[vm_top - 2] ;
+                        basic_value_t *right = &vm_stack[vm_top - 1] ;
+                        if (left->type_ == BASIC_VALUE_TYPE_NUMBER && right->type_ == BASIC_VALUE_TYPE_NUMBER &&
+                            numeric_operator(oper, left->value.nvalue_, right->value.nvalue_, &left->value.nvalue_)) {
+                            vm_top-- ;
+                            break ;
+                        }
+
+                        ok = basic_expr_apply_operator(oper, left, right, &result, err) ;
+                        unwind_stack(vm_top - 2) ;
+                    }
+
+                    if (!ok) {
+                        unwind_stack(base) ;
+                        return false ;
+                    }
+                    vm_stack[vm_top++] = result ;
+                }
+                break ;
+        }
+    }
+}
+
+//
+// The numeric evaluator.  An expression the parser found has no strings anywhere
+// in it runs the same code on a stack of plain numbers, so nothing is type checked
+// and nothing needs to be released as it runs.  The arguments of a DEF FN function
+// are checked once when it is called.  Such an expression cannot itself call a DEF
+// FN function, so this is never reentered and the stack can be shared.  Integers
+// are held on the same stack as int32_t, and the compiler has put a conversion
+// wherever an integer meets a number, so each opcode knows which one it has.
+//
+typedef union vm_num
+{
+    basic_num_t n_ ;
+    int32_t i_ ;
+} vm_num_t ;
+
+static vm_num_t num_stack[BASIC_VM_STACK_DEPTH] ;
+
+#define NUM_MAX_FUNC_ARGS               (3)
+
+//
+// An operator on two integers.  The operator is a constant in each case, so the
+// switch in basic_int_operator() is compiled away.
+//
+#define NUM_INT_OPERATOR(oper)                                                  \
+    case BASIC_VM_OP_INT_OPERATOR + oper:                                       \
+        sp-- ;                                                                  \
+        if (!basic_int_operator(oper, sp[-1].i_, sp[0].i_, &sp[-1].i_, err))    \
+            return false ;                                                      \
+        break
+
+static inline bool run_number(basic_expr_t *expr, uint32_t cntv, basic_value_t *values, vm_num_t *ret, basic_err_t *err)
+{
+    const uint8_t *pc = expr->code_ ;
+    vm_num_t *sp = num_stack ;
+    uint32_t dims[BASIC_MAX_DIMS] ;
+
+    assert(expr->numeric_) ;
+
+    if (expr->depth_ > BASIC_VM_STACK_DEPTH) {
+        *err = BASIC_ERR_TOO_COMPLEX ;
+        return false ;
+    }
+
+    for(uint32_t i = 0 ; i < cntv ; i++) {
+        if (values[i].type_ != BASIC_VALUE_TYPE_NUMBER) {
+            *err = BASIC_ERR_TYPE_MISMATCH ;
+            return false ;
+        }
+    }
+
+    while (true) {
+        uint8_t op = *pc++ ;
+
+        switch(op)
+        {
+            case BASIC_VM_OP_END:
+                assert(sp == num_stack + 1) ;
+                *ret = sp[-1] ;
+                return true ;
+
+            case BASIC_VM_OP_PUSH_NUM:
+                memcpy(&sp->n_, pc, sizeof(basic_num_t)) ;
+                pc += sizeof(basic_num_t) ;
+                sp++ ;
+                break ;
+
+            case BASIC_VM_OP_PUSH_INT:
+                (sp++)->i_ = (int32_t)read_u32(pc) ;
+                pc += 4 ;
+                break ;
+
+            case BASIC_VM_OP_LOAD_VAR:
+                if (!basic_var_read_number(read_u32(pc), 0, NULL, &sp->n_, err))
+                    return false ;
+                pc += 4 ;
+                sp++ ;
+                break ;
+
+            case BASIC_VM_OP_LOAD_INT_VAR:
+                if (!basic_var_read_int(read_u32(pc), 0, NULL, &sp->i_, err))
+                    return false ;
+                pc += 4 ;
+                sp++ ;
+                break ;
+
+            case BASIC_VM_OP_LOAD_ARRAY:
+            case BASIC_VM_OP_LOAD_INT_ARRAY:
+                {
+                    uint32_t varidx = read_u32(pc) ;
+                    uint8_t dimcnt = pc[4] ;
+                    bool ok ;
+                    pc += 5 ;
+
+                    sp -= dimcnt ;
+                    for(uint8_t i = 0 ; i < dimcnt ; i++)
+                        dims[i] = (uint32_t)sp[i].i_ ;
+
+                    if (op == BASIC_VM_OP_LOAD_INT_ARRAY)
+                        ok = basic_var_read_int(varidx, dimcnt, dims, &sp->i_, err) ;
+                    else
+                        ok = basic_var_read_number(varidx, dimcnt, dims, &sp->n_, err) ;
+
+                    if (!ok)
+                        return false ;
+                    sp++ ;
+                }
+                break ;
+
+            case BASIC_VM_OP_LOAD_LOCAL:
+                {
+                    uint8_t index = *pc++ ;
+                    if (index >= cntv) {
+                        *err = BASIC_ERR_UNBOUND_LOCAL_VAR ;
+                        return false ;
+                    }
+                    (sp++)->n_ = values[index].value.nvalue_ ;
+                }
+                break ;
+
+            case BASIC_VM_OP_TO_NUM:
+                if (!basic_num_put_int(sp[-1].i_, &sp[-1].n_, err))
+                    return false ;
+                break ;
+
+            case BASIC_VM_OP_TO_INT:
+                if (!basic_num_get_int(sp[-1].n_, &sp[-1].i_, err))
+                    return false ;
+                break ;
+
+            case BASIC_VM_OP_POWER_INT:
+                sp[-1].n_ = basic_power_int(sp[-1].n_, *pc++) ;
+                break ;
+
+            case BASIC_VM_OP_AND_JUMP:
+                if (!basic_num_is_true(sp[-1].n_)) {
+                    sp[-1].n_ = basic_num_from_int(0) ;
+                    pc += read_u32(pc) ;
+                }
+                else {
+                    sp-- ;
+                }
+                pc += 4 ;
+                break ;
+
+            case BASIC_VM_OP_OR_JUMP:
+                if (basic_num_is_true(sp[-1].n_)) {
+                    sp[-1].n_ = basic_num_from_int(1) ;
+                    pc += read_u32(pc) ;
+                }
+                else {
+                    sp-- ;
+                }
+                pc += 4 ;
+                break ;
+
+            case BASIC_VM_OP_TO_BOOL:
+                sp[-1].n_ = basic_num_from_int(basic_num_is_true(sp[-1].n_)) ;
+                break ;
+
+            case BASIC_VM_OP_TEST:
+                sp[-1].i_ = (sp[-1].n_ >= BASIC_NUM_EPSILON) ;
+                break ;
+
+            case BASIC_VM_OP_CALL:
+                {
+                    function_table_t *fun = &functions[*pc++] ;
+                    basic_value_t args[NUM_MAX_FUNC_ARGS] ;
+                    basic_value_t result ;
+
+                    assert(fun->num_args_ <= NUM_MAX_FUNC_ARGS) ;
+                    sp -= fun->num_args_ ;
+                    for(int i = 0 ; i < fun->num_args_ ; i++)
+                        set_number(&args[i], sp[i].n_) ;
+
+                    if (!(*fun->eval_)(fun->num_args_, args, &result, err))
+                        return false ;
+
+                    (sp++)->n_ = result.value.nvalue_ ;
+                }
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_UNARY_MINUS:
+                sp[-1].n_ = -sp[-1].n_ ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_PLUS:
+                sp-- ;
+                sp[-1].n_ += sp[0].n_ ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_MINUS:
+                sp-- ;
+                sp[-1].n_ -= sp[0].n_ ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_TIMES:
+                sp-- ;
+                sp[-1].n_ = basic_num_mul(sp[-1].n_, sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_DIVIDE:
+                sp-- ;
+                if (sp[0].n_ == 0) {
+                    *err = BASIC_ERR_DIVIDE_ZERO ;
+                    return false ;
+                }
+                sp[-1].n_ = basic_num_div(sp[-1].n_, sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_POWER:
+                sp-- ;
+                if (basic_is_power_int(sp[0].n_))
+                    sp[-1].n_ = basic_power_int(sp[-1].n_, basic_num_to_int(sp[0].n_)) ;
+                else
+                    sp[-1].n_ = basic_num_pow(sp[-1].n_, sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_NOT_EQUAL:
+                sp-- ;
+                sp[-1].n_ = basic_num_from_int(sp[-1].n_ != sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_EQUAL:
+                sp-- ;
+                sp[-1].n_ = basic_num_from_int(sp[-1].n_ == sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_GREATER:
+                sp-- ;
+                sp[-1].n_ = basic_num_from_int(sp[-1].n_ > sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_GREATER_EQ:
+                sp-- ;
+                sp[-1].n_ = basic_num_from_int(sp[-1].n_ >= sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_LESS:
+                sp-- ;
+                sp[-1].n_ = basic_num_from_int(sp[-1].n_ < sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_LESS_EQ:
+                sp-- ;
+                sp[-1].n_ = basic_num_from_int(sp[-1].n_ <= sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_OR:
+                sp-- ;
+                sp[-1].n_ = basic_num_from_int(basic_num_is_true(sp[-1].n_) || basic_num_is_true(sp[0].n_)) ;
+                break ;
+
+            case BASIC_VM_OP_OPERATOR + BASIC_OPERATOR_AND:
+                sp-- ;
+                sp[-1].n_ = basic_num_from_int(basic_num_is_true(sp[-1].n_) && basic_num_is_true(sp[0].n_)) ;
+                break ;
+
+            case BASIC_VM_OP_COMPARE + BASIC_OPERATOR_NOT_EQUAL:
+                sp-- ;
+                sp[-1].i_ = (sp[-1].n_ != sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_COMPARE + BASIC_OPERATOR_EQUAL:
+                sp-- ;
+                sp[-1].i_ = (sp[-1].n_ == sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_COMPARE + BASIC_OPERATOR_GREATER:
+                sp-- ;
+                sp[-1].i_ = (sp[-1].n_ > sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_COMPARE + BASIC_OPERATOR_GREATER_EQ:
+                sp-- ;
+                sp[-1].i_ = (sp[-1].n_ >= sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_COMPARE + BASIC_OPERATOR_LESS:
+                sp-- ;
+                sp[-1].i_ = (sp[-1].n_ < sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_COMPARE + BASIC_OPERATOR_LESS_EQ:
+                sp-- ;
+                sp[-1].i_ = (sp[-1].n_ <= sp[0].n_) ;
+                break ;
+
+            case BASIC_VM_OP_INT_OPERATOR + BASIC_OPERATOR_UNARY_MINUS:
+                if (!basic_int_operator(BASIC_OPERATOR_UNARY_MINUS, sp[-1].i_, 0, &sp[-1].i_, err))
+                    return false ;
+                break ;
+
+            NUM_INT_OPERATOR(BASIC_OPERATOR_PLUS) ;
+            NUM_INT_OPERATOR(BASIC_OPERATOR_MINUS) ;
+            NUM_INT_OPERATOR(BASIC_OPERATOR_TIMES) ;
+            NUM_INT_OPERATOR(BASIC_OPERATOR_INT_DIVIDE) ;
+            NUM_INT_OPERATOR(BASIC_OPERATOR_MOD) ;
+            NUM_INT_OPERATOR(BASIC_OPERATOR_NOT_EQUAL) ;
+            NUM_INT_OPERATOR(BASIC_OPERATOR_EQUAL) ;
+            NUM_INT_OPERATOR(BASIC_OPERATOR_GREATER) ;
+            NUM_INT_OPERATOR(BASIC_OPERATOR_GREATER_EQ) ;
+            NUM_INT_OPERATOR(BASIC_OPERATOR_LESS) ;
+            NUM_INT_OPERATOR(BASIC_OPERATOR_LESS_EQ) ;
+
+            default:
+                //
+                // Strings and DEF FN calls never reach here
+                //
+                assert(false) ;
+                *err = BASIC_ERR_TYPE_MISMATCH ;
+                return false ;
+        }
+    }
+}
+
+#undef NUM_INT_OPERATOR
+
+bool basic_vm_eval_number(basic_expr_t *expr, uint32_t cntv, basic_value_t *values, basic_num_t *ret, basic_err_t *err)
+{
+    vm_num_t result ;
+
+    if (!run_number(expr, cntv, values, &result, err))
+        return false ;
+
+    if (expr->integer_)
+        return basic_num_put_int(result.i_, ret, err) ;
+
+    *ret = result.n_ ;
+    return true ;
+}
+
+//
+// Evaluate the condition of an IF, see compile_condition()
+//
+bool basic_vm_eval_condition(basic_expr_t *expr, bool *ret, basic_err_t *err)
+{
+    vm_num_t result ;
+
+    assert(expr->condition_) ;
+
+    if (!run_number(expr, 0, NULL, &result, err))
+        return false ;
+
+    *ret = (result.i_ > 0) ;
+    return true ;
+}
+
+//
+// Evaluate an integer expression, for an A% variable or an array index
+//
+bool basic_vm_eval_int(basic_expr_t *expr, int32_t *ret, basic_err_t *err)
+{
+    vm_num_t result ;
+
+    assert(expr->integer_) ;
+
+    if (!run_number(expr, 0, NULL, &result, err))
+        return false ;
+
+    *ret = result.i_ ;
+    return true ;
+}
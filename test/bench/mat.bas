@@ -0,0 +1,23 @@
+10 REM MAT BENCHMARK, MATFOR.BAS DOES THE SAME WORK WITH FOR LOOPS
+20 BASE 1
+30 N = 48
+40 DIM A(48,48), B(48,48), C(48,48)
+50 FOR I = 1 TO N
+60 FOR J = 1 TO N
+70 A(I,J) = (I + J) / N
+80 B(I,J) = (I - J) / N
+90 NEXT J
+100 NEXT I
+110 FOR K = 1 TO 20
+120 MAT C = A + B
+130 MAT C = (0.5) * C
+140 MAT C = A * C
+150 NEXT K
+160 S = 0
+170 FOR I = 1 TO N
+180 FOR J = 1 TO N
+190 S = S + C(I,J)
+200 NEXT J
+210 NEXT I
+220 PRINT "S = "; S
+230 END
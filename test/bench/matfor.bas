@@ -0,0 +1,39 @@
+10 REM FOR LOOP BENCHMARK, MAT.BAS DOES THE SAME WORK WITH MAT
+20 BASE 1
+30 N = 48
+40 DIM A(48,48), B(48,48), C(48,48), T(48,48)
+50 FOR I = 1 TO N
+60 FOR J = 1 TO N
+70 A(I,J) = (I + J) / N
+80 B(I,J) = (I - J) / N
+90 NEXT J
+100 NEXT I
+110 FOR K = 1 TO 20
+120 FOR I = 1 TO N
+130 FOR J = 1 TO N
+140 T(I,J) = A(I,J) + B(I,J)
+150 NEXT J
+160 NEXT I
+170 FOR I = 1 TO N
+180 FOR J = 1 TO N
+190 T(I,J) = 0.5 * T(I,J)
+200 NEXT J
+210 NEXT I
+220 FOR I = 1 TO N
+230 FOR J = 1 TO N
+240 S = 0
+250 FOR P = 1 TO N
+260 S = S + A(I,P) * T(P,J)
+270 NEXT P
+280 C(I,J) = S
+290 NEXT J
+300 NEXT I
+310 NEXT K
+320 S = 0
+330 FOR I = 1 TO N
+340 FOR J = 1 TO N
+350 S = S + C(I,J)
+360 NEXT J
+370 NEXT I
+380 PRINT "S = "; S
+390 END
@@ -0,0 +1,16 @@
+10 REM STATEMENT DISPATCH BENCHMARK
+20 DIM A(10)
+30 S = 0
+40 FOR I = 1 TO 500000
+50 J = I - INT(I / 10) * 10
+60 A(J) = A(J) + 1
+70 IF J = 5 THEN GOSUB 200
+80 IF J > 7 THEN 100
+90 S = S + 1
+100 NEXT I
+110 GOTO 130
+120 PRINT "NOT REACHED"
+130 PRINT "S = "; S; " A(5) = "; A(5)
+140 END
+200 T = T + 1
+210 RETURN
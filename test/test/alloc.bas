@@ -0,0 +1,9 @@
+10 X = 0 : S$ = "ABC" : A = 0 : B = 0 : C = 0
+20 A = MEM(6)
+30 FOR I = 1 TO 10 : X = X + I * 2 - SQRT(I) / 3 : IF S$ = "ABC" AND LEN(S$) = 3 THEN X = X - 1
+40 NEXT I
+50 B = MEM(6)
+60 FOR I = 1 TO 1000 : X = X + I * 2 - SQRT(I) / 3 : IF S$ = "ABC" AND LEN(S$) = 3 THEN X = X - 1
+70 NEXT I
+80 C = MEM(6)
+90 PRINT "LOOP ALLOCS "; (C - B) - (B - A)
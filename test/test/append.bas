@@ -0,0 +1,9 @@
+10 A$ = ""
+20 FOR I = 1 TO 20 : A$ = A$ + "X" : NEXT I
+30 PRINT LEN(A$); A$
+40 B$ = A$ : A$ = A$ + "YZ"
+50 PRINT B$ : PRINT A$
+60 A$ = A$ + A$ : PRINT LEN(A$)
+70 C$ = "" : FOR I = 1 TO 5 : C$ = C$ + "-" + CHR$(64 + I) : NEXT I : PRINT C$
+80 D$ = MID$(A$, 3, 15) : A$ = "" : D$ = D$ + "!" : PRINT D$
+90 E$ = E$ + "NEW" : PRINT E$
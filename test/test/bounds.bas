@@ -0,0 +1,4 @@
+10 DIM A(5), B%(2,3)
+20 A(0) = 1 : A(5) = 5 : B%(2,3) = 23
+30 PRINT A(0); A(5); B%(2,3); B%(0,3)
+40 DIM C(536870912)
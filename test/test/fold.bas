@@ -0,0 +1,6 @@
+10 X = 3
+20 A = 2*3.14159/360 : B = -(5) : C = SQR(4) + INT(7/2) : D$ = CHR$(65) + "BC" : E = LEN("abc")
+30 PRINT A; B; C; D$; E
+40 PRINT X^2; X^3; X^4; X^5; (X+1)^2; 2^10; -X^2
+50 IF 1 = 0 THEN PRINT 1/0
+60 PRINT LEFT$("HELLO WORLD, HOW ARE YOU", 20)
@@ -5,3 +5,7 @@
 50 A = 10: IF A > 5 THEN PRINT "GOOD #4"
 60 A = 20: IF A > 12 THEN PRINT "GOOD $5" : PRINT "GOOD #6"
 70 A = 10: IF A > 12 THEN PRINT "BAD #2" : PRINT "BAD #3"
+80 A = 0: IF A <> 0 AND 10 / A > 1 THEN PRINT "BAD #4"
+90 IF A = 0 OR 10 / A > 1 THEN PRINT "GOOD #7"
+100 IF A + 1 THEN PRINT "GOOD #8"
+110 B% = 3: IF B% > 2 AND A < B% THEN PRINT "GOOD #9"
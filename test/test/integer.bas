@@ -0,0 +1,9 @@
+10 DIM B%(10), C(3)
+20 FOR I% = 1 TO 10 : B%(I%) = I% * I% : NEXT I%
+30 PRINT I%; B%(3) + B%(4); B%(10) \ 7; B%(10) MOD 7; -B%(9) MOD 5
+40 A% = 7.9 : N% = -7.9 : X = A% / 2
+50 PRINT A%; N%; X; A% \ 2 * 2; 17 MOD 5 + 1; 2 + 7 \ 2
+60 C(A% - 5) = 1.5 : C(1.7) = 2.5
+70 PRINT C(2); C(1); B%(C(1) + 1); A% = 7; A% < X
+80 FOR J% = 10 TO 1 STEP -3 : PRINT J%; : NEXT J% : PRINT
+90 K% = 2147483647 : PRINT K%; K% + 1
@@ -0,0 +1,21 @@
+10 BASE 1
+20 DIM A(2,3), B(2,3), C(2,3), T(3,2), P(2,2), I(3,3), V(3), W(2)
+30 MAT READ A, B
+40 MAT C = A + B
+50 MAT PRINT C
+60 MAT C = B - A
+70 MAT C = (2 + 0.5) * C
+80 MAT PRINT C
+90 MAT T = TRN(A)
+100 MAT P = A * T
+110 MAT P = P * P
+120 MAT PRINT T, P
+130 MAT I = IDN
+140 MAT V = CON
+150 MAT W = A * V
+160 MAT PRINT I, W
+170 MAT A = ZER
+180 MAT PRINT A
+190 DATA 1,2,3,4,5,6
+200 DATA 10,20,30,40,50,60
+210 MAT P = A
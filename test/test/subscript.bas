@@ -0,0 +1,3 @@
+10 DIM A(5)
+20 I = 6
+30 PRINT A(I)
@@ -0,0 +1,8 @@
+10 DIM A(5)
+20 FOR I = 1 TO 5 : A(I) = I * I : NEXT I
+30 DEF FNH(X, Y) = SQR(X * X + Y * Y)
+40 PRINT FNH(3, 4); A(2) + A(3); -A(4) / 2; 2 ^ 0.5
+50 PRINT (1 < 2) AND (3 > 4); (1 < 2) OR (3 > 4); A(1) <> A(2); ABS(-3) >= 3
+60 Z = 0
+70 PRINT Z; Q; INT(-2.5); EXP(0)
+80 PRINT 5 / Z